@@ -743,6 +743,11 @@ bool OBSApp::InitLocale()
 
 	locale = lang;
 
+	char cacheDir[512];
+	if (GetConfigPath(cacheDir, sizeof(cacheDir),
+				"obs-studio/locale_cache") > 0)
+		text_lookup_set_cache_dir(cacheDir);
+
 	string englishPath;
 	if (!GetDataFilePath("locale/" DEFAULT_LANG ".ini", englishPath)) {
 		OBSErrorBox(NULL, "Failed to find locale/" DEFAULT_LANG ".ini");
@@ -1065,6 +1070,9 @@ OBSApp::~OBSApp()
 
 	os_inhibit_sleep_set_active(sleepInhibitor, false);
 	os_inhibit_sleep_destroy(sleepInhibitor);
+
+	text_lookup_set_cache_dir(NULL);
+	gs_set_shader_cache_dir(NULL);
 }
 
 static void move_basic_to_profiles(void)
@@ -1160,6 +1168,11 @@ void OBSApp::AppInit()
 		throw "Failed to initialize global config";
 	if (!InitLocale())
 		throw "Failed to load locale";
+
+	char shaderCacheDir[512];
+	if (GetConfigPath(shaderCacheDir, sizeof(shaderCacheDir),
+				"obs-studio/shader_cache") > 0)
+		gs_set_shader_cache_dir(shaderCacheDir);
 	if (!InitTheme())
 		throw "Failed to load theme";
 
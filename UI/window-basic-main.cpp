@@ -1558,6 +1558,12 @@ void OBSBasic::OBSInit()
 	InitHotkeys();
 
 	AddExtraModulePaths();
+
+	char cachePath[512];
+	if (GetConfigPath(cachePath, sizeof(cachePath),
+				"obs-studio/plugin_cache.json") > 0)
+		obs_set_module_cache_path(cachePath);
+
 	blog(LOG_INFO, "---------------------------------");
 	obs_load_all_modules();
 	blog(LOG_INFO, "---------------------------------");
@@ -275,6 +275,8 @@ try {
 	if (FAILED(hr))
 		throw HRError("Failed to create device", hr);
 
+	SetMultithreadProtected(device);
+
 	dev = device;
 
 	obj = first_obj;
@@ -258,6 +258,8 @@ void gs_device::InitDevice(uint32_t adapterIdx)
 	if (FAILED(hr))
 		throw UnsupportedHWError("Failed to create device", hr);
 
+	SetMultithreadProtected(device);
+
 	ComQIPtr<ID3D11Device1> d3d11_1(device);
 	if (!!d3d11_1) {
 		D3D11_FEATURE_DATA_D3D11_OPTIONS opts = {};
@@ -1468,6 +1470,34 @@ void device_present(gs_device_t *device)
 	}
 }
 
+/* the swap chain is referenced so that it stays valid if the device is
+ * rebuilt before it is presented */
+void *device_present_begin(gs_device_t *device)
+{
+	IDXGISwapChain *swap;
+
+	if (!device->curSwapChain) {
+		blog(LOG_WARNING, "device_present_begin (D3D11): "
+		                  "No active swap");
+		return nullptr;
+	}
+
+	swap = device->curSwapChain->swap;
+	swap->AddRef();
+	return swap;
+}
+
+bool device_present_end(gs_device_t *device, void *present)
+{
+	IDXGISwapChain *swap = (IDXGISwapChain*)present;
+	HRESULT hr = swap->Present(0, 0);
+	swap->Release();
+
+	UNUSED_PARAMETER(device);
+	return hr != DXGI_ERROR_DEVICE_REMOVED &&
+	       hr != DXGI_ERROR_DEVICE_RESET;
+}
+
 extern "C" void reset_duplicators(void);
 
 void device_flush(gs_device_t *device)
@@ -1749,6 +1779,11 @@ void device_projection_pop(gs_device_t *device)
 	device->projStack.pop_back();
 }
 
+void device_projection_get(const gs_device_t *device, matrix4 *dst)
+{
+	memcpy(dst, &device->curProjMatrix, sizeof(matrix4));
+}
+
 void gs_swapchain_destroy(gs_swapchain_t *swapchain)
 {
 	if (swapchain->device->curSwapChain == swapchain)
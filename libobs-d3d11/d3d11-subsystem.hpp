@@ -28,6 +28,7 @@
 #include <dxgi.h>
 #include <dxgi1_2.h>
 #include <d3d11_1.h>
+#include <d3d10.h>
 #include <d3dcompiler.h>
 
 #include <util/base.h>
@@ -59,6 +60,15 @@ static inline uint32_t GetWinVer()
 	return (ver.major << 8) | ver.minor;
 }
 
+/* serializes the immediate context with swap chains presented on other
+ * threads (see device_present_begin) */
+static inline void SetMultithreadProtected(ID3D11Device *device)
+{
+	ComQIPtr<ID3D10Multithread> multithread(device);
+	if (!!multithread)
+		multithread->SetMultithreadProtected(TRUE);
+}
+
 static inline DXGI_FORMAT ConvertGSTextureFormat(gs_color_format format)
 {
 	switch (format) {
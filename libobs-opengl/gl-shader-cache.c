@@ -0,0 +1,278 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <util/platform.h>
+#include <util/dstr.h>
+#include "gl-subsystem.h"
+
+/*
+ *   Linked programs are cached on disk as program binaries, keyed by the
+ * translated GLSL of both of their shaders and the driver that compiled them.
+ *
+ *   Shaders that have compiled successfully on the same driver before are
+ * marked with an empty file, and are only compiled once a program using them
+ * has no cached binary, so with a complete cache nothing is compiled at all.
+ */
+
+#define PROGRAM_CACHE_MAGIC   0x4B504C47 /* "GLPK" */
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format;
+	uint32_t size;
+};
+
+static inline uint64_t hash_data(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static inline uint64_t hash_string(uint64_t hash, const char *str)
+{
+	return str ? hash_data(hash, str, strlen(str) + 1) : hash;
+}
+
+#define HASH_BASIS 14695981039346656037ULL
+
+uint64_t gl_shader_cache_hash(const char *glsl)
+{
+	return hash_string(HASH_BASIS, glsl);
+}
+
+void gl_shader_cache_init(struct gs_device *device)
+{
+	uint64_t hash = HASH_BASIS;
+	GLint formats = 0;
+
+	hash = hash_string(hash, (const char*)glGetString(GL_VENDOR));
+	hash = hash_string(hash, (const char*)glGetString(GL_RENDERER));
+	hash = hash_string(hash, (const char*)glGetString(GL_VERSION));
+	device->driver_hash = hash;
+
+	if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+		return;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (!gl_success("glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS)"))
+		return;
+
+	device->program_binary = formats > 0;
+}
+
+void gl_shader_cache_free(struct gs_device *device)
+{
+	bfree(device->shader_cache_dir);
+	device->shader_cache_dir = NULL;
+}
+
+void device_set_shader_cache_dir(gs_device_t *device, const char *dir)
+{
+	gl_shader_cache_free(device);
+
+	if (!dir || !*dir || !device->program_binary)
+		return;
+
+	if (os_mkdirs(dir) == MKDIR_ERROR) {
+		blog(LOG_WARNING, "Failed to create shader cache directory "
+		                  "'%s'", dir);
+		return;
+	}
+
+	device->shader_cache_dir = bstrdup(dir);
+}
+
+static void get_cache_path(struct dstr *path, const struct gs_device *device,
+		uint64_t hash, const char *ext)
+{
+	hash = hash_data(hash, &device->driver_hash,
+			sizeof(device->driver_hash));
+
+	dstr_printf(path, "%s/%016llx.%s", device->shader_cache_dir,
+			(unsigned long long)hash, ext);
+}
+
+bool gl_shader_cache_has_shader(const struct gs_device *device,
+		uint64_t hash)
+{
+	struct dstr path = {0};
+	bool exists;
+
+	if (!device->shader_cache_dir)
+		return false;
+
+	get_cache_path(&path, device, hash, "shader");
+	exists = os_file_exists(path.array);
+	dstr_free(&path);
+	return exists;
+}
+
+void gl_shader_cache_add_shader(const struct gs_device *device, uint64_t hash)
+{
+	struct dstr path = {0};
+	FILE *file;
+
+	if (!device->shader_cache_dir)
+		return;
+
+	get_cache_path(&path, device, hash, "shader");
+	file = os_fopen(path.array, "wb");
+	if (file)
+		fclose(file);
+	dstr_free(&path);
+}
+
+static inline uint64_t program_hash(const struct gs_program *program)
+{
+	uint64_t hash = HASH_BASIS;
+
+	hash = hash_data(hash, &program->vertex_shader->glsl_hash,
+			sizeof(uint64_t));
+	hash = hash_data(hash, &program->pixel_shader->glsl_hash,
+			sizeof(uint64_t));
+	return hash;
+}
+
+static void *read_program_binary(const char *path,
+		struct program_cache_header *header)
+{
+	void *data = NULL;
+	FILE *file;
+
+	file = os_fopen(path, "rb");
+	if (!file)
+		return NULL;
+
+	if (fread(header, 1, sizeof(*header), file) != sizeof(*header))
+		goto fail;
+	if (header->magic != PROGRAM_CACHE_MAGIC ||
+	    header->version != PROGRAM_CACHE_VERSION ||
+	    !header->size)
+		goto fail;
+
+	data = bmalloc(header->size);
+	if (fread(data, 1, header->size, file) != header->size) {
+		bfree(data);
+		data = NULL;
+	}
+
+fail:
+	fclose(file);
+	return data;
+}
+
+bool gl_shader_cache_load_program(struct gs_program *program)
+{
+	struct gs_device *device = program->device;
+	struct program_cache_header header;
+	struct dstr path = {0};
+	GLint linked = GL_FALSE;
+	void *data;
+
+	if (!device->shader_cache_dir)
+		return false;
+
+	get_cache_path(&path, device, program_hash(program), "program");
+
+	data = read_program_binary(path.array, &header);
+	if (!data)
+		goto fail;
+
+	glProgramBinary(program->obj, (GLenum)header.format, data,
+			(GLsizei)header.size);
+	bfree(data);
+
+	if (!gl_success("glProgramBinary"))
+		goto fail;
+
+	glGetProgramiv(program->obj, GL_LINK_STATUS, &linked);
+	if (!gl_success("glGetProgramiv") || linked == GL_FALSE) {
+		/* rejected by the driver, so it will be linked and saved
+		 * again */
+		blog(LOG_DEBUG, "Discarding cached program '%s'", path.array);
+		os_unlink(path.array);
+		goto fail;
+	}
+
+	dstr_free(&path);
+	return true;
+
+fail:
+	dstr_free(&path);
+	return false;
+}
+
+void gl_shader_cache_save_program(struct gs_program *program)
+{
+	struct gs_device *device = program->device;
+	struct program_cache_header header = {0};
+	struct dstr path = {0};
+	struct dstr tmp_path = {0};
+	GLint size = 0;
+	GLenum format = 0;
+	GLsizei written = 0;
+	void *data = NULL;
+	FILE *file;
+	bool success;
+
+	if (!device->shader_cache_dir)
+		return;
+
+	glGetProgramiv(program->obj, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (!gl_success("glGetProgramiv") || size <= 0)
+		return;
+
+	data = bmalloc(size);
+	glGetProgramBinary(program->obj, size, &written, &format, data);
+	if (!gl_success("glGetProgramBinary") || written <= 0)
+		goto exit;
+
+	header.magic   = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.format  = (uint32_t)format;
+	header.size    = (uint32_t)written;
+
+	get_cache_path(&path, device, program_hash(program), "program");
+	dstr_copy_dstr(&tmp_path, &path);
+	dstr_cat(&tmp_path, ".tmp");
+
+	file = os_fopen(tmp_path.array, "wb");
+	if (!file)
+		goto exit;
+
+	success = fwrite(&header, 1, sizeof(header), file) == sizeof(header) &&
+		fwrite(data, 1, header.size, file) == header.size;
+	fclose(file);
+
+	if (success)
+		success = os_rename(tmp_path.array, path.array) == 0;
+	if (!success)
+		os_unlink(tmp_path.array);
+
+exit:
+	dstr_free(&tmp_path);
+	dstr_free(&path);
+	bfree(data);
+}
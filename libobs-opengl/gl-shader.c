@@ -187,8 +187,7 @@ static inline bool gl_process_attribs(struct gs_shader *shader,
 	return true;
 }
 
-static bool gl_shader_init(struct gs_shader *shader,
-		struct gl_shader_parser *glsp,
+static bool gl_shader_compile(struct gs_shader *shader, const char *glsl,
 		const char *file, char **error_string)
 {
 	GLenum type = convert_shader_type(shader->type);
@@ -199,8 +198,7 @@ static bool gl_shader_init(struct gs_shader *shader,
 	if (!gl_success("glCreateShader") || !shader->obj)
 		return false;
 
-	glShaderSource(shader->obj, 1, (const GLchar**)&glsp->gl_string.array,
-			0);
+	glShaderSource(shader->obj, 1, (const GLchar**)&glsl, 0);
 	if (!gl_success("glShaderSource"))
 		return false;
 
@@ -212,7 +210,7 @@ static bool gl_shader_init(struct gs_shader *shader,
 	blog(LOG_DEBUG, "+++++++++++++++++++++++++++++++++++");
 	blog(LOG_DEBUG, "  GL shader string for: %s", file);
 	blog(LOG_DEBUG, "-----------------------------------");
-	blog(LOG_DEBUG, "%s", glsp->gl_string.array);
+	blog(LOG_DEBUG, "%s", glsl);
 	blog(LOG_DEBUG, "+++++++++++++++++++++++++++++++++++");
 #endif
 
@@ -224,6 +222,59 @@ static bool gl_shader_init(struct gs_shader *shader,
 		success = false;
 
 	gl_get_shader_info(shader->obj, file, error_string);
+	return success;
+}
+
+/* compiles a shader whose compilation was deferred because it had compiled
+ * before, see gl-shader-cache.c.  there's no caller to return errors to at
+ * this point, so they're logged, and the shader stays unusable. */
+static bool gl_shader_compile_deferred(struct gs_shader *shader)
+{
+	char *errors = NULL;
+	bool success;
+
+	if (shader->obj)
+		return true;
+	if (!shader->glsl)
+		return false;
+
+	success = gl_shader_compile(shader, shader->glsl, shader->file,
+			&errors);
+	if (!success) {
+		blog(LOG_ERROR, "Failed to compile deferred shader '%s':\n%s",
+				shader->file, errors ? errors : "");
+
+		if (shader->obj) {
+			glDeleteShader(shader->obj);
+			gl_success("glDeleteShader");
+			shader->obj = 0;
+		}
+	}
+
+	bfree(errors);
+	bfree(shader->glsl);
+	shader->glsl = NULL;
+	return success;
+}
+
+static bool gl_shader_init(struct gs_shader *shader,
+		struct gl_shader_parser *glsp,
+		const char *file, char **error_string)
+{
+	const char *glsl = glsp->gl_string.array;
+	bool success = true;
+
+	shader->glsl_hash = gl_shader_cache_hash(glsl);
+
+	if (gl_shader_cache_has_shader(shader->device, shader->glsl_hash)) {
+		shader->glsl = bstrdup(glsl);
+		shader->file = bstrdup(file);
+	} else {
+		success = gl_shader_compile(shader, glsl, file, error_string);
+		if (success)
+			gl_shader_cache_add_shader(shader->device,
+					shader->glsl_hash);
+	}
 
 	if (success)
 		success = gl_add_params(shader, glsp);
@@ -332,6 +383,8 @@ void gs_shader_destroy(gs_shader_t *shader)
 		gl_success("glDeleteShader");
 	}
 
+	bfree(shader->glsl);
+	bfree(shader->file);
 	da_free(shader->samplers);
 	da_free(shader->params);
 	da_free(shader->attribs);
@@ -517,11 +570,31 @@ static void program_set_param_data(struct gs_program *program,
 	}
 }
 
+static inline bool param_unchanged(struct program_param *pp)
+{
+	size_t size = pp->param->cur_value.num;
+
+	if (pp->param->type == GS_SHADER_PARAM_TEXTURE)
+		return false;
+	if (!size || size > sizeof(pp->last_value))
+		return false;
+
+	if (pp->last_size == size &&
+	    memcmp(pp->last_value, pp->param->cur_value.array, size) == 0)
+		return true;
+
+	memcpy(pp->last_value, pp->param->cur_value.array, size);
+	pp->last_size = size;
+	return false;
+}
+
 void program_update_params(struct gs_program *program)
 {
 	for (size_t i = 0; i < program->params.num; i++) {
 		struct program_param *pp = program->params.array + i;
-		program_set_param_data(program, pp);
+
+		if (!param_unchanged(pp))
+			program_set_param_data(program, pp);
 	}
 }
 
@@ -577,7 +650,7 @@ static inline bool assign_program_attribs(struct gs_program *program)
 static bool assign_program_param(struct gs_program *program,
 		struct gs_shader_param *param)
 {
-	struct program_param info;
+	struct program_param info = {0};
 
 	info.obj = glGetUniformLocation(program->obj, param->name);
 	if (!gl_success("glGetUniformLocation"))
@@ -614,38 +687,71 @@ static inline bool assign_program_params(struct gs_program *program)
 	return true;
 }
 
-struct gs_program *gs_program_create(struct gs_device *device)
+static bool gl_program_link(struct gs_program *program)
 {
-	struct gs_program *program = bzalloc(sizeof(*program));
+	bool success = false;
 	int linked = false;
 
-	program->device        = device;
-	program->vertex_shader = device->cur_vertex_shader;
-	program->pixel_shader  = device->cur_pixel_shader;
+	if (!gl_shader_compile_deferred(program->vertex_shader))
+		return false;
+	if (!gl_shader_compile_deferred(program->pixel_shader))
+		return false;
 
-	program->obj = glCreateProgram();
-	if (!gl_success("glCreateProgram"))
-		goto error_detach_neither;
+	if (program->device->shader_cache_dir) {
+		glProgramParameteri(program->obj,
+				GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		gl_success("glProgramParameteri");
+	}
 
 	glAttachShader(program->obj, program->vertex_shader->obj);
 	if (!gl_success("glAttachShader (vertex)"))
-		goto error_detach_neither;
+		return false;
 
 	glAttachShader(program->obj, program->pixel_shader->obj);
 	if (!gl_success("glAttachShader (pixel)"))
-		goto error_detach_vertex;
+		goto detach_vertex;
 
 	glLinkProgram(program->obj);
 	if (!gl_success("glLinkProgram"))
-		goto error;
+		goto detach;
 
 	glGetProgramiv(program->obj, GL_LINK_STATUS, &linked);
 	if (!gl_success("glGetProgramiv"))
-		goto error;
+		goto detach;
 
-	if (linked == GL_FALSE) {
+	if (linked == GL_FALSE)
 		print_link_errors(program->obj);
+	else
+		success = true;
+
+detach:
+	glDetachShader(program->obj, program->pixel_shader->obj);
+	gl_success("glDetachShader (pixel)");
+
+detach_vertex:
+	glDetachShader(program->obj, program->vertex_shader->obj);
+	gl_success("glDetachShader (vertex)");
+
+	return success;
+}
+
+struct gs_program *gs_program_create(struct gs_device *device)
+{
+	struct gs_program *program = bzalloc(sizeof(*program));
+
+	program->device        = device;
+	program->vertex_shader = device->cur_vertex_shader;
+	program->pixel_shader  = device->cur_pixel_shader;
+
+	program->obj = glCreateProgram();
+	if (!gl_success("glCreateProgram"))
 		goto error;
+
+	if (!gl_shader_cache_load_program(program)) {
+		if (!gl_program_link(program))
+			goto error;
+
+		gl_shader_cache_save_program(program);
 	}
 
 	if (!assign_program_attribs(program))
@@ -653,12 +759,6 @@ struct gs_program *gs_program_create(struct gs_device *device)
 	if (!assign_program_params(program))
 		goto error;
 
-	glDetachShader(program->obj, program->vertex_shader->obj);
-	gl_success("glDetachShader (vertex)");
-
-	glDetachShader(program->obj, program->pixel_shader->obj);
-	gl_success("glDetachShader (pixel)");
-
 	program->next = device->first_program;
 	program->prev_next = &device->first_program;
 	device->first_program = program;
@@ -668,14 +768,6 @@ struct gs_program *gs_program_create(struct gs_device *device)
 	return program;
 
 error:
-	glDetachShader(program->obj, program->pixel_shader->obj);
-	gl_success("glDetachShader (pixel)");
-
-error_detach_vertex:
-	glDetachShader(program->obj, program->vertex_shader->obj);
-	gl_success("glDetachShader (vertex)");
-
-error_detach_neither:
 	gs_program_destroy(program);
 	return NULL;
 }
@@ -232,6 +232,8 @@ int device_create(gs_device_t **p_device, uint32_t adapter)
 	blog(LOG_INFO, "OpenGL loaded successfully, version %s, shading "
 			"language %s", glVersion, glShadingLanguage);
 
+	gl_shader_cache_init(device);
+
 	gl_enable(GL_CULL_FACE);
 	
 	device_leave_context(device);
@@ -262,6 +264,7 @@ void device_destroy(gs_device_t *device)
 		while (device->first_program)
 			gs_program_destroy(device->first_program);
 
+		gl_shader_cache_free(device);
 		da_free(device->proj_stack);
 		gl_platform_destroy(device->plat);
 		bfree(device);
@@ -1341,6 +1344,11 @@ void device_projection_pop(gs_device_t *device)
 	da_pop_back(device->proj_stack);
 }
 
+void device_projection_get(const gs_device_t *device, struct matrix4 *dst)
+{
+	matrix4_copy(dst, &device->cur_proj);
+}
+
 void gs_swapchain_destroy(gs_swapchain_t *swapchain)
 {
 	if (!swapchain)
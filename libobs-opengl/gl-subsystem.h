@@ -332,6 +332,12 @@ struct gs_shader {
 	enum gs_shader_type  type;
 	GLuint               obj;
 
+	/* hash of the translated GLSL, and the GLSL itself while compiling is
+	 * deferred until a program needs it (see gl-shader-cache.c) */
+	uint64_t             glsl_hash;
+	char                 *glsl;
+	char                 *file;
+
 	struct gs_shader_param  *viewproj;
 	struct gs_shader_param  *world;
 
@@ -343,6 +349,10 @@ struct gs_shader {
 struct program_param {
 	GLint                  obj;
 	struct gs_shader_param *param;
+
+	/* last value uploaded to the program, uniforms keep their values */
+	size_t                 last_size;
+	uint8_t                last_value[sizeof(struct matrix4)];
 };
 
 struct gs_program {
@@ -503,6 +513,10 @@ struct gs_device {
 	DARRAY(struct matrix4)   proj_stack;
 
 	struct fbo_info          *cur_fbo;
+
+	char                     *shader_cache_dir;
+	uint64_t                 driver_hash;
+	bool                     program_binary;
 };
 
 extern struct fbo_info *get_fbo(gs_texture_t *tex, uint32_t width,
@@ -510,6 +524,16 @@ extern struct fbo_info *get_fbo(gs_texture_t *tex, uint32_t width,
 
 extern void                  gl_update(gs_device_t *device);
 
+extern uint64_t gl_shader_cache_hash(const char *glsl);
+extern void gl_shader_cache_init(struct gs_device *device);
+extern void gl_shader_cache_free(struct gs_device *device);
+extern bool gl_shader_cache_has_shader(const struct gs_device *device,
+		uint64_t hash);
+extern void gl_shader_cache_add_shader(const struct gs_device *device,
+		uint64_t hash);
+extern bool gl_shader_cache_load_program(struct gs_program *program);
+extern void gl_shader_cache_save_program(struct gs_program *program);
+
 extern struct gl_platform   *gl_platform_create(gs_device_t *device,
 		uint32_t adapter);
 extern void                  gl_platform_destroy(struct gl_platform *platform);
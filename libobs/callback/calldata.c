@@ -20,6 +20,7 @@
 #include "../util/base.h"
 
 #include "calldata.h"
+#include "decl.h"
 
 /*
  *   Uses a data stack.  Probably more complex than it should be, but reduces
@@ -146,7 +147,7 @@ static inline bool cd_ensure_capacity(calldata_t *data, uint8_t **pos,
 
 	if (new_size < data->capacity)
 		return true;
-	if (data->fixed) {
+	if (data->fixed && !data->spill) {
 		blog(LOG_ERROR, "Tried to go above fixed calldata stack size!");
 		return false;
 	}
@@ -157,7 +158,17 @@ static inline bool cd_ensure_capacity(calldata_t *data, uint8_t **pos,
 	if (new_capacity < new_size)
 		new_capacity = new_size;
 
-	data->stack    = brealloc(data->stack, new_capacity);
+	if (data->fixed) {
+		uint8_t *stack = bmalloc(new_capacity);
+		memcpy(stack, data->stack, data->size);
+
+		data->stack = stack;
+		data->fixed = false;
+		data->spill = false;
+	} else {
+		data->stack = brealloc(data->stack, new_capacity);
+	}
+
 	data->capacity = new_capacity;
 
 	*pos = data->stack + offset;
@@ -248,3 +259,67 @@ bool calldata_get_string(const calldata_t *data, const char *name,
 	*str = cd_serialize_string(&pos);
 	return true;
 }
+
+/* ------------------------------------------------------------------------- */
+
+/* returns the position of the parameter's data size if it's at its
+ * precomputed offset, NULL otherwise */
+static uint8_t *cd_get_decl_param(const calldata_t *data,
+		const struct decl_param *param)
+{
+	size_t end = param->offset + param->name_size + param->data_size +
+		sizeof(size_t) * 2;
+	uint8_t *pos;
+
+	if (param->offset == DECL_PARAM_NO_OFFSET || !data->stack)
+		return NULL;
+	if (end + sizeof(size_t) > data->size)
+		return NULL;
+
+	pos = data->stack + param->offset;
+	if (cd_serialize_size(&pos) != param->name_size)
+		return NULL;
+	if (memcmp(pos, param->name, param->name_size) != 0)
+		return NULL;
+
+	return pos + param->name_size;
+}
+
+void calldata_set_decl_data(calldata_t *data, const struct decl_info *decl,
+		size_t idx, const void *in, size_t size)
+{
+	const struct decl_param *param;
+	uint8_t *pos;
+
+	if (!data || !decl || idx >= decl->params.num)
+		return;
+
+	param = decl->params.array + idx;
+	if (size != param->data_size || !data->stack)
+		goto fallback;
+
+	/* all preceding parameters are set, append without searching */
+	if (data->size == param->offset + sizeof(size_t)) {
+		size_t new_size = data->size + param->name_size + size +
+			sizeof(size_t) * 2;
+
+		pos = data->stack + param->offset;
+		if (!cd_ensure_capacity(data, &pos, new_size))
+			return;
+
+		cd_copy_string(&pos, param->name, param->name_size);
+		cd_copy_data(&pos, in, size);
+		memset(pos, 0, sizeof(size_t));
+		data->size = new_size;
+		return;
+	}
+
+	pos = cd_get_decl_param(data, param);
+	if (pos && cd_serialize_size(&pos) == size) {
+		memcpy(pos, in, size);
+		return;
+	}
+
+fallback:
+	calldata_set_data(data, param->name, in, size);
+}
@@ -48,10 +48,13 @@ struct calldata {
 	size_t  size;     /* size of the stack, in bytes */
 	size_t  capacity; /* capacity of the stack, in bytes */
 	bool    fixed;    /* fixed size (using call stack) */
+	bool    spill;    /* fixed stack moves to the heap when full */
 };
 
 typedef struct calldata calldata_t;
 
+struct decl_info;
+
 static inline void calldata_init(struct calldata *data)
 {
 	memset(data, 0, sizeof(struct calldata));
@@ -65,10 +68,21 @@ static inline void calldata_init_fixed(struct calldata *data, uint8_t *stack,
 	data->stack = stack;
 	data->capacity = size;
 	data->fixed = true;
+	data->spill = false;
 	data->size = 0;
 	calldata_clear(data);
 }
 
+/* Like calldata_init_fixed, but instead of failing when the parameters no
+ * longer fit in the provided stack, they are moved to the heap.  Must be freed
+ * with calldata_free. */
+static inline void calldata_init_stack(struct calldata *data, uint8_t *stack,
+		size_t size)
+{
+	calldata_init_fixed(data, stack, size);
+	data->spill = true;
+}
+
 static inline void calldata_free(struct calldata *data)
 {
 	if (!data->fixed)
@@ -204,6 +218,42 @@ static inline void calldata_set_string(calldata_t *data, const char *name,
 		calldata_set_data(data, name, NULL, 0);
 }
 
+/* ------------------------------------------------------------------------- */
+/* Parameter access by declaration index.
+ *
+ *   When parameters are set in the same order as in their declaration (see
+ * callback/decl.h), their positions in the stack are known ahead of time, so
+ * these can write them directly instead of looking them up by name.  If the
+ * calldata was built in any other order they fall back to the name. */
+
+EXPORT void calldata_set_decl_data(calldata_t *data,
+		const struct decl_info *decl, size_t idx, const void *in,
+		size_t size);
+
+static inline void calldata_set_decl_int(calldata_t *data,
+		const struct decl_info *decl, size_t idx, long long val)
+{
+	calldata_set_decl_data(data, decl, idx, &val, sizeof(val));
+}
+
+static inline void calldata_set_decl_float(calldata_t *data,
+		const struct decl_info *decl, size_t idx, double val)
+{
+	calldata_set_decl_data(data, decl, idx, &val, sizeof(val));
+}
+
+static inline void calldata_set_decl_bool(calldata_t *data,
+		const struct decl_info *decl, size_t idx, bool val)
+{
+	calldata_set_decl_data(data, decl, idx, &val, sizeof(val));
+}
+
+static inline void calldata_set_decl_ptr(calldata_t *data,
+		const struct decl_info *decl, size_t idx, void *ptr)
+{
+	calldata_set_decl_data(data, decl, idx, &ptr, sizeof(ptr));
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -174,6 +174,43 @@ static void parse_params(struct cf_parser *cfp, struct decl_info *decl)
 		cf_next_token_should_be(cfp, ")", NULL, NULL);
 }
 
+static size_t get_type_size(enum call_param_type type)
+{
+	switch (type) {
+	case CALL_PARAM_TYPE_INT:   return sizeof(long long);
+	case CALL_PARAM_TYPE_FLOAT: return sizeof(double);
+	case CALL_PARAM_TYPE_BOOL:  return sizeof(bool);
+	case CALL_PARAM_TYPE_PTR:   return sizeof(void*);
+	case CALL_PARAM_TYPE_VOID:
+	case CALL_PARAM_TYPE_STRING:
+		break;
+	}
+
+	return 0;
+}
+
+/* see the stack format in calldata.c */
+static void compute_param_offsets(struct decl_info *decl)
+{
+	size_t offset = 0;
+
+	for (size_t i = 0; i < decl->params.num; i++) {
+		struct decl_param *param = decl->params.array + i;
+
+		param->name_size = strlen(param->name) + 1;
+		param->data_size = get_type_size(param->type);
+		param->offset    = offset;
+
+		if (offset == DECL_PARAM_NO_OFFSET || !param->data_size) {
+			offset = DECL_PARAM_NO_OFFSET;
+			continue;
+		}
+
+		offset += sizeof(size_t) * 2 + param->name_size +
+			param->data_size;
+	}
+}
+
 static void print_errors(struct cf_parser *cfp, const char *decl_string)
 {
 	char *errors = error_data_buildstring(&cfp->error_list);
@@ -229,6 +266,9 @@ fail:
 		da_push_back(decl->params, &ret_param);
 	}
 
+	if (success)
+		compute_param_offsets(decl);
+
 	if (!success)
 		decl_info_free(decl);
 
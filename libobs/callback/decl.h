@@ -23,10 +23,19 @@
 extern "C" {
 #endif
 
+#define DECL_PARAM_NO_OFFSET ((size_t)-1)
+
 struct decl_param {
 	char                 *name;
 	enum call_param_type type;
 	uint32_t             flags;
+
+	/* position of the parameter in a calldata stack that had every
+	 * parameter set in declaration order, or DECL_PARAM_NO_OFFSET if it
+	 * comes after a parameter of variable size (a string) */
+	size_t               offset;
+	size_t               name_size;
+	size_t               data_size;
 };
 
 static inline void decl_param_free(struct decl_param *param)
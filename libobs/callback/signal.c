@@ -16,6 +16,7 @@
 
 #include "../util/darray.h"
 #include "../util/threading.h"
+#include "../util/platform.h"
 
 #include "decl.h"
 #include "signal.h"
@@ -23,19 +24,48 @@
 struct signal_callback {
 	signal_callback_t callback;
 	void              *data;
-	bool              remove;
 	bool              keep_ref;
+	volatile bool     remove;
+	volatile long     calling;
+};
+
+/* Callbacks are never modified in place.  Connecting or disconnecting builds
+ * a new list and publishes it atomically, so emitting a signal never has to
+ * take a lock.  Lists (and callbacks) that have been replaced are retired and
+ * only freed once no thread is emitting the signal anymore. */
+struct signal_callback_list {
+	size_t                 num;
+	struct signal_callback **array;
 };
 
 struct signal_info {
 	struct decl_info               func;
-	DARRAY(struct signal_callback) callbacks;
+	struct signal_callback_list    *callbacks;
+	volatile long                  emitting;
+
 	pthread_mutex_t                mutex;
-	bool                           signalling;
+	DARRAY(void*)                  retired;
+	volatile bool                  has_retired;
 
 	struct signal_info             *next;
 };
 
+static inline struct signal_callback_list *callback_list_create(size_t num)
+{
+	struct signal_callback_list *list;
+
+	list = bmalloc(sizeof(*list) + sizeof(struct signal_callback*) * num);
+	list->num   = num;
+	list->array = (struct signal_callback**)(list + 1);
+	return list;
+}
+
+static inline struct signal_callback_list *get_callbacks(
+		struct signal_info *si)
+{
+	return os_atomic_load_ptr((void *volatile *)&si->callbacks);
+}
+
 static inline struct signal_info *signal_info_create(struct decl_info *info)
 {
 	pthread_mutexattr_t attr;
@@ -46,17 +76,16 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0)
 		return NULL;
 
-	si = bmalloc(sizeof(struct signal_info));
+	si = bzalloc(sizeof(struct signal_info));
 
-	si->func       = *info;
-	si->next       = NULL;
-	si->signalling = false;
-	da_init(si->callbacks);
+	si->func      = *info;
+	si->callbacks = callback_list_create(0);
 
 	if (pthread_mutex_init(&si->mutex, &attr) != 0) {
 		blog(LOG_ERROR, "Could not create signal");
 
 		decl_info_free(&si->func);
+		bfree(si->callbacks);
 		bfree(si);
 		return NULL;
 	}
@@ -64,27 +93,71 @@ static inline struct signal_info *signal_info_create(struct decl_info *info)
 	return si;
 }
 
+static inline void signal_info_free_retired(struct signal_info *si)
+{
+	for (size_t i = 0; i < si->retired.num; i++)
+		bfree(si->retired.array[i]);
+
+	da_resize(si->retired, 0);
+	os_atomic_set_bool(&si->has_retired, false);
+}
+
 static inline void signal_info_destroy(struct signal_info *si)
 {
 	if (si) {
+		struct signal_callback_list *list = si->callbacks;
+
+		for (size_t i = 0; i < list->num; i++)
+			bfree(list->array[i]);
+		bfree(list);
+
+		signal_info_free_retired(si);
+		da_free(si->retired);
+
 		pthread_mutex_destroy(&si->mutex);
 		decl_info_free(&si->func);
-		da_free(si->callbacks);
 		bfree(si);
 	}
 }
 
-static inline size_t signal_get_callback_idx(struct signal_info *si,
+/* must be called with si->mutex held */
+static inline void signal_info_retire(struct signal_info *si, void *ptr)
+{
+	da_push_back(si->retired, &ptr);
+	os_atomic_set_bool(&si->has_retired, true);
+}
+
+/* must be called with si->mutex held.  Anything retired before this point
+ * was already replaced, so once no thread is emitting the signal nothing can
+ * still be referencing it. */
+static inline void signal_info_reclaim(struct signal_info *si)
+{
+	if (si->retired.num && os_atomic_load_long(&si->emitting) == 0)
+		signal_info_free_retired(si);
+}
+
+/* must be called with si->mutex held */
+static void signal_info_publish(struct signal_info *si,
+		struct signal_callback_list *list)
+{
+	void *prev = os_atomic_set_ptr((void *volatile *)&si->callbacks, list);
+	signal_info_retire(si, prev);
+	signal_info_reclaim(si);
+}
+
+static inline struct signal_callback *signal_get_callback(
+		struct signal_callback_list *list,
 		signal_callback_t callback, void *data)
 {
-	for (size_t i = 0; i < si->callbacks.num; i++) {
-		struct signal_callback *sc = si->callbacks.array+i;
+	for (size_t i = 0; i < list->num; i++) {
+		struct signal_callback *sc = list->array[i];
 
-		if (sc->callback == callback && sc->data == data)
-			return i;
+		if (sc->callback == callback && sc->data == data &&
+		    !os_atomic_load_bool(&sc->remove))
+			return sc;
 	}
 
-	return DARRAY_INVALID;
+	return NULL;
 }
 
 struct global_callback_info {
@@ -101,20 +174,23 @@ struct signal_handler {
 
 	DARRAY(struct global_callback_info) global_callbacks;
 	pthread_mutex_t                     global_callbacks_mutex;
+	volatile bool                       has_global_callbacks;
 };
 
+/* signals are only ever appended, so the list can be walked without holding
+ * the handler mutex */
 static struct signal_info *getsignal(signal_handler_t *handler,
 		const char *name, struct signal_info **p_last)
 {
 	struct signal_info *signal, *last= NULL;
 
-	signal = handler->first;
+	signal = os_atomic_load_ptr((void *volatile *)&handler->first);
 	while (signal != NULL) {
 		if (strcmp(signal->func.name, name) == 0)
 			break;
 
 		last = signal;
-		signal = signal->next;
+		signal = os_atomic_load_ptr((void *volatile *)&signal->next);
 	}
 
 	if (p_last)
@@ -195,9 +271,10 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 	} else {
 		sig = signal_info_create(&func);
 		if (!last)
-			handler->first = sig;
+			os_atomic_set_ptr((void *volatile *)&handler->first,
+					sig);
 		else
-			last->next = sig;
+			os_atomic_set_ptr((void *volatile *)&last->next, sig);
 	}
 
 	pthread_mutex_unlock(&handler->mutex);
@@ -205,21 +282,29 @@ bool signal_handler_add(signal_handler_t *handler, const char *signal_decl)
 	return success;
 }
 
+signal_id_t signal_handler_get_id(signal_handler_t *handler,
+		const char *signal)
+{
+	return handler ? getsignal(handler, signal, NULL) : NULL;
+}
+
+const struct decl_info *signal_handler_get_decl(signal_id_t id)
+{
+	return id ? &id->func : NULL;
+}
+
 static void signal_handler_connect_internal(signal_handler_t *handler,
 		const char *signal, signal_callback_t callback, void *data,
 		bool keep_ref)
 {
-	struct signal_info *sig, *last;
-	struct signal_callback cb_data = {callback, data, false, keep_ref};
-	size_t idx;
+	struct signal_callback_list *list, *new_list;
+	struct signal_callback *cb;
+	struct signal_info *sig;
 
 	if (!handler)
 		return;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, signal, &last);
-	pthread_mutex_unlock(&handler->mutex);
-
+	sig = getsignal(handler, signal, NULL);
 	if (!sig) {
 		blog(LOG_WARNING, "signal_handler_connect: "
 		                  "signal '%s' not found", signal);
@@ -233,9 +318,20 @@ static void signal_handler_connect_internal(signal_handler_t *handler,
 	if (keep_ref)
 		os_atomic_inc_long(&handler->refs);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (keep_ref || idx == DARRAY_INVALID)
-		da_push_back(sig->callbacks, &cb_data);
+	list = get_callbacks(sig);
+	if (keep_ref || !signal_get_callback(list, callback, data)) {
+		cb = bzalloc(sizeof(struct signal_callback));
+		cb->callback = callback;
+		cb->data     = data;
+		cb->keep_ref = keep_ref;
+
+		new_list = callback_list_create(list->num + 1);
+		memcpy(new_list->array, list->array,
+				sizeof(struct signal_callback*) * list->num);
+		new_list->array[list->num] = cb;
+
+		signal_info_publish(sig, new_list);
+	}
 
 	pthread_mutex_unlock(&sig->mutex);
 }
@@ -252,121 +348,203 @@ void signal_handler_connect_ref(signal_handler_t *handler, const char *signal,
 	signal_handler_connect_internal(handler, signal, callback, data, true);
 }
 
-static inline struct signal_info *getsignal_locked(signal_handler_t *handler,
-		const char *name)
+/* callbacks currently being called on this thread, innermost first */
+struct signal_frame {
+	struct signal_callback      *cb;
+	struct global_callback_info *global_cb;
+	bool                        remove_current;
+	struct signal_frame         *prev;
+};
+
+static THREAD_LOCAL struct signal_frame *current_frame = NULL;
+
+static inline long calls_on_this_thread(struct signal_callback *cb)
 {
-	struct signal_info *sig;
+	long calls = 0;
 
-	if (!handler)
-		return NULL;
+	for (struct signal_frame *f = current_frame; f; f = f->prev)
+		if (f->cb == cb)
+			calls++;
 
-	pthread_mutex_lock(&handler->mutex);
-	sig = getsignal(handler, name, NULL);
-	pthread_mutex_unlock(&handler->mutex);
+	return calls;
+}
+
+/* builds a list without callbacks flagged for removal and publishes it.  must
+ * be called with sig->mutex held.  returns the number of handler references
+ * held by the removed callbacks. */
+static long signal_info_purge_removed(struct signal_info *sig)
+{
+	struct signal_callback_list *list = get_callbacks(sig);
+	struct signal_callback_list *new_list;
+	long remove_refs = 0;
+	size_t num = 0;
+
+	new_list = callback_list_create(list->num);
 
-	return sig;
+	for (size_t i = 0; i < list->num; i++) {
+		struct signal_callback *cb = list->array[i];
+
+		if (!os_atomic_load_bool(&cb->remove)) {
+			new_list->array[num++] = cb;
+			continue;
+		}
+
+		if (cb->keep_ref)
+			remove_refs++;
+		signal_info_retire(sig, cb);
+	}
+
+	new_list->num = num;
+	signal_info_publish(sig, new_list);
+	return remove_refs;
 }
 
 void signal_handler_disconnect(signal_handler_t *handler, const char *signal,
 		signal_callback_t callback, void *data)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
-	bool keep_ref = false;
-	size_t idx;
+	struct signal_info *sig;
+	struct signal_callback *cb;
+	long remove_refs = 0;
 
+	if (!handler)
+		return;
+
+	sig = getsignal(handler, signal, NULL);
 	if (!sig)
 		return;
 
 	pthread_mutex_lock(&sig->mutex);
 
-	idx = signal_get_callback_idx(sig, callback, data);
-	if (idx != DARRAY_INVALID) {
-		if (sig->signalling) {
-			sig->callbacks.array[idx].remove = true;
-		} else {
-			keep_ref = sig->callbacks.array[idx].keep_ref;
-			da_erase(sig->callbacks, idx);
-		}
+	cb = signal_get_callback(get_callbacks(sig), callback, data);
+	if (cb) {
+		os_atomic_set_bool(&cb->remove, true);
+		remove_refs = signal_info_purge_removed(sig);
+
+		/* keeps the callback from being reclaimed while waiting */
+		os_atomic_inc_long(&sig->emitting);
 	}
 
 	pthread_mutex_unlock(&sig->mutex);
 
-	if (keep_ref && os_atomic_dec_long(&handler->refs) == 0) {
-		signal_handler_actually_destroy(handler);
+	if (!cb)
+		return;
+
+	/* the callback can no longer be entered, but other threads may still
+	 * be inside of it; wait for them so that the caller can safely free
+	 * the data afterward */
+	long own_calls = calls_on_this_thread(cb);
+	while (os_atomic_load_long(&cb->calling) > own_calls)
+		os_sleep_ms(0);
+
+	os_atomic_dec_long(&sig->emitting);
+
+	while (remove_refs--) {
+		if (os_atomic_dec_long(&handler->refs) == 0) {
+			signal_handler_actually_destroy(handler);
+			break;
+		}
 	}
 }
 
-static THREAD_LOCAL struct signal_callback *current_signal_cb = NULL;
-static THREAD_LOCAL struct global_callback_info *current_global_cb = NULL;
-
 void signal_handler_remove_current(void)
 {
-	if (current_signal_cb)
-		current_signal_cb->remove = true;
-	else if (current_global_cb)
-		current_global_cb->remove = true;
+	if (!current_frame)
+		return;
+
+	if (current_frame->cb) {
+		os_atomic_set_bool(&current_frame->cb->remove, true);
+		current_frame->remove_current = true;
+	} else if (current_frame->global_cb) {
+		current_frame->global_cb->remove = true;
+	}
 }
 
-void signal_handler_signal(signal_handler_t *handler, const char *signal,
+static void signal_emit_global(signal_handler_t *handler, const char *signal,
 		calldata_t *params)
 {
-	struct signal_info *sig = getsignal_locked(handler, signal);
-	long remove_refs = 0;
+	struct signal_frame frame = {0};
 
-	if (!sig)
-		return;
+	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	pthread_mutex_lock(&sig->mutex);
-	sig->signalling = true;
+	frame.prev = current_frame;
+	current_frame = &frame;
+
+	for (size_t i = 0; i < handler->global_callbacks.num; i++) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + i;
 
-	for (size_t i = 0; i < sig->callbacks.num; i++) {
-		struct signal_callback *cb = sig->callbacks.array+i;
 		if (!cb->remove) {
-			current_signal_cb = cb;
-			cb->callback(cb->data, params);
-			current_signal_cb = NULL;
+			cb->signaling++;
+			frame.global_cb = cb;
+			cb->callback(cb->data, signal, params);
+			frame.global_cb = NULL;
+			cb->signaling--;
 		}
 	}
 
-	for (size_t i = sig->callbacks.num; i > 0; i--) {
-		struct signal_callback *cb = sig->callbacks.array+i-1;
-		if (cb->remove) {
-			if (cb->keep_ref)
-				remove_refs++;
+	current_frame = frame.prev;
 
-			da_erase(sig->callbacks, i-1);
-		}
+	for (size_t i = handler->global_callbacks.num; i > 0; i--) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + (i - 1);
+
+		if (cb->remove && !cb->signaling)
+			da_erase(handler->global_callbacks, i - 1);
 	}
 
-	sig->signalling = false;
-	pthread_mutex_unlock(&sig->mutex);
+	os_atomic_set_bool(&handler->has_global_callbacks,
+			handler->global_callbacks.num != 0);
 
-	pthread_mutex_lock(&handler->global_callbacks_mutex);
+	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+}
+
+void signal_handler_signal_id(signal_handler_t *handler, signal_id_t sig,
+		calldata_t *params)
+{
+	struct signal_callback_list *list;
+	struct signal_frame frame = {0};
+	long remove_refs = 0;
+
+	if (!handler || !sig)
+		return;
+
+	os_atomic_inc_long(&sig->emitting);
+	list = get_callbacks(sig);
 
-	if (handler->global_callbacks.num) {
-		for (size_t i = 0; i < handler->global_callbacks.num; i++) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + i;
-
-			if (!cb->remove) {
-				cb->signaling++;
-				current_global_cb = cb;
-				cb->callback(cb->data, signal, params);
-				current_global_cb = NULL;
-				cb->signaling--;
-			}
+	frame.prev = current_frame;
+	current_frame = &frame;
+
+	for (size_t i = 0; i < list->num; i++) {
+		struct signal_callback *cb = list->array[i];
+
+		/* the call count must be raised before checking the remove
+		 * flag, see signal_handler_disconnect */
+		os_atomic_inc_long(&cb->calling);
+		if (!os_atomic_load_bool(&cb->remove)) {
+			frame.cb = cb;
+			cb->callback(cb->data, params);
+			frame.cb = NULL;
 		}
+		os_atomic_dec_long(&cb->calling);
+	}
 
-		for (size_t i = handler->global_callbacks.num; i > 0; i--) {
-			struct global_callback_info *cb =
-				handler->global_callbacks.array + (i - 1);
+	current_frame = frame.prev;
 
-			if (cb->remove && !cb->signaling)
-				da_erase(handler->global_callbacks, i - 1);
-		}	
+	if (frame.remove_current) {
+		pthread_mutex_lock(&sig->mutex);
+		remove_refs = signal_info_purge_removed(sig);
+		pthread_mutex_unlock(&sig->mutex);
 	}
 
-	pthread_mutex_unlock(&handler->global_callbacks_mutex);
+	if (os_atomic_dec_long(&sig->emitting) == 0 &&
+	    os_atomic_load_bool(&sig->has_retired) &&
+	    pthread_mutex_trylock(&sig->mutex) == 0) {
+		signal_info_reclaim(sig);
+		pthread_mutex_unlock(&sig->mutex);
+	}
+
+	if (os_atomic_load_bool(&handler->has_global_callbacks))
+		signal_emit_global(handler, sig->func.name, params);
 
 	if (remove_refs) {
 		os_atomic_set_long(&handler->refs,
@@ -375,6 +553,28 @@ void signal_handler_signal(signal_handler_t *handler, const char *signal,
 	}
 }
 
+void signal_handler_signal(signal_handler_t *handler, const char *signal,
+		calldata_t *params)
+{
+	if (handler)
+		signal_handler_signal_id(handler,
+				getsignal(handler, signal, NULL), params);
+}
+
+static size_t find_global_callback(signal_handler_t *handler,
+		global_signal_callback_t callback, void *data)
+{
+	for (size_t i = 0; i < handler->global_callbacks.num; i++) {
+		struct global_callback_info *cb =
+			handler->global_callbacks.array + i;
+
+		if (cb->callback == callback && cb->data == data)
+			return i;
+	}
+
+	return DARRAY_INVALID;
+}
+
 void signal_handler_connect_global(signal_handler_t *handler,
 		global_signal_callback_t callback, void *data)
 {
@@ -386,9 +586,13 @@ void signal_handler_connect_global(signal_handler_t *handler,
 
 	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
+	idx = find_global_callback(handler, callback, data);
 	if (idx == DARRAY_INVALID)
 		da_push_back(handler->global_callbacks, &cb_data);
+	else
+		handler->global_callbacks.array[idx].remove = false;
+
+	os_atomic_set_bool(&handler->has_global_callbacks, true);
 
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
@@ -396,7 +600,6 @@ void signal_handler_connect_global(signal_handler_t *handler,
 void signal_handler_disconnect_global(signal_handler_t *handler,
 		global_signal_callback_t callback, void *data)
 {
-	struct global_callback_info cb_data = {callback, data, false};
 	size_t idx;
 
 	if (!handler || !callback)
@@ -404,7 +607,7 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 
 	pthread_mutex_lock(&handler->global_callbacks_mutex);
 
-	idx = da_find(handler->global_callbacks, &cb_data, 0);
+	idx = find_global_callback(handler, callback, data);
 	if (idx != DARRAY_INVALID) {
 		struct global_callback_info *cb =
 			handler->global_callbacks.array + idx;
@@ -415,5 +618,8 @@ void signal_handler_disconnect_global(signal_handler_t *handler,
 			da_erase(handler->global_callbacks, idx);
 	}
 
+	os_atomic_set_bool(&handler->has_global_callbacks,
+			handler->global_callbacks.num != 0);
+
 	pthread_mutex_unlock(&handler->global_callbacks_mutex);
 }
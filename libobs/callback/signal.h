@@ -33,6 +33,7 @@ extern "C" {
 
 struct signal_handler;
 typedef struct signal_handler signal_handler_t;
+typedef struct signal_info *signal_id_t;
 typedef void (*global_signal_callback_t)(void*, const char*, calldata_t*);
 typedef void (*signal_callback_t)(void*, calldata_t*);
 
@@ -56,6 +57,21 @@ static inline bool signal_handler_add_array(signal_handler_t *handler,
 	return success;
 }
 
+/**
+ * Resolves a signal name to an identifier that can be used to emit the signal
+ * without having to look it up by name each time.  The identifier stays valid
+ * for as long as the signal handler exists.  Returns NULL if the signal has
+ * not been declared.
+ */
+EXPORT signal_id_t signal_handler_get_id(signal_handler_t *handler,
+		const char *signal);
+
+/**
+ * Returns the declaration of a signal, which can be used to set its
+ * parameters by index (see calldata_set_decl_data).
+ */
+EXPORT const struct decl_info *signal_handler_get_decl(signal_id_t id);
+
 EXPORT void signal_handler_connect(signal_handler_t *handler,
 		const char *signal, signal_callback_t callback, void *data);
 EXPORT void signal_handler_connect_ref(signal_handler_t *handler,
@@ -72,6 +88,8 @@ EXPORT void signal_handler_remove_current(void);
 
 EXPORT void signal_handler_signal(signal_handler_t *handler, const char *signal,
 		calldata_t *params);
+EXPORT void signal_handler_signal_id(signal_handler_t *handler, signal_id_t id,
+		calldata_t *params);
 
 #ifdef __cplusplus
 }
@@ -142,6 +142,12 @@ EXPORT void device_frustum(gs_device_t *device, float left, float right,
 		float top, float bottom, float znear, float zfar);
 EXPORT void device_projection_push(gs_device_t *device);
 EXPORT void device_projection_pop(gs_device_t *device);
+EXPORT void device_projection_get(const gs_device_t *device,
+		struct matrix4 *dst);
+EXPORT void device_set_shader_cache_dir(gs_device_t *device,
+		const char *dir);
+EXPORT void *device_present_begin(gs_device_t *device);
+EXPORT bool device_present_end(gs_device_t *device, void *present);
 
 #ifdef __cplusplus
 }
@@ -1808,10 +1808,15 @@ static bool ep_compile(struct effect_parser *ep)
 
 	for (i = 0; i < ep->params.num; i++)
 		ep_compile_param(ep, i);
+
+	/* passes look up their params by name */
+	effect_build_param_table(ep->effect);
+
 	for (i = 0; i < ep->techniques.num; i++) {
 		if (!ep_compile_technique(ep, i))
 			success = false;
 	}
 
+	effect_build_technique_table(ep->effect);
 	return success;
 }
@@ -35,20 +35,119 @@ void gs_effect_destroy(gs_effect_t *effect)
 	}
 }
 
-gs_technique_t *gs_effect_get_technique(const gs_effect_t *effect,
-		const char *name)
+/* ------------------------------------------------------------------------- */
+/* name lookup tables */
+
+static inline uint32_t name_hash(const char *name)
 {
-	if (!effect) return NULL;
+	uint32_t hash = 2166136261U;
 
-	for (size_t i = 0; i < effect->techniques.num; i++) {
-		struct gs_effect_technique *tech = effect->techniques.array+i;
-		if (strcmp(tech->name, name) == 0)
-			return tech;
+	while (*name) {
+		hash ^= (uint8_t)*(name++);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* the name of both params and techniques is their first member */
+static inline const char *item_name(const void *array, size_t stride,
+		size_t idx)
+{
+	return *(char* const*)((const uint8_t*)array + stride * idx);
+}
+
+static void build_table(struct darray *table, const void *array,
+		size_t stride, size_t num)
+{
+	uint32_t *slots;
+	size_t size = 4;
+	size_t mask;
+
+	while (size < num * 2)
+		size *= 2;
+	mask = size - 1;
+
+	darray_resize(sizeof(uint32_t), table, size);
+	slots = table->array;
+	memset(slots, 0, sizeof(uint32_t) * size);
+
+	for (size_t i = 0; i < num; i++) {
+		const char *name = item_name(array, stride, i);
+		bool duplicate = false;
+		size_t slot;
+
+		if (!name)
+			continue;
+
+		slot = name_hash(name) & mask;
+
+		/* the first of any duplicate names is found, as before */
+		while (slots[slot]) {
+			const char *cur = item_name(array, stride,
+					slots[slot] - 1);
+			if (strcmp(cur, name) == 0) {
+				duplicate = true;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+
+		if (!duplicate)
+			slots[slot] = (uint32_t)i + 1;
+	}
+}
+
+static const void *table_find(const struct darray *table, const void *array,
+		size_t stride, const char *name)
+{
+	const uint32_t *slots = table->array;
+	size_t mask;
+	size_t slot;
+
+	if (!table->num || !name)
+		return NULL;
+
+	mask = table->num - 1;
+	slot = name_hash(name) & mask;
+
+	while (slots[slot]) {
+		size_t idx = slots[slot] - 1;
+
+		if (strcmp(item_name(array, stride, idx), name) == 0)
+			return (const uint8_t*)array + stride * idx;
+
+		slot = (slot + 1) & mask;
 	}
 
 	return NULL;
 }
 
+void effect_build_param_table(gs_effect_t *effect)
+{
+	build_table(&effect->param_table.da, effect->params.array,
+			sizeof(struct gs_effect_param), effect->params.num);
+}
+
+void effect_build_technique_table(gs_effect_t *effect)
+{
+	build_table(&effect->technique_table.da, effect->techniques.array,
+			sizeof(struct gs_effect_technique),
+			effect->techniques.num);
+}
+
+/* ------------------------------------------------------------------------- */
+
+gs_technique_t *gs_effect_get_technique(const gs_effect_t *effect,
+		const char *name)
+{
+	if (!effect) return NULL;
+
+	return (gs_technique_t*)table_find(&effect->technique_table.da,
+			effect->techniques.array,
+			sizeof(struct gs_effect_technique), name);
+}
+
 gs_technique_t *gs_effect_get_current_technique(const gs_effect_t *effect)
 {
 	if (!effect) return NULL;
@@ -100,6 +199,9 @@ size_t gs_technique_begin(gs_technique_t *tech)
 {
 	if (!tech) return 0;
 
+	/* batched sprites must be drawn before any other technique is used */
+	gs_sprite_batch_flush();
+
 	tech->effect->cur_technique = tech;
 	tech->effect->graphics->cur_effect = tech->effect;
 
@@ -274,16 +376,9 @@ gs_eparam_t *gs_effect_get_param_by_name(const gs_effect_t *effect,
 {
 	if (!effect) return NULL;
 
-	struct gs_effect_param *params = effect->params.array;
-
-	for (size_t i = 0; i < effect->params.num; i++) {
-		struct gs_effect_param *param = params+i;
-
-		if (strcmp(param->name, name) == 0)
-			return param;
-	}
-
-	return NULL;
+	return (gs_eparam_t*)table_find(&effect->param_table.da,
+			effect->params.array,
+			sizeof(struct gs_effect_param), name);
 }
 
 size_t gs_param_get_num_annotations(const gs_eparam_t *param)
@@ -363,6 +458,18 @@ void gs_effect_get_param_info(const gs_eparam_t *param,
 	info->type = param->type;
 }
 
+/* pending sprites are drawn with the params their effect has when they're
+ * flushed, and the flush resets those params afterwards, so the batch has to
+ * be drawn before any param of its effect changes */
+static inline void flush_batch_of(const gs_eparam_t *param)
+{
+	graphics_t *graphics = param->effect->graphics;
+
+	if (graphics && graphics->batch_count &&
+	    graphics->batch_effect == param->effect)
+		gs_sprite_batch_flush();
+}
+
 static inline void effect_setval_inline(gs_eparam_t *param,
 		const void *data, size_t size)
 {
@@ -378,6 +485,8 @@ static inline void effect_setval_inline(gs_eparam_t *param,
 		return;
 	}
 
+	flush_batch_of(param);
+
 	size_changed = param->cur_val.num != size;
 
 	if (size_changed)
@@ -481,6 +590,23 @@ void gs_effect_set_val(gs_eparam_t *param, const void *val, size_t size)
 	effect_setval_inline(param, val, size);
 }
 
+void gs_effect_set_params(const struct gs_effect_param_value *values,
+		size_t num)
+{
+	if (!values)
+		return;
+
+	for (size_t i = 0; i < num; i++) {
+		const struct gs_effect_param_value *value = values + i;
+
+		/* params missing from the effect are skipped, so that callers
+		 * can look them up unconditionally */
+		if (value->param)
+			effect_setval_inline(value->param, value->data,
+					value->size);
+	}
+}
+
 void *gs_effect_get_val(gs_eparam_t *param)
 {
 	if (!param) {
@@ -542,6 +668,8 @@ void gs_effect_set_next_sampler(gs_eparam_t *param, gs_samplerstate_t *sampler)
 		return;
 	}
 
-	if (param->type == GS_SHADER_PARAM_TEXTURE)
+	if (param->type == GS_SHADER_PARAM_TEXTURE) {
+		flush_batch_of(param);
 		param->next_sampler = sampler;
+	}
 }
@@ -155,6 +155,11 @@ struct gs_effect {
 	DARRAY(struct gs_effect_param) params;
 	DARRAY(struct gs_effect_technique) techniques;
 
+	/* open addressed hash tables of param/technique indices + 1, used to
+	 * look them up by name */
+	DARRAY(uint32_t) param_table;
+	DARRAY(uint32_t) technique_table;
+
 	struct gs_effect_technique *cur_technique;
 	struct gs_effect_pass *cur_pass;
 
@@ -182,6 +187,8 @@ static inline void effect_free(gs_effect_t *effect)
 
 	da_free(effect->params);
 	da_free(effect->techniques);
+	da_free(effect->param_table);
+	da_free(effect->technique_table);
 
 	bfree(effect->effect_path);
 	bfree(effect->effect_dir);
@@ -189,6 +196,9 @@ static inline void effect_free(gs_effect_t *effect)
 	effect->effect_dir = NULL;
 }
 
+extern void effect_build_param_table(gs_effect_t *effect);
+extern void effect_build_technique_table(gs_effect_t *effect);
+
 EXPORT void effect_upload_params(gs_effect_t *effect, bool changed_only);
 EXPORT void effect_upload_shader_params(gs_effect_t *effect,
 		gs_shader_t *shader, struct darray *pass_params,
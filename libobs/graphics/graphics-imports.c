@@ -106,6 +106,10 @@ bool load_graphics_imports(struct gs_exports *exports, void *module,
 	GRAPHICS_IMPORT(device_frustum);
 	GRAPHICS_IMPORT(device_projection_push);
 	GRAPHICS_IMPORT(device_projection_pop);
+	GRAPHICS_IMPORT_OPTIONAL(device_projection_get);
+	GRAPHICS_IMPORT_OPTIONAL(device_set_shader_cache_dir);
+	GRAPHICS_IMPORT_OPTIONAL(device_present_begin);
+	GRAPHICS_IMPORT_OPTIONAL(device_present_end);
 
 	GRAPHICS_IMPORT(gs_swapchain_destroy);
 
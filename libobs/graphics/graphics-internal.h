@@ -148,6 +148,12 @@ struct gs_exports {
 			float top, float bottom, float znear, float zfar);
 	void (*device_projection_push)(gs_device_t *device);
 	void (*device_projection_pop)(gs_device_t *device);
+	void (*device_projection_get)(const gs_device_t *device,
+			struct matrix4 *dst);
+	void (*device_set_shader_cache_dir)(gs_device_t *device,
+			const char *dir);
+	void *(*device_present_begin)(gs_device_t *device);
+	bool (*device_present_end)(gs_device_t *device, void *present);
 
 	void     (*gs_swapchain_destroy)(gs_swapchain_t *swapchain);
 
@@ -299,6 +305,12 @@ struct graphics_subsystem {
 
 	gs_vertbuffer_t        *sprite_buffer;
 
+	gs_vertbuffer_t        *batch_buffer;
+	size_t                 batch_count;
+	gs_effect_t            *batch_effect;
+	const char             *batch_technique;
+	gs_texture_t           *batch_texture;
+
 	bool                   using_immediate;
 	struct gs_vb_data      *vbd;
 	gs_vertbuffer_t        *immediate_vertbuffer;
@@ -140,6 +140,27 @@ static bool graphics_init_sprite_vb(struct graphics_subsystem *graphics)
 	return true;
 }
 
+static bool graphics_init_batch_vb(struct graphics_subsystem *graphics)
+{
+	struct gs_vb_data *vbd;
+	size_t num = GS_SPRITE_BATCH_MAX * 6;
+
+	vbd = gs_vbdata_create();
+	vbd->num     = num;
+	vbd->points  = bzalloc(sizeof(struct vec3) * num);
+	vbd->num_tex = 1;
+	vbd->tvarray = bmalloc(sizeof(struct gs_tvertarray));
+	vbd->tvarray[0].width = 2;
+	vbd->tvarray[0].array = bzalloc(sizeof(struct vec2) * num);
+
+	graphics->batch_buffer = graphics->exports.
+		device_vertexbuffer_create(graphics->device, vbd, GS_DYNAMIC);
+	if (!graphics->batch_buffer)
+		return false;
+
+	return true;
+}
+
 static bool graphics_init(struct graphics_subsystem *graphics)
 {
 	struct matrix4 top_mat;
@@ -153,6 +174,8 @@ static bool graphics_init(struct graphics_subsystem *graphics)
 		return false;
 	if (!graphics_init_sprite_vb(graphics))
 		return false;
+	if (!graphics_init_batch_vb(graphics))
+		return false;
 	if (pthread_mutex_init(&graphics->mutex, NULL) != 0)
 		return false;
 	if (pthread_mutex_init(&graphics->effect_mutex, NULL) != 0)
@@ -173,6 +196,14 @@ static bool graphics_init(struct graphics_subsystem *graphics)
 	return true;
 }
 
+static char *shader_cache_dir = NULL;
+
+void gs_set_shader_cache_dir(const char *dir)
+{
+	bfree(shader_cache_dir);
+	shader_cache_dir = dir ? bstrdup(dir) : NULL;
+}
+
 int gs_create(graphics_t **pgraphics, const char *module, uint32_t adapter)
 {
 	int errcode = GS_ERROR_FAIL;
@@ -195,6 +226,10 @@ int gs_create(graphics_t **pgraphics, const char *module, uint32_t adapter)
 	if (errcode != GS_SUCCESS)
 		goto error;
 
+	if (shader_cache_dir && graphics->exports.device_set_shader_cache_dir)
+		graphics->exports.device_set_shader_cache_dir(graphics->device,
+				shader_cache_dir);
+
 	if (!graphics_init(graphics)) {
 		errcode = GS_ERROR_FAIL;
 		goto error;
@@ -232,6 +267,8 @@ void gs_destroy(graphics_t *graphics)
 
 		graphics->exports.gs_vertexbuffer_destroy(
 				graphics->sprite_buffer);
+		graphics->exports.gs_vertexbuffer_destroy(
+				graphics->batch_buffer);
 		graphics->exports.gs_vertexbuffer_destroy(
 				graphics->immediate_vertbuffer);
 		graphics->exports.device_destroy(graphics->device);
@@ -1064,6 +1101,126 @@ void gs_draw_sprite_subregion(gs_texture_t *tex, uint32_t flip,
 	gs_draw(GS_TRISTRIP, 0, 0);
 }
 
+static inline void flush_sprite_batch(graphics_t *graphics)
+{
+	if (graphics->batch_count)
+		gs_sprite_batch_flush();
+}
+
+void gs_sprite_batch_draw(gs_effect_t *effect, const char *technique,
+		gs_texture_t *tex, uint32_t flip, uint32_t width,
+		uint32_t height)
+{
+	graphics_t *graphics = thread_graphics;
+	struct matrix4 *world;
+	struct gs_vb_data *data;
+	struct vec3 points[4];
+	struct vec2 uvs[4];
+	struct vec3 *out_points;
+	struct vec2 *out_uvs;
+	float start_u, end_u;
+	float start_v, end_v;
+	float fcx, fcy;
+
+	if (!gs_valid_p3("gs_sprite_batch_draw", effect, technique, tex))
+		return;
+	if (gs_get_texture_type(tex) != GS_TEXTURE_2D) {
+		blog(LOG_ERROR, "A sprite must be a 2D texture");
+		return;
+	}
+
+	if (graphics->batch_count) {
+		if (graphics->batch_count == GS_SPRITE_BATCH_MAX ||
+		    graphics->batch_effect != effect ||
+		    graphics->batch_texture != tex ||
+		    strcmp(graphics->batch_technique, technique) != 0)
+			gs_sprite_batch_flush();
+	}
+
+	graphics->batch_effect = effect;
+	graphics->batch_technique = technique;
+	graphics->batch_texture = tex;
+
+	fcx = width  ? (float)width  : (float)gs_texture_get_width(tex);
+	fcy = height ? (float)height : (float)gs_texture_get_height(tex);
+
+	if (gs_texture_is_rect(tex)) {
+		assign_sprite_rect(&start_u, &end_u,
+				(float)gs_texture_get_width(tex),
+				(flip & GS_FLIP_U) != 0);
+		assign_sprite_rect(&start_v, &end_v,
+				(float)gs_texture_get_height(tex),
+				(flip & GS_FLIP_V) != 0);
+	} else {
+		assign_sprite_uv(&start_u, &end_u, (flip & GS_FLIP_U) != 0);
+		assign_sprite_uv(&start_v, &end_v, (flip & GS_FLIP_V) != 0);
+	}
+
+	/* the current world matrix is applied here so that every sprite in
+	 * the batch can be drawn with the same one */
+	world = top_matrix(graphics);
+
+	vec3_set(&points[0], 0.0f, 0.0f, 0.0f);
+	vec3_set(&points[1],  fcx, 0.0f, 0.0f);
+	vec3_set(&points[2], 0.0f,  fcy, 0.0f);
+	vec3_set(&points[3],  fcx,  fcy, 0.0f);
+	vec2_set(&uvs[0], start_u, start_v);
+	vec2_set(&uvs[1], end_u,   start_v);
+	vec2_set(&uvs[2], start_u, end_v);
+	vec2_set(&uvs[3], end_u,   end_v);
+
+	for (size_t i = 0; i < 4; i++)
+		vec3_transform(&points[i], &points[i], world);
+
+	data = gs_vertexbuffer_get_data(graphics->batch_buffer);
+	out_points = data->points + graphics->batch_count * 6;
+	out_uvs = (struct vec2*)data->tvarray[0].array +
+		graphics->batch_count * 6;
+
+	/* two triangles: 0 1 2, 2 1 3 */
+	out_points[0] = points[0]; out_uvs[0] = uvs[0];
+	out_points[1] = points[1]; out_uvs[1] = uvs[1];
+	out_points[2] = points[2]; out_uvs[2] = uvs[2];
+	out_points[3] = points[2]; out_uvs[3] = uvs[2];
+	out_points[4] = points[1]; out_uvs[4] = uvs[1];
+	out_points[5] = points[3]; out_uvs[5] = uvs[3];
+
+	graphics->batch_count++;
+}
+
+void gs_sprite_batch_flush(void)
+{
+	graphics_t *graphics = thread_graphics;
+	gs_effect_t *effect;
+	gs_eparam_t *image;
+	uint32_t num_verts;
+
+	if (!gs_valid("gs_sprite_batch_flush"))
+		return;
+	if (!graphics->batch_count)
+		return;
+
+	/* cleared first, as beginning the technique flushes the batch */
+	num_verts = (uint32_t)graphics->batch_count * 6;
+	graphics->batch_count = 0;
+
+	effect = graphics->batch_effect;
+	image = gs_effect_get_param_by_name(effect, "image");
+	gs_effect_set_texture(image, graphics->batch_texture);
+
+	gs_matrix_push();
+	gs_matrix_identity();
+
+	gs_vertexbuffer_flush(graphics->batch_buffer);
+	gs_load_vertexbuffer(graphics->batch_buffer);
+	gs_load_indexbuffer(NULL);
+
+	while (gs_effect_loop(effect, graphics->batch_technique))
+		gs_draw(GS_TRIS, 0, num_verts);
+
+	gs_matrix_pop();
+}
+
 void gs_draw_cube_backdrop(gs_texture_t *cubetex, const struct quat *rot,
 		float left, float right, float top, float bottom, float znear)
 {
@@ -1660,6 +1817,8 @@ void gs_set_render_target(gs_texture_t *tex, gs_zstencil_t *zstencil)
 	if (!gs_valid("gs_set_render_target"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_set_render_target(graphics->device, tex,
 			zstencil);
 }
@@ -1672,6 +1831,8 @@ void gs_set_cube_render_target(gs_texture_t *cubetex, int side,
 	if (!gs_valid("gs_set_cube_render_target"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_set_cube_render_target(graphics->device,
 			cubetex, side, zstencil);
 }
@@ -1683,6 +1844,8 @@ void gs_copy_texture(gs_texture_t *dst, gs_texture_t *src)
 	if (!gs_valid_p2("gs_copy_texture", dst, src))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_copy_texture(graphics->device, dst, src);
 }
 
@@ -1695,6 +1858,8 @@ void gs_copy_texture_region(gs_texture_t *dst, uint32_t dst_x, uint32_t dst_y,
 	if (!gs_valid_p("gs_copy_texture_region", dst))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_copy_texture_region(graphics->device,
 			dst, dst_x, dst_y,
 			src, src_x, src_y, src_w, src_h);
@@ -1707,6 +1872,8 @@ void gs_stage_texture(gs_stagesurf_t *dst, gs_texture_t *src)
 	if (!gs_valid("gs_stage_texture"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_stage_texture(graphics->device, dst, src);
 }
 
@@ -1728,6 +1895,8 @@ void gs_draw(enum gs_draw_mode draw_mode, uint32_t start_vert,
 	if (!gs_valid("gs_draw"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_draw(graphics->device, draw_mode,
 			start_vert, num_verts);
 }
@@ -1739,6 +1908,8 @@ void gs_end_scene(void)
 	if (!gs_valid("gs_end_scene"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_end_scene(graphics->device);
 }
 
@@ -1760,6 +1931,8 @@ void gs_clear(uint32_t clear_flags, const struct vec4 *color, float depth,
 	if (!gs_valid("gs_clear"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_clear(graphics->device, clear_flags, color,
 			depth, stencil);
 }
@@ -1771,7 +1944,47 @@ void gs_present(void)
 	if (!gs_valid("gs_present"))
 		return;
 
+	flush_sprite_batch(graphics);
+
+	graphics->exports.device_present(graphics->device);
+}
+
+void *gs_present_begin(void)
+{
+	graphics_t *graphics = thread_graphics;
+	void *present;
+
+	if (!gs_valid("gs_present_begin"))
+		return NULL;
+
+	flush_sprite_batch(graphics);
+
+	if (graphics->exports.device_present_begin &&
+	    graphics->exports.device_present_end) {
+		present = graphics->exports.device_present_begin(
+				graphics->device);
+		if (present)
+			return present;
+	}
+
 	graphics->exports.device_present(graphics->device);
+	return NULL;
+}
+
+void gs_present_end(graphics_t *graphics, gs_swapchain_t *swapchain,
+		void *present)
+{
+	if (!graphics || !present)
+		return;
+
+	/* if the device was lost, present again with the context so that the
+	 * subsystem can recover */
+	if (!graphics->exports.device_present_end(graphics->device, present)) {
+		gs_enter_context(graphics);
+		gs_load_swapchain(swapchain);
+		graphics->exports.device_present(graphics->device);
+		gs_leave_context();
+	}
 }
 
 void gs_flush(void)
@@ -1781,6 +1994,8 @@ void gs_flush(void)
 	if (!gs_valid("gs_flush"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_flush(graphics->device);
 }
 
@@ -1791,6 +2006,8 @@ void gs_set_cull_mode(enum gs_cull_mode mode)
 	if (!gs_valid("gs_set_cull_mode"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_set_cull_mode(graphics->device, mode);
 }
 
@@ -1811,6 +2028,8 @@ void gs_enable_blending(bool enable)
 	if (!gs_valid("gs_enable_blending"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->cur_blend_state.enabled = enable;
 	graphics->exports.device_enable_blending(graphics->device, enable);
 }
@@ -1852,6 +2071,8 @@ void gs_enable_color(bool red, bool green, bool blue, bool alpha)
 	if (!gs_valid("gs_enable_color"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_enable_color(graphics->device, red, green,
 			blue, alpha);
 }
@@ -1863,6 +2084,8 @@ void gs_blend_function(enum gs_blend_type src, enum gs_blend_type dest)
 	if (!gs_valid("gs_blend_function"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->cur_blend_state.src_c  = src;
 	graphics->cur_blend_state.dest_c = dest;
 	graphics->cur_blend_state.src_a  = src;
@@ -1879,6 +2102,8 @@ void gs_blend_function_separate(
 	if (!gs_valid("gs_blend_function_separate"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->cur_blend_state.src_c  = src_c;
 	graphics->cur_blend_state.dest_c = dest_c;
 	graphics->cur_blend_state.src_a  = src_a;
@@ -1926,6 +2151,8 @@ void gs_set_viewport(int x, int y, int width, int height)
 	if (!gs_valid("gs_set_viewport"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_set_viewport(graphics->device, x, y, width,
 			height);
 }
@@ -1947,6 +2174,8 @@ void gs_set_scissor_rect(const struct gs_rect *rect)
 	if (!gs_valid("gs_set_scissor_rect"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_set_scissor_rect(graphics->device, rect);
 }
 
@@ -1958,6 +2187,8 @@ void gs_ortho(float left, float right, float top, float bottom, float znear,
 	if (!gs_valid("gs_ortho"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_ortho(graphics->device, left, right, top,
 			bottom, znear, zfar);
 }
@@ -1970,6 +2201,8 @@ void gs_frustum(float left, float right, float top, float bottom, float znear,
 	if (!gs_valid("gs_frustum"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_frustum(graphics->device, left, right, top,
 			bottom, znear, zfar);
 }
@@ -1991,9 +2224,24 @@ void gs_projection_pop(void)
 	if (!gs_valid("gs_projection_pop"))
 		return;
 
+	flush_sprite_batch(graphics);
+
 	graphics->exports.device_projection_pop(graphics->device);
 }
 
+bool gs_projection_get(struct matrix4 *dst)
+{
+	graphics_t *graphics = thread_graphics;
+
+	if (!gs_valid_p("gs_projection_get", dst))
+		return false;
+	if (!graphics->exports.device_projection_get)
+		return false;
+
+	graphics->exports.device_projection_get(graphics->device, dst);
+	return true;
+}
+
 void gs_swapchain_destroy(gs_swapchain_t *swapchain)
 {
 	graphics_t *graphics = thread_graphics;
@@ -2208,6 +2456,11 @@ void gs_texture_destroy(gs_texture_t *tex)
 	if (!tex)
 		return;
 
+	if (graphics->batch_texture == tex) {
+		flush_sprite_batch(graphics);
+		graphics->batch_texture = NULL;
+	}
+
 	graphics->exports.gs_texture_destroy(tex);
 }
 
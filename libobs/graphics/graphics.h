@@ -412,6 +412,23 @@ EXPORT void gs_effect_set_vec3(gs_eparam_t *param, const struct vec3 *val);
 EXPORT void gs_effect_set_vec4(gs_eparam_t *param, const struct vec4 *val);
 EXPORT void gs_effect_set_texture(gs_eparam_t *param, gs_texture_t *val);
 EXPORT void gs_effect_set_val(gs_eparam_t *param, const void *val, size_t size);
+
+struct gs_effect_param_value {
+	gs_eparam_t *param;
+	const void  *data;
+	size_t      size;
+};
+
+/**
+ * Sets a block of parameter values at once
+ *
+ *   Values are only marked as changed if they differ from the current ones,
+ * and all changed values are uploaded together when the next pass begins or
+ * when gs_effect_update_params is called.  Values with a NULL param are
+ * skipped.
+ */
+EXPORT void gs_effect_set_params(const struct gs_effect_param_value *values,
+		size_t num);
 EXPORT void gs_effect_set_default(gs_eparam_t *param);
 EXPORT size_t gs_effect_get_val_size(gs_eparam_t *param);
 EXPORT void *gs_effect_get_val(gs_eparam_t *param);
@@ -486,6 +503,12 @@ EXPORT void gs_enum_adapters(
 		bool (*callback)(void *param, const char *name, uint32_t id),
 		void *param);
 
+/**
+ * Sets the directory that compiled shaders are cached in by graphics
+ * subsystems created after this call, or NULL to disable the cache
+ */
+EXPORT void gs_set_shader_cache_dir(const char *dir);
+
 EXPORT int gs_create(graphics_t **graphics, const char *module,
 		uint32_t adapter);
 EXPORT void gs_destroy(graphics_t *graphics);
@@ -556,6 +579,25 @@ EXPORT void gs_draw_sprite(gs_texture_t *tex, uint32_t flip, uint32_t width,
 EXPORT void gs_draw_sprite_subregion(gs_texture_t *tex, uint32_t flip,
 		uint32_t x, uint32_t y, uint32_t cx, uint32_t cy);
 
+#define GS_SPRITE_BATCH_MAX 256
+
+/**
+ * Queues a 2D sprite to be drawn with other sprites in a single draw call
+ *
+ *   Sprites are transformed by the current matrix when queued, and drawn
+ * together once a sprite with a different effect, technique or texture is
+ * queued, or when any draw, render target, viewport, projection or blend
+ * state is changed.  The technique string must stay valid until then, and
+ * only the "image" parameter of the effect is set for the draw.  Must not be
+ * called while a technique of an effect is active.
+ */
+EXPORT void gs_sprite_batch_draw(gs_effect_t *effect, const char *technique,
+		gs_texture_t *tex, uint32_t flip, uint32_t width,
+		uint32_t height);
+
+/** Draws all queued batched sprites */
+EXPORT void gs_sprite_batch_flush(void);
+
 EXPORT void gs_draw_cube_backdrop(gs_texture_t *cubetex, const struct quat *rot,
 		float left, float right, float top, float bottom, float znear);
 
@@ -663,6 +705,16 @@ EXPORT void gs_clear(uint32_t clear_flags, const struct vec4 *color,
 EXPORT void gs_present(void);
 EXPORT void gs_flush(void);
 
+/**
+ * Presents the current swap chain in two steps, so that the graphics context
+ * doesn't have to be held while presenting.  gs_present_begin is called with
+ * the context, and gs_present_end after leaving it.  Subsystems that can only
+ * present with the context present in gs_present_begin instead.
+ */
+EXPORT void *gs_present_begin(void);
+EXPORT void gs_present_end(graphics_t *graphics, gs_swapchain_t *swapchain,
+		void *present);
+
 EXPORT void gs_set_cull_mode(enum gs_cull_mode mode);
 EXPORT enum gs_cull_mode gs_get_cull_mode(void);
 
@@ -697,6 +749,9 @@ EXPORT void gs_frustum(float left, float right, float top, float bottom,
 EXPORT void gs_projection_push(void);
 EXPORT void gs_projection_pop(void);
 
+/** Gets the current projection matrix, returns false if unsupported */
+EXPORT bool gs_projection_get(struct matrix4 *dst);
+
 EXPORT void     gs_swapchain_destroy(gs_swapchain_t *swapchain);
 
 EXPORT void     gs_texture_destroy(gs_texture_t *tex);
@@ -16,8 +16,18 @@
 ******************************************************************************/
 
 #include "format-conversion.h"
+#include "../util/threading.h"
+#include "../util/bmem.h"
 #include <xmmintrin.h>
 #include <emmintrin.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_FUNC
+#else
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
 
 /* ...surprisingly, if I don't use a macro to force inlining, it causes the
  * CPU usage to boost by a tremendous amount in debug builds. */
@@ -89,7 +99,139 @@ static FORCE_INLINE uint32_t min_uint32(uint32_t a, uint32_t b)
 	return a < b ? a : b;
 }
 
-void compress_uyvx_to_i420(
+/* width in pixels of the rows being converted */
+static FORCE_INLINE uint32_t conversion_width(uint32_t in_linesize,
+		const uint32_t out_linesize[])
+{
+	return min_uint32(in_linesize / 4, out_linesize[0]);
+}
+
+/* ------------------------------------------------------------------------- */
+/* scalar conversion of columns x to width of row y, and of row y + 1 if
+ * two_rows is set.  these also convert what is left over at the right and
+ * bottom edges by the SIMD variants.  like the planes of video_frame_init,
+ * the chroma of a frame with an odd width or height only covers the whole
+ * 2x2 blocks, and x must be even. */
+
+static void i420_rows_c(const uint8_t *input, uint32_t in_linesize,
+		uint32_t y, bool two_rows, uint32_t x, uint32_t width,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	const uint8_t *line1 = input + y * in_linesize;
+	const uint8_t *line2 = line1 + in_linesize;
+	uint8_t *lum1 = output[0] + y * out_linesize[0];
+	uint8_t *lum2 = lum1 + out_linesize[0];
+	uint8_t *u_plane = output[1] + (y>>1) * out_linesize[1];
+	uint8_t *v_plane = output[2] + (y>>1) * out_linesize[1];
+
+	for (uint32_t i = x; i < width; i++) {
+		lum1[i] = line1[i*4 + 1];
+		if (two_rows)
+			lum2[i] = line2[i*4 + 1];
+	}
+
+	if (!two_rows)
+		return;
+
+	for (uint32_t i = x; i + 1 < width; i += 2) {
+		const uint8_t *px1 = line1 + i*4;
+		const uint8_t *px2 = line2 + i*4;
+
+		u_plane[i>>1] = (uint8_t)((px1[0] + px1[4] +
+					px2[0] + px2[4]) >> 2);
+		v_plane[i>>1] = (uint8_t)((px1[2] + px1[6] +
+					px2[2] + px2[6]) >> 2);
+	}
+}
+
+static void nv12_rows_c(const uint8_t *input, uint32_t in_linesize,
+		uint32_t y, bool two_rows, uint32_t x, uint32_t width,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	const uint8_t *line1 = input + y * in_linesize;
+	const uint8_t *line2 = line1 + in_linesize;
+	uint8_t *lum1 = output[0] + y * out_linesize[0];
+	uint8_t *lum2 = lum1 + out_linesize[0];
+	uint8_t *chroma_plane = output[1] + (y>>1) * out_linesize[1];
+
+	for (uint32_t i = x; i < width; i++) {
+		lum1[i] = line1[i*4 + 1];
+		if (two_rows)
+			lum2[i] = line2[i*4 + 1];
+	}
+
+	if (!two_rows)
+		return;
+
+	for (uint32_t i = x; i + 1 < width; i += 2) {
+		const uint8_t *px1 = line1 + i*4;
+		const uint8_t *px2 = line2 + i*4;
+
+		chroma_plane[i]   = (uint8_t)((px1[0] + px1[4] +
+					px2[0] + px2[4]) >> 2);
+		chroma_plane[i+1] = (uint8_t)((px1[2] + px1[6] +
+					px2[2] + px2[6]) >> 2);
+	}
+}
+
+static void i444_rows_c(const uint8_t *input, uint32_t in_linesize,
+		uint32_t y, bool two_rows, uint32_t x, uint32_t width,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t rows = two_rows ? 2 : 1;
+
+	for (uint32_t row = 0; row < rows; row++) {
+		const uint8_t *line = input + (y + row) * in_linesize;
+		uint32_t pos = (y + row) * out_linesize[0];
+
+		for (uint32_t i = x; i < width; i++) {
+			output[0][pos + i] = line[i*4 + 1];
+			output[1][pos + i] = line[i*4];
+			output[2][pos + i] = line[i*4 + 2];
+		}
+	}
+}
+
+static void compress_uyvx_to_i420_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = conversion_width(in_linesize, out_linesize);
+
+	for (uint32_t y = start_y; y < end_y; y += 2)
+		i420_rows_c(input, in_linesize, y, y + 1 < end_y, 0, width,
+				output, out_linesize);
+}
+
+static void compress_uyvx_to_nv12_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = conversion_width(in_linesize, out_linesize);
+
+	for (uint32_t y = start_y; y < end_y; y += 2)
+		nv12_rows_c(input, in_linesize, y, y + 1 < end_y, 0, width,
+				output, out_linesize);
+}
+
+static void convert_uyvx_to_i444_c(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint32_t width = conversion_width(in_linesize, out_linesize);
+
+	for (uint32_t y = start_y; y < end_y; y += 2)
+		i444_rows_c(input, in_linesize, y, y + 1 < end_y, 0, width,
+				output, out_linesize);
+}
+
+/* ------------------------------------------------------------------------- */
+/* SSE2 variants, which process four pixels of two lines at a time */
+
+static void compress_uyvx_to_i420_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -97,25 +239,25 @@ void compress_uyvx_to_i420(
 	uint8_t  *lum_plane   = output[0];
 	uint8_t  *u_plane     = output[1];
 	uint8_t  *v_plane     = output[2];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i uv_mask  = _mm_set1_epi16(0x00FF);
 
-	for (y = start_y; y < end_y; y += 2) {
+	for (y = start_y; y + 1 < end_y; y += 2) {
 		uint32_t y_pos        = y      * in_linesize;
 		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -124,35 +266,42 @@ void compress_uyvx_to_i420(
 					chroma_y_pos + (x>>1),
 					line1, line2, uv_mask);
 		}
+
+		i420_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
 	}
+
+	if (y < end_y)
+		i420_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
 }
 
-void compress_uyvx_to_nv12(
+static void compress_uyvx_to_nv12_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
 {
 	uint8_t *lum_plane    = output[0];
 	uint8_t *chroma_plane = output[1];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i uv_mask  = _mm_set1_epi16(0x00FF);
 
-	for (y = start_y; y < end_y; y += 2) {
+	for (y = start_y; y + 1 < end_y; y += 2) {
 		uint32_t y_pos        = y      * in_linesize;
 		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -160,10 +309,17 @@ void compress_uyvx_to_nv12(
 			pack_ch_1plane(chroma_plane, chroma_y_pos + x,
 					line1, line2, uv_mask);
 		}
+
+		nv12_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
 	}
+
+	if (y < end_y)
+		nv12_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
 }
 
-void convert_uyvx_to_i444(
+static void convert_uyvx_to_i444_sse2(
 		const uint8_t *input, uint32_t in_linesize,
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[])
@@ -171,25 +327,25 @@ void convert_uyvx_to_i444(
 	uint8_t  *lum_plane   = output[0];
 	uint8_t  *u_plane     = output[1];
 	uint8_t  *v_plane     = output[2];
-	uint32_t width        = min_uint32(in_linesize, out_linesize[0]);
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
 	uint32_t y;
 
 	__m128i lum_mask = _mm_set1_epi32(0x0000FF00);
 	__m128i u_mask   = _mm_set1_epi32(0x000000FF);
 	__m128i v_mask   = _mm_set1_epi32(0x00FF0000);
 
-	for (y = start_y; y < end_y; y += 2) {
+	for (y = start_y; y + 1 < end_y; y += 2) {
 		uint32_t y_pos        = y      * in_linesize;
 		uint32_t lum_y_pos    = y      * out_linesize[0];
 		uint32_t x;
 
-		for (x = 0; x < width; x += 4) {
+		for (x = 0; x + 4 <= width; x += 4) {
 			const uint8_t *img = input + y_pos + x*4;
 			uint32_t lum_pos0  = lum_y_pos + x;
 			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
 
-			__m128i line1 = _mm_load_si128((const __m128i*)img);
-			__m128i line2 = _mm_load_si128(
+			__m128i line1 = _mm_loadu_si128((const __m128i*)img);
+			__m128i line2 = _mm_loadu_si128(
 					(const __m128i*)(img + in_linesize));
 
 			pack_shift(lum_plane, lum_pos0, lum_pos1,
@@ -199,6 +355,303 @@ void convert_uyvx_to_i444(
 			pack_shift(v_plane, lum_pos0, lum_pos1,
 					line1, line2, v_mask, 2);
 		}
+
+		i444_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
+	}
+
+	if (y < end_y)
+		i444_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
+}
+
+/* ------------------------------------------------------------------------- */
+/* AVX2 variants, which process eight pixels of two lines at a time */
+
+/* the 256-bit pack instructions work per 128-bit lane, this puts the first
+ * dword of each lane next to each other */
+#define avx2_lane_order() _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)
+
+#define avx2_pack_plane(plane, pos0, pos1, line1, line2, mask, sh)            \
+do {                                                                          \
+	__m128i pack_lo;                                                      \
+	__m256i pack_val = _mm256_packs_epi32(                                \
+			_mm256_and_si256(_mm256_srli_epi32(line1, sh), mask), \
+			_mm256_and_si256(_mm256_srli_epi32(line2, sh), mask));\
+	pack_val = _mm256_packus_epi16(pack_val, pack_val);                   \
+	pack_val = _mm256_permutevar8x32_epi32(pack_val, avx2_lane_order());  \
+	pack_lo = _mm256_castsi256_si128(pack_val);                           \
+                                                                              \
+	_mm_storel_epi64((__m128i*)(plane+pos0), pack_lo);                    \
+	_mm_storel_epi64((__m128i*)(plane+pos1), _mm_srli_si128(pack_lo, 8)); \
+} while (false)
+
+/* averages each 2x2 block, resulting in U0 U1 U2 U3 V0 V1 V2 V3 ordered by
+ * chroma_order */
+#define avx2_avg_chroma(out, line1, line2, mask, chroma_order)                \
+do {                                                                          \
+	__m256i u_sum = _mm256_add_epi32(                                     \
+			_mm256_and_si256(line1, mask),                        \
+			_mm256_and_si256(line2, mask));                       \
+	__m256i v_sum = _mm256_add_epi32(                                     \
+			_mm256_and_si256(_mm256_srli_epi32(line1, 16), mask), \
+			_mm256_and_si256(_mm256_srli_epi32(line2, 16), mask));\
+	__m256i avg_val = _mm256_srli_epi32(                                  \
+			_mm256_hadd_epi32(u_sum, v_sum), 2);                  \
+	avg_val = _mm256_packs_epi32(avg_val, avg_val);                       \
+	avg_val = _mm256_packus_epi16(avg_val, avg_val);                      \
+	avg_val = _mm256_permutevar8x32_epi32(avg_val, avx2_lane_order());    \
+	out = _mm_shuffle_epi8(_mm256_castsi256_si128(avg_val), chroma_order);\
+} while (false)
+
+static AVX2_FUNC void compress_uyvx_to_i420_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
+	uint32_t y;
+
+	__m256i byte_mask    = _mm256_set1_epi32(0x000000FF);
+	__m128i chroma_order = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7,
+			8, 9, 12, 13, 10, 11, 14, 15);
+
+	for (y = start_y; y + 1 < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x*4;
+			uint32_t lum_pos0  = lum_y_pos + x;
+			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
+			uint32_t chroma_pos = chroma_y_pos + (x>>1);
+			__m128i chroma;
+
+			__m256i line1 = _mm256_loadu_si256((const __m256i*)img);
+			__m256i line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			avx2_pack_plane(lum_plane, lum_pos0, lum_pos1,
+					line1, line2, byte_mask, 8);
+			avx2_avg_chroma(chroma, line1, line2, byte_mask,
+					chroma_order);
+
+			*(uint32_t*)(u_plane+chroma_pos) =
+				(uint32_t)_mm_cvtsi128_si32(chroma);
+			*(uint32_t*)(v_plane+chroma_pos) =
+				(uint32_t)_mm_cvtsi128_si32(
+						_mm_srli_si128(chroma, 4));
+		}
+
+		i420_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
+	}
+
+	if (y < end_y)
+		i420_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
+}
+
+static AVX2_FUNC void compress_uyvx_to_nv12_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t *lum_plane    = output[0];
+	uint8_t *chroma_plane = output[1];
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
+	uint32_t y;
+
+	__m256i byte_mask    = _mm256_set1_epi32(0x000000FF);
+	__m128i chroma_order = _mm_setr_epi8(0, 2, 1, 3, 4, 6, 5, 7,
+			8, 10, 9, 11, 12, 14, 13, 15);
+
+	for (y = start_y; y + 1 < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t chroma_y_pos = (y>>1) * out_linesize[1];
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x*4;
+			uint32_t lum_pos0  = lum_y_pos + x;
+			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
+			__m128i chroma;
+
+			__m256i line1 = _mm256_loadu_si256((const __m256i*)img);
+			__m256i line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			avx2_pack_plane(lum_plane, lum_pos0, lum_pos1,
+					line1, line2, byte_mask, 8);
+			avx2_avg_chroma(chroma, line1, line2, byte_mask,
+					chroma_order);
+
+			_mm_storel_epi64((__m128i*)(chroma_plane +
+						chroma_y_pos + x), chroma);
+		}
+
+		nv12_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
+	}
+
+	if (y < end_y)
+		nv12_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
+}
+
+static AVX2_FUNC void convert_uyvx_to_i444_avx2(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	uint8_t  *lum_plane   = output[0];
+	uint8_t  *u_plane     = output[1];
+	uint8_t  *v_plane     = output[2];
+	uint32_t width        = conversion_width(in_linesize, out_linesize);
+	uint32_t y;
+
+	__m256i byte_mask = _mm256_set1_epi32(0x000000FF);
+
+	for (y = start_y; y + 1 < end_y; y += 2) {
+		uint32_t y_pos        = y      * in_linesize;
+		uint32_t lum_y_pos    = y      * out_linesize[0];
+		uint32_t x;
+
+		for (x = 0; x + 8 <= width; x += 8) {
+			const uint8_t *img = input + y_pos + x*4;
+			uint32_t lum_pos0  = lum_y_pos + x;
+			uint32_t lum_pos1  = lum_pos0 + out_linesize[0];
+
+			__m256i line1 = _mm256_loadu_si256((const __m256i*)img);
+			__m256i line2 = _mm256_loadu_si256(
+					(const __m256i*)(img + in_linesize));
+
+			avx2_pack_plane(lum_plane, lum_pos0, lum_pos1,
+					line1, line2, byte_mask, 8);
+			avx2_pack_plane(u_plane, lum_pos0, lum_pos1,
+					line1, line2, byte_mask, 0);
+			avx2_pack_plane(v_plane, lum_pos0, lum_pos1,
+					line1, line2, byte_mask, 16);
+		}
+
+		i444_rows_c(input, in_linesize, y, true, x, width,
+				output, out_linesize);
+	}
+
+	if (y < end_y)
+		i444_rows_c(input, in_linesize, y, false, 0, width,
+				output, out_linesize);
+}
+
+static bool detect_avx2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	/* the OS must save the YMM registers as well */
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static volatile enum format_conversion_isa conversion_isa =
+	FORMAT_CONVERSION_ISA_AUTO;
+
+static inline enum format_conversion_isa get_conversion_isa(void)
+{
+	if (conversion_isa == FORMAT_CONVERSION_ISA_AUTO)
+		conversion_isa = detect_avx2() ?
+			FORMAT_CONVERSION_ISA_AVX2 : FORMAT_CONVERSION_ISA_SSE2;
+	return conversion_isa;
+}
+
+bool format_conversion_set_isa(enum format_conversion_isa isa)
+{
+	if (isa == FORMAT_CONVERSION_ISA_AVX2 && !detect_avx2())
+		return false;
+
+	conversion_isa = isa;
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void compress_uyvx_to_i420(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	switch (get_conversion_isa()) {
+	case FORMAT_CONVERSION_ISA_AVX2:
+		compress_uyvx_to_i420_avx2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	case FORMAT_CONVERSION_ISA_SSE2:
+		compress_uyvx_to_i420_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	default:
+		compress_uyvx_to_i420_c(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+	}
+}
+
+void compress_uyvx_to_nv12(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	switch (get_conversion_isa()) {
+	case FORMAT_CONVERSION_ISA_AVX2:
+		compress_uyvx_to_nv12_avx2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	case FORMAT_CONVERSION_ISA_SSE2:
+		compress_uyvx_to_nv12_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	default:
+		compress_uyvx_to_nv12_c(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+	}
+}
+
+void convert_uyvx_to_i444(
+		const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[])
+{
+	switch (get_conversion_isa()) {
+	case FORMAT_CONVERSION_ISA_AVX2:
+		convert_uyvx_to_i444_avx2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	case FORMAT_CONVERSION_ISA_SSE2:
+		convert_uyvx_to_i444_sse2(input, in_linesize, start_y, end_y,
+				output, out_linesize);
+		break;
+	default:
+		convert_uyvx_to_i444_c(input, in_linesize, start_y, end_y,
+				output, out_linesize);
 	}
 }
 
@@ -322,3 +775,135 @@ void decompress_422(
 		}
 	}
 }
+
+/* ------------------------------------------------------------------------- */
+/* Stripe-parallel conversion
+ *
+ *   Frames are split in to row stripes that are converted by a small pool of
+ * persistent threads.  The calling thread converts stripes as well instead
+ * of sitting idle, and stripes are handed out dynamically so that a
+ * descheduled worker doesn't stall the frame. */
+
+struct format_conversion_pool {
+	pthread_t                *threads;
+	size_t                   num_threads;
+	uint32_t                 num_stripes;
+	os_sem_t                 *start;
+	os_sem_t                 *done;
+	volatile bool            stop;
+
+	volatile long            next_stripe;
+	uint32_t                 height;
+	format_conversion_rows_t convert;
+	void                     *param;
+};
+
+static inline uint32_t stripe_row(uint32_t height, uint32_t stripe,
+		uint32_t num_stripes)
+{
+	/* the conversion functions work on two rows at a time */
+	if (stripe == num_stripes)
+		return height;
+	return (uint32_t)((uint64_t)height * stripe / num_stripes) & ~1U;
+}
+
+static void convert_stripes(struct format_conversion_pool *pool)
+{
+	uint32_t num = pool->num_stripes;
+	long stripe;
+
+	while ((stripe = os_atomic_inc_long(&pool->next_stripe) - 1)
+			< (long)num) {
+		uint32_t start_y = stripe_row(pool->height, (uint32_t)stripe,
+				num);
+		uint32_t end_y = stripe_row(pool->height,
+				(uint32_t)stripe + 1, num);
+
+		if (start_y < end_y)
+			pool->convert(pool->param, start_y, end_y);
+	}
+}
+
+static void *convert_thread(void *param)
+{
+	struct format_conversion_pool *pool = param;
+
+	os_set_thread_name("obs video convert thread");
+
+	while (os_sem_wait(pool->start) == 0) {
+		if (os_atomic_load_bool(&pool->stop))
+			break;
+
+		convert_stripes(pool);
+		os_sem_post(pool->done);
+	}
+
+	return NULL;
+}
+
+struct format_conversion_pool *format_conversion_pool_create(
+		size_t num_threads)
+{
+	struct format_conversion_pool *pool;
+
+	if (!num_threads)
+		return NULL;
+
+	pool = bzalloc(sizeof(*pool));
+	pool->threads = bzalloc(sizeof(pthread_t) * num_threads);
+
+	if (os_sem_init(&pool->start, 0) != 0)
+		goto fail;
+	if (os_sem_init(&pool->done, 0) != 0)
+		goto fail;
+
+	for (size_t i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, convert_thread,
+					pool) != 0)
+			goto fail;
+		pool->num_threads++;
+	}
+
+	/* more stripes than threads to balance out uneven scheduling */
+	pool->num_stripes = (uint32_t)(pool->num_threads + 1) * 2;
+	return pool;
+
+fail:
+	format_conversion_pool_destroy(pool);
+	return NULL;
+}
+
+void format_conversion_pool_destroy(struct format_conversion_pool *pool)
+{
+	if (!pool)
+		return;
+
+	os_atomic_set_bool(&pool->stop, true);
+
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_post(pool->start);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	os_sem_destroy(pool->start);
+	os_sem_destroy(pool->done);
+	bfree(pool->threads);
+	bfree(pool);
+}
+
+void format_conversion_pool_run(struct format_conversion_pool *pool,
+		uint32_t height, format_conversion_rows_t convert, void *param)
+{
+	pool->height  = height;
+	pool->convert = convert;
+	pool->param   = param;
+	os_atomic_set_long(&pool->next_stripe, 0);
+
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_post(pool->start);
+
+	convert_stripes(pool);
+
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_wait(pool->done);
+}
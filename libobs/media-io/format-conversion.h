@@ -42,6 +42,19 @@ EXPORT void convert_uyvx_to_i444(
 		uint32_t start_y, uint32_t end_y,
 		uint8_t *output[], const uint32_t out_linesize[]);
 
+/* instruction sets the conversions to packed 444 YUV above can use.  The
+ * best one the CPU supports is used unless another one is set, which is only
+ * meant for comparing the variants with each other. */
+enum format_conversion_isa {
+	FORMAT_CONVERSION_ISA_AUTO,
+	FORMAT_CONVERSION_ISA_SCALAR,
+	FORMAT_CONVERSION_ISA_SSE2,
+	FORMAT_CONVERSION_ISA_AVX2,
+};
+
+/* returns false if the CPU doesn't support the instruction set */
+EXPORT bool format_conversion_set_isa(enum format_conversion_isa isa);
+
 EXPORT void decompress_nv12(
 		const uint8_t *const input[], const uint32_t in_linesize[],
 		uint32_t start_y, uint32_t end_y,
@@ -58,6 +71,26 @@ EXPORT void decompress_422(
 		uint8_t *output, uint32_t out_linesize,
 		bool leading_lum);
 
+/*
+ * Pool of threads that convert a frame in row stripes.  The rows function is
+ * called with an even start_y for each stripe, from the pool's threads and
+ * from the thread that runs the pool.
+ */
+
+struct format_conversion_pool;
+
+typedef void (*format_conversion_rows_t)(void *param,
+		uint32_t start_y, uint32_t end_y);
+
+EXPORT struct format_conversion_pool *format_conversion_pool_create(
+		size_t num_threads);
+EXPORT void format_conversion_pool_destroy(
+		struct format_conversion_pool *pool);
+
+/* converts rows 0 to height, returning once all of them are done */
+EXPORT void format_conversion_pool_run(struct format_conversion_pool *pool,
+		uint32_t height, format_conversion_rows_t convert, void *param);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,7 +19,9 @@
 
 #include "../util/base.h"
 #include "../util/bmem.h"
+#include "../util/darray.h"
 #include "../util/platform.h"
+#include "../util/threading.h"
 
 #include <libavformat/avformat.h>
 
@@ -32,11 +34,174 @@
 #define CODEC_FLAG_GLOBAL_H CODEC_FLAG_GLOBAL_HEADER
 #endif
 
+/* buffer size of the I/O contexts used by batch jobs */
+#define REMUX_IO_BUFFER_SIZE (1024 * 1024)
+
+struct remux_file {
+	FILE *file;
+	AVIOContext *avio;
+	struct media_remux_batch *batch;
+};
+
 struct media_remux_job {
 	int64_t in_size;
 	AVFormatContext *ifmt_ctx, *ofmt_ctx;
+
+	/* only used by batch jobs */
+	struct media_remux_batch *batch;
+	struct remux_file in_file, out_file;
 };
 
+struct batch_job {
+	char *in_filename;
+	char *out_filename;
+	int64_t in_size;
+	bool done;
+	bool success;
+};
+
+struct media_remux_batch {
+	DARRAY(struct batch_job) jobs;
+	size_t max_jobs;
+	uint64_t max_io_rate;
+	int64_t total_size;
+
+	pthread_mutex_t io_mutex;
+	uint64_t io_next_ns;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+
+	os_event_t *worker_event;
+	volatile long next_job;
+	volatile long jobs_done;
+	volatile long active_workers;
+	volatile bool stop;
+
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+};
+
+/* ------------------------------------------------------------------------- */
+/* buffered file I/O for batch jobs */
+
+static void account_io(struct media_remux_batch *batch, size_t size,
+		bool write)
+{
+	uint64_t now = 0;
+	uint64_t wait_until = 0;
+
+	pthread_mutex_lock(&batch->io_mutex);
+
+	if (write)
+		batch->bytes_written += size;
+	else
+		batch->bytes_read += size;
+
+	/* each transfer takes the next slot of the shared I/O budget, and
+	 * waits until that slot is over */
+	if (batch->max_io_rate) {
+		now = os_gettime_ns();
+		if (batch->io_next_ns < now)
+			batch->io_next_ns = now;
+		batch->io_next_ns += (uint64_t)size * 1000000000ULL /
+			batch->max_io_rate;
+		wait_until = batch->io_next_ns;
+	}
+
+	pthread_mutex_unlock(&batch->io_mutex);
+
+	if (wait_until > now)
+		os_sleepto_ns(wait_until);
+}
+
+static int remux_file_read(void *opaque, uint8_t *buf, int buf_size)
+{
+	struct remux_file *rf = opaque;
+	size_t size = fread(buf, 1, (size_t)buf_size, rf->file);
+
+	if (!size)
+		return AVERROR_EOF;
+
+	account_io(rf->batch, size, false);
+	return (int)size;
+}
+
+static int remux_file_write(void *opaque, uint8_t *buf, int buf_size)
+{
+	struct remux_file *rf = opaque;
+	size_t size = fwrite(buf, 1, (size_t)buf_size, rf->file);
+
+	if (size != (size_t)buf_size)
+		return AVERROR(EIO);
+
+	account_io(rf->batch, size, true);
+	return buf_size;
+}
+
+static int64_t remux_file_seek(void *opaque, int64_t offset, int whence)
+{
+	struct remux_file *rf = opaque;
+
+	if (whence == AVSEEK_SIZE) {
+		int64_t pos = os_ftelli64(rf->file);
+		int64_t size;
+
+		os_fseeki64(rf->file, 0, SEEK_END);
+		size = os_ftelli64(rf->file);
+		os_fseeki64(rf->file, pos, SEEK_SET);
+		return size;
+	}
+
+	if (os_fseeki64(rf->file, offset, whence & ~AVSEEK_FORCE) != 0)
+		return -1;
+
+	return os_ftelli64(rf->file);
+}
+
+static bool open_remux_file(struct remux_file *rf,
+		struct media_remux_batch *batch, const char *filename,
+		bool write)
+{
+	uint8_t *buf;
+
+	rf->batch = batch;
+	rf->file = os_fopen(filename, write ? "wb" : "rb");
+	if (!rf->file)
+		return false;
+
+	buf = av_malloc(REMUX_IO_BUFFER_SIZE);
+	if (!buf)
+		return false;
+
+	rf->avio = avio_alloc_context(buf, REMUX_IO_BUFFER_SIZE, write, rf,
+			write ? NULL : remux_file_read,
+			write ? remux_file_write : NULL,
+			remux_file_seek);
+	if (!rf->avio) {
+		av_free(buf);
+		return false;
+	}
+
+	return true;
+}
+
+static void close_remux_file(struct remux_file *rf)
+{
+	if (rf->avio) {
+		if (rf->avio->write_flag)
+			avio_flush(rf->avio);
+		av_freep(&rf->avio->buffer);
+		av_freep(&rf->avio);
+	}
+
+	if (rf->file) {
+		fclose(rf->file);
+		rf->file = NULL;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
 static inline void init_size(media_remux_job_t job, const char *in_filename)
 {
 #ifdef _MSC_VER
@@ -51,7 +216,25 @@ static inline void init_size(media_remux_job_t job, const char *in_filename)
 
 static inline bool init_input(media_remux_job_t job, const char *in_filename)
 {
-	int ret = avformat_open_input(&job->ifmt_ctx, in_filename, NULL, NULL);
+	int ret;
+
+	if (job->batch) {
+		if (!open_remux_file(&job->in_file, job->batch, in_filename,
+					false)) {
+			blog(LOG_ERROR, "media_remux: Could not open input "
+					"file '%s'", in_filename);
+			return false;
+		}
+
+		job->ifmt_ctx = avformat_alloc_context();
+		if (!job->ifmt_ctx)
+			return false;
+
+		job->ifmt_ctx->pb = job->in_file.avio;
+		job->ifmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	ret = avformat_open_input(&job->ifmt_ctx, in_filename, NULL, NULL);
 	if (ret < 0) {
 		blog(LOG_ERROR, "media_remux: Could not open input file '%s'",
 				in_filename);
@@ -120,7 +303,17 @@ static inline bool init_output(media_remux_job_t job, const char *out_filename)
 	av_dump_format(job->ofmt_ctx, 0, out_filename, true);
 #endif
 
-	if (!(job->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+	if (job->batch && !(job->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+		if (!open_remux_file(&job->out_file, job->batch, out_filename,
+					true)) {
+			blog(LOG_ERROR, "media_remux: Failed to open output"
+					" file '%s'", out_filename);
+			return false;
+		}
+
+		job->ofmt_ctx->pb = job->out_file.avio;
+
+	} else if (!(job->ofmt_ctx->oformat->flags & AVFMT_NOFILE)) {
 		ret = avio_open(&job->ofmt_ctx->pb, out_filename,
 				AVIO_FLAG_WRITE);
 		if (ret < 0) {
@@ -133,8 +326,8 @@ static inline bool init_output(media_remux_job_t job, const char *out_filename)
 	return true;
 }
 
-bool media_remux_job_create(media_remux_job_t *job, const char *in_filename,
-		const char *out_filename)
+static bool create_job(media_remux_job_t *job, const char *in_filename,
+		const char *out_filename, struct media_remux_batch *batch)
 {
 	if (!job)
 		return false;
@@ -151,6 +344,7 @@ bool media_remux_job_create(media_remux_job_t *job, const char *in_filename,
 		return false;
 
 	init_size(*job, in_filename);
+	(*job)->batch = batch;
 
 	av_register_all();
 
@@ -164,9 +358,16 @@ bool media_remux_job_create(media_remux_job_t *job, const char *in_filename,
 
 fail:
 	media_remux_job_destroy(*job);
+	*job = NULL;
 	return false;
 }
 
+bool media_remux_job_create(media_remux_job_t *job, const char *in_filename,
+		const char *out_filename)
+{
+	return create_job(job, in_filename, out_filename, NULL);
+}
+
 static inline void process_packet(AVPacket *pkt,
 		AVStream *in_stream, AVStream *out_stream)
 {
@@ -250,6 +451,16 @@ bool media_remux_job_process(media_remux_job_t job,
 		success = false;
 	}
 
+	if (job->out_file.avio) {
+		avio_flush(job->out_file.avio);
+		if (job->out_file.avio->error < 0) {
+			blog(LOG_ERROR, "media_remux: Error writing output "
+					"file: %s",
+					av_err2str(job->out_file.avio->error));
+			success = false;
+		}
+	}
+
 	if (callback != NULL)
 		callback(data, 100.f);
 
@@ -263,10 +474,242 @@ void media_remux_job_destroy(media_remux_job_t job)
 
 	avformat_close_input(&job->ifmt_ctx);
 
-	if (job->ofmt_ctx && !(job->ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+	if (job->ofmt_ctx && !job->out_file.avio &&
+	    !(job->ofmt_ctx->oformat->flags & AVFMT_NOFILE))
 		avio_close(job->ofmt_ctx->pb);
 
 	avformat_free_context(job->ofmt_ctx);
 
+	close_remux_file(&job->in_file);
+	close_remux_file(&job->out_file);
+
 	bfree(job);
 }
+
+/* ------------------------------------------------------------------------- */
+/* batch remuxing */
+
+media_remux_batch_t media_remux_batch_create(size_t max_jobs,
+		uint64_t max_io_rate)
+{
+	struct media_remux_batch *batch = bzalloc(sizeof(*batch));
+	pthread_mutex_init_value(&batch->io_mutex);
+
+	if (!max_jobs)
+		max_jobs = (size_t)os_get_logical_cores();
+
+	batch->max_jobs = max_jobs ? max_jobs : 1;
+	batch->max_io_rate = max_io_rate;
+
+	if (pthread_mutex_init(&batch->io_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&batch->worker_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+
+	av_register_all();
+	return batch;
+
+fail:
+	pthread_mutex_destroy(&batch->io_mutex);
+	bfree(batch);
+	return NULL;
+}
+
+void media_remux_batch_destroy(media_remux_batch_t batch)
+{
+	if (!batch)
+		return;
+
+	for (size_t i = 0; i < batch->jobs.num; i++) {
+		bfree(batch->jobs.array[i].in_filename);
+		bfree(batch->jobs.array[i].out_filename);
+	}
+
+	da_free(batch->jobs);
+	pthread_mutex_destroy(&batch->io_mutex);
+	os_event_destroy(batch->worker_event);
+	bfree(batch);
+}
+
+size_t media_remux_batch_add(media_remux_batch_t batch,
+		const char *in_filename, const char *out_filename)
+{
+	struct batch_job *bj;
+
+	if (!batch || !in_filename || !out_filename)
+		return (size_t)-1;
+	if (!os_file_exists(in_filename))
+		return (size_t)-1;
+	if (strcmp(in_filename, out_filename) == 0)
+		return (size_t)-1;
+
+	bj = da_push_back_new(batch->jobs);
+	bj->in_filename = bstrdup(in_filename);
+	bj->out_filename = bstrdup(out_filename);
+	bj->in_size = os_get_file_size(in_filename);
+
+	if (bj->in_size > 0)
+		batch->total_size += bj->in_size;
+
+	return batch->jobs.num - 1;
+}
+
+static bool batch_job_progress(void *data, float percent)
+{
+	struct media_remux_batch *batch = data;
+
+	UNUSED_PARAMETER(percent);
+	return !os_atomic_load_bool(&batch->stop);
+}
+
+static void *batch_worker_thread(void *data)
+{
+	struct media_remux_batch *batch = data;
+
+	os_set_thread_name("media_remux: batch worker");
+
+	while (!os_atomic_load_bool(&batch->stop)) {
+		size_t idx = (size_t)os_atomic_inc_long(&batch->next_job) - 1;
+		struct batch_job *bj;
+		media_remux_job_t job;
+
+		if (idx >= batch->jobs.num)
+			break;
+
+		bj = batch->jobs.array + idx;
+
+		if (create_job(&job, bj->in_filename, bj->out_filename,
+					batch)) {
+			bj->success = media_remux_job_process(job,
+					batch_job_progress, batch);
+			media_remux_job_destroy(job);
+		}
+
+		if (os_atomic_load_bool(&batch->stop))
+			bj->success = false;
+
+		bj->done = true;
+		os_atomic_inc_long(&batch->jobs_done);
+		os_event_signal(batch->worker_event);
+	}
+
+	os_atomic_dec_long(&batch->active_workers);
+	os_event_signal(batch->worker_event);
+	return NULL;
+}
+
+static float batch_progress(struct media_remux_batch *batch)
+{
+	uint64_t bytes_read;
+
+	if (batch->total_size <= 0)
+		return 0.0f;
+
+	pthread_mutex_lock(&batch->io_mutex);
+	bytes_read = batch->bytes_read;
+	pthread_mutex_unlock(&batch->io_mutex);
+
+	if (bytes_read >= (uint64_t)batch->total_size)
+		return 100.0f;
+
+	return (float)bytes_read / (float)batch->total_size * 100.0f;
+}
+
+bool media_remux_batch_process(media_remux_batch_t batch,
+		media_remux_progress_callback callback, void *data)
+{
+	size_t num_threads;
+	pthread_t *threads;
+	bool success = true;
+
+	if (!batch || !batch->jobs.num)
+		return false;
+
+	for (size_t i = 0; i < batch->jobs.num; i++) {
+		batch->jobs.array[i].done = false;
+		batch->jobs.array[i].success = false;
+	}
+
+	num_threads = batch->max_jobs < batch->jobs.num ?
+		batch->max_jobs : batch->jobs.num;
+	threads = bmalloc(sizeof(pthread_t) * num_threads);
+
+	batch->next_job = 0;
+	batch->jobs_done = 0;
+	batch->active_workers = 0;
+	batch->stop = false;
+	batch->bytes_read = 0;
+	batch->bytes_written = 0;
+	batch->io_next_ns = 0;
+	batch->start_ns = os_gettime_ns();
+
+	if (callback != NULL)
+		callback(data, 0.f);
+
+	for (size_t i = 0; i < num_threads; i++) {
+		os_atomic_inc_long(&batch->active_workers);
+
+		if (pthread_create(&threads[i], NULL, batch_worker_thread,
+					batch) != 0) {
+			blog(LOG_ERROR, "media_remux: Failed to create batch "
+					"worker thread");
+			os_atomic_dec_long(&batch->active_workers);
+			num_threads = i;
+			break;
+		}
+	}
+
+	while (os_atomic_load_long(&batch->active_workers) > 0) {
+		os_event_timedwait(batch->worker_event, 100);
+
+		if (callback != NULL && !callback(data, batch_progress(batch)))
+			os_atomic_set_bool(&batch->stop, true);
+	}
+
+	for (size_t i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	bfree(threads);
+	batch->elapsed_ns = os_gettime_ns() - batch->start_ns;
+
+	for (size_t i = 0; i < batch->jobs.num; i++) {
+		if (!batch->jobs.array[i].success)
+			success = false;
+	}
+
+	if (callback != NULL)
+		callback(data, 100.f);
+
+	return success;
+}
+
+bool media_remux_batch_job_succeeded(media_remux_batch_t batch, size_t idx)
+{
+	return batch && idx < batch->jobs.num &&
+		batch->jobs.array[idx].success;
+}
+
+void media_remux_batch_get_stats(media_remux_batch_t batch,
+		struct media_remux_batch_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (!batch)
+		return;
+
+	stats->jobs_total = batch->jobs.num;
+	stats->jobs_done = (size_t)os_atomic_load_long(&batch->jobs_done);
+
+	for (size_t i = 0; i < batch->jobs.num; i++) {
+		struct batch_job *bj = batch->jobs.array + i;
+		if (bj->done && !bj->success)
+			stats->jobs_failed++;
+	}
+
+	pthread_mutex_lock(&batch->io_mutex);
+	stats->bytes_read = batch->bytes_read;
+	stats->bytes_written = batch->bytes_written;
+	pthread_mutex_unlock(&batch->io_mutex);
+
+	stats->elapsed_ns = batch->elapsed_ns ? batch->elapsed_ns :
+		os_gettime_ns() - batch->start_ns;
+}
@@ -24,6 +24,18 @@ typedef struct media_remux_job *media_remux_job_t;
 
 typedef bool (media_remux_progress_callback)(void *data, float percent);
 
+struct media_remux_batch;
+typedef struct media_remux_batch *media_remux_batch_t;
+
+struct media_remux_batch_stats {
+	size_t   jobs_total;
+	size_t   jobs_done;
+	size_t   jobs_failed;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t elapsed_ns;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,6 +46,30 @@ EXPORT bool media_remux_job_process(media_remux_job_t job,
 		media_remux_progress_callback callback, void *data);
 EXPORT void media_remux_job_destroy(media_remux_job_t job);
 
+/* Batch remuxing: up to max_jobs files are remuxed at the same time through
+ * large buffered I/O contexts, or one file per logical core if max_jobs is
+ * 0.  max_io_rate limits the combined read and write rate of all jobs in
+ * bytes per second, 0 for no limit. */
+EXPORT media_remux_batch_t media_remux_batch_create(size_t max_jobs,
+		uint64_t max_io_rate);
+EXPORT void media_remux_batch_destroy(media_remux_batch_t batch);
+
+/* returns the index of the job, or (size_t)-1 if the files are not valid */
+EXPORT size_t media_remux_batch_add(media_remux_batch_t batch,
+		const char *in_filename, const char *out_filename);
+
+/* Processes every job added to the batch and returns when they are all done.
+ * The callback is called from the calling thread with the combined progress
+ * of all jobs, and can return false to stop the remaining jobs.  Returns
+ * true if every job succeeded. */
+EXPORT bool media_remux_batch_process(media_remux_batch_t batch,
+		media_remux_progress_callback callback, void *data);
+
+EXPORT bool media_remux_batch_job_succeeded(media_remux_batch_t batch,
+		size_t idx);
+EXPORT void media_remux_batch_get_stats(media_remux_batch_t batch,
+		struct media_remux_batch_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,7 @@
 #include "../util/profiler.h"
 #include "../util/threading.h"
 #include "../util/darray.h"
+#include "../util/circlebuf.h"
 
 #include "format-conversion.h"
 #include "video-io.h"
@@ -30,32 +31,94 @@
 
 extern profiler_name_store_t *obs_get_profiler_name_store(void);
 
-#define MAX_CONVERT_BUFFERS 3
 #define MAX_CACHE_SIZE 16
+#define MAX_SCALE_SLICES 4
+#define MIN_SLICE_HEIGHT 180
 
 struct cached_frame_info {
 	struct video_data frame;
+	uint64_t id;
 	int skipped;
 	int count;
+	long refs;
+	bool used;
+	bool queued;
 };
 
+/* a cached frame queued for an input, by cache index */
+struct input_frame {
+	size_t   idx;
+	uint64_t id;
+	uint64_t timestamp;
+};
+
+struct video_converter;
+
+struct video_slice {
+	struct video_converter    *converter;
+	video_scaler_t            *scaler;
+	uint32_t                  y;
+
+	pthread_t                 thread;
+	bool                      thread_initialized;
+	os_sem_t                  *start;
+	bool                      success;
+};
+
+/*
+ *   Inputs that request the same conversion share a converter, so each cached
+ * frame is converted once however many inputs use it.  The converted frame is
+ * kept until its cached frame is reused, so it's shared by reference just
+ * like the cached frame itself.
+ *
+ *   Conversions that don't scale vertically can be split into horizontal
+ * slices, each with its own scaler and converted on its own thread.
+ */
+struct video_converter {
+	struct video_output       *video;
+	struct video_scale_info   info;
+	long                      refs;
+
+	pthread_mutex_t           mutex;
+	struct video_frame        frames[MAX_CACHE_SIZE];
+	uint64_t                  frame_ids[MAX_CACHE_SIZE];
+
+	size_t                    num_slices;
+	struct video_slice        slices[MAX_SCALE_SLICES];
+	os_sem_t                  *slices_done;
+	volatile bool             slices_stop;
+	const struct video_data   *slice_input;
+	struct video_frame        *slice_output;
+};
+
+/*
+ *   Each input has its own thread and bounded queue of cached frames, so
+ * inputs (i.e. encoders) don't wait on each other, and an input that can't
+ * keep up only drops its own frames.  Cached frames are referenced rather
+ * than copied, and are reused once every input queued them is done with
+ * them.
+ */
 struct video_input {
+	struct video_output       *video;
 	struct video_scale_info   conversion;
-	video_scaler_t            *scaler;
-	struct video_frame        frame[MAX_CONVERT_BUFFERS];
-	int                       cur_frame;
+	struct video_converter    *converter;
+
+	pthread_t                 thread;
+	bool                      thread_initialized;
+	os_sem_t                  *queue_semaphore;
+	pthread_mutex_t           queue_mutex;
+	struct circlebuf          queue;
+	size_t                    queue_depth;
+	size_t                    max_queued;
+	volatile long             total_frames;
+	volatile long             dropped_frames;
+	volatile bool             stop;
+	bool                      detached;
 
 	void (*callback)(void *param, struct video_data *frame);
 	void *param;
 };
 
-static inline void video_input_free(struct video_input *input)
-{
-	for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-		video_frame_free(&input->frame[i]);
-	video_scaler_destroy(input->scaler);
-}
-
 struct video_output {
 	struct video_output_info   info;
 
@@ -71,11 +134,17 @@ struct video_output {
 	bool                       initialized;
 
 	pthread_mutex_t            input_mutex;
-	DARRAY(struct video_input) inputs;
+	DARRAY(struct video_input*) inputs;
+	DARRAY(struct video_converter*) converters;
+	volatile long              detached_inputs;
 
 	size_t                     available_frames;
-	size_t                     first_added;
 	size_t                     last_added;
+	size_t                     locked_frame;
+	size_t                     queue[MAX_CACHE_SIZE];
+	size_t                     first_queued;
+	size_t                     num_queued;
+	uint64_t                   last_frame_id;
 	struct cached_frame_info   cache[MAX_CACHE_SIZE];
 
 	volatile bool              raw_active;
@@ -84,79 +153,191 @@ struct video_output {
 
 /* ------------------------------------------------------------------------- */
 
+/* chroma planes of 4:2:0 formats have half as many rows */
+static inline uint32_t get_plane_row(enum video_format format, size_t plane,
+		uint32_t y)
+{
+	if (plane > 0 && (format == VIDEO_FORMAT_I420 ||
+	                  format == VIDEO_FORMAT_NV12))
+		return y / 2;
+	return y;
+}
+
+static bool scale_slice(struct video_converter *converter,
+		struct video_slice *slice)
+{
+	const struct video_data *input = converter->slice_input;
+	struct video_frame *output = converter->slice_output;
+	enum video_format in_format = converter->video->info.format;
+	enum video_format out_format = converter->info.format;
+	const uint8_t *in_data[MAX_AV_PLANES] = {0};
+	uint8_t *out_data[MAX_AV_PLANES] = {0};
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		if (input->data[i])
+			in_data[i] = input->data[i] + input->linesize[i] *
+				get_plane_row(in_format, i, slice->y);
+		if (output->data[i])
+			out_data[i] = output->data[i] + output->linesize[i] *
+				get_plane_row(out_format, i, slice->y);
+	}
+
+	return video_scaler_scale(slice->scaler, out_data, output->linesize,
+			in_data, input->linesize);
+}
+
+static void *video_slice_thread(void *param)
+{
+	struct video_slice *slice = param;
+	struct video_converter *converter = slice->converter;
+
+	os_set_thread_name("video-io: video scale thread");
+
+	while (os_sem_wait(slice->start) == 0) {
+		if (os_atomic_load_bool(&converter->slices_stop))
+			break;
+
+		slice->success = scale_slice(converter, slice);
+		os_sem_post(converter->slices_done);
+	}
+
+	return NULL;
+}
+
+/* converter mutex must be locked */
+static bool scale_frame(struct video_converter *converter,
+		struct video_frame *output, const struct video_data *input)
+{
+	bool success;
+
+	converter->slice_input  = input;
+	converter->slice_output = output;
+
+	for (size_t i = 1; i < converter->num_slices; i++)
+		os_sem_post(converter->slices[i].start);
+
+	success = scale_slice(converter, &converter->slices[0]);
+
+	for (size_t i = 1; i < converter->num_slices; i++)
+		os_sem_wait(converter->slices_done);
+	for (size_t i = 1; i < converter->num_slices; i++)
+		success = success && converter->slices[i].success;
+
+	return success;
+}
+
 static inline bool scale_video_output(struct video_input *input,
-		struct video_data *data)
+		struct video_data *data, size_t idx, uint64_t id)
 {
+	struct video_converter *converter = input->converter;
+	struct video_frame *frame;
 	bool success = true;
 
-	if (input->scaler) {
-		struct video_frame *frame;
-
-		if (++input->cur_frame == MAX_CONVERT_BUFFERS)
-			input->cur_frame = 0;
+	if (!converter)
+		return true;
 
-		frame = &input->frame[input->cur_frame];
+	frame = &converter->frames[idx];
 
-		success = video_scaler_scale(input->scaler,
-				frame->data, frame->linesize,
-				(const uint8_t * const*)data->data,
-				data->linesize);
+	/* another input with the same conversion may have converted this
+	 * frame already */
+	pthread_mutex_lock(&converter->mutex);
+	if (converter->frame_ids[idx] != id) {
+		success = scale_frame(converter, frame, data);
+		converter->frame_ids[idx] = success ? id : 0;
+	}
+	pthread_mutex_unlock(&converter->mutex);
 
-		if (success) {
-			for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-				data->data[i]     = frame->data[i];
-				data->linesize[i] = frame->linesize[i];
-			}
-		} else {
-			blog(LOG_WARNING, "video-io: Could not scale frame!");
+	if (success) {
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			data->data[i]     = frame->data[i];
+			data->linesize[i] = frame->linesize[i];
 		}
+	} else {
+		blog(LOG_WARNING, "video-io: Could not scale frame!");
 	}
 
 	return success;
 }
 
-static inline bool video_output_cur_frame(struct video_output *video)
+/* frees a cached frame once it has been dispatched and is no longer
+ * referenced by any input.  data_mutex must be locked. */
+static inline void free_cached_frame(struct video_output *video, size_t idx)
 {
-	struct cached_frame_info *frame_info;
-	bool complete;
-	bool skipped;
+	struct cached_frame_info *cfi = &video->cache[idx];
 
-	/* -------------------------------- */
+	if (cfi->used && !cfi->queued && cfi->refs == 0) {
+		cfi->used = false;
+		video->available_frames++;
+	}
+}
 
+static void release_input_frame(struct video_output *video, size_t idx)
+{
 	pthread_mutex_lock(&video->data_mutex);
-
-	frame_info = &video->cache[video->first_added];
-
+	video->cache[idx].refs--;
+	free_cached_frame(video, idx);
 	pthread_mutex_unlock(&video->data_mutex);
+}
 
-	/* -------------------------------- */
+/* input_mutex and data_mutex must be locked */
+static inline void queue_input_frame(struct video_input *input, size_t idx,
+		uint64_t id, uint64_t timestamp)
+{
+	struct input_frame frame = {idx, id, timestamp};
+	size_t queued;
 
-	pthread_mutex_lock(&video->input_mutex);
+	os_atomic_inc_long(&input->total_frames);
 
-	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
-		struct video_data frame = frame_info->frame;
+	pthread_mutex_lock(&input->queue_mutex);
 
-		if (scale_video_output(input, &frame))
-			input->callback(input->param, &frame);
+	queued = input->queue.size / sizeof(frame);
+	if (queued < input->queue_depth) {
+		circlebuf_push_back(&input->queue, &frame, sizeof(frame));
+		if (++queued > input->max_queued)
+			input->max_queued = queued;
+		input->video->cache[idx].refs++;
+	} else {
+		os_atomic_inc_long(&input->dropped_frames);
+		queued = 0;
 	}
 
-	pthread_mutex_unlock(&video->input_mutex);
+	pthread_mutex_unlock(&input->queue_mutex);
 
-	/* -------------------------------- */
+	if (queued)
+		os_sem_post(input->queue_semaphore);
+}
 
+static inline bool video_output_cur_frame(struct video_output *video)
+{
+	struct cached_frame_info *frame_info;
+	size_t idx;
+	bool complete;
+	bool skipped;
+
+	pthread_mutex_lock(&video->input_mutex);
 	pthread_mutex_lock(&video->data_mutex);
 
+	idx = video->queue[video->first_queued];
+	frame_info = &video->cache[idx];
+
+	for (size_t i = 0; i < video->inputs.num; i++)
+		queue_input_frame(video->inputs.array[i], idx,
+				frame_info->id, frame_info->frame.timestamp);
+
+	pthread_mutex_unlock(&video->input_mutex);
+
 	frame_info->frame.timestamp += video->frame_time;
 	complete = --frame_info->count == 0;
 	skipped = frame_info->skipped > 0;
 
 	if (complete) {
-		if (++video->first_added == video->info.cache_size)
-			video->first_added = 0;
+		if (++video->first_queued == video->info.cache_size)
+			video->first_queued = 0;
+		video->num_queued--;
+
+		frame_info->queued = false;
+		free_cached_frame(video, idx);
 
-		if (++video->available_frames == video->info.cache_size)
-			video->last_added = video->first_added;
 	} else if (skipped) {
 		--frame_info->skipped;
 		os_atomic_inc_long(&video->skipped_frames);
@@ -164,11 +345,123 @@ static inline bool video_output_cur_frame(struct video_output *video)
 
 	pthread_mutex_unlock(&video->data_mutex);
 
-	/* -------------------------------- */
-
 	return complete;
 }
 
+static void video_input_free(struct video_input *input);
+static void release_converter(struct video_output *video,
+		struct video_converter *converter);
+
+static void *video_input_thread(void *param)
+{
+	struct video_input *input = param;
+	struct video_output *video = input->video;
+
+	os_set_thread_name("video-io: video input thread");
+
+	const char *video_input_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"video_input_thread(%s)", video->info.name);
+
+	while (os_sem_wait(input->queue_semaphore) == 0) {
+		struct input_frame queued;
+		struct video_data frame;
+
+		if (os_atomic_load_bool(&input->stop))
+			break;
+
+		pthread_mutex_lock(&input->queue_mutex);
+		circlebuf_pop_front(&input->queue, &queued, sizeof(queued));
+		pthread_mutex_unlock(&input->queue_mutex);
+
+		profile_start(video_input_thread_name);
+
+		/* the timestamp of the cached frame is updated by the video
+		 * thread while frames are repeated, so only the planes are
+		 * used from it */
+		const struct video_data *cached = &video->cache[queued.idx].frame;
+		memcpy(frame.data, cached->data, sizeof(frame.data));
+		memcpy(frame.linesize, cached->linesize, sizeof(frame.linesize));
+		frame.timestamp = queued.timestamp;
+
+		if (scale_video_output(input, &frame, queued.idx, queued.id))
+			input->callback(input->param, &frame);
+
+		release_input_frame(video, queued.idx);
+
+		profile_end(video_input_thread_name);
+		profile_reenable_thread();
+
+		/* disconnected from within its own callback */
+		if (os_atomic_load_bool(&input->stop))
+			break;
+	}
+
+	if (input->detached) {
+		video_input_free(input);
+		os_atomic_dec_long(&video->detached_inputs);
+	}
+
+	return NULL;
+}
+
+static void video_input_free(struct video_input *input)
+{
+	struct input_frame queued;
+
+	/* frames still queued are released without being output */
+	while (input->queue.size) {
+		circlebuf_pop_front(&input->queue, &queued, sizeof(queued));
+		release_input_frame(input->video, queued.idx);
+	}
+
+	if (input->thread_initialized) {
+		long dropped = os_atomic_load_long(&input->dropped_frames);
+		long total = os_atomic_load_long(&input->total_frames);
+
+		if (dropped)
+			blog(LOG_INFO, "video-io: Video input of '%s' dropped "
+					"%ld/%ld frames due to lag (max "
+					"queued: %d)",
+					input->video->info.name,
+					dropped, total, (int)input->max_queued);
+	}
+
+	if (input->converter) {
+		pthread_mutex_lock(&input->video->input_mutex);
+		release_converter(input->video, input->converter);
+		pthread_mutex_unlock(&input->video->input_mutex);
+	}
+
+	circlebuf_free(&input->queue);
+	os_sem_destroy(input->queue_semaphore);
+	pthread_mutex_destroy(&input->queue_mutex);
+	bfree(input);
+}
+
+static void video_input_stop(struct video_input *input)
+{
+	if (!input->thread_initialized) {
+		video_input_free(input);
+		return;
+	}
+
+	os_atomic_set_bool(&input->stop, true);
+
+	/* if disconnected from within its own callback, the thread frees the
+	 * input once the callback returns */
+	if (pthread_equal(pthread_self(), input->thread)) {
+		input->detached = true;
+		os_atomic_inc_long(&input->video->detached_inputs);
+		pthread_detach(input->thread);
+		return;
+	}
+
+	os_sem_post(input->queue_semaphore);
+	pthread_join(input->thread, NULL);
+	video_input_free(input);
+}
+
 static void *video_thread(void *param)
 {
 	struct video_output *video = param;
@@ -270,9 +563,14 @@ void video_output_close(video_t *video)
 	video_output_stop(video);
 
 	for (size_t i = 0; i < video->inputs.num; i++)
-		video_input_free(&video->inputs.array[i]);
+		video_input_stop(video->inputs.array[i]);
 	da_free(video->inputs);
 
+	while (os_atomic_load_long(&video->detached_inputs))
+		os_sleep_ms(1);
+
+	da_free(video->converters);
+
 	for (size_t i = 0; i < video->info.cache_size; i++)
 		video_frame_free((struct video_frame*)&video->cache[i]);
 
@@ -287,7 +585,7 @@ static size_t video_get_input_idx(const video_t *video,
 		void *param)
 {
 	for (size_t i = 0; i < video->inputs.num; i++) {
-		struct video_input *input = video->inputs.array+i;
+		struct video_input *input = video->inputs.array[i];
 		if (input->callback == callback && input->param == param)
 			return i;
 	}
@@ -295,22 +593,100 @@ static size_t video_get_input_idx(const video_t *video,
 	return DARRAY_INVALID;
 }
 
-static inline bool video_input_init(struct video_input *input,
+static inline bool same_conversion(const struct video_scale_info *a,
+		const struct video_scale_info *b)
+{
+	return a->format == b->format && a->width == b->width &&
+	       a->height == b->height && a->range == b->range &&
+	       a->colorspace == b->colorspace;
+}
+
+static inline bool is_420_format(enum video_format format)
+{
+	return format == VIDEO_FORMAT_I420 || format == VIDEO_FORMAT_NV12;
+}
+
+static size_t get_num_slices(const struct video_output *video,
+		const struct video_scale_info *info)
+{
+	int cores = os_get_logical_cores();
+	size_t num_slices;
+
+	/* slices are scaled independently, so the rows of each slice must
+	 * map to the same rows of the output */
+	if (info->height != video->info.height ||
+	    is_420_format(info->format) != is_420_format(video->info.format))
+		return 1;
+
+	num_slices = cores > 4 ? (size_t)cores / 4 : 1;
+	if (num_slices > MAX_SCALE_SLICES)
+		num_slices = MAX_SCALE_SLICES;
+
+	while (num_slices > 1 && info->height / num_slices < MIN_SLICE_HEIGHT)
+		num_slices--;
+
+	return num_slices;
+}
+
+static void video_converter_destroy(struct video_converter *converter)
+{
+	os_atomic_set_bool(&converter->slices_stop, true);
+
+	for (size_t i = 0; i < converter->num_slices; i++) {
+		struct video_slice *slice = &converter->slices[i];
+
+		if (slice->thread_initialized) {
+			os_sem_post(slice->start);
+			pthread_join(slice->thread, NULL);
+		}
+
+		os_sem_destroy(slice->start);
+		video_scaler_destroy(slice->scaler);
+	}
+
+	for (size_t i = 0; i < MAX_CACHE_SIZE; i++)
+		video_frame_free(&converter->frames[i]);
+
+	os_sem_destroy(converter->slices_done);
+	pthread_mutex_destroy(&converter->mutex);
+	bfree(converter);
+}
+
+static bool video_converter_init(struct video_converter *converter,
 		struct video_output *video)
 {
-	if (input->conversion.width  != video->info.width ||
-	    input->conversion.height != video->info.height ||
-	    input->conversion.format != video->info.format) {
+	const struct video_scale_info *info = &converter->info;
+	size_t num_slices = converter->num_slices;
+	uint32_t slice_height = info->height;
+
+	if (num_slices > 1)
+		slice_height = (uint32_t)(info->height / num_slices) & ~1;
+
+	if (pthread_mutex_init(&converter->mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&converter->slices_done, 0) != 0)
+		return false;
+
+	for (size_t i = 0; i < num_slices; i++) {
+		struct video_slice *slice = &converter->slices[i];
+		uint32_t y = (uint32_t)i * slice_height;
+		uint32_t height = (i == num_slices - 1) ?
+			info->height - y : slice_height;
+
 		struct video_scale_info from = {
 			.format = video->info.format,
 			.width  = video->info.width,
-			.height = video->info.height,
+			.height = num_slices > 1 ? height : video->info.height,
 			.range = video->info.range,
 			.colorspace = video->info.colorspace
 		};
+		struct video_scale_info to = *info;
+		to.height = height;
+
+		slice->converter = converter;
+		slice->y = y;
 
-		int ret = video_scaler_create(&input->scaler,
-				&input->conversion, &from,
+		int ret = video_scaler_create(&slice->scaler, &to, &from,
 				VIDEO_SCALE_FAST_BILINEAR);
 		if (ret != VIDEO_SCALER_SUCCESS) {
 			if (ret == VIDEO_SCALER_BAD_CONVERSION)
@@ -323,13 +699,98 @@ static inline bool video_input_init(struct video_input *input,
 			return false;
 		}
 
-		for (size_t i = 0; i < MAX_CONVERT_BUFFERS; i++)
-			video_frame_init(&input->frame[i],
-					input->conversion.format,
-					input->conversion.width,
-					input->conversion.height);
+		/* the first slice is scaled by the input thread itself */
+		if (i == 0)
+			continue;
+
+		if (os_sem_init(&slice->start, 0) != 0)
+			return false;
+		if (pthread_create(&slice->thread, NULL, video_slice_thread,
+					slice) != 0)
+			return false;
+
+		slice->thread_initialized = true;
+	}
+
+	for (size_t i = 0; i < video->info.cache_size; i++)
+		video_frame_init(&converter->frames[i], info->format,
+				info->width, info->height);
+
+	return true;
+}
+
+/* input_mutex must be locked */
+static struct video_converter *get_converter(struct video_output *video,
+		const struct video_scale_info *info)
+{
+	struct video_converter *converter;
+
+	for (size_t i = 0; i < video->converters.num; i++) {
+		converter = video->converters.array[i];
+
+		if (same_conversion(&converter->info, info)) {
+			converter->refs++;
+			return converter;
+		}
+	}
+
+	converter = bzalloc(sizeof(*converter));
+	converter->video      = video;
+	converter->info       = *info;
+	converter->refs       = 1;
+	converter->num_slices = get_num_slices(video, info);
+	pthread_mutex_init_value(&converter->mutex);
+
+	if (!video_converter_init(converter, video)) {
+		video_converter_destroy(converter);
+		return NULL;
 	}
 
+	if (converter->num_slices > 1)
+		blog(LOG_DEBUG, "video-io: Converting video of '%s' to "
+				"%"PRIu32"x%"PRIu32" in %d slices",
+				video->info.name, info->width, info->height,
+				(int)converter->num_slices);
+
+	da_push_back(video->converters, &converter);
+	return converter;
+}
+
+/* input_mutex must be locked */
+static void release_converter(struct video_output *video,
+		struct video_converter *converter)
+{
+	if (--converter->refs == 0) {
+		da_erase_item(video->converters, &converter);
+		video_converter_destroy(converter);
+	}
+}
+
+static inline bool video_input_init(struct video_input *input,
+		struct video_output *video)
+{
+	if (input->conversion.width  != video->info.width ||
+	    input->conversion.height != video->info.height ||
+	    input->conversion.format != video->info.format) {
+		input->converter = get_converter(video, &input->conversion);
+		if (!input->converter)
+			return false;
+	}
+
+	/* leave at least half of the cache to the other inputs */
+	input->queue_depth = video->info.cache_size / 2;
+	if (!input->queue_depth)
+		input->queue_depth = 1;
+
+	if (pthread_mutex_init(&input->queue_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&input->queue_semaphore, 0) != 0)
+		return false;
+	if (pthread_create(&input->thread, NULL, video_input_thread,
+				input) != 0)
+		return false;
+
+	input->thread_initialized = true;
 	return true;
 }
 
@@ -344,6 +805,7 @@ bool video_output_connect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
 {
+	struct video_input *failed = NULL;
 	bool success = false;
 
 	if (!video || !callback)
@@ -352,26 +814,28 @@ bool video_output_connect(video_t *video,
 	pthread_mutex_lock(&video->input_mutex);
 
 	if (video_get_input_idx(video, callback, param) == DARRAY_INVALID) {
-		struct video_input input;
-		memset(&input, 0, sizeof(input));
+		struct video_input *input = bzalloc(sizeof(*input));
 
-		input.callback = callback;
-		input.param    = param;
+		pthread_mutex_init_value(&input->queue_mutex);
+
+		input->video    = video;
+		input->callback = callback;
+		input->param    = param;
 
 		if (conversion) {
-			input.conversion = *conversion;
+			input->conversion = *conversion;
 		} else {
-			input.conversion.format    = video->info.format;
-			input.conversion.width     = video->info.width;
-			input.conversion.height    = video->info.height;
+			input->conversion.format    = video->info.format;
+			input->conversion.width     = video->info.width;
+			input->conversion.height    = video->info.height;
 		}
 
-		if (input.conversion.width == 0)
-			input.conversion.width = video->info.width;
-		if (input.conversion.height == 0)
-			input.conversion.height = video->info.height;
+		if (input->conversion.width == 0)
+			input->conversion.width = video->info.width;
+		if (input->conversion.height == 0)
+			input->conversion.height = video->info.height;
 
-		success = video_input_init(&input, video);
+		success = video_input_init(input, video);
 		if (success) {
 			if (video->inputs.num == 0) {
 				if (!os_atomic_load_long(&video->gpu_refs)) {
@@ -380,11 +844,17 @@ bool video_output_connect(video_t *video,
 				os_atomic_set_bool(&video->raw_active, true);
 			}
 			da_push_back(video->inputs, &input);
+		} else {
+			failed = input;
 		}
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
 
+	/* freeing an input takes input_mutex to release its converter */
+	if (failed)
+		video_input_stop(failed);
+
 	return success;
 }
 
@@ -410,6 +880,8 @@ void video_output_disconnect(video_t *video,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
 {
+	struct video_input *input = NULL;
+
 	if (!video || !callback)
 		return;
 
@@ -417,7 +889,7 @@ void video_output_disconnect(video_t *video,
 
 	size_t idx = video_get_input_idx(video, callback, param);
 	if (idx != DARRAY_INVALID) {
-		video_input_free(video->inputs.array+idx);
+		input = video->inputs.array[idx];
 		da_erase(video->inputs, idx);
 
 		if (video->inputs.num == 0) {
@@ -429,6 +901,11 @@ void video_output_disconnect(video_t *video,
 	}
 
 	pthread_mutex_unlock(&video->input_mutex);
+
+	/* the input's thread is joined without input_mutex, so that the video
+	 * thread isn't blocked while the input outputs its last frame */
+	if (input)
+		video_input_stop(input);
 }
 
 bool video_output_active(const video_t *video)
@@ -453,17 +930,25 @@ bool video_output_lock_frame(video_t *video, struct video_frame *frame,
 	pthread_mutex_lock(&video->data_mutex);
 
 	if (video->available_frames == 0) {
-		video->cache[video->last_added].count += count;
-		video->cache[video->last_added].skipped += count;
+		/* if every cached frame has already been dispatched and is
+		 * only waiting on inputs, there is no frame left to repeat */
+		if (!video->num_queued) {
+			for (int i = 0; i < count; i++)
+				os_atomic_inc_long(&video->skipped_frames);
+		} else {
+			video->cache[video->last_added].count += count;
+			video->cache[video->last_added].skipped += count;
+		}
 		locked = false;
 
 	} else {
-		if (video->available_frames != video->info.cache_size) {
-			if (++video->last_added == video->info.cache_size)
-				video->last_added = 0;
-		}
+		size_t idx = 0;
+		while (video->cache[idx].used)
+			idx++;
+
+		video->locked_frame = idx;
 
-		cfi = &video->cache[video->last_added];
+		cfi = &video->cache[idx];
 		cfi->frame.timestamp = timestamp;
 		cfi->count = count;
 		cfi->skipped = 0;
@@ -484,6 +969,17 @@ void video_output_unlock_frame(video_t *video)
 
 	pthread_mutex_lock(&video->data_mutex);
 
+	size_t idx = video->locked_frame;
+	size_t last = (video->first_queued + video->num_queued) %
+		video->info.cache_size;
+
+	video->cache[idx].id = ++video->last_frame_id;
+	video->cache[idx].used = true;
+	video->cache[idx].queued = true;
+	video->queue[last] = idx;
+	video->num_queued++;
+	video->last_added = idx;
+
 	video->available_frames--;
 	os_sem_post(video->update_semaphore);
 
@@ -551,6 +1047,41 @@ uint32_t video_output_get_total_frames(const video_t *video)
 	return (uint32_t)os_atomic_load_long(&video->total_frames);
 }
 
+bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats)
+{
+	struct video_input *input;
+	size_t idx;
+
+	if (!video || !stats)
+		return false;
+
+	pthread_mutex_lock(&video->input_mutex);
+
+	idx = video_get_input_idx(video, callback, param);
+	if (idx == DARRAY_INVALID) {
+		pthread_mutex_unlock(&video->input_mutex);
+		return false;
+	}
+
+	input = video->inputs.array[idx];
+
+	pthread_mutex_lock(&input->queue_mutex);
+	stats->queued       = input->queue.size / sizeof(struct input_frame);
+	stats->max_queued   = input->max_queued;
+	stats->queue_depth  = input->queue_depth;
+	pthread_mutex_unlock(&input->queue_mutex);
+
+	stats->total_frames   =
+		(uint32_t)os_atomic_load_long(&input->total_frames);
+	stats->dropped_frames =
+		(uint32_t)os_atomic_load_long(&input->dropped_frames);
+
+	pthread_mutex_unlock(&video->input_mutex);
+	return true;
+}
+
 /* Note: These four functions below are a very slight bit of a hack.  If the
  * texture encoder thread is active while the raw encoder thread is active, the
  * total frame count will just be doubled while they're both active.  Which is
@@ -202,6 +202,23 @@ EXPORT double video_output_get_frame_rate(const video_t *video);
 EXPORT uint32_t video_output_get_skipped_frames(const video_t *video);
 EXPORT uint32_t video_output_get_total_frames(const video_t *video);
 
+/**
+ * Each connected input receives frames on its own thread, through a queue of
+ * up to queue_depth frames.  Frames output while its queue is full are
+ * dropped for that input only.
+ */
+struct video_input_stats {
+	size_t   queued;
+	size_t   max_queued;
+	size_t   queue_depth;
+	uint32_t total_frames;
+	uint32_t dropped_frames;
+};
+
+EXPORT bool video_output_get_input_stats(video_t *video,
+		void (*callback)(void *param, struct video_data *frame),
+		void *param, struct video_input_stats *stats);
+
 extern void video_output_inc_texture_encoders(video_t *video);
 extern void video_output_dec_texture_encoders(video_t *video);
 extern void video_output_inc_texture_frames(video_t *video);
@@ -384,6 +384,12 @@ bool audio_callback(void *param,
 	size_t audio_size;
 	uint64_t min_ts;
 
+	bool realtime = os_atomic_load_bool(&obs->video.pacing_realtime);
+	if (audio->realtime != realtime) {
+		set_thread_realtime(realtime, "audio");
+		audio->realtime = realtime;
+	}
+
 	da_resize(audio->render_order, 0);
 	da_resize(audio->root_nodes, 0);
 
@@ -0,0 +1,508 @@
+/******************************************************************************
+    Copyright (C) 2013 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "obs.h"
+#include "obs-internal.h"
+#include "graphics/vec4.h"
+#include "media-io/video-frame.h"
+#include "media-io/video-scaler.h"
+
+/*
+ *   Canvases are additional render targets with their own resolution, frame
+ * rate, format and channels.  They share sources, the graphics context and
+ * the graphics thread with the main video, and each has its own video output
+ * that encoders can be connected to.
+ *
+ *   A canvas is rendered on the graphics thread every time its own frame
+ * interval has elapsed, so canvases with a frame rate above that of the main
+ * video get duplicated frames.
+ */
+
+static inline void make_canvas_video_info(struct video_output_info *vi,
+		const struct obs_video_info *ovi)
+{
+	vi->name       = "canvas";
+	vi->format     = ovi->output_format;
+	vi->fps_num    = ovi->fps_num;
+	vi->fps_den    = ovi->fps_den;
+	vi->width      = ovi->output_width;
+	vi->height     = ovi->output_height;
+	vi->range      = ovi->range;
+	vi->colorspace = ovi->colorspace;
+	vi->cache_size = 6;
+}
+
+static inline bool canvas_scaled(const struct obs_canvas *canvas)
+{
+	return canvas->ovi.output_width  != canvas->ovi.base_width ||
+	       canvas->ovi.output_height != canvas->ovi.base_height;
+}
+
+static bool obs_canvas_init_textures(struct obs_canvas *canvas)
+{
+	const struct obs_video_info *ovi = &canvas->ovi;
+
+	canvas->render_texture = gs_texture_create(
+			ovi->base_width, ovi->base_height,
+			GS_RGBA, 1, NULL, GS_RENDER_TARGET);
+	if (!canvas->render_texture)
+		return false;
+
+	if (canvas_scaled(canvas)) {
+		canvas->output_texture = gs_texture_create(
+				ovi->output_width, ovi->output_height,
+				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
+		if (!canvas->output_texture)
+			return false;
+	}
+
+	for (size_t i = 0; i < NUM_TEXTURES; i++) {
+		canvas->copy_surfaces[i] = gs_stagesurface_create(
+				ovi->output_width, ovi->output_height,
+				GS_RGBA);
+		if (!canvas->copy_surfaces[i])
+			return false;
+	}
+
+	return true;
+}
+
+static bool obs_canvas_init_scaler(struct obs_canvas *canvas)
+{
+	const struct obs_video_info *ovi = &canvas->ovi;
+
+	if (ovi->output_format == VIDEO_FORMAT_RGBA)
+		return true;
+
+	struct video_scale_info from = {
+		.format     = VIDEO_FORMAT_RGBA,
+		.width      = ovi->output_width,
+		.height     = ovi->output_height,
+		.range      = ovi->range,
+		.colorspace = ovi->colorspace
+	};
+	struct video_scale_info to = {
+		.format     = ovi->output_format,
+		.width      = ovi->output_width,
+		.height     = ovi->output_height,
+		.range      = ovi->range,
+		.colorspace = ovi->colorspace
+	};
+
+	return video_scaler_create(&canvas->scaler, &to, &from,
+			VIDEO_SCALE_POINT) == VIDEO_SCALER_SUCCESS;
+}
+
+static bool obs_canvas_init(struct obs_canvas *canvas)
+{
+	struct video_output_info vi;
+	bool success;
+
+	if (!obs_view_init(&canvas->view))
+		return false;
+
+	make_canvas_video_info(&vi, &canvas->ovi);
+	if (video_output_open(&canvas->video, &vi) != VIDEO_OUTPUT_SUCCESS) {
+		blog(LOG_ERROR, "obs_canvas_init: Could not open video output");
+		return false;
+	}
+
+	canvas->frame_interval = video_output_get_frame_time(canvas->video);
+
+	if (!obs_canvas_init_scaler(canvas)) {
+		blog(LOG_ERROR, "obs_canvas_init: Failed to create scaler");
+		return false;
+	}
+
+	gs_enter_context(obs->video.graphics);
+	success = obs_canvas_init_textures(canvas);
+	gs_leave_context();
+
+	if (!success)
+		blog(LOG_ERROR, "obs_canvas_init: Failed to create textures");
+	return success;
+}
+
+obs_canvas_t *obs_canvas_create(const struct obs_video_info *ovi)
+{
+	struct obs_video_info aligned;
+	struct obs_canvas *canvas;
+
+	if (!obs || !obs->video.graphics || !ovi)
+		return NULL;
+
+	/* align to multiple-of-two and SSE alignment sizes before validating,
+	 * so that a size that aligns down to nothing is rejected */
+	aligned = *ovi;
+	aligned.output_width  &= 0xFFFFFFFC;
+	aligned.output_height &= 0xFFFFFFFE;
+
+	if (aligned.base_width < 2 || aligned.base_height < 2 ||
+	    aligned.output_width < 2 || aligned.output_height < 2 ||
+	    !aligned.fps_num || !aligned.fps_den) {
+		blog(LOG_ERROR, "obs_canvas_create: Invalid video parameters");
+		return NULL;
+	}
+
+	canvas = bzalloc(sizeof(struct obs_canvas));
+	canvas->ovi = aligned;
+
+	if (!obs_canvas_init(canvas)) {
+		obs_canvas_destroy(canvas);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+	canvas->prev_next       = &obs->data.first_canvas;
+	canvas->next            = obs->data.first_canvas;
+	obs->data.first_canvas  = canvas;
+	if (canvas->next)
+		canvas->next->prev_next = &canvas->next;
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+
+	blog(LOG_INFO, "canvas created: %dx%d -> %dx%d, %d/%d fps, %s",
+			canvas->ovi.base_width, canvas->ovi.base_height,
+			canvas->ovi.output_width, canvas->ovi.output_height,
+			canvas->ovi.fps_num, canvas->ovi.fps_den,
+			get_video_format_name(canvas->ovi.output_format));
+
+	return canvas;
+}
+
+static void obs_canvas_free_channels(struct obs_canvas *canvas)
+{
+	struct obs_view *view = &canvas->view;
+
+	for (size_t i = 0; i < MAX_CHANNELS; i++) {
+		struct obs_source *source = view->channels[i];
+		if (source) {
+			obs_source_deactivate(source, MAIN_VIEW);
+			obs_source_release(source);
+		}
+	}
+
+	memset(view->channels, 0, sizeof(view->channels));
+	pthread_mutex_destroy(&view->channels_mutex);
+}
+
+void obs_canvas_destroy(obs_canvas_t *canvas)
+{
+	if (!canvas)
+		return;
+
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+	if (canvas->prev_next)
+		*canvas->prev_next = canvas->next;
+	if (canvas->next)
+		canvas->next->prev_next = canvas->prev_next;
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+
+	video_output_close(canvas->video);
+	video_scaler_destroy(canvas->scaler);
+
+	obs_enter_graphics();
+	for (size_t i = 0; i < NUM_TEXTURES; i++)
+		gs_stagesurface_destroy(canvas->copy_surfaces[i]);
+	gs_texture_destroy(canvas->output_texture);
+	gs_texture_destroy(canvas->render_texture);
+	obs_leave_graphics();
+
+	obs_canvas_free_channels(canvas);
+	bfree(canvas);
+}
+
+bool obs_canvas_get_video_info(const obs_canvas_t *canvas,
+		struct obs_video_info *ovi)
+{
+	if (!canvas || !ovi)
+		return false;
+
+	*ovi = canvas->ovi;
+	return true;
+}
+
+video_t *obs_canvas_get_video(const obs_canvas_t *canvas)
+{
+	return canvas ? canvas->video : NULL;
+}
+
+void obs_canvas_set_source(obs_canvas_t *canvas, uint32_t channel,
+		obs_source_t *source)
+{
+	struct obs_source *prev_source;
+	struct obs_view *view;
+
+	assert(channel < MAX_CHANNELS);
+
+	if (!canvas) return;
+	if (channel >= MAX_CHANNELS) return;
+
+	view = &canvas->view;
+
+	pthread_mutex_lock(&view->channels_mutex);
+
+	obs_source_addref(source);
+
+	prev_source = view->channels[channel];
+	view->channels[channel] = source;
+
+	pthread_mutex_unlock(&view->channels_mutex);
+
+	/* canvases are outputs in their own right, so their sources are
+	 * activated the same way as those of the main view */
+	if (source)
+		obs_source_activate(source, MAIN_VIEW);
+
+	if (prev_source) {
+		obs_source_deactivate(prev_source, MAIN_VIEW);
+		obs_source_release(prev_source);
+	}
+}
+
+obs_source_t *obs_canvas_get_source(obs_canvas_t *canvas, uint32_t channel)
+{
+	return canvas ? obs_view_get_source(&canvas->view, channel) : NULL;
+}
+
+void obs_canvas_render_texture(obs_canvas_t *canvas)
+{
+	gs_texture_t *tex;
+	gs_effect_t *effect;
+	gs_eparam_t *param;
+
+	if (!canvas || !canvas->texture_rendered)
+		return;
+
+	tex = canvas->render_texture;
+	effect = obs_get_base_effect(OBS_EFFECT_DEFAULT);
+	param = gs_effect_get_param_by_name(effect, "image");
+	gs_effect_set_texture(param, tex);
+
+	while (gs_effect_loop(effect, "Draw"))
+		gs_draw_sprite(tex, 0, 0, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Rendering (graphics thread) */
+
+static inline void set_canvas_render_size(uint32_t width, uint32_t height)
+{
+	gs_enable_depth_test(false);
+	gs_set_cull_mode(GS_NEITHER);
+
+	gs_ortho(0.0f, (float)width, 0.0f, (float)height, -100.0f, 100.0f);
+	gs_set_viewport(0, 0, width, height);
+}
+
+static void render_canvas_texture(struct obs_canvas *canvas)
+{
+	struct vec4 clear_color;
+	vec4_set(&clear_color, 0.0f, 0.0f, 0.0f, 0.0f);
+
+	gs_set_render_target(canvas->render_texture, NULL);
+	gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+
+	set_canvas_render_size(canvas->ovi.base_width, canvas->ovi.base_height);
+	obs_view_render(&canvas->view);
+
+	canvas->texture_rendered = true;
+}
+
+static gs_effect_t *get_canvas_scale_effect(const struct obs_canvas *canvas)
+{
+	const struct obs_video_info *ovi = &canvas->ovi;
+	struct obs_core_video *video = &obs->video;
+	gs_effect_t *effect;
+
+	if (ovi->output_width  < (ovi->base_width  / 2) &&
+	    ovi->output_height < (ovi->base_height / 2)) {
+		effect = video->bilinear_lowres_effect;
+	} else {
+		switch (ovi->scale_type) {
+		case OBS_SCALE_BILINEAR: effect = video->default_effect; break;
+		case OBS_SCALE_LANCZOS:  effect = video->lanczos_effect; break;
+		default:                 effect = video->bicubic_effect;
+		}
+	}
+
+	return effect ? effect : video->default_effect;
+}
+
+static void render_canvas_output(struct obs_canvas *canvas)
+{
+	gs_texture_t   *texture = canvas->render_texture;
+	uint32_t       width    = canvas->ovi.output_width;
+	uint32_t       height   = canvas->ovi.output_height;
+	gs_effect_t    *effect  = get_canvas_scale_effect(canvas);
+	gs_technique_t *tech    = gs_effect_get_technique(effect, "Draw");
+	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
+	gs_eparam_t    *bres_i  = gs_effect_get_param_by_name(effect,
+			"base_dimension_i");
+	size_t         passes, i;
+
+	gs_set_render_target(canvas->output_texture, NULL);
+	set_canvas_render_size(width, height);
+
+	if (bres_i) {
+		struct vec2 base_i;
+		vec2_set(&base_i,
+			1.0f / (float)canvas->ovi.base_width,
+			1.0f / (float)canvas->ovi.base_height);
+		gs_effect_set_vec2(bres_i, &base_i);
+	}
+
+	gs_effect_set_texture(image, texture);
+
+	gs_enable_blending(false);
+	passes = gs_technique_begin(tech);
+	for (i = 0; i < passes; i++) {
+		gs_technique_begin_pass(tech, i);
+		gs_draw_sprite(texture, 0, width, height);
+		gs_technique_end_pass(tech);
+	}
+	gs_technique_end(tech);
+	gs_enable_blending(true);
+}
+
+static void stage_canvas_output(struct obs_canvas *canvas,
+		uint64_t timestamp, int count)
+{
+	int cur = canvas->cur_stage_surface;
+	gs_texture_t *texture = canvas_scaled(canvas) ?
+		canvas->output_texture : canvas->render_texture;
+
+	gs_stage_texture(canvas->copy_surfaces[cur], texture);
+
+	canvas->copy_timestamps[cur] = timestamp;
+	canvas->copy_counts[cur] = count;
+	canvas->textures_copied[cur] = true;
+}
+
+static inline void copy_canvas_frame(struct video_frame *output,
+		const uint8_t *data, uint32_t linesize, uint32_t width,
+		uint32_t height)
+{
+	if (linesize == output->linesize[0]) {
+		memcpy(output->data[0], data, linesize * height);
+	} else {
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(output->data[0] + output->linesize[0] * y,
+					data + linesize * y, width * 4);
+	}
+}
+
+/* outputs the oldest staged frame, which is the next one to be staged to */
+static void output_canvas_frame(struct obs_canvas *canvas)
+{
+	int oldest = (canvas->cur_stage_surface + 1) % NUM_TEXTURES;
+	gs_stagesurf_t *surface = canvas->copy_surfaces[oldest];
+	struct video_frame output;
+	uint8_t *data;
+	uint32_t linesize;
+
+	if (!canvas->textures_copied[oldest])
+		return;
+	if (!gs_stagesurface_map(surface, &data, &linesize))
+		return;
+
+	if (video_output_lock_frame(canvas->video, &output,
+				canvas->copy_counts[oldest],
+				canvas->copy_timestamps[oldest])) {
+		if (canvas->scaler) {
+			const uint8_t *input[] = {data};
+			const uint32_t input_linesize[] = {linesize};
+
+			video_scaler_scale(canvas->scaler,
+					output.data, output.linesize,
+					input, input_linesize);
+		} else {
+			copy_canvas_frame(&output, data, linesize,
+					canvas->ovi.output_width,
+					canvas->ovi.output_height);
+		}
+
+		video_output_unlock_frame(canvas->video);
+	}
+
+	gs_stagesurface_unmap(surface);
+	canvas->textures_copied[oldest] = false;
+}
+
+static void render_canvas(struct obs_canvas *canvas, uint64_t video_time)
+{
+	bool active = video_output_active(canvas->video);
+	int count;
+
+	if (!canvas->next_frame_time)
+		canvas->next_frame_time = video_time;
+	if (video_time < canvas->next_frame_time)
+		return;
+
+	count = 1 + (int)((video_time - canvas->next_frame_time) /
+			canvas->frame_interval);
+	canvas->next_frame_time += canvas->frame_interval * count;
+
+	if (active && !canvas->was_active) {
+		memset(canvas->textures_copied, 0,
+				sizeof(canvas->textures_copied));
+		canvas->cur_stage_surface = 0;
+	}
+	canvas->was_active = active;
+
+	render_canvas_texture(canvas);
+
+	if (!active)
+		return;
+
+	if (canvas_scaled(canvas))
+		render_canvas_output(canvas);
+
+	output_canvas_frame(canvas);
+	stage_canvas_output(canvas, video_time, count);
+
+	if (++canvas->cur_stage_surface == NUM_TEXTURES)
+		canvas->cur_stage_surface = 0;
+}
+
+static const char *render_canvases_name = "render_canvases";
+void render_canvases(uint64_t video_time)
+{
+	struct obs_canvas *canvas;
+
+	pthread_mutex_lock(&obs->data.canvases_mutex);
+
+	canvas = obs->data.first_canvas;
+	if (!canvas)
+		goto unlock;
+
+	profile_start(render_canvases_name);
+	gs_enter_context(obs->video.graphics);
+	gs_begin_scene();
+
+	while (canvas) {
+		render_canvas(canvas, video_time);
+		canvas = canvas->next;
+	}
+
+	gs_set_render_target(NULL, NULL);
+	gs_end_scene();
+	gs_leave_context();
+	profile_end(render_canvases_name);
+
+unlock:
+	pthread_mutex_unlock(&obs->data.canvases_mutex);
+}
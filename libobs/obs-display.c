@@ -172,19 +172,34 @@ static inline void render_display_begin(struct obs_display *display,
 	gs_set_viewport(0, 0, cx, cy);
 }
 
-static inline void render_display_end()
+static inline void *render_display_end()
 {
 	gs_end_scene();
-	gs_present();
+	return gs_present_begin();
 }
 
-void render_display(struct obs_display *display)
+void render_display(struct obs_display *display, uint64_t time)
 {
 	uint32_t cx, cy;
 	bool size_changed;
+	void *present;
 
 	if (!display || !display->enabled) return;
 
+	if (display->render_interval_ns) {
+		uint64_t interval = display->render_interval_ns;
+		uint64_t next = display->last_render_ns + interval;
+
+		/* allow for half a video frame of jitter, otherwise the
+		 * display would drop to a lower multiple of the frame rate */
+		if (time + video_output_get_frame_time(obs->video.video) / 2 <
+				next)
+			return;
+
+		/* skip the missed frames if rendering fell behind */
+		display->last_render_ns = time > next + interval ? time : next;
+	}
+
 	/* -------------------------------------------- */
 
 	pthread_mutex_lock(&display->draw_info_mutex);
@@ -200,6 +215,11 @@ void render_display(struct obs_display *display)
 
 	/* -------------------------------------------- */
 
+	/* the context is only held while drawing, so that the graphics
+	 * thread can output frames between displays and while they are
+	 * presented */
+	gs_enter_context(obs->video.graphics);
+
 	render_display_begin(display, cx, cy, size_changed);
 
 	pthread_mutex_lock(&display->draw_callbacks_mutex);
@@ -213,7 +233,11 @@ void render_display(struct obs_display *display)
 
 	pthread_mutex_unlock(&display->draw_callbacks_mutex);
 
-	render_display_end();
+	present = render_display_end();
+
+	gs_leave_context();
+
+	gs_present_end(obs->video.graphics, display->swap, present);
 }
 
 void obs_display_set_enabled(obs_display_t *display, bool enable)
@@ -222,6 +246,13 @@ void obs_display_set_enabled(obs_display_t *display, bool enable)
 		display->enabled = enable;
 }
 
+void obs_display_set_max_fps(obs_display_t *display, double fps)
+{
+	if (display)
+		display->render_interval_ns = fps > 0.0 ?
+			(uint64_t)(1000000000.0 / fps) : 0;
+}
+
 bool obs_display_enabled(obs_display_t *display)
 {
 	return display ? display->enabled : false;
@@ -28,13 +28,35 @@ struct obs_encoder_info *find_encoder(const char *id)
 	for (size_t i = 0; i < obs->encoder_types.num; i++) {
 		struct obs_encoder_info *info = obs->encoder_types.array+i;
 
-		if (strcmp(info->id, id) == 0)
-			return info;
+		if (strcmp(info->id, id) != 0)
+			continue;
+
+		/* the info of a loaded deferred type is kept in its type data */
+		if (!info->create && obs_deferred_type_loaded(info->type_data)) {
+			struct obs_module_type *type = info->type_data;
+			return &type->encoder_info;
+		}
+
+		return info;
 	}
 
 	return NULL;
 }
 
+/* returns the encoder info, loading the module that registered it first if
+ * the module was deferred */
+static struct obs_encoder_info *find_loaded_encoder(const char *id)
+{
+	struct obs_encoder_info *info = find_encoder(id);
+
+	if (info && !info->create) {
+		obs_load_deferred_type(info->type_data);
+		info = find_encoder(id);
+	}
+
+	return (info && info->create) ? info : NULL;
+}
+
 const char *obs_encoder_get_display_name(const char *id)
 {
 	struct obs_encoder_info *ei = find_encoder(id);
@@ -49,6 +71,7 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 	pthread_mutex_init_value(&encoder->init_mutex);
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->audio_queue_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -63,6 +86,10 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		return false;
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->audio_queue_mutex, NULL) != 0)
+		return false;
+
+	encoder->audio_batch = 1;
 
 	if (encoder->orig_info.get_defaults)
 		encoder->orig_info.get_defaults(encoder->context.settings);
@@ -75,7 +102,7 @@ static struct obs_encoder *create_encoder(const char *id,
 		obs_data_t *settings, size_t mixer_idx, obs_data_t *hotkey_data)
 {
 	struct obs_encoder *encoder;
-	struct obs_encoder_info *ei = find_encoder(id);
+	struct obs_encoder_info *ei = find_loaded_encoder(id);
 	bool success;
 
 	if (ei && ei->type != type)
@@ -185,12 +212,83 @@ static inline bool gpu_encode_available(const struct obs_encoder *encoder)
 		obs->video.using_nv12_tex;
 }
 
+static void free_audio_queue(struct obs_encoder *encoder)
+{
+	pthread_mutex_lock(&encoder->audio_queue_mutex);
+	for (size_t i = 0; i < MAX_AV_PLANES; i++)
+		circlebuf_free(&encoder->audio_queue[i]);
+	circlebuf_free(&encoder->audio_queue_blocks);
+	encoder->audio_queue_frames = 0;
+	pthread_mutex_unlock(&encoder->audio_queue_mutex);
+}
+
+static void *audio_encoder_thread(void *data);
+
+/* joins a thread that was stopped from within itself */
+static void join_audio_thread(struct obs_encoder *encoder)
+{
+	if (encoder->audio_thread_joinable) {
+		pthread_join(encoder->audio_thread, NULL);
+		encoder->audio_thread_joinable = false;
+	}
+}
+
+static bool start_audio_thread(struct obs_encoder *encoder)
+{
+	join_audio_thread(encoder);
+
+	if (os_sem_init(&encoder->audio_sem, 0) != 0)
+		return false;
+
+	if (pthread_create(&encoder->audio_thread, NULL, audio_encoder_thread,
+				encoder) != 0) {
+		os_sem_destroy(encoder->audio_sem);
+		encoder->audio_sem = NULL;
+		return false;
+	}
+
+	/* cleared only after the new thread id is stored, so that a previous
+	 * thread that stopped itself can never pick up the new queue */
+	os_atomic_set_bool(&encoder->audio_thread_stop, false);
+	encoder->audio_thread_active = true;
+	encoder->audio_thread_joinable = true;
+	return true;
+}
+
+static void stop_audio_thread(struct obs_encoder *encoder)
+{
+	if (!encoder->audio_thread_active)
+		return;
+
+	os_atomic_set_bool(&encoder->audio_thread_stop, true);
+	os_sem_post(encoder->audio_sem);
+
+	/* an encoding error stops the encoder from its own thread, which
+	 * then exits on its own once the stop flag is seen.  it is joined
+	 * when the encoder is started again or destroyed. */
+	if (!pthread_equal(pthread_self(), encoder->audio_thread))
+		join_audio_thread(encoder);
+
+	os_sem_destroy(encoder->audio_sem);
+	encoder->audio_sem = NULL;
+	encoder->audio_thread_active = false;
+
+	free_audio_queue(encoder);
+}
+
 static void add_connection(struct obs_encoder *encoder)
 {
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		struct audio_convert_info audio_info = {0};
 		get_audio_info(encoder, &audio_info);
 
+		if (encoder->audio_threaded && !start_audio_thread(encoder)) {
+			blog(LOG_WARNING, "Failed to create audio thread for "
+					"encoder '%s', encoding on the audio "
+					"thread instead",
+					encoder->context.name);
+		}
+
 		audio_output_connect(encoder->media, encoder->mixer_idx,
 				&audio_info, receive_audio, encoder);
 	} else {
@@ -213,6 +311,7 @@ static void remove_connection(struct obs_encoder *encoder)
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		audio_output_disconnect(encoder->media, encoder->mixer_idx,
 				receive_audio, encoder);
+		stop_audio_thread(encoder);
 	} else {
 		if (gpu_encode_available(encoder)) {
 			stop_gpu_encode(encoder);
@@ -237,6 +336,18 @@ static inline void free_audio_buffers(struct obs_encoder *encoder)
 static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 {
 	if (encoder) {
+		/* the audio thread is still using the encoder if it was
+		 * stopped from within itself, so it destroys the encoder
+		 * itself once it exits */
+		if (encoder->audio_thread_joinable &&
+		    pthread_equal(pthread_self(), encoder->audio_thread)) {
+			os_atomic_set_bool(&encoder->audio_thread_destroy,
+					true);
+			return;
+		}
+
+		join_audio_thread(encoder);
+
 		pthread_mutex_lock(&encoder->outputs_mutex);
 		for (size_t i = 0; i < encoder->outputs.num; i++) {
 			struct obs_output *output = encoder->outputs.array[i];
@@ -255,6 +366,8 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		pthread_mutex_destroy(&encoder->init_mutex);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		free_audio_queue(encoder);
+		pthread_mutex_destroy(&encoder->audio_queue_mutex);
 		obs_context_data_free(&encoder->context);
 		if (encoder->owns_info_id)
 			bfree((void*)encoder->info.id);
@@ -312,7 +425,7 @@ static inline obs_data_t *get_defaults(const struct obs_encoder_info *info)
 
 obs_data_t *obs_encoder_defaults(const char *id)
 {
-	const struct obs_encoder_info *info = find_encoder(id);
+	const struct obs_encoder_info *info = find_loaded_encoder(id);
 	return (info) ? get_defaults(info) : NULL;
 }
 
@@ -326,7 +439,7 @@ obs_data_t *obs_encoder_get_defaults(const obs_encoder_t *encoder)
 
 obs_properties_t *obs_get_encoder_properties(const char *id)
 {
-	const struct obs_encoder_info *ei = find_encoder(id);
+	const struct obs_encoder_info *ei = find_loaded_encoder(id);
 	if (ei && (ei->get_properties || ei->get_properties2)) {
 		obs_data_t       *defaults = get_defaults(ei);
 		obs_properties_t *properties;
@@ -462,7 +575,7 @@ void *obs_encoder_create_rerouted(obs_encoder_t *encoder, const char *reroute_id
 	if (!can_reroute)
 		return NULL;
 
-	const struct obs_encoder_info *ei = find_encoder(reroute_id);
+	const struct obs_encoder_info *ei = find_loaded_encoder(reroute_id);
 	if (ei) {
 		if (ei->type != encoder->orig_info.type ||
 		    astrcmpi(ei->codec, encoder->orig_info.codec) != 0) {
@@ -901,6 +1014,16 @@ void do_encode(struct obs_encoder *encoder, struct encoder_frame *frame)
 	profile_end(do_encode_name);
 }
 
+static inline int64_t get_video_pts(const struct obs_encoder *encoder,
+		uint64_t timestamp)
+{
+	uint64_t frame_time = video_output_get_frame_time(encoder->media);
+	uint64_t frames = (timestamp - encoder->start_ts + frame_time / 2) /
+		frame_time;
+
+	return (int64_t)frames * (int64_t)encoder->timebase_num;
+}
+
 static const char *receive_video_name = "receive_video";
 static void receive_video(void *param, struct video_data *frame)
 {
@@ -927,6 +1050,11 @@ static void receive_video(void *param, struct video_data *frame)
 	if (!encoder->start_ts)
 		encoder->start_ts = frame->timestamp;
 
+	/* frames dropped by the video output (see video-io.c) never reach the
+	 * encoder, so the pts follows the frame timestamp rather than the
+	 * number of frames received, to stay in sync with audio */
+	encoder->cur_pts = get_video_pts(encoder, frame->timestamp);
+
 	enc_frame.frames = 1;
 	enc_frame.pts    = encoder->cur_pts;
 
@@ -1063,13 +1191,15 @@ static void send_audio_data(struct obs_encoder *encoder)
 	encoder->cur_pts += encoder->framesize;
 }
 
-static const char *receive_audio_name = "receive_audio";
-static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
+static inline bool audio_thread_stopping(struct obs_encoder *encoder)
 {
-	profile_start(receive_audio_name);
-
-	struct obs_encoder *encoder = param;
+	return os_atomic_load_bool(&encoder->audio_thread_stop) ||
+		!pthread_equal(pthread_self(), encoder->audio_thread);
+}
 
+static void encode_audio(struct obs_encoder *encoder, struct audio_data *data,
+		bool threaded)
+{
 	if (!encoder->first_received) {
 		encoder->first_raw_ts = data->timestamp;
 		encoder->first_received = true;
@@ -1077,14 +1207,143 @@ static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
 	}
 
 	if (!buffer_audio(encoder, data))
-		goto end;
+		return;
+
+	while (encoder->audio_input_buffer[0].size >= encoder->framesize_bytes) {
+		if (threaded && audio_thread_stopping(encoder))
+			break;
 
-	while (encoder->audio_input_buffer[0].size >= encoder->framesize_bytes)
 		send_audio_data(encoder);
+	}
+}
+
+struct audio_block {
+	uint64_t timestamp;
+	uint32_t frames;
+};
+
+/* copies the mixed audio for the encoder thread.  only the copy is done on
+ * the audio thread, and the encoder thread is woken once enough audio has
+ * been queued to encode audio_batch frames */
+static void queue_audio(struct obs_encoder *encoder, struct audio_data *data)
+{
+	struct audio_block block = {data->timestamp, data->frames};
+	size_t size = data->frames * encoder->blocksize;
+	size_t batch_frames = encoder->framesize * encoder->audio_batch;
+	bool wake = false;
+
+	pthread_mutex_lock(&encoder->audio_queue_mutex);
+
+	for (size_t i = 0; i < encoder->planes; i++)
+		circlebuf_push_back(&encoder->audio_queue[i], data->data[i],
+				size);
+	circlebuf_push_back(&encoder->audio_queue_blocks, &block,
+			sizeof(block));
+
+	encoder->audio_queue_frames += data->frames;
+	if (encoder->audio_queue_frames >= batch_frames) {
+		encoder->audio_queue_frames = 0;
+		wake = true;
+	}
+
+	pthread_mutex_unlock(&encoder->audio_queue_mutex);
+
+	if (wake)
+		os_sem_post(encoder->audio_sem);
+}
+
+static bool pop_audio_block(struct obs_encoder *encoder,
+		struct audio_data *audio, uint8_t **planes, size_t *capacity)
+{
+	struct audio_block block;
+	size_t size;
+
+	pthread_mutex_lock(&encoder->audio_queue_mutex);
+
+	if (!encoder->audio_queue_blocks.size) {
+		pthread_mutex_unlock(&encoder->audio_queue_mutex);
+		return false;
+	}
+
+	circlebuf_pop_front(&encoder->audio_queue_blocks, &block,
+			sizeof(block));
+	size = block.frames * encoder->blocksize;
+
+	if (size > *capacity) {
+		for (size_t i = 0; i < encoder->planes; i++)
+			planes[i] = brealloc(planes[i], size);
+		*capacity = size;
+	}
+
+	for (size_t i = 0; i < encoder->planes; i++) {
+		circlebuf_pop_front(&encoder->audio_queue[i], planes[i], size);
+		audio->data[i] = planes[i];
+	}
+
+	pthread_mutex_unlock(&encoder->audio_queue_mutex);
+
+	audio->frames    = block.frames;
+	audio->timestamp = block.timestamp;
+	return true;
+}
+
+static const char *audio_encoder_thread_name = "audio_encoder_thread";
+static void *audio_encoder_thread(void *data)
+{
+	struct obs_encoder *encoder = data;
+	uint8_t *planes[MAX_AV_PLANES] = {0};
+	size_t capacity = 0;
+
+	os_set_thread_name("libobs: audio encoder thread");
+
+	while (os_sem_wait(encoder->audio_sem) == 0) {
+		struct audio_data audio = {0};
+		bool stopping;
+
+		if (audio_thread_stopping(encoder))
+			break;
+
+		profile_start(audio_encoder_thread_name);
+
+		while (!(stopping = audio_thread_stopping(encoder)) &&
+		       pop_audio_block(encoder, &audio, planes, &capacity))
+			encode_audio(encoder, &audio, true);
+
+		profile_end(audio_encoder_thread_name);
+		profile_reenable_thread();
+
+		/* the semaphore is already destroyed if the encoder was
+		 * stopped from this thread */
+		if (stopping)
+			break;
+	}
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++)
+		bfree(planes[i]);
+
+	if (os_atomic_load_bool(&encoder->audio_thread_destroy)) {
+		pthread_detach(encoder->audio_thread);
+		encoder->audio_thread_joinable = false;
+		obs_encoder_actually_destroy(encoder);
+	}
+
+	return NULL;
+}
+
+static const char *receive_audio_name = "receive_audio";
+static void receive_audio(void *param, size_t mix_idx, struct audio_data *data)
+{
+	profile_start(receive_audio_name);
+
+	struct obs_encoder *encoder = param;
+
+	if (encoder->audio_thread_active)
+		queue_audio(encoder, data);
+	else
+		encode_audio(encoder, data, false);
 
 	UNUSED_PARAMETER(mix_idx);
 
-end:
 	profile_end(receive_audio_name);
 }
 
@@ -1168,6 +1427,31 @@ void obs_encoder_set_preferred_video_format(obs_encoder_t *encoder,
 	encoder->preferred_format = format;
 }
 
+void obs_encoder_set_audio_thread(obs_encoder_t *encoder, bool enabled,
+		uint32_t batch_frames)
+{
+	if (!encoder || encoder->info.type != OBS_ENCODER_AUDIO)
+		return;
+
+	if (encoder_active(encoder)) {
+		blog(LOG_WARNING, "encoder '%s': Cannot change the audio "
+				"thread while the encoder is active",
+				encoder->context.name);
+		return;
+	}
+
+	encoder->audio_threaded = enabled;
+	encoder->audio_batch    = batch_frames ? batch_frames : 1;
+}
+
+bool obs_encoder_audio_thread_enabled(const obs_encoder_t *encoder)
+{
+	if (!encoder || encoder->info.type != OBS_ENCODER_AUDIO)
+		return false;
+
+	return encoder->audio_threaded;
+}
+
 enum video_format obs_encoder_get_preferred_video_format(
 		const obs_encoder_t *encoder)
 {
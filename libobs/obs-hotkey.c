@@ -138,7 +138,9 @@ void obs_hotkey_pair_set_descriptions(obs_hotkey_pair_id id,
 static void hotkey_signal(const char *signal, obs_hotkey_t *hotkey)
 {
 	calldata_t data;
-	calldata_init(&data);
+	uint8_t stack[128];
+
+	calldata_init_stack(&data, stack, sizeof(stack));
 	calldata_set_ptr(&data, "key", hotkey);
 
 	signal_handler_signal(obs->hotkeys.signals, signal, &data);
@@ -37,6 +37,8 @@
 #include "obs.h"
 
 #define NUM_TEXTURES 2
+#define MAX_STAGE_SURFACES 4
+#define NUM_CONVERSION_PARAMS 11
 #define MICROSECOND_DEN 1000000
 #define NUM_ENCODE_TEXTURES 3
 #define NUM_ENCODE_TEXTURE_FRAMES_TO_WAIT 1
@@ -79,6 +81,21 @@ static inline bool obs_object_valid(const void *obj, const char *f,
 /* ------------------------------------------------------------------------- */
 /* modules */
 
+/* a type registered by a deferred module, restored from the module cache.
+ * once the module is loaded, the info it registers is stored here instead of
+ * replacing the deferred entry, so that the shared type arrays are never
+ * rewritten while other threads are reading them */
+struct obs_module_type {
+	struct obs_module       *module;
+	char                    *id;
+	char                    *name;
+	char                    *codec;
+
+	volatile bool           loaded;
+	struct obs_source_info  source_info;
+	struct obs_encoder_info encoder_info;
+};
+
 struct obs_module {
 	char *mod_name;
 	const char *file;
@@ -87,6 +104,22 @@ struct obs_module {
 	void *module;
 	bool loaded;
 
+	/* time spent opening the library and loading its locale, and time
+	 * spent in obs_module_load */
+	uint64_t open_time_ns;
+	uint64_t init_time_ns;
+
+	/* modules that only register sources and encoders can be registered
+	 * from the module cache and loaded when one of their types is first
+	 * used (see OBS_MODULE_ALLOW_DEFERRED_LOAD) */
+	bool allow_deferred_load;
+	bool deferred;
+	bool registers_other_types;
+	obs_data_t *cache_data;
+	DARRAY(struct obs_module_type*) deferred_types;
+	DARRAY(char*) source_ids;
+	DARRAY(char*) encoder_ids;
+
 	bool        (*load)(void);
 	void        (*unload)(void);
 	void        (*post_load)(void);
@@ -102,6 +135,21 @@ struct obs_module {
 };
 
 extern void free_module(struct obs_module *mod);
+extern bool obs_load_deferred_module(struct obs_module *mod);
+
+/* deferred types are registered without a create callback, and their type
+ * data is a struct obs_module_type */
+static inline void obs_load_deferred_type(void *type_data)
+{
+	struct obs_module_type *type = type_data;
+	obs_load_deferred_module(type->module);
+}
+
+static inline bool obs_deferred_type_loaded(void *type_data)
+{
+	struct obs_module_type *type = type_data;
+	return os_atomic_load_bool(&type->loaded);
+}
 
 struct obs_module_path {
 	char *bin;
@@ -205,6 +253,8 @@ struct obs_display {
 	bool                            enabled;
 	uint32_t                        cx, cy;
 	uint32_t                        background_color;
+	uint64_t                        render_interval_ns;
+	uint64_t                        last_render_ns;
 	gs_swapchain_t                  *swap;
 	pthread_mutex_t                 draw_callbacks_mutex;
 	pthread_mutex_t                 draw_info_mutex;
@@ -219,6 +269,37 @@ extern bool obs_display_init(struct obs_display *display,
 extern void obs_display_free(struct obs_display *display);
 
 
+/* ------------------------------------------------------------------------- */
+/* canvases */
+
+struct video_scaler;
+
+struct obs_canvas {
+	struct obs_view                 view;
+	struct obs_video_info           ovi;
+	video_t                         *video;
+	struct video_scaler             *scaler;
+
+	gs_texture_t                    *render_texture;
+	gs_texture_t                    *output_texture;
+	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
+	uint64_t                        copy_timestamps[NUM_TEXTURES];
+	int                             copy_counts[NUM_TEXTURES];
+	bool                            textures_copied[NUM_TEXTURES];
+	bool                            texture_rendered;
+	int                             cur_stage_surface;
+	bool                            was_active;
+
+	uint64_t                        frame_interval;
+	uint64_t                        next_frame_time;
+
+	struct obs_canvas               *next;
+	struct obs_canvas               **prev_next;
+};
+
+extern void render_canvases(uint64_t video_time);
+
+
 /* ------------------------------------------------------------------------- */
 /* core */
 
@@ -237,18 +318,23 @@ struct obs_tex_frame {
 	bool released;
 };
 
+#define MAX_CONVERT_THREADS 8
+
 struct obs_core_video {
 	graphics_t                      *graphics;
-	gs_stagesurf_t                  *copy_surfaces[NUM_TEXTURES];
+	gs_stagesurf_t                  *copy_surfaces[MAX_STAGE_SURFACES];
 	gs_texture_t                    *render_textures[NUM_TEXTURES];
 	gs_texture_t                    *output_textures[NUM_TEXTURES];
 	gs_texture_t                    *convert_textures[NUM_TEXTURES];
 	gs_texture_t                    *convert_uv_textures[NUM_TEXTURES];
 	bool                            textures_rendered[NUM_TEXTURES];
 	bool                            textures_output[NUM_TEXTURES];
-	bool                            textures_copied[NUM_TEXTURES];
+	bool                            textures_copied[MAX_STAGE_SURFACES];
 	bool                            textures_converted[NUM_TEXTURES];
 	bool                            using_nv12_tex;
+	uint32_t                        num_stage_surfaces;
+	uint32_t                        readback_depth;
+	int                             cur_stage_surface;
 	struct circlebuf                vframe_info_buffer;
 	struct circlebuf                vframe_info_buffer_gpu;
 	gs_effect_t                     *default_effect;
@@ -257,6 +343,9 @@ struct obs_core_video {
 	gs_effect_t                     *solid_effect;
 	gs_effect_t                     *repeat_effect;
 	gs_effect_t                     *conversion_effect;
+	gs_eparam_t                     *conversion_image;
+	gs_eparam_t                     *conversion_params[
+	                                        NUM_CONVERSION_PARAMS];
 	gs_effect_t                     *bicubic_effect;
 	gs_effect_t                     *lanczos_effect;
 	gs_effect_t                     *bilinear_lowres_effect;
@@ -278,6 +367,13 @@ struct obs_core_video {
 
 	uint64_t                        video_time;
 	uint64_t                        video_avg_frame_time_ns;
+
+	volatile long                   pacing_spin_us;
+	volatile bool                   pacing_realtime;
+	pthread_mutex_t                 pacing_mutex;
+	struct obs_video_pacing_stats   pacing_stats;
+	uint64_t                        pacing_lateness_total_ns;
+
 	double                          video_fps;
 	video_t                         *video;
 	pthread_t                       video_thread;
@@ -285,6 +381,24 @@ struct obs_core_video {
 	uint32_t                        lagged_frames;
 	bool                            thread_initialized;
 
+	pthread_t                       readback_thread;
+	bool                            readback_thread_initialized;
+	os_sem_t                        *readback_start;
+	os_event_t                      *readback_idle;
+	volatile bool                   readback_stop;
+	struct video_data               readback_frame;
+	int                             readback_count;
+
+	pthread_t                       display_thread;
+	bool                            display_thread_initialized;
+	os_event_t                      *display_start;
+	volatile bool                   display_stop;
+
+	struct format_conversion_pool   *convert_pool;
+	struct video_frame              *convert_output;
+	const struct video_data         *convert_input;
+	const struct video_output_info  *convert_info;
+
 	bool                            gpu_conversion;
 	const char                      *conversion_tech;
 	uint32_t                        conversion_height;
@@ -325,6 +439,7 @@ struct obs_core_audio {
 	struct circlebuf                buffered_timestamps;
 	int                             buffering_wait_ticks;
 	int                             total_buffering_ticks;
+	bool                            realtime;
 
 	float                           user_volume;
 
@@ -339,12 +454,14 @@ struct obs_core_data {
 	struct obs_source               *first_source;
 	struct obs_source               *first_audio_source;
 	struct obs_display              *first_display;
+	struct obs_canvas               *first_canvas;
 	struct obs_output               *first_output;
 	struct obs_encoder              *first_encoder;
 	struct obs_service              *first_service;
 
 	pthread_mutex_t                 sources_mutex;
 	pthread_mutex_t                 displays_mutex;
+	pthread_mutex_t                 canvases_mutex;
 	pthread_mutex_t                 outputs_mutex;
 	pthread_mutex_t                 encoders_mutex;
 	pthread_mutex_t                 services_mutex;
@@ -416,6 +533,8 @@ struct obs_core {
 
 	char                            *locale;
 	char                            *module_config_path;
+	char                            *module_cache_path;
+	struct obs_module               *loading_module;
 	bool                            name_store_owned;
 	profiler_name_store_t           *name_store;
 
@@ -430,6 +549,13 @@ struct obs_core {
 extern struct obs_core *obs;
 
 extern void *obs_graphics_thread(void *param);
+extern bool init_readback_thread(struct obs_core_video *video);
+extern void free_readback_thread(struct obs_core_video *video);
+extern void set_thread_realtime(bool realtime, const char *name);
+extern bool init_display_thread(struct obs_core_video *video);
+extern void free_display_thread(struct obs_core_video *video);
+extern bool init_convert_threads(struct obs_core_video *video);
+extern void free_convert_threads(struct obs_core_video *video);
 
 extern gs_effect_t *obs_load_effect(gs_effect_t **effect, const char *file);
 
@@ -596,6 +722,16 @@ struct obs_source {
 	/* used to temporarily disable sources if needed */
 	bool                            enabled;
 
+	/* set by sources that currently draw only opaque pixels */
+	volatile bool                   opaque;
+
+	/* incremented when the video of a static source changes */
+	volatile long                   video_stamp;
+
+	/* last render of a static source and its filters */
+	gs_texrender_t                  *video_cache;
+	long                            video_cache_stamp;
+
 	/* timing (if video is present, is based upon video) */
 	volatile bool                   timing_set;
 	volatile uint64_t               timing_adjust;
@@ -683,6 +819,7 @@ struct obs_source {
 	DARRAY(struct obs_source*)      filters;
 	pthread_mutex_t                 filter_mutex;
 	gs_texrender_t                  *filter_texrender;
+	long                            filter_cache_stamp;
 	enum obs_allow_direct_render    allow_direct;
 	bool                            rendering_filter;
 
@@ -789,6 +926,18 @@ static inline enum gs_color_format convert_video_format(
 	return GS_BGRX;
 }
 
+/* consumes async frames of a source that is not being rendered this frame */
+extern void obs_source_video_skip(obs_source_t *source);
+
+/* whether a source currently draws only opaque pixels over its entire width
+ * and height */
+extern bool obs_source_is_opaque(const obs_source_t *source);
+
+/* cached render textures of a source and its filters */
+extern bool obs_source_video_cacheable(obs_source_t *source);
+extern bool obs_source_video_cache_stale(obs_source_t *source,
+		long *cache_stamp);
+extern gs_texture_t *obs_source_get_video_cache(obs_source_t *source);
 extern void obs_source_activate(obs_source_t *source, enum view_type type);
 extern void obs_source_deactivate(obs_source_t *source, enum view_type type);
 extern void obs_source_video_tick(obs_source_t *source, float seconds);
@@ -1008,6 +1157,22 @@ struct obs_encoder {
 	uint64_t                        first_raw_ts;
 	uint64_t                        start_ts;
 
+	/* audio encoders can run on their own thread instead of the audio
+	 * thread.  mixed audio is queued by the audio thread, and the encoder
+	 * thread is woken once audio_batch frames of the encoder are queued */
+	bool                            audio_threaded;
+	uint32_t                        audio_batch;
+	bool                            audio_thread_active;
+	bool                            audio_thread_joinable;
+	volatile bool                   audio_thread_stop;
+	volatile bool                   audio_thread_destroy;
+	pthread_t                       audio_thread;
+	os_sem_t                        *audio_sem;
+	pthread_mutex_t                 audio_queue_mutex;
+	struct circlebuf                audio_queue[MAX_AV_PLANES];
+	struct circlebuf                audio_queue_blocks;
+	size_t                          audio_queue_frames;
+
 	pthread_mutex_t                 outputs_mutex;
 	DARRAY(obs_output_t*)            outputs;
 
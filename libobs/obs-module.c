@@ -15,6 +15,8 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <sys/stat.h>
+
 #include "util/platform.h"
 #include "util/dstr.h"
 
@@ -54,6 +56,9 @@ static int load_module_exports(struct obs_module *mod, const char *path)
 	mod->name        = os_dlsym(mod->module, "obs_module_name");
 	mod->description = os_dlsym(mod->module, "obs_module_description");
 	mod->author      = os_dlsym(mod->module, "obs_module_author");
+
+	mod->allow_deferred_load = !!os_dlsym(mod->module,
+			"obs_module_allow_deferred_load");
 	return MODULE_SUCCESS;
 }
 
@@ -72,19 +77,29 @@ static inline char *get_module_name(const char *file)
 	return name.array;
 }
 
+static void set_module_paths(struct obs_module *mod, const char *path,
+		const char *data_path)
+{
+	mod->bin_path  = bstrdup(path);
+	mod->file      = strrchr(mod->bin_path, '/');
+	mod->file      = (!mod->file) ? mod->bin_path : (mod->file + 1);
+	mod->mod_name  = get_module_name(mod->file);
+	mod->data_path = bstrdup(data_path);
+}
+
 #ifdef _WIN32
 extern void reset_win32_symbol_paths(void);
 #endif
 
-int obs_open_module(obs_module_t **module, const char *path,
+/* opens the library and loads its locale without adding it to the module
+ * list, which allows modules to be opened in parallel */
+static int open_module_internal(obs_module_t **module, const char *path,
 		const char *data_path)
 {
 	struct obs_module mod = {0};
+	uint64_t start_time = os_gettime_ns();
 	int errorcode;
 
-	if (!module || !path || !obs)
-		return MODULE_ERROR;
-
 #ifdef __APPLE__
 	/* HACK: Do not load obsolete obs-browser build on macOS; the
 	 * obs-browser plugin used to live in the Application Support
@@ -108,24 +123,36 @@ int obs_open_module(obs_module_t **module, const char *path,
 	if (errorcode != MODULE_SUCCESS)
 		return errorcode;
 
-	mod.bin_path  = bstrdup(path);
-	mod.file      = strrchr(mod.bin_path, '/');
-	mod.file      = (!mod.file) ? mod.bin_path : (mod.file + 1);
-	mod.mod_name  = get_module_name(mod.file);
-	mod.data_path = bstrdup(data_path);
-	mod.next      = obs->first_module;
+	set_module_paths(&mod, path, data_path);
 
 	if (mod.file) {
 		blog(LOG_DEBUG, "Loading module: %s", mod.file);
 	}
 
 	*module = bmemdup(&mod, sizeof(mod));
-	obs->first_module = (*module);
 	mod.set_pointer(*module);
 
 	if (mod.set_locale)
 		mod.set_locale(obs->locale);
 
+	(*module)->open_time_ns = os_gettime_ns() - start_time;
+	return MODULE_SUCCESS;
+}
+
+int obs_open_module(obs_module_t **module, const char *path,
+		const char *data_path)
+{
+	int errorcode;
+
+	if (!module || !path || !obs)
+		return MODULE_ERROR;
+
+	errorcode = open_module_internal(module, path, data_path);
+	if (errorcode != MODULE_SUCCESS)
+		return errorcode;
+
+	(*module)->next = obs->first_module;
+	obs->first_module = *module;
 	return MODULE_SUCCESS;
 }
 
@@ -141,7 +168,12 @@ bool obs_init_module(obs_module_t *module)
 				"obs_init_module(%s)", module->file);
 	profile_start(profile_name);
 
+	uint64_t start_time = os_gettime_ns();
+	obs->loading_module = module;
 	module->loaded = module->load();
+	obs->loading_module = NULL;
+	module->init_time_ns = os_gettime_ns() - start_time;
+
 	if (!module->loaded)
 		blog(LOG_WARNING, "Failed to initialize module '%s'",
 				module->file);
@@ -188,6 +220,16 @@ const char *obs_get_module_data_path(obs_module_t *module)
 	return module ? module->data_path : NULL;
 }
 
+uint64_t obs_get_module_open_time_ns(obs_module_t *module)
+{
+	return module ? module->open_time_ns : 0;
+}
+
+uint64_t obs_get_module_init_time_ns(obs_module_t *module)
+{
+	return module ? module->init_time_ns : 0;
+}
+
 char *obs_find_module_file(obs_module_t *module, const char *file)
 {
 	struct dstr output = {0};
@@ -233,22 +275,439 @@ void obs_add_module_path(const char *bin, const char *data)
 	da_push_back(obs->module_paths, &omp);
 }
 
-static void load_all_callback(void *param, const struct obs_module_info *info)
-{
+#define MAX_MODULE_OPEN_THREADS 8
+
+struct pending_module {
+	char         *bin_path;
+	char         *data_path;
+	obs_data_t   *cache_data;
 	obs_module_t *module;
+	int          code;
+};
+
+struct module_open_queue {
+	DARRAY(struct pending_module) modules;
+	volatile long                 next;
+};
+
+static void find_all_callback(void *param, const struct obs_module_info *info)
+{
+	struct module_open_queue *queue = param;
+	struct pending_module *pending = da_push_back_new(queue->modules);
+
+	pending->bin_path  = bstrdup(info->bin_path);
+	pending->data_path = bstrdup(info->data_path);
+}
+
+static void *module_open_thread(void *param)
+{
+	struct module_open_queue *queue = param;
+
+	os_set_thread_name("libobs: module open thread");
+
+	for (;;) {
+		long idx = os_atomic_inc_long(&queue->next) - 1;
+		if ((size_t)idx >= queue->modules.num)
+			break;
+
+		struct pending_module *pending = queue->modules.array + idx;
+		if (pending->cache_data)
+			continue;
+
+		pending->code = open_module_internal(&pending->module,
+				pending->bin_path, pending->data_path);
+	}
+
+	return NULL;
+}
+
+/* dlopen and locale parsing are independent for each module, so they are
+ * spread over several threads.  Modules are still added to the module list
+ * and initialized in the order they were found, so type registration order
+ * does not depend on thread timing. */
+static void open_modules(struct module_open_queue *queue)
+{
+	pthread_t threads[MAX_MODULE_OPEN_THREADS];
+	size_t num_threads = (size_t)os_get_logical_cores();
+	size_t started = 0;
+
+	if (num_threads > MAX_MODULE_OPEN_THREADS)
+		num_threads = MAX_MODULE_OPEN_THREADS;
+	if (num_threads > queue->modules.num)
+		num_threads = queue->modules.num;
+
+	for (size_t i = 1; i < num_threads; i++) {
+		if (pthread_create(&threads[started], NULL, module_open_thread,
+					queue) == 0)
+			started++;
+	}
+
+	module_open_thread(queue);
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void log_module_load_times(struct module_open_queue *queue,
+		uint64_t total_ns)
+{
+	blog(LOG_INFO, "---------------------------------");
+	blog(LOG_INFO, "Module load times:");
+
+	for (size_t i = 0; i < queue->modules.num; i++) {
+		obs_module_t *mod = queue->modules.array[i].module;
+		if (!mod)
+			continue;
+
+		blog(LOG_INFO, "    %s: open %.1f ms, init %.1f ms", mod->file,
+				(double)mod->open_time_ns / 1000000.0,
+				(double)mod->init_time_ns / 1000000.0);
+	}
+
+	blog(LOG_INFO, "Total: %.1f ms", (double)total_ns / 1000000.0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* module cache / deferred loading */
+
+static pthread_mutex_t deferred_load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct darray *get_source_type_array(enum obs_source_type type)
+{
+	switch (type) {
+	case OBS_SOURCE_TYPE_INPUT:      return &obs->input_types.da;
+	case OBS_SOURCE_TYPE_FILTER:     return &obs->filter_types.da;
+	case OBS_SOURCE_TYPE_TRANSITION: return &obs->transition_types.da;
+	case OBS_SOURCE_TYPE_SCENE:      break;
+	}
+
+	return NULL;
+}
+
+static const char *deferred_type_get_name(void *type_data)
+{
+	struct obs_module_type *type = type_data;
+	return type->name;
+}
+
+static obs_properties_t *deferred_source_get_properties(void *data,
+		void *type_data)
+{
+	struct obs_module_type *type = type_data;
+	const struct obs_source_info *info;
+
+	obs_load_deferred_module(type->module);
+
+	info = get_source_info(type->id);
+	if (!info || !info->create)
+		return NULL;
+
+	if (info->get_properties2)
+		return info->get_properties2(data, info->type_data);
+	else if (info->get_properties)
+		return info->get_properties(data);
+	return NULL;
+}
+
+static obs_properties_t *deferred_encoder_get_properties(void *data,
+		void *type_data)
+{
+	struct obs_module_type *type = type_data;
+	const struct obs_encoder_info *info;
+
+	obs_load_deferred_module(type->module);
+
+	info = find_encoder(type->id);
+	if (!info || !info->create)
+		return NULL;
+
+	if (info->get_properties2)
+		return info->get_properties2(data, info->type_data);
+	else if (info->get_properties)
+		return info->get_properties(data);
+	return NULL;
+}
+
+static struct obs_module_type *create_module_type(struct obs_module *mod,
+		obs_data_t *item)
+{
+	struct obs_module_type *type = bzalloc(sizeof(*type));
+	const char *codec = obs_data_get_string(item, "codec");
 
-	int code = obs_open_module(&module, info->bin_path, info->data_path);
-	if (code != MODULE_SUCCESS) {
-		blog(LOG_DEBUG, "Failed to load module file '%s': %d",
-				info->bin_path, code);
+	type->module = mod;
+	type->id     = bstrdup(obs_data_get_string(item, "id"));
+	type->name   = bstrdup(obs_data_get_string(item, "name"));
+	type->codec  = *codec ? bstrdup(codec) : NULL;
+
+	da_push_back(mod->deferred_types, &type);
+	return type;
+}
+
+static void register_deferred_source(struct obs_module *mod, obs_data_t *item)
+{
+	struct obs_source_info info = {0};
+	struct obs_module_type *type;
+	struct darray *array;
+
+	if (get_source_info(obs_data_get_string(item, "id")))
+		return;
+
+	type = create_module_type(mod, item);
+
+	info.id           = type->id;
+	info.type         = (enum obs_source_type)obs_data_get_int(item,
+			"type");
+	info.output_flags = (uint32_t)obs_data_get_int(item, "output_flags");
+	info.get_name     = deferred_type_get_name;
+	info.type_data    = type;
+
+	if (obs_data_get_bool(item, "configurable"))
+		info.get_properties2 = deferred_source_get_properties;
+
+	array = get_source_type_array(info.type);
+	if (array)
+		darray_push_back(sizeof(struct obs_source_info), array, &info);
+	da_push_back(obs->source_types, &info);
+}
+
+static void register_deferred_encoder(struct obs_module *mod,
+		obs_data_t *item)
+{
+	struct obs_encoder_info info = {0};
+	struct obs_module_type *type;
+
+	if (find_encoder(obs_data_get_string(item, "id")))
 		return;
+
+	type = create_module_type(mod, item);
+
+	info.id        = type->id;
+	info.type      = (enum obs_encoder_type)obs_data_get_int(item, "type");
+	info.codec     = type->codec;
+	info.caps      = (uint32_t)obs_data_get_int(item, "caps");
+	info.get_name  = deferred_type_get_name;
+	info.type_data = type;
+
+	if (obs_data_get_bool(item, "configurable"))
+		info.get_properties2 = deferred_encoder_get_properties;
+
+	da_push_back(obs->encoder_types, &info);
+}
+
+static void register_deferred_types(struct obs_module *mod,
+		const char *name, void (*reg)(struct obs_module*, obs_data_t*))
+{
+	obs_data_array_t *items = obs_data_get_array(mod->cache_data, name);
+	size_t count = obs_data_array_count(items);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *item = obs_data_array_item(items, i);
+		reg(mod, item);
+		obs_data_release(item);
 	}
 
-	obs_init_module(module);
+	obs_data_array_release(items);
+}
+
+static struct obs_module *create_deferred_module(
+		struct pending_module *pending)
+{
+	struct obs_module *mod = bzalloc(sizeof(*mod));
+
+	set_module_paths(mod, pending->bin_path, pending->data_path);
+	mod->allow_deferred_load = true;
+	mod->deferred            = true;
+	mod->cache_data          = pending->cache_data;
+	pending->cache_data      = NULL;
+
+	register_deferred_types(mod, "sources", register_deferred_source);
+	register_deferred_types(mod, "encoders", register_deferred_encoder);
 
-	UNUSED_PARAMETER(param);
+	blog(LOG_DEBUG, "Deferred loading module: %s", mod->file);
+	return mod;
 }
 
+bool obs_load_deferred_module(struct obs_module *mod)
+{
+	uint64_t start_time = os_gettime_ns();
+	bool success = false;
+
+	pthread_mutex_lock(&deferred_load_mutex);
+
+	if (!mod->deferred) {
+		success = mod->loaded;
+		goto finish;
+	}
+
+	mod->deferred = false;
+	blog(LOG_INFO, "Loading deferred module '%s'", mod->file);
+
+	mod->module = os_dlopen(mod->bin_path);
+	if (!mod->module) {
+		blog(LOG_WARNING, "Module '%s' not loaded", mod->bin_path);
+		goto finish;
+	}
+
+	if (load_module_exports(mod, mod->bin_path) != MODULE_SUCCESS)
+		goto finish;
+
+	mod->set_pointer(mod);
+	if (mod->set_locale)
+		mod->set_locale(obs->locale);
+
+	mod->open_time_ns = os_gettime_ns() - start_time;
+	success = obs_init_module(mod);
+
+finish:
+	pthread_mutex_unlock(&deferred_load_mutex);
+	return success;
+}
+
+/* returns the cache entry of a module if it can be registered from the cache
+ * instead of being loaded */
+static obs_data_t *get_deferrable_cache_entry(obs_data_array_t *entries,
+		const char *bin_path)
+{
+	size_t count = obs_data_array_count(entries);
+	struct stat st;
+
+	if (!count || os_stat(bin_path, &st) != 0)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t *entry = obs_data_array_item(entries, i);
+
+		if (strcmp(obs_data_get_string(entry, "file"), bin_path) != 0) {
+			obs_data_release(entry);
+			continue;
+		}
+
+		if (obs_data_get_bool(entry, "deferrable") &&
+		    obs_data_get_int(entry, "mtime") == (long long)st.st_mtime &&
+		    obs_data_get_int(entry, "size") == (long long)st.st_size &&
+		    strcmp(obs_data_get_string(entry, "locale"),
+			    obs->locale) == 0)
+			return entry;
+
+		obs_data_release(entry);
+		break;
+	}
+
+	return NULL;
+}
+
+static void add_cache_types(obs_data_t *entry, const char *name,
+		char **ids, size_t num, bool is_source)
+{
+	obs_data_array_t *items = obs_data_array_create();
+
+	for (size_t i = 0; i < num; i++) {
+		obs_data_t *item = obs_data_create();
+		const char *id = ids[i];
+
+		obs_data_set_string(item, "id", id);
+
+		if (is_source) {
+			const struct obs_source_info *info = get_source_info(id);
+			obs_data_set_int(item, "type", info->type);
+			obs_data_set_int(item, "output_flags",
+					info->output_flags);
+			obs_data_set_string(item, "name",
+					info->get_name(info->type_data));
+			obs_data_set_bool(item, "configurable",
+					info->get_properties ||
+					info->get_properties2);
+		} else {
+			const struct obs_encoder_info *info = find_encoder(id);
+			obs_data_set_int(item, "type", info->type);
+			obs_data_set_string(item, "codec", info->codec);
+			obs_data_set_int(item, "caps", info->caps);
+			obs_data_set_string(item, "name",
+					info->get_name(info->type_data));
+			obs_data_set_bool(item, "configurable",
+					info->get_properties ||
+					info->get_properties2);
+		}
+
+		obs_data_array_push_back(items, item);
+		obs_data_release(item);
+	}
+
+	obs_data_set_array(entry, name, items);
+	obs_data_array_release(items);
+}
+
+static obs_data_t *create_cache_entry(struct obs_module *mod)
+{
+	obs_data_t *entry;
+	struct stat st;
+	bool deferrable;
+
+	if (mod->deferred) {
+		obs_data_addref(mod->cache_data);
+		return mod->cache_data;
+	}
+
+	if (!mod->loaded || os_stat(mod->bin_path, &st) != 0)
+		return NULL;
+
+	deferrable = mod->allow_deferred_load &&
+		!mod->post_load &&
+		!mod->registers_other_types &&
+		(mod->source_ids.num || mod->encoder_ids.num);
+
+	entry = obs_data_create();
+	obs_data_set_string(entry, "file", mod->bin_path);
+	obs_data_set_int(entry, "mtime", (long long)st.st_mtime);
+	obs_data_set_int(entry, "size", (long long)st.st_size);
+	obs_data_set_string(entry, "locale", obs->locale);
+	obs_data_set_bool(entry, "deferrable", deferrable);
+
+	if (deferrable) {
+		add_cache_types(entry, "sources", mod->source_ids.array,
+				mod->source_ids.num, true);
+		add_cache_types(entry, "encoders", mod->encoder_ids.array,
+				mod->encoder_ids.num, false);
+	}
+
+	return entry;
+}
+
+static void save_module_cache(void)
+{
+	obs_data_t *cache = obs_data_create();
+	obs_data_array_t *entries = obs_data_array_create();
+
+	for (obs_module_t *mod = obs->first_module; !!mod; mod = mod->next) {
+		obs_data_t *entry = create_cache_entry(mod);
+		if (entry) {
+			obs_data_array_push_back(entries, entry);
+			obs_data_release(entry);
+		}
+	}
+
+	obs_data_set_array(cache, "modules", entries);
+
+	if (!obs_data_save_json_safe(cache, obs->module_cache_path, "tmp",
+				"bak"))
+		blog(LOG_WARNING, "Failed to save module cache '%s'",
+				obs->module_cache_path);
+
+	obs_data_array_release(entries);
+	obs_data_release(cache);
+}
+
+void obs_set_module_cache_path(const char *path)
+{
+	if (!obs)
+		return;
+
+	bfree(obs->module_cache_path);
+	obs->module_cache_path = path ? bstrdup(path) : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
 static const char *obs_load_all_modules_name = "obs_load_all_modules";
 #ifdef _WIN32
 static const char *reset_win32_symbol_paths_name = "reset_win32_symbol_paths";
@@ -256,8 +715,66 @@ static const char *reset_win32_symbol_paths_name = "reset_win32_symbol_paths";
 
 void obs_load_all_modules(void)
 {
+	struct module_open_queue queue = {0};
+	uint64_t start_time = os_gettime_ns();
+
+	if (!obs)
+		return;
+
 	profile_start(obs_load_all_modules_name);
-	obs_find_modules(load_all_callback, NULL);
+	obs_find_modules(find_all_callback, &queue);
+
+	if (obs->module_cache_path) {
+		obs_data_t *cache = obs_data_create_from_json_file_safe(
+				obs->module_cache_path, "bak");
+		obs_data_array_t *entries = obs_data_get_array(cache,
+				"modules");
+
+		for (size_t i = 0; i < queue.modules.num; i++) {
+			struct pending_module *pending =
+				queue.modules.array + i;
+			pending->cache_data = get_deferrable_cache_entry(
+					entries, pending->bin_path);
+		}
+
+		obs_data_array_release(entries);
+		obs_data_release(cache);
+	}
+
+	open_modules(&queue);
+
+	for (size_t i = 0; i < queue.modules.num; i++) {
+		struct pending_module *pending = queue.modules.array + i;
+
+		if (pending->cache_data) {
+			pending->module = create_deferred_module(pending);
+			pending->module->next = obs->first_module;
+			obs->first_module = pending->module;
+			continue;
+		}
+
+		if (pending->code != MODULE_SUCCESS) {
+			blog(LOG_DEBUG, "Failed to load module file '%s': %d",
+					pending->bin_path, pending->code);
+			continue;
+		}
+
+		pending->module->next = obs->first_module;
+		obs->first_module = pending->module;
+		obs_init_module(pending->module);
+	}
+
+	log_module_load_times(&queue, os_gettime_ns() - start_time);
+
+	if (obs->module_cache_path)
+		save_module_cache();
+
+	for (size_t i = 0; i < queue.modules.num; i++) {
+		bfree(queue.modules.array[i].bin_path);
+		bfree(queue.modules.array[i].data_path);
+	}
+	da_free(queue.modules);
+
 #ifdef _WIN32
 	profile_start(reset_win32_symbol_paths_name);
 	reset_win32_symbol_paths();
@@ -451,6 +968,31 @@ void free_module(struct obs_module *mod)
 		/* os_dlclose(mod->module); */
 	}
 
+	for (size_t i = 0; i < mod->deferred_types.num; i++) {
+		struct obs_module_type *type = mod->deferred_types.array[i];
+		struct obs_source_info *si = &type->source_info;
+		struct obs_encoder_info *ei = &type->encoder_info;
+
+		if (si->type_data && si->free_type_data)
+			si->free_type_data(si->type_data);
+		if (ei->type_data && ei->free_type_data)
+			ei->free_type_data(ei->type_data);
+
+		bfree(type->id);
+		bfree(type->name);
+		bfree(type->codec);
+		bfree(type);
+	}
+	for (size_t i = 0; i < mod->source_ids.num; i++)
+		bfree(mod->source_ids.array[i]);
+	for (size_t i = 0; i < mod->encoder_ids.num; i++)
+		bfree(mod->encoder_ids.array[i]);
+
+	da_free(mod->deferred_types);
+	da_free(mod->source_ids);
+	da_free(mod->encoder_ids);
+	obs_data_release(mod->cache_data);
+
 	bfree(mod->mod_name);
 	bfree(mod->bin_path);
 	bfree(mod->data_path);
@@ -559,24 +1101,42 @@ cleanup:
 #define service_warn(format, ...) \
 	blog(LOG_WARNING, "obs_register_service: " format, ##__VA_ARGS__)
 
+static inline void record_registered_type(struct darray *ids, const char *id)
+{
+	char *id_copy = bstrdup(id);
+	darray_push_back(sizeof(char*), ids, &id_copy);
+}
+
+/* the module cache can only describe modules that register nothing but
+ * sources and encoders */
+static inline void mark_registers_other_types(void)
+{
+	if (obs->loading_module)
+		obs->loading_module->registers_other_types = true;
+}
+
+/* deferred modules only register the types listed in their cache entry */
+static inline bool loading_deferred_module(void)
+{
+	return obs->loading_module && obs->loading_module->cache_data;
+}
+
 void obs_register_source_s(const struct obs_source_info *info, size_t size)
 {
 	struct obs_source_info data = {0};
-	struct darray *array = NULL;
-
-	if (info->type == OBS_SOURCE_TYPE_INPUT) {
-		array = &obs->input_types.da;
-	} else if (info->type == OBS_SOURCE_TYPE_FILTER) {
-		array = &obs->filter_types.da;
-	} else if (info->type == OBS_SOURCE_TYPE_TRANSITION) {
-		array = &obs->transition_types.da;
-	} else if (info->type != OBS_SOURCE_TYPE_SCENE) {
+	struct obs_source_info *existing;
+	struct darray *array;
+
+	array = get_source_type_array(info->type);
+	if (!array && info->type != OBS_SOURCE_TYPE_SCENE) {
 		source_warn("Tried to register unknown source type: %u",
 				info->type);
 		goto error;
 	}
 
-	if (get_source_info(info->id)) {
+	/* deferred types are resolved once their module is loaded */
+	existing = get_source_info(info->id);
+	if (existing && existing->create) {
 		source_warn("Source '%s' already exists!  "
 		                  "Duplicate library?", info->id);
 		goto error;
@@ -643,6 +1203,23 @@ void obs_register_source_s(const struct obs_source_info *info, size_t size)
 		goto error;
 	}
 
+	if (obs->loading_module)
+		record_registered_type(&obs->loading_module->source_ids.da,
+				data.id);
+
+	if (existing) {
+		struct obs_module_type *type = existing->type_data;
+		type->source_info = data;
+		os_atomic_set_bool(&type->loaded, true);
+		return;
+	}
+
+	if (loading_deferred_module()) {
+		source_warn("Source '%s' is not in the module cache, "
+				"ignoring", data.id);
+		goto error;
+	}
+
 	if (array)
 		darray_push_back(sizeof(struct obs_source_info), array, &data);
 	da_push_back(obs->source_types, &data);
@@ -654,6 +1231,8 @@ error:
 
 void obs_register_output_s(const struct obs_output_info *info, size_t size)
 {
+	mark_registers_other_types();
+
 	if (find_output(info->id)) {
 		output_warn("Output id '%s' already exists!  "
 		                  "Duplicate library?", info->id);
@@ -696,7 +1275,10 @@ error:
 
 void obs_register_encoder_s(const struct obs_encoder_info *info, size_t size)
 {
-	if (find_encoder(info->id)) {
+	struct obs_encoder_info *existing = find_encoder(info->id);
+	struct obs_module_type *type;
+
+	if (existing && existing->create) {
 		encoder_warn("Encoder id '%s' already exists!  "
 		                  "Duplicate library?", info->id);
 		goto error;
@@ -717,6 +1299,33 @@ void obs_register_encoder_s(const struct obs_encoder_info *info, size_t size)
 		CHECK_REQUIRED_VAL_(info, get_frame_size, obs_register_encoder);
 #undef CHECK_REQUIRED_VAL_
 
+	if (obs->loading_module)
+		record_registered_type(&obs->loading_module->encoder_ids.da,
+				info->id);
+
+	/* deferred types are resolved once their module is loaded */
+	if (existing) {
+		if (size > sizeof(*existing)) {
+			encoder_warn("Tried to register obs_encoder_info with "
+					"size %llu which is more than libobs "
+					"currently supports (%llu)",
+					(long long unsigned)size,
+					(long long unsigned)sizeof(*existing));
+			goto error;
+		}
+
+		type = existing->type_data;
+		memcpy(&type->encoder_info, info, size);
+		os_atomic_set_bool(&type->loaded, true);
+		return;
+	}
+
+	if (loading_deferred_module()) {
+		encoder_warn("Encoder id '%s' is not in the module cache, "
+				"ignoring", info->id);
+		goto error;
+	}
+
 	REGISTER_OBS_DEF(size, obs_encoder_info, obs->encoder_types, info);
 	return;
 
@@ -726,6 +1335,8 @@ error:
 
 void obs_register_service_s(const struct obs_service_info *info, size_t size)
 {
+	mark_registers_other_types();
+
 	if (find_service(info->id)) {
 		service_warn("Service id '%s' already exists!  "
 		                  "Duplicate library?", info->id);
@@ -748,6 +1359,8 @@ error:
 
 void obs_register_modal_ui_s(const struct obs_modal_ui *info, size_t size)
 {
+	mark_registers_other_types();
+
 #define CHECK_REQUIRED_VAL_(info, val, func) \
 	CHECK_REQUIRED_VAL(struct obs_modal_ui, info, val, func)
 	CHECK_REQUIRED_VAL_(info, task,   obs_register_modal_ui);
@@ -764,6 +1377,8 @@ error:
 
 void obs_register_modeless_ui_s(const struct obs_modeless_ui *info, size_t size)
 {
+	mark_registers_other_types();
+
 #define CHECK_REQUIRED_VAL_(info, val, func) \
 	CHECK_REQUIRED_VAL(struct obs_modeless_ui, info, val, func)
 	CHECK_REQUIRED_VAL_(info, task,   obs_register_modeless_ui);
@@ -84,6 +84,17 @@ bool obs_module_load(void)
 	MODULE_EXPORT uint32_t obs_module_ver(void); \
 	uint32_t obs_module_ver(void) {return LIBOBS_API_VER;}
 
+/**
+ * Optional: Declares that the module's obs_module_load only registers sources
+ * and encoders and has no other side effects.  When a module cache is used
+ * (see obs_set_module_cache_path), such modules are not loaded at startup;
+ * their types are registered from the cache and the module is loaded the
+ * first time one of them is created or its properties are requested.
+ */
+#define OBS_MODULE_ALLOW_DEFERRED_LOAD() \
+	MODULE_EXPORT bool obs_module_allow_deferred_load(void); \
+	bool obs_module_allow_deferred_load(void) {return true;}
+
 /**
  * Required: Called when the module is loaded.  Use this function to load all
  * the sources/encoders/outputs/services for your module, or anything else that
@@ -1634,8 +1634,9 @@ static inline void signal_reconnect_success(struct obs_output *output)
 static inline void signal_stop(struct obs_output *output)
 {
 	struct calldata params;
+	uint8_t stack[256];
 
-	calldata_init(&params);
+	calldata_init_stack(&params, stack, sizeof(stack));
 	calldata_set_string(&params, "last_error", output->last_error_message);
 	calldata_set_int(&params, "code", output->stop_code);
 	calldata_set_ptr(&params, "output", output);
@@ -95,6 +95,9 @@ static void *scene_create(obs_data_t *settings, struct obs_source *source)
 
 	signal_handler_add_array(obs_source_get_signal_handler(source),
 			obs_scene_signals);
+	scene->item_transform_signal = signal_handler_get_id(
+			obs_source_get_signal_handler(source),
+			"item_transform");
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		goto fail;
@@ -345,6 +348,8 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 	struct vec2     scale;
 	struct calldata params;
 	uint8_t         stack[128];
+	signal_id_t     signal_id;
+	const struct decl_info *decl;
 
 	if (os_atomic_load_long(&item->defer_update) > 0)
 		return;
@@ -409,9 +414,14 @@ static void update_item_transform(struct obs_scene_item *item, bool update_tex)
 
 	/* ----------------------- */
 
+	signal_id = item->parent->item_transform_signal;
+	decl = signal_handler_get_decl(signal_id);
+
 	calldata_init_fixed(&params, stack, sizeof(stack));
-	calldata_set_ptr(&params, "item", item);
-	signal_parent(item->parent, "item_transform", &params);
+	calldata_set_decl_ptr(&params, decl, 0, item->parent);
+	calldata_set_decl_ptr(&params, decl, 1, item);
+	signal_handler_signal_id(item->parent->source->context.signals,
+			signal_id, &params);
 
 	if (!update_tex)
 		return;
@@ -501,10 +511,51 @@ static void render_item_texture(struct obs_scene_item *item)
 		}
 	}
 
+	/* default draws are batched with other draws of the same texture */
+	if (effect == obs->video.default_effect && type != OBS_SCALE_POINT) {
+		gs_sprite_batch_draw(effect, "Draw", tex, 0, 0, 0);
+		return;
+	}
+
 	while (gs_effect_loop(effect, "Draw"))
 		obs_source_draw(tex, 0, 0, 0, 0, 0);
 }
 
+/* static sources are drawn from their cached texture, so that items of the
+ * same source are batched together */
+static inline void render_item_cached(struct obs_scene_item *item)
+{
+	gs_texture_t *tex = obs_source_get_video_cache(item->source);
+
+	if (tex)
+		gs_sprite_batch_draw(obs->video.default_effect, "Draw", tex,
+				0, 0, 0);
+	else
+		obs_source_video_render(item->source);
+}
+
+static inline bool crop_equal(const struct obs_sceneitem_crop *crop1,
+		const struct obs_sceneitem_crop *crop2)
+{
+	return crop1->left   == crop2->left  &&
+	       crop1->right  == crop2->right &&
+	       crop1->top    == crop2->top   &&
+	       crop1->bottom == crop2->bottom;
+}
+
+/* static sources are only rendered to the item texture again when they (or
+ * the crop) change, rather than every frame */
+static inline void update_item_cache(struct obs_scene_item *item)
+{
+	bool stale = obs_source_video_cache_stale(item->source,
+			&item->cache_stamp);
+
+	if (stale || !crop_equal(&item->crop, &item->cache_crop)) {
+		gs_texrender_reset(item->item_render);
+		item->cache_crop = item->crop;
+	}
+}
+
 static inline void render_item(struct obs_scene_item *item)
 {
 	if (item->item_render) {
@@ -517,6 +568,8 @@ static inline void render_item(struct obs_scene_item *item)
 		uint32_t cx = calc_cx(item, width);
 		uint32_t cy = calc_cy(item, height);
 
+		update_item_cache(item);
+
 		if (cx && cy && gs_texrender_begin(item->item_render, cx, cy)) {
 			float cx_scale = (float)width  / (float)cx;
 			float cy_scale = (float)height / (float)cy;
@@ -545,12 +598,193 @@ static inline void render_item(struct obs_scene_item *item)
 	gs_matrix_mul(&item->draw_transform);
 	if (item->item_render) {
 		render_item_texture(item);
+	} else if (obs_source_video_cacheable(item->source)) {
+		render_item_cached(item);
 	} else {
 		obs_source_video_render(item->source);
 	}
 	gs_matrix_pop();
 }
 
+/* ------------------------------------------------------------------------- */
+/* Culling
+ *
+ *   Items are skipped if they are entirely outside of the current view, or
+ * entirely covered by axis-aligned items of opaque sources above them.  Only
+ * items of input sources are culled, as scenes and transitions may contain
+ * async sources that still need their frames consumed. */
+
+#define MAX_OCCLUDERS 16
+
+struct item_rect {
+	float left, top, right, bottom;
+};
+
+static void get_item_corners(const struct obs_scene_item *item,
+		const struct matrix4 *transform, struct vec3 corners[4])
+{
+	float cx = (float)calc_cx(item, item->last_width);
+	float cy = (float)calc_cy(item, item->last_height);
+
+	vec3_set(&corners[0], 0.0f, 0.0f, 0.0f);
+	vec3_set(&corners[1], cx,   0.0f, 0.0f);
+	vec3_set(&corners[2], 0.0f, cy,   0.0f);
+	vec3_set(&corners[3], cx,   cy,   0.0f);
+
+	for (size_t i = 0; i < 4; i++)
+		vec3_transform(&corners[i], &corners[i], transform);
+}
+
+static void get_item_rect(const struct obs_scene_item *item,
+		struct item_rect *rect)
+{
+	struct vec3 corners[4];
+
+	get_item_corners(item, &item->draw_transform, corners);
+
+	rect->left = rect->right  = corners[0].x;
+	rect->top  = rect->bottom = corners[0].y;
+
+	for (size_t i = 1; i < 4; i++) {
+		rect->left   = fminf(rect->left,   corners[i].x);
+		rect->right  = fmaxf(rect->right,  corners[i].x);
+		rect->top    = fminf(rect->top,    corners[i].y);
+		rect->bottom = fmaxf(rect->bottom, corners[i].y);
+	}
+}
+
+static bool get_cull_viewproj(struct matrix4 *viewproj)
+{
+	struct matrix4 world;
+	struct matrix4 proj;
+
+	if (!gs_projection_get(&proj))
+		return false;
+
+	/* only orthographic projections keep w at 1 */
+	if (proj.x.w != 0.0f || proj.y.w != 0.0f || proj.z.w != 0.0f ||
+	    proj.t.w != 1.0f)
+		return false;
+
+	gs_matrix_get(&world);
+	matrix4_mul(viewproj, &world, &proj);
+	return true;
+}
+
+static bool item_offscreen(const struct obs_scene_item *item,
+		const struct matrix4 *viewproj)
+{
+	struct matrix4 transform;
+	struct vec3 corners[4];
+	bool left = true, right = true, top = true, bottom = true;
+
+	matrix4_mul(&transform, &item->draw_transform, viewproj);
+	get_item_corners(item, &transform, corners);
+
+	for (size_t i = 0; i < 4; i++) {
+		if (corners[i].x >= -1.0f) left   = false;
+		if (corners[i].x <=  1.0f) right  = false;
+		if (corners[i].y >= -1.0f) top    = false;
+		if (corners[i].y <=  1.0f) bottom = false;
+	}
+
+	return left || right || top || bottom;
+}
+
+static bool item_occluded(const struct item_rect *rect,
+		const struct item_rect *occluders, size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		const struct item_rect *occluder = &occluders[i];
+
+		if (rect->left   >= occluder->left  &&
+		    rect->right  <= occluder->right &&
+		    rect->top    >= occluder->top   &&
+		    rect->bottom <= occluder->bottom)
+			return true;
+	}
+
+	return false;
+}
+
+static inline bool item_can_cull(const struct obs_scene_item *item)
+{
+	const struct obs_source *source = item->source;
+
+	return source->info.type == OBS_SOURCE_TYPE_INPUT &&
+		(source->info.output_flags & OBS_SOURCE_COMPOSITE) == 0;
+}
+
+static bool item_is_occluder(const struct obs_scene_item *item)
+{
+	const struct obs_source *source = item->source;
+	const struct matrix4 *m = &item->draw_transform;
+
+	if (!source->enabled || source->filters.num)
+		return false;
+	if (!obs_source_is_opaque(source))
+		return false;
+
+	/* rotated items do not cover their bounding rect */
+	return fabsf(m->x.y) < EPSILON && fabsf(m->y.x) < EPSILON;
+}
+
+static void cull_items(struct obs_scene *scene)
+{
+	struct item_rect occluders[MAX_OCCLUDERS];
+	size_t num_occluders = 0;
+	struct obs_scene_item *item = scene->first_item;
+	struct matrix4 viewproj;
+	bool cull_offscreen;
+
+	if (!item)
+		return;
+
+	cull_offscreen = get_cull_viewproj(&viewproj);
+
+	while (item->next)
+		item = item->next;
+
+	/* walk from the top so that occluders are known before the items
+	 * beneath them */
+	for (; item; item = item->prev) {
+		struct item_rect rect;
+
+		item->culled = ITEM_CULL_NONE;
+		if (!item->user_visible)
+			continue;
+
+		get_item_rect(item, &rect);
+
+		if (item_can_cull(item)) {
+			if (cull_offscreen && item_offscreen(item, &viewproj))
+				item->culled = ITEM_CULL_OFFSCREEN;
+			else if (item_occluded(&rect, occluders,
+						num_occluders))
+				item->culled = ITEM_CULL_OCCLUDED;
+		}
+
+		if (item->culled == ITEM_CULL_NONE &&
+		    num_occluders < MAX_OCCLUDERS &&
+		    item_is_occluder(item))
+			occluders[num_occluders++] = rect;
+	}
+}
+
+static const char *culled_offscreen_name = "culled_offscreen_item";
+static const char *culled_occluded_name = "culled_occluded_item";
+static inline void skip_item(struct obs_scene_item *item)
+{
+	const char *name = item->culled == ITEM_CULL_OFFSCREEN ?
+		culled_offscreen_name : culled_occluded_name;
+
+	/* the call counts of these profiler entries are the culled item
+	 * counts */
+	profile_start(name);
+	obs_source_video_skip(item->source);
+	profile_end(name);
+}
+
 static void scene_video_tick(void *data, float seconds)
 {
 	struct obs_scene *scene = data;
@@ -559,7 +793,7 @@ static void scene_video_tick(void *data, float seconds)
 	video_lock(scene);
 	item = scene->first_item;
 	while (item) {
-		if (item->item_render)
+		if (item->item_render && !obs_source_video_cacheable(item->source))
 			gs_texrender_reset(item->item_render);
 		item = item->next;
 	}
@@ -629,14 +863,21 @@ static void scene_video_render(void *data, gs_effect_t *effect)
 	gs_blend_state_push();
 	gs_reset_blend_state();
 
+	cull_items(scene);
+
 	item = scene->first_item;
 	while (item) {
-		if (item->user_visible)
-			render_item(item);
+		if (item->user_visible) {
+			if (item->culled != ITEM_CULL_NONE)
+				skip_item(item);
+			else
+				render_item(item);
+		}
 
 		item = item->next;
 	}
 
+	gs_sprite_batch_flush();
 	gs_blend_state_pop();
 
 	video_unlock(scene);
@@ -2181,15 +2422,6 @@ void obs_scene_atomic_update(obs_scene_t *scene,
 	obs_scene_release(scene);
 }
 
-static inline bool crop_equal(const struct obs_sceneitem_crop *crop1,
-		const struct obs_sceneitem_crop *crop2)
-{
-	return crop1->left   == crop2->left  &&
-	       crop1->right  == crop2->right &&
-	       crop1->top    == crop2->top   &&
-	       crop1->bottom == crop2->bottom;
-}
-
 void obs_sceneitem_set_crop(obs_sceneitem_t *item,
 		const struct obs_sceneitem_crop *crop)
 {
@@ -28,6 +28,12 @@ struct item_action {
 	uint64_t timestamp;
 };
 
+enum item_cull {
+	ITEM_CULL_NONE,
+	ITEM_CULL_OFFSCREEN,
+	ITEM_CULL_OCCLUDED
+};
+
 struct obs_scene_item {
 	volatile long         ref;
 	volatile bool         removed;
@@ -67,6 +73,14 @@ struct obs_scene_item {
 	struct matrix4        box_transform;
 	struct matrix4        draw_transform;
 
+	/* only used while the parent scene is rendering */
+	enum item_cull        culled;
+
+	/* identifies the source video last rendered to item_render, if the
+	 * source is static */
+	long                  cache_stamp;
+	struct obs_sceneitem_crop cache_crop;
+
 	enum obs_bounds_type  bounds_type;
 	uint32_t              bounds_align;
 	struct vec2           bounds;
@@ -93,6 +107,8 @@ struct obs_scene {
 
 	int64_t               id_counter;
 
+	signal_id_t           item_transform_signal;
+
 	pthread_mutex_t       video_mutex;
 	pthread_mutex_t       audio_mutex;
 	struct obs_scene_item *first_item;
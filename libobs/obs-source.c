@@ -44,13 +44,35 @@ struct obs_source_info *get_source_info(const char *id)
 {
 	for (size_t i = 0; i < obs->source_types.num; i++) {
 		struct obs_source_info *info = &obs->source_types.array[i];
-		if (strcmp(info->id, id) == 0)
-			return info;
+		if (strcmp(info->id, id) != 0)
+			continue;
+
+		/* the info of a loaded deferred type is kept in its type data */
+		if (!info->create && obs_deferred_type_loaded(info->type_data)) {
+			struct obs_module_type *type = info->type_data;
+			return &type->source_info;
+		}
+
+		return info;
 	}
 
 	return NULL;
 }
 
+/* returns the source info, loading the module that registered it first if
+ * the module was deferred */
+static const struct obs_source_info *get_loaded_source_info(const char *id)
+{
+	struct obs_source_info *info = get_source_info(id);
+
+	if (info && !info->create) {
+		obs_load_deferred_type(info->type_data);
+		info = get_source_info(id);
+	}
+
+	return (info && info->create) ? info : NULL;
+}
+
 static const char *source_signals[] = {
 	"void destroy(ptr source)",
 	"void remove(ptr source)",
@@ -300,7 +322,7 @@ static obs_source_t *obs_source_create_internal(const char *id,
 {
 	struct obs_source *source = bzalloc(sizeof(struct obs_source));
 
-	const struct obs_source_info *info = get_source_info(id);
+	const struct obs_source_info *info = get_loaded_source_info(id);
 	if (!info) {
 		blog(LOG_ERROR, "Source ID '%s' not found", id);
 
@@ -581,6 +603,8 @@ void obs_source_destroy(struct obs_source *source)
 		gs_texture_destroy(source->async_prev_texture);
 	if (source->filter_texrender)
 		gs_texrender_destroy(source->filter_texrender);
+	if (source->video_cache)
+		gs_texrender_destroy(source->video_cache);
 	gs_leave_context();
 
 	for (i = 0; i < MAX_AV_PLANES; i++)
@@ -722,19 +746,19 @@ static inline obs_data_t *get_defaults(const struct obs_source_info *info)
 
 obs_data_t *obs_source_settings(const char *id)
 {
-	const struct obs_source_info *info = get_source_info(id);
+	const struct obs_source_info *info = get_loaded_source_info(id);
 	return (info) ? get_defaults(info) : NULL;
 }
 
 obs_data_t *obs_get_source_defaults(const char *id)
 {
-	const struct obs_source_info *info = get_source_info(id);
+	const struct obs_source_info *info = get_loaded_source_info(id);
 	return info ? get_defaults(info) : NULL;
 }
 
 obs_properties_t *obs_get_source_properties(const char *id)
 {
-	const struct obs_source_info *info = get_source_info(id);
+	const struct obs_source_info *info = get_loaded_source_info(id);
 	if (info && (info->get_properties || info->get_properties2)) {
 		obs_data_t       *defaults = get_defaults(info);
 		obs_properties_t *props;
@@ -797,6 +821,210 @@ uint32_t obs_get_source_output_flags(const char *id)
 	return info ? info->output_flags : 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Render caching
+ *
+ *   Every change to the video of a static source (or to its filter chain) takes
+ * a new stamp from a global counter, so the newest stamp of a source and its
+ * filters identifies the texture that was last rendered from them. */
+
+static volatile long video_stamp_counter = 0;
+
+static inline void video_changed(obs_source_t *source)
+{
+	os_atomic_set_long(&source->video_stamp,
+			os_atomic_inc_long(&video_stamp_counter));
+}
+
+static inline bool video_static(const obs_source_t *source)
+{
+	return (source->info.output_flags & OBS_SOURCE_STATIC_VIDEO) != 0;
+}
+
+/* gets the newest stamp of a source and its filters below the given filter
+ * (or all of them if filter is NULL).  returns false if any of them can
+ * change without a new stamp. */
+static bool get_video_stamp(obs_source_t *parent, obs_source_t *filter,
+		long *stamp)
+{
+	bool cacheable;
+	long newest;
+
+	pthread_mutex_lock(&parent->filter_mutex);
+
+	cacheable = video_static(parent);
+	newest = os_atomic_load_long(&parent->video_stamp);
+
+	for (size_t i = parent->filters.num; i > 0; i--) {
+		obs_source_t *cur = parent->filters.array[i - 1];
+		long cur_stamp;
+
+		if (cur == filter)
+			break;
+
+		if (cur->enabled && !video_static(cur))
+			cacheable = false;
+
+		cur_stamp = os_atomic_load_long(&cur->video_stamp);
+		if (cur_stamp > newest)
+			newest = cur_stamp;
+	}
+
+	pthread_mutex_unlock(&parent->filter_mutex);
+
+	*stamp = newest;
+	return cacheable;
+}
+
+static bool video_cache_stale(obs_source_t *parent, obs_source_t *filter,
+		long *cache_stamp)
+{
+	long stamp;
+	bool stale;
+
+	if (!get_video_stamp(parent, filter, &stamp)) {
+		/* reset every frame in video_tick instead */
+		*cache_stamp = -1;
+		return false;
+	}
+
+	stale = stamp != *cache_stamp;
+	*cache_stamp = stamp;
+	return stale;
+}
+
+bool obs_source_video_cacheable(obs_source_t *source)
+{
+	long stamp;
+	return get_video_stamp(source, NULL, &stamp);
+}
+
+bool obs_source_video_cache_stale(obs_source_t *source, long *cache_stamp)
+{
+	return video_cache_stale(source, NULL, cache_stamp);
+}
+
+/* largest unfiltered source that is cached, the cache of a large source
+ * costs more memory than batching its draws saves */
+#define MAX_VIDEO_CACHE_PIXELS (1024 * 1024)
+
+static inline bool video_cache_useful(obs_source_t *source,
+		uint32_t cx, uint32_t cy)
+{
+	return source->filters.num ||
+		(uint64_t)cx * (uint64_t)cy <= MAX_VIDEO_CACHE_PIXELS;
+}
+
+/* renders a static source to a texture only when it changes, so that it can
+ * be drawn like any other texture (and batched with other draws of it).
+ * returns NULL if the source should be rendered directly instead */
+gs_texture_t *obs_source_get_video_cache(obs_source_t *source)
+{
+	uint32_t cx = obs_source_get_width(source);
+	uint32_t cy = obs_source_get_height(source);
+
+	if (!cx || !cy)
+		return NULL;
+
+	if (!video_cache_useful(source, cx, cy)) {
+		gs_texrender_destroy(source->video_cache);
+		source->video_cache = NULL;
+		return NULL;
+	}
+
+	if (!source->video_cache)
+		source->video_cache = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+
+	if (obs_source_video_cache_stale(source, &source->video_cache_stamp))
+		gs_texrender_reset(source->video_cache);
+
+	if (gs_texrender_begin(source->video_cache, cx, cy)) {
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 0.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		gs_blend_state_push();
+		gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+		obs_source_video_render(source);
+		gs_blend_state_pop();
+
+		gs_texrender_end(source->video_cache);
+	}
+
+	return gs_texrender_get_texture(source->video_cache);
+}
+
+void obs_source_video_changed(obs_source_t *source)
+{
+	if (!obs_source_valid(source, "obs_source_video_changed"))
+		return;
+
+	video_changed(source);
+}
+
+void obs_source_set_opaque(obs_source_t *source, bool opaque)
+{
+	if (!obs_source_valid(source, "obs_source_set_opaque"))
+		return;
+
+	os_atomic_set_bool(&source->opaque, opaque);
+}
+
+static inline bool async_format_opaque(enum video_format format)
+{
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+	case VIDEO_FORMAT_NV12:
+	case VIDEO_FORMAT_YVYU:
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_UYVY:
+	case VIDEO_FORMAT_I444:
+	case VIDEO_FORMAT_BGRX:
+	case VIDEO_FORMAT_Y800:
+		return true;
+	case VIDEO_FORMAT_NONE:
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+		return false;
+	}
+
+	return false;
+}
+
+bool obs_source_is_opaque(const obs_source_t *source)
+{
+	uint32_t flags = source->info.output_flags;
+
+	if ((flags & OBS_SOURCE_ASYNC) != 0) {
+		/* async frames in formats without alpha are always opaque */
+		if (!source->async_active)
+			return false;
+		if (async_format_opaque(source->async_format))
+			return true;
+	}
+
+	return (flags & OBS_SOURCE_OPAQUE) != 0 ||
+		os_atomic_load_bool(&source->opaque);
+}
+
+static inline bool filter_input_cacheable(obs_source_t *filter)
+{
+	obs_source_t *parent = filter->filter_parent;
+	long stamp;
+
+	return parent && get_video_stamp(parent, filter, &stamp);
+}
+
+static inline bool filter_input_stale(obs_source_t *filter)
+{
+	obs_source_t *parent = filter->filter_parent;
+
+	return !parent || video_cache_stale(parent, filter,
+			&filter->filter_cache_stamp);
+}
+
 static void obs_source_deferred_update(obs_source_t *source)
 {
 	if (source->context.data && source->info.update)
@@ -804,6 +1032,7 @@ static void obs_source_deferred_update(obs_source_t *source)
 				source->context.settings);
 
 	source->defer_update = false;
+	video_changed(source);
 }
 
 void obs_source_update(obs_source_t *source, obs_data_t *settings)
@@ -816,6 +1045,7 @@ void obs_source_update(obs_source_t *source, obs_data_t *settings)
 
 	if (source->info.output_flags & OBS_SOURCE_VIDEO) {
 		source->defer_update = true;
+		video_changed(source);
 	} else if (source->context.data && source->info.update) {
 		source->info.update(source->context.data,
 				source->context.settings);
@@ -1043,8 +1273,10 @@ void obs_source_video_tick(obs_source_t *source, float seconds)
 	if (source->defer_update)
 		obs_source_deferred_update(source);
 
-	/* reset the filter render texture information once every frame */
-	if (source->filter_texrender)
+	/* reset the filter render texture information once every frame,
+	 * unless its input is static, in which case it is only reset when the
+	 * input changes */
+	if (source->filter_texrender && !filter_input_cacheable(source))
 		gs_texrender_reset(source->filter_texrender);
 
 	/* call show/hide if the reference changed */
@@ -1785,6 +2017,16 @@ static inline void obs_source_main_render(obs_source_t *source)
 
 static bool ready_async_frame(obs_source_t *source, uint64_t sys_time);
 
+static inline void update_async_video(obs_source_t *source)
+{
+	if (source->info.type == OBS_SOURCE_TYPE_INPUT &&
+	    (source->info.output_flags & OBS_SOURCE_ASYNC) != 0) {
+		if (deinterlacing_enabled(source))
+			deinterlace_update_async_video(source);
+		obs_source_update_async_video(source);
+	}
+}
+
 static inline void render_video(obs_source_t *source)
 {
 	if (source->info.type != OBS_SOURCE_TYPE_FILTER &&
@@ -1794,13 +2036,8 @@ static inline void render_video(obs_source_t *source)
 		return;
 	}
 
-	if (source->info.type == OBS_SOURCE_TYPE_INPUT &&
-	    (source->info.output_flags & OBS_SOURCE_ASYNC) != 0 &&
-	    !source->rendering_filter) {
-		if (deinterlacing_enabled(source))
-			deinterlace_update_async_video(source);
-		obs_source_update_async_video(source);
-	}
+	if (!source->rendering_filter)
+		update_async_video(source);
 
 	if (!source->context.data || !source->enabled) {
 		if (source->filter_parent)
@@ -1834,6 +2071,14 @@ void obs_source_video_render(obs_source_t *source)
 	obs_source_release(source);
 }
 
+void obs_source_video_skip(obs_source_t *source)
+{
+	if (!obs_source_valid(source, "obs_source_video_skip"))
+		return;
+
+	update_async_video(source);
+}
+
 static uint32_t get_base_width(const obs_source_t *source)
 {
 	bool is_filter = !!source->filter_parent;
@@ -1991,6 +2236,7 @@ void obs_source_filter_add(obs_source_t *source, obs_source_t *filter)
 		source : source->filters.array[0];
 
 	da_insert(source->filters, 0, &filter);
+	video_changed(source);
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
@@ -2026,6 +2272,7 @@ static bool obs_source_filter_remove_refless(obs_source_t *source,
 	}
 
 	da_erase(source->filters, idx);
+	video_changed(source);
 
 	pthread_mutex_unlock(&source->filter_mutex);
 
@@ -2138,6 +2385,7 @@ static bool move_filter_dir(obs_source_t *source,
 		source->filters.array[i]->filter_target = next_filter;
 	}
 
+	video_changed(source);
 	return true;
 }
 
@@ -2886,10 +3134,11 @@ void obs_source_set_name(obs_source_t *source, const char *name)
 	if (!name || !*name || !source->context.name ||
 			strcmp(name, source->context.name) != 0) {
 		struct calldata data;
+		uint8_t stack[256];
 		char *prev_name = bstrdup(source->context.name);
 		obs_context_data_setname(&source->context, name);
 
-		calldata_init(&data);
+		calldata_init_stack(&data, stack, sizeof(stack));
 		calldata_set_ptr(&data, "source", source);
 		calldata_set_string(&data, "new_name", source->context.name);
 		calldata_set_string(&data, "prev_name", prev_name);
@@ -3005,6 +3254,9 @@ bool obs_source_process_filter_begin(obs_source_t *filter,
 		filter->filter_texrender = gs_texrender_create(format,
 				GS_ZS_NONE);
 
+	if (filter_input_stale(filter))
+		gs_texrender_reset(filter->filter_texrender);
+
 	gs_blend_state_push();
 	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
 
@@ -3610,6 +3862,7 @@ void obs_source_set_enabled(obs_source_t *source, bool enabled)
 		return;
 
 	source->enabled = enabled;
+	video_changed(source);
 
 	calldata_init_fixed(&data, stack, sizeof(stack));
 	calldata_set_ptr(&data, "source", source);
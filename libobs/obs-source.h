@@ -140,6 +140,25 @@ enum obs_balance_type {
  */
 #define OBS_SOURCE_CAP_DISABLED (1<<10)
 
+/**
+ * Source always draws fully opaque pixels over its entire width and height
+ *
+ * Scenes use this to skip rendering items that are completely covered by an
+ * item of this source.  Must not be set if the source can draw anything
+ * transparent, or if it can draw nothing while it has a width and height.
+ */
+#define OBS_SOURCE_OPAQUE (1<<11)
+
+/**
+ * Source video only changes when its settings are updated, or when it calls
+ * obs_source_video_changed
+ *
+ * Scene items and filters reuse the last rendered texture of such sources
+ * (and of their filters, if those have this flag as well) instead of
+ * rendering them again every frame.
+ */
+#define OBS_SOURCE_STATIC_VIDEO (1<<12)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
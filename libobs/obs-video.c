@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <inttypes.h>
 #include <time.h>
 #include <stdlib.h>
 
@@ -72,30 +73,88 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	return cur_time;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Displays
+ *
+ *   Displays are rendered on their own thread from the last composited
+ * textures, so presenting them doesn't add to the time it takes to output a
+ * frame.  The graphics thread signals the display thread after each frame;
+ * frames signaled while the displays are still being rendered are skipped. */
+
 /* in obs-display.c */
-extern void render_display(struct obs_display *display);
+extern void render_display(struct obs_display *display, uint64_t time);
 
 static inline void render_displays(void)
 {
 	struct obs_display *display;
+	uint64_t time = os_gettime_ns();
 
 	if (!obs->data.valid)
 		return;
 
-	gs_enter_context(obs->video.graphics);
-
-	/* render extra displays/swaps */
+	/* render extra displays/swaps, each display enters the graphics
+	 * context by itself */
 	pthread_mutex_lock(&obs->data.displays_mutex);
 
 	display = obs->data.first_display;
 	while (display) {
-		render_display(display);
+		render_display(display, time);
 		display = display->next;
 	}
 
 	pthread_mutex_unlock(&obs->data.displays_mutex);
+}
 
-	gs_leave_context();
+static void *display_thread(void *param)
+{
+	struct obs_core_video *video = param;
+
+	os_set_thread_name("libobs: display thread");
+
+	const char *display_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"display_thread");
+
+	while (os_event_wait(video->display_start) == 0) {
+		if (os_atomic_load_bool(&video->display_stop))
+			break;
+
+		profile_start(display_thread_name);
+		render_displays();
+		profile_end(display_thread_name);
+
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+bool init_display_thread(struct obs_core_video *video)
+{
+	video->display_stop = false;
+
+	if (os_event_init(&video->display_start, OS_EVENT_TYPE_AUTO) != 0)
+		return false;
+
+	if (pthread_create(&video->display_thread, NULL, display_thread,
+				video) != 0)
+		return false;
+
+	video->display_thread_initialized = true;
+	return true;
+}
+
+void free_display_thread(struct obs_core_video *video)
+{
+	if (video->display_thread_initialized) {
+		os_atomic_set_bool(&video->display_stop, true);
+		os_event_signal(video->display_start);
+		pthread_join(video->display_thread, NULL);
+		video->display_thread_initialized = false;
+	}
+
+	os_event_destroy(video->display_start);
+	video->display_start = NULL;
 }
 
 static inline void set_render_size(uint32_t width, uint32_t height)
@@ -255,10 +314,57 @@ end:
 	profile_end(render_output_texture_name);
 }
 
-static inline void set_eparam(gs_effect_t *effect, const char *name, float val)
+/* in the same order as the values set in render_convert_texture */
+static const char *conversion_param_names[NUM_CONVERSION_PARAMS] = {
+	"u_plane_offset",
+	"v_plane_offset",
+	"width",
+	"height",
+	"width_i",
+	"height_i",
+	"width_d2",
+	"height_d2",
+	"width_d2_i",
+	"height_d2_i",
+	"input_height"
+};
+
+static void get_conversion_params(struct obs_core_video *video)
+{
+	gs_effect_t *effect = video->conversion_effect;
+
+	video->conversion_image = gs_effect_get_param_by_name(effect, "image");
+
+	for (size_t i = 0; i < NUM_CONVERSION_PARAMS; i++)
+		video->conversion_params[i] = gs_effect_get_param_by_name(
+				effect, conversion_param_names[i]);
+}
+
+static void set_conversion_params(struct obs_core_video *video,
+		float fwidth, float fheight)
 {
-	gs_eparam_t *param = gs_effect_get_param_by_name(effect, name);
-	gs_effect_set_float(param, val);
+	struct gs_effect_param_value params[NUM_CONVERSION_PARAMS];
+	const float values[NUM_CONVERSION_PARAMS] = {
+		(float)video->plane_offsets[1],
+		(float)video->plane_offsets[2],
+		fwidth,
+		fheight,
+		1.0f / fwidth,
+		1.0f / fheight,
+		fwidth  * 0.5f,
+		fheight * 0.5f,
+		1.0f / (fwidth  * 0.5f),
+		1.0f / (fheight * 0.5f),
+		(float)video->conversion_height
+	};
+
+	for (size_t i = 0; i < NUM_CONVERSION_PARAMS; i++) {
+		params[i].param = video->conversion_params[i];
+		params[i].data  = &values[i];
+		params[i].size  = sizeof(float);
+	}
+
+	gs_effect_set_params(params, NUM_CONVERSION_PARAMS);
 }
 
 static const char *render_convert_texture_name = "render_convert_texture";
@@ -274,26 +380,17 @@ static void render_convert_texture(struct obs_core_video *video,
 	size_t       passes, i;
 
 	gs_effect_t    *effect  = video->conversion_effect;
-	gs_eparam_t    *image   = gs_effect_get_param_by_name(effect, "image");
 	gs_technique_t *tech    = gs_effect_get_technique(effect,
 			video->conversion_tech);
 
 	if (!video->textures_output[prev_texture])
 		goto end;
 
-	set_eparam(effect, "u_plane_offset", (float)video->plane_offsets[1]);
-	set_eparam(effect, "v_plane_offset", (float)video->plane_offsets[2]);
-	set_eparam(effect, "width",  fwidth);
-	set_eparam(effect, "height", fheight);
-	set_eparam(effect, "width_i",  1.0f / fwidth);
-	set_eparam(effect, "height_i", 1.0f / fheight);
-	set_eparam(effect, "width_d2",  fwidth  * 0.5f);
-	set_eparam(effect, "height_d2", fheight * 0.5f);
-	set_eparam(effect, "width_d2_i",  1.0f / (fwidth  * 0.5f));
-	set_eparam(effect, "height_d2_i", 1.0f / (fheight * 0.5f));
-	set_eparam(effect, "input_height", (float)video->conversion_height);
+	if (!video->conversion_image)
+		get_conversion_params(video);
 
-	gs_effect_set_texture(image, texture);
+	set_conversion_params(video, fwidth, fheight);
+	gs_effect_set_texture(video->conversion_image, texture);
 
 	gs_set_render_target(target, NULL);
 	set_render_size(video->output_width, video->conversion_height);
@@ -364,15 +461,24 @@ end:
 	profile_end(render_convert_nv12_name);
 }
 
+static const char *wait_readback_name = "wait_readback";
+static inline void wait_readback(struct obs_core_video *video)
+{
+	profile_start(wait_readback_name);
+	os_event_wait(video->readback_idle);
+	profile_end(wait_readback_name);
+}
+
 static const char *stage_output_texture_name = "stage_output_texture";
 static inline void stage_output_texture(struct obs_core_video *video,
-		int cur_texture, int prev_texture)
+		int prev_texture)
 {
 	profile_start(stage_output_texture_name);
 
 	gs_texture_t   *texture;
 	bool        texture_ready;
-	gs_stagesurf_t *copy = video->copy_surfaces[cur_texture];
+	int            cur_stage = video->cur_stage_surface;
+	gs_stagesurf_t *copy = video->copy_surfaces[cur_stage];
 
 	if (video->gpu_conversion) {
 		texture = video->convert_textures[prev_texture];
@@ -382,6 +488,9 @@ static inline void stage_output_texture(struct obs_core_video *video,
 		texture_ready = video->textures_output[prev_texture];
 	}
 
+	/* the surface being staged to is the one that was mapped last, so the
+	 * readback thread has to be done with it first */
+	wait_readback(video);
 	unmap_last_surface(video);
 
 	if (!texture_ready)
@@ -389,7 +498,7 @@ static inline void stage_output_texture(struct obs_core_video *video,
 
 	gs_stage_texture(copy, texture);
 
-	video->textures_copied[cur_texture] = true;
+	video->textures_copied[cur_stage] = true;
 
 end:
 	profile_end(stage_output_texture_name);
@@ -525,7 +634,7 @@ static inline void render_video(struct obs_core_video *video,
 		}
 #endif
 		if (raw_active)
-			stage_output_texture(video, cur_texture, prev_texture);
+			stage_output_texture(video, prev_texture);
 	}
 
 	gs_set_render_target(NULL, NULL);
@@ -534,12 +643,15 @@ static inline void render_video(struct obs_core_video *video,
 	gs_end_scene();
 }
 
+/* maps the oldest staged surface, which is the next one to be staged to */
 static inline bool download_frame(struct obs_core_video *video,
-		int prev_texture, struct video_data *frame)
+		struct video_data *frame)
 {
-	gs_stagesurf_t *surface = video->copy_surfaces[prev_texture];
+	int oldest = (video->cur_stage_surface + 1) %
+		(int)video->num_stage_surfaces;
+	gs_stagesurf_t *surface = video->copy_surfaces[oldest];
 
-	if (!video->textures_copied[prev_texture])
+	if (!video->textures_copied[oldest])
 		return false;
 
 	if (!gs_stagesurface_map(surface, &frame->data[0], &frame->linesize[0]))
@@ -650,26 +762,27 @@ static void set_gpu_converted_data(struct obs_core_video *video,
 	}
 }
 
-static void convert_frame(
+static void convert_frame_rows(
 		struct video_frame *output, const struct video_data *input,
-		const struct video_output_info *info)
+		const struct video_output_info *info,
+		uint32_t start_y, uint32_t end_y)
 {
 	if (info->format == VIDEO_FORMAT_I420) {
 		compress_uyvx_to_i420(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_NV12) {
 		compress_uyvx_to_nv12(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else if (info->format == VIDEO_FORMAT_I444) {
 		convert_uyvx_to_i444(
 				input->data[0], input->linesize[0],
-				0, info->height,
+				start_y, end_y,
 				output->data, output->linesize);
 
 	} else {
@@ -677,6 +790,67 @@ static void convert_frame(
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* Stripe-parallel conversion
+ *
+ *   When GPU conversion is disabled, frames are converted in row stripes by a
+ * format conversion pool, which the graphics thread takes part in. */
+
+static void convert_rows(void *param, uint32_t start_y, uint32_t end_y)
+{
+	struct obs_core_video *video = param;
+
+	convert_frame_rows(video->convert_output, video->convert_input,
+			video->convert_info, start_y, end_y);
+}
+
+bool init_convert_threads(struct obs_core_video *video)
+{
+	int cores = os_get_physical_cores();
+	size_t num_threads;
+
+	/* the graphics thread takes part in conversion, so one fewer worker
+	 * than there are cores */
+	num_threads = cores > 1 ? (size_t)cores - 1 : 0;
+	if (num_threads > MAX_CONVERT_THREADS)
+		num_threads = MAX_CONVERT_THREADS;
+	if (!num_threads)
+		return true;
+
+	video->convert_pool = format_conversion_pool_create(num_threads);
+	if (!video->convert_pool) {
+		blog(LOG_ERROR, "Failed to create video conversion threads");
+		return false;
+	}
+
+	blog(LOG_INFO, "Using %d threads for CPU video conversion",
+			(int)num_threads + 1);
+	return true;
+}
+
+void free_convert_threads(struct obs_core_video *video)
+{
+	format_conversion_pool_destroy(video->convert_pool);
+	video->convert_pool = NULL;
+}
+
+static void convert_frame(struct obs_core_video *video,
+		struct video_frame *output, const struct video_data *input,
+		const struct video_output_info *info)
+{
+	if (!video->convert_pool) {
+		convert_frame_rows(output, input, info, 0, info->height);
+		return;
+	}
+
+	video->convert_output = output;
+	video->convert_input  = input;
+	video->convert_info   = info;
+
+	format_conversion_pool_run(video->convert_pool, info->height,
+			convert_rows, video);
+}
+
 static inline void copy_rgbx_frame(
 		struct video_frame *output, const struct video_data *input,
 		const struct video_output_info *info)
@@ -713,7 +887,8 @@ static inline void output_video_data(struct obs_core_video *video,
 					input_frame, info);
 
 		} else if (format_is_yuv(info->format)) {
-			convert_frame(&output_frame, input_frame, info);
+			convert_frame(video, &output_frame, input_frame,
+					info);
 		} else {
 			copy_rgbx_frame(&output_frame, input_frame, info);
 		}
@@ -722,6 +897,142 @@ static inline void output_video_data(struct obs_core_video *video,
 	}
 }
 
+/* ------------------------------------------------------------------------- */
+/* Readback
+ *
+ *   Copying (or converting) a mapped frame in to the video output cache is
+ * done on its own thread, so the graphics thread can move on to the next
+ * frame.  The mapped surface is only unmapped by the graphics thread once the
+ * readback thread is done with it. */
+
+static void *readback_thread(void *param)
+{
+	struct obs_core_video *video = param;
+
+	os_set_thread_name("libobs: readback thread");
+
+	const char *readback_thread_name =
+		profile_store_name(obs_get_profiler_name_store(),
+				"readback_thread");
+
+	while (os_sem_wait(video->readback_start) == 0) {
+		if (os_atomic_load_bool(&video->readback_stop))
+			break;
+
+		profile_start(readback_thread_name);
+		output_video_data(video, &video->readback_frame,
+				video->readback_count);
+		profile_end(readback_thread_name);
+
+		os_event_signal(video->readback_idle);
+		profile_reenable_thread();
+	}
+
+	return NULL;
+}
+
+static inline void queue_readback(struct obs_core_video *video,
+		const struct video_data *frame, int count)
+{
+	video->readback_frame = *frame;
+	video->readback_count = count;
+
+	os_event_reset(video->readback_idle);
+	os_sem_post(video->readback_start);
+}
+
+bool init_readback_thread(struct obs_core_video *video)
+{
+	video->readback_stop = false;
+
+	if (os_sem_init(&video->readback_start, 0) != 0)
+		return false;
+	if (os_event_init(&video->readback_idle, OS_EVENT_TYPE_MANUAL) != 0)
+		return false;
+
+	os_event_signal(video->readback_idle);
+
+	if (pthread_create(&video->readback_thread, NULL, readback_thread,
+				video) != 0)
+		return false;
+
+	video->readback_thread_initialized = true;
+	return true;
+}
+
+void free_readback_thread(struct obs_core_video *video)
+{
+	if (video->readback_thread_initialized) {
+		os_atomic_set_bool(&video->readback_stop, true);
+		os_sem_post(video->readback_start);
+		pthread_join(video->readback_thread, NULL);
+		video->readback_thread_initialized = false;
+	}
+
+	os_sem_destroy(video->readback_start);
+	os_event_destroy(video->readback_idle);
+	video->readback_start = NULL;
+	video->readback_idle = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Pacing */
+
+#define LATE_WAKEUP_NS 1000000ULL
+
+void set_thread_realtime(bool realtime, const char *name)
+{
+	if (!realtime) {
+		os_set_thread_priority(OS_THREAD_PRIORITY_NORMAL);
+
+	} else if (os_set_thread_priority(OS_THREAD_PRIORITY_REALTIME)) {
+		blog(LOG_INFO, "Set %s thread to realtime priority", name);
+
+	} else if (os_set_thread_priority(OS_THREAD_PRIORITY_HIGH)) {
+		blog(LOG_INFO, "Set %s thread to high priority (realtime "
+		               "priority not permitted)", name);
+	} else {
+		blog(LOG_WARNING, "Failed to raise %s thread priority", name);
+	}
+}
+
+static inline void record_wakeup(struct obs_core_video *video,
+		uint64_t lateness)
+{
+	struct obs_video_pacing_stats *stats = &video->pacing_stats;
+
+	pthread_mutex_lock(&video->pacing_mutex);
+
+	stats->wakeups++;
+	if (lateness > LATE_WAKEUP_NS)
+		stats->late_wakeups++;
+	if (lateness > stats->max_lateness_ns)
+		stats->max_lateness_ns = lateness;
+
+	video->pacing_lateness_total_ns += lateness;
+	stats->avg_lateness_ns =
+		video->pacing_lateness_total_ns / stats->wakeups;
+
+	pthread_mutex_unlock(&video->pacing_mutex);
+}
+
+static void log_pacing_stats(struct obs_core_video *video)
+{
+	struct obs_video_pacing_stats *stats = &video->pacing_stats;
+
+	if (!stats->wakeups)
+		return;
+
+	blog(LOG_INFO, "Video pacing: %"PRIu64" wakeups, average lateness "
+	               "%.3f ms, max lateness %.3f ms, %"PRIu64" over 1 ms "
+	               "late, %"PRIu32" lagged frames",
+	               stats->wakeups,
+	               (double)stats->avg_lateness_ns / 1000000.0,
+	               (double)stats->max_lateness_ns / 1000000.0,
+	               stats->late_wakeups,
+	               video->lagged_frames);
+}
+
 static inline void video_sleep(struct obs_core_video *video,
 		bool raw_active, const bool gpu_active,
 		uint64_t *p_time, uint64_t interval_ns)
@@ -729,9 +1040,12 @@ static inline void video_sleep(struct obs_core_video *video,
 	struct obs_vframe_info vframe_info;
 	uint64_t cur_time = *p_time;
 	uint64_t t = cur_time + interval_ns;
+	uint64_t spin_ns =
+		(uint64_t)os_atomic_load_long(&video->pacing_spin_us) * 1000;
 	int count;
 
-	if (os_sleepto_ns(t)) {
+	if (os_sleepto_ns_spin(t, spin_ns)) {
+		record_wakeup(video, os_gettime_ns() - t);
 		*p_time = t;
 		count = 1;
 	} else {
@@ -757,7 +1071,7 @@ static const char *output_frame_gs_context_name = "gs_context(video->graphics)";
 static const char *output_frame_render_video_name = "render_video";
 static const char *output_frame_download_frame_name = "download_frame";
 static const char *output_frame_gs_flush_name = "gs_flush";
-static const char *output_frame_output_video_data_name = "output_video_data";
+static const char *output_frame_queue_readback_name = "queue_readback";
 static inline void output_frame(bool raw_active, const bool gpu_active)
 {
 	struct obs_core_video *video = &obs->video;
@@ -778,7 +1092,7 @@ static inline void output_frame(bool raw_active, const bool gpu_active)
 
 	if (raw_active) {
 		profile_start(output_frame_download_frame_name);
-		frame_ready = download_frame(video, prev_texture, &frame);
+		frame_ready = download_frame(video, &frame);
 		profile_end(output_frame_download_frame_name);
 	}
 
@@ -795,13 +1109,15 @@ static inline void output_frame(bool raw_active, const bool gpu_active)
 				sizeof(vframe_info));
 
 		frame.timestamp = vframe_info.timestamp;
-		profile_start(output_frame_output_video_data_name);
-		output_video_data(video, &frame, vframe_info.count);
-		profile_end(output_frame_output_video_data_name);
+		profile_start(output_frame_queue_readback_name);
+		queue_readback(video, &frame, vframe_info.count);
+		profile_end(output_frame_queue_readback_name);
 	}
 
 	if (++video->cur_texture == NUM_TEXTURES)
 		video->cur_texture = 0;
+	if (++video->cur_stage_surface == (int)video->num_stage_surfaces)
+		video->cur_stage_surface = 0;
 }
 
 #define NBSP "\xC2\xA0"
@@ -813,6 +1129,7 @@ static void clear_base_frame_data(void)
 	memset(video->textures_converted, 0, sizeof(video->textures_converted));
 	circlebuf_free(&video->vframe_info_buffer);
 	video->cur_texture = 0;
+	video->cur_stage_surface = 0;
 }
 
 static void clear_raw_frame_data(void)
@@ -832,7 +1149,6 @@ static void clear_gpu_frame_data(void)
 #endif
 
 static const char *tick_sources_name = "tick_sources";
-static const char *render_displays_name = "render_displays";
 static const char *output_frame_name = "output_frame";
 void *obs_graphics_thread(void *param)
 {
@@ -844,6 +1160,7 @@ void *obs_graphics_thread(void *param)
 	bool gpu_was_active = false;
 	bool raw_was_active = false;
 	bool was_active = false;
+	bool realtime = false;
 
 	obs->video.video_time = os_gettime_ns();
 
@@ -867,6 +1184,11 @@ void *obs_graphics_thread(void *param)
 #endif
 		bool active = raw_active || gpu_active;
 
+		if (realtime != os_atomic_load_bool(&obs->video.pacing_realtime)) {
+			realtime = !realtime;
+			set_thread_realtime(realtime, "graphics");
+		}
+
 		if (!was_active && active)
 			clear_base_frame_data();
 		if (!raw_was_active && raw_active)
@@ -881,17 +1203,21 @@ void *obs_graphics_thread(void *param)
 
 		profile_start(video_thread_name);
 
+		/* sources may also be rendered by the display thread, so they
+		 * are ticked while holding the graphics context */
 		profile_start(tick_sources_name);
+		gs_enter_context(obs->video.graphics);
 		last_time = tick_sources(obs->video.video_time, last_time);
+		gs_leave_context();
 		profile_end(tick_sources_name);
 
 		profile_start(output_frame_name);
 		output_frame(raw_active, gpu_active);
 		profile_end(output_frame_name);
 
-		profile_start(render_displays_name);
-		render_displays();
-		profile_end(render_displays_name);
+		render_canvases(obs->video.video_time);
+
+		os_event_signal(obs->video.display_start);
 
 		frame_time_ns = os_gettime_ns() - frame_start;
 
@@ -918,6 +1244,8 @@ void *obs_graphics_thread(void *param)
 		}
 	}
 
+	log_pacing_stats(&obs->video);
+
 	UNUSED_PARAMETER(param);
 	return NULL;
 }
@@ -215,7 +215,12 @@ static bool obs_init_textures(struct obs_video_info *ovi)
 		video->conversion_height : ovi->output_height;
 	size_t i;
 
-	for (i = 0; i < NUM_TEXTURES; i++) {
+	video->num_stage_surfaces = video->readback_depth ?
+		video->readback_depth : 2;
+	if (video->num_stage_surfaces > MAX_STAGE_SURFACES)
+		video->num_stage_surfaces = MAX_STAGE_SURFACES;
+
+	for (i = 0; i < video->num_stage_surfaces; i++) {
 #ifdef _WIN32
 		if (video->using_nv12_tex) {
 			video->copy_surfaces[i] = gs_stagesurface_create_nv12(
@@ -233,7 +238,9 @@ static bool obs_init_textures(struct obs_video_info *ovi)
 #ifdef _WIN32
 		}
 #endif
+	}
 
+	for (i = 0; i < NUM_TEXTURES; i++) {
 		video->render_textures[i] = gs_texture_create(
 				ovi->base_width, ovi->base_height,
 				GS_RGBA, 1, NULL, GS_RENDER_TARGET);
@@ -433,6 +440,15 @@ static int obs_init_video(struct obs_video_info *ovi)
 		return OBS_VIDEO_FAIL;
 	if (pthread_mutex_init(&video->gpu_encoder_mutex, NULL) < 0)
 		return OBS_VIDEO_FAIL;
+	if (pthread_mutex_init(&video->pacing_mutex, NULL) < 0)
+		return OBS_VIDEO_FAIL;
+	if (!ovi->gpu_conversion && format_is_yuv(ovi->output_format) &&
+	    !init_convert_threads(video))
+		return OBS_VIDEO_FAIL;
+	if (!init_readback_thread(video))
+		return OBS_VIDEO_FAIL;
+	if (!init_display_thread(video))
+		return OBS_VIDEO_FAIL;
 
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_graphics_thread, obs);
@@ -455,6 +471,9 @@ static void stop_video(void)
 			pthread_join(video->video_thread, &thread_retval);
 			video->thread_initialized = false;
 		}
+
+		/* displays render the textures freed with the video */
+		free_display_thread(video);
 	}
 
 }
@@ -464,8 +483,10 @@ static void obs_free_video(void)
 	struct obs_core_video *video = &obs->video;
 
 	if (video->video) {
+		free_readback_thread(video);
 		video_output_close(video->video);
 		video->video = NULL;
+		free_convert_threads(video);
 
 		if (!video->graphics)
 			return;
@@ -477,14 +498,17 @@ static void obs_free_video(void)
 			video->mapped_surface = NULL;
 		}
 
-		for (size_t i = 0; i < NUM_TEXTURES; i++) {
+		for (size_t i = 0; i < MAX_STAGE_SURFACES; i++) {
 			gs_stagesurface_destroy(video->copy_surfaces[i]);
+			video->copy_surfaces[i] = NULL;
+		}
+
+		for (size_t i = 0; i < NUM_TEXTURES; i++) {
 			gs_texture_destroy(video->render_textures[i]);
 			gs_texture_destroy(video->convert_textures[i]);
 			gs_texture_destroy(video->convert_uv_textures[i]);
 			gs_texture_destroy(video->output_textures[i]);
 
-			video->copy_surfaces[i]       = NULL;
 			video->render_textures[i]     = NULL;
 			video->convert_textures[i]    = NULL;
 			video->convert_uv_textures[i] = NULL;
@@ -507,10 +531,15 @@ static void obs_free_video(void)
 
 		pthread_mutex_destroy(&video->gpu_encoder_mutex);
 		pthread_mutex_init_value(&video->gpu_encoder_mutex);
+		pthread_mutex_destroy(&video->pacing_mutex);
+		pthread_mutex_init_value(&video->pacing_mutex);
+		memset(&video->pacing_stats, 0, sizeof(video->pacing_stats));
+		video->pacing_lateness_total_ns = 0;
 		da_free(video->gpu_encoders);
 
 		video->gpu_encoder_active = 0;
 		video->cur_texture = 0;
+		video->cur_stage_surface = 0;
 	}
 }
 
@@ -601,6 +630,7 @@ static bool obs_init_data(void)
 	assert(data != NULL);
 
 	pthread_mutex_init_value(&obs->data.displays_mutex);
+	pthread_mutex_init_value(&obs->data.canvases_mutex);
 	pthread_mutex_init_value(&obs->data.draw_callbacks_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
@@ -613,6 +643,8 @@ static bool obs_init_data(void)
 		goto fail;
 	if (pthread_mutex_init(&data->displays_mutex, &attr) != 0)
 		goto fail;
+	if (pthread_mutex_init(&data->canvases_mutex, &attr) != 0)
+		goto fail;
 	if (pthread_mutex_init(&data->outputs_mutex, &attr) != 0)
 		goto fail;
 	if (pthread_mutex_init(&data->encoders_mutex, &attr) != 0)
@@ -665,6 +697,7 @@ static void obs_free_data(void)
 
 	blog(LOG_INFO, "Freeing OBS context data");
 
+	FREE_OBS_LINKED_LIST(canvas);
 	FREE_OBS_LINKED_LIST(source);
 	FREE_OBS_LINKED_LIST(output);
 	FREE_OBS_LINKED_LIST(encoder);
@@ -674,6 +707,7 @@ static void obs_free_data(void)
 	pthread_mutex_destroy(&data->sources_mutex);
 	pthread_mutex_destroy(&data->audio_sources_mutex);
 	pthread_mutex_destroy(&data->displays_mutex);
+	pthread_mutex_destroy(&data->canvases_mutex);
 	pthread_mutex_destroy(&data->outputs_mutex);
 	pthread_mutex_destroy(&data->encoders_mutex);
 	pthread_mutex_destroy(&data->services_mutex);
@@ -1012,6 +1046,7 @@ void obs_shutdown(void)
 		profiler_name_store_free(core->name_store);
 
 	bfree(core->module_config_path);
+	bfree(core->module_cache_path);
 	bfree(core->locale);
 	bfree(core);
 	bfree(cmdline_args.argv);
@@ -1048,7 +1083,10 @@ void obs_set_locale(const char *locale)
 
 	module = obs->first_module;
 	while (module) {
-		if (module->set_locale)
+		/* cached display names are only valid for the old locale */
+		if (module->deferred)
+			obs_load_deferred_module(module);
+		else if (module->set_locale)
 			module->set_locale(locale);
 
 		module = module->next;
@@ -1141,6 +1179,19 @@ int obs_reset_video(struct obs_video_info *ovi)
 	return obs_init_video(ovi);
 }
 
+void obs_set_video_readback_depth(uint32_t frames)
+{
+	if (!obs)
+		return;
+
+	if (frames > MAX_STAGE_SURFACES)
+		frames = MAX_STAGE_SURFACES;
+	else if (frames == 1)
+		frames = 2;
+
+	obs->video.readback_depth = frames;
+}
+
 bool obs_reset_audio(const struct obs_audio_info *oai)
 {
 	struct audio_output_info ai;
@@ -1364,7 +1415,10 @@ void obs_set_output_source(uint32_t channel, obs_source_t *source)
 
 	struct obs_source *prev_source;
 	struct obs_view *view = &obs->data.main_view;
-	struct calldata params = {0};
+	struct calldata params;
+	uint8_t stack[128];
+
+	calldata_init_stack(&params, stack, sizeof(stack));
 
 	pthread_mutex_lock(&view->channels_mutex);
 
@@ -1661,10 +1715,12 @@ gs_texture_t *obs_get_main_texture(void)
 
 void obs_set_master_volume(float volume)
 {
-	struct calldata data = {0};
+	struct calldata data;
+	uint8_t stack[128];
 
 	if (!obs) return;
 
+	calldata_init_stack(&data, stack, sizeof(stack));
 	calldata_set_float(&data, "volume", volume);
 	signal_handler_signal(obs->signals, "master_volume", &data);
 	volume = (float)calldata_float(&data, "volume");
@@ -2254,6 +2310,32 @@ uint32_t obs_get_lagged_frames(void)
 	return obs ? obs->video.lagged_frames : 0;
 }
 
+void obs_set_video_pacing(uint64_t spin_ns, bool realtime)
+{
+	if (!obs) return;
+
+	os_atomic_set_long(&obs->video.pacing_spin_us,
+			(long)(spin_ns / 1000));
+	os_atomic_set_bool(&obs->video.pacing_realtime, realtime);
+}
+
+bool obs_get_video_pacing_stats(struct obs_video_pacing_stats *stats)
+{
+	struct obs_core_video *video;
+
+	if (!obs || !obs->video.video || !stats)
+		return false;
+
+	video = &obs->video;
+
+	pthread_mutex_lock(&video->pacing_mutex);
+	*stats = video->pacing_stats;
+	pthread_mutex_unlock(&video->pacing_mutex);
+
+	stats->lagged_frames = video->lagged_frames;
+	return true;
+}
+
 void start_raw_video(video_t *v, const struct video_scale_info *conversion,
 		void (*callback)(void *param, struct video_data *frame),
 		void *param)
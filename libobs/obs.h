@@ -41,6 +41,7 @@ struct matrix4;
 /* opaque types */
 struct obs_display;
 struct obs_view;
+struct obs_canvas;
 struct obs_source;
 struct obs_scene;
 struct obs_scene_item;
@@ -53,6 +54,7 @@ struct obs_volmeter;
 
 typedef struct obs_display    obs_display_t;
 typedef struct obs_view       obs_view_t;
+typedef struct obs_canvas     obs_canvas_t;
 typedef struct obs_source     obs_source_t;
 typedef struct obs_scene      obs_scene_t;
 typedef struct obs_scene_item obs_sceneitem_t;
@@ -357,6 +359,14 @@ EXPORT profiler_name_store_t *obs_get_profiler_name_store(void);
  */
 EXPORT int obs_reset_video(struct obs_video_info *ovi);
 
+/**
+ * Sets the number of frames raw video output is staged ahead of being read
+ * back from the GPU.  Higher values give the GPU more time to finish copying a
+ * frame before it is mapped, at the cost of latency.  Takes effect on the next
+ * call to obs_reset_video.  Valid values are 2 to 4, or 0 for the default (2).
+ */
+EXPORT void obs_set_video_readback_depth(uint32_t frames);
+
 /**
  * Sets base audio output format/channels/samples/etc
  *
@@ -422,6 +432,15 @@ EXPORT const char *obs_get_module_binary_path(obs_module_t *module);
 /** Returns the module data path */
 EXPORT const char *obs_get_module_data_path(obs_module_t *module);
 
+/**
+ * Returns the time spent opening the module's library and loading its locale,
+ * in nanoseconds
+ */
+EXPORT uint64_t obs_get_module_open_time_ns(obs_module_t *module);
+
+/** Returns the time spent in the module's obs_module_load, in nanoseconds */
+EXPORT uint64_t obs_get_module_init_time_ns(obs_module_t *module);
+
 /**
  * Adds a module search path to be used with obs_find_modules.  If the search
  * path strings contain %module%, that text will be replaced with the module
@@ -432,7 +451,20 @@ EXPORT const char *obs_get_module_data_path(obs_module_t *module);
  */
 EXPORT void obs_add_module_path(const char *bin, const char *data);
 
-/** Automatically loads all modules from module paths (convenience function) */
+/**
+ * Sets the file used to cache the types registered by each module.  When set,
+ * obs_load_all_modules will not load modules that allow deferred loading (see
+ * OBS_MODULE_ALLOW_DEFERRED_LOAD) if they are unchanged since the cache was
+ * written, and will instead load them the first time one of their types is
+ * used.
+ */
+EXPORT void obs_set_module_cache_path(const char *path);
+
+/**
+ * Automatically loads all modules from module paths (convenience function).
+ * Module libraries and their locales are opened on multiple threads, but the
+ * modules are initialized one at a time in the order they were found.
+ */
 EXPORT void obs_load_all_modules(void);
 
 /** Notifies modules that all modules have been loaded.  This function should
@@ -714,6 +746,31 @@ EXPORT uint64_t obs_get_average_frame_time_ns(void);
 EXPORT uint32_t obs_get_total_frames(void);
 EXPORT uint32_t obs_get_lagged_frames(void);
 
+struct obs_video_pacing_stats {
+	uint64_t wakeups;
+	uint64_t late_wakeups;
+	uint64_t avg_lateness_ns;
+	uint64_t max_lateness_ns;
+	uint32_t lagged_frames;
+};
+
+/**
+ * Sets how the graphics thread waits for the next frame.
+ *
+ * @param  spin_ns   Time before each frame to spin instead of sleeping, for
+ *                   more accurate wakeups at the cost of CPU time.
+ * @param  realtime  Runs the graphics and audio threads with realtime
+ *                   priority, or with high priority if that is not
+ *                   permitted.
+ */
+EXPORT void obs_set_video_pacing(uint64_t spin_ns, bool realtime);
+
+/**
+ * Gets how late the graphics thread woke up for frames since video was last
+ * reset.  Late wakeups are those over a millisecond late.
+ */
+EXPORT bool obs_get_video_pacing_stats(struct obs_video_pacing_stats *stats);
+
 EXPORT bool obs_nv12_tex_active(void);
 
 EXPORT void obs_apply_private_data(obs_data_t *settings);
@@ -747,6 +804,52 @@ EXPORT obs_source_t *obs_view_get_source(obs_view_t *view,
 EXPORT void obs_view_render(obs_view_t *view);
 
 
+/* ------------------------------------------------------------------------- */
+/* Canvases */
+
+/**
+ * Creates a canvas, an additional render target with its own base/output
+ * resolution, frame rate, format and channels.  Canvases share sources and
+ * the graphics thread with the main video, and each has its own video output
+ * for encoders to use (see obs_encoder_set_video).
+ *
+ *   The graphics_module, adapter and gpu_conversion members of the video info
+ * are ignored.  Canvases with a frame rate above that of the main video get
+ * duplicated frames.
+ *
+ * @param  ovi  The video settings of the canvas.
+ * @return      The new canvas, or NULL if failed.
+ */
+EXPORT obs_canvas_t *obs_canvas_create(const struct obs_video_info *ovi);
+
+/**
+ * Destroys a canvas.  Encoders using its video output must be stopped
+ * beforehand.
+ */
+EXPORT void obs_canvas_destroy(obs_canvas_t *canvas);
+
+/** Gets the video settings of a canvas */
+EXPORT bool obs_canvas_get_video_info(const obs_canvas_t *canvas,
+		struct obs_video_info *ovi);
+
+/** Gets the video output of a canvas */
+EXPORT video_t *obs_canvas_get_video(const obs_canvas_t *canvas);
+
+/** Sets the source to be rendered to a channel of a canvas */
+EXPORT void obs_canvas_set_source(obs_canvas_t *canvas, uint32_t channel,
+		obs_source_t *source);
+
+/** Gets the source of a channel of a canvas */
+EXPORT obs_source_t *obs_canvas_get_source(obs_canvas_t *canvas,
+		uint32_t channel);
+
+/**
+ * Renders the last base resolution texture of a canvas, useful for
+ * previewing it in a display.
+ */
+EXPORT void obs_canvas_render_texture(obs_canvas_t *canvas);
+
+
 /* ------------------------------------------------------------------------- */
 /* Display context */
 
@@ -786,6 +889,15 @@ EXPORT void obs_display_remove_draw_callback(obs_display_t *display,
 		void *param);
 
 EXPORT void obs_display_set_enabled(obs_display_t *display, bool enable);
+
+/**
+ * Limits how often a display is rendered.  Displays are rendered on their
+ * own thread after each video frame, so this only lowers the rate.
+ *
+ * @param  display  The display context.
+ * @param  fps      The maximum frame rate, or 0 to render every frame.
+ */
+EXPORT void obs_display_set_max_fps(obs_display_t *display, double fps);
 EXPORT bool obs_display_enabled(obs_display_t *display);
 
 EXPORT void obs_display_set_background_color(obs_display_t *display,
@@ -866,6 +978,19 @@ EXPORT void obs_source_update(obs_source_t *source, obs_data_t *settings);
 /** Renders a video source. */
 EXPORT void obs_source_video_render(obs_source_t *source);
 
+/**
+ * Notifies that the video of a source with the OBS_SOURCE_STATIC_VIDEO flag
+ * has changed, and that any cached renders of it must be discarded.
+ */
+EXPORT void obs_source_video_changed(obs_source_t *source);
+
+/**
+ * Sets whether a source currently draws only opaque pixels over its entire
+ * width and height, for sources whose opacity depends on their settings.
+ * See OBS_SOURCE_OPAQUE.
+ */
+EXPORT void obs_source_set_opaque(obs_source_t *source, bool opaque);
+
 /** Gets the width of a source (if it has video) */
 EXPORT uint32_t obs_source_get_width(obs_source_t *source);
 
@@ -1869,6 +1994,17 @@ EXPORT void obs_encoder_set_preferred_video_format(obs_encoder_t *encoder,
 EXPORT enum video_format obs_encoder_get_preferred_video_format(
 		const obs_encoder_t *encoder);
 
+/**
+ * Runs an audio encoder on its own thread instead of the audio thread, so
+ * that several audio encoders do not delay the next audio mix.  The encoder
+ * thread is woken once batch_frames encoder frames worth of audio has been
+ * mixed (0 is treated as 1).  Can only be changed while the encoder is not
+ * active.
+ */
+EXPORT void obs_encoder_set_audio_thread(obs_encoder_t *encoder, bool enabled,
+		uint32_t batch_frames);
+EXPORT bool obs_encoder_audio_thread_enabled(const obs_encoder_t *encoder);
+
 /** Gets the default settings for an encoder type */
 EXPORT obs_data_t *obs_encoder_defaults(const char *id);
 EXPORT obs_data_t *obs_encoder_get_defaults(const obs_encoder_t *encoder);
@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2013 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "threading.h"
+#include "file-writer.h"
+
+#define DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_NUM_BUFFERS 16
+
+/* offset, size and memory alignment required for direct I/O */
+#define DIRECT_IO_ALIGN 4096
+
+#ifdef _WIN32
+typedef HANDLE file_handle_t;
+#define INVALID_FILE INVALID_HANDLE_VALUE
+#else
+typedef int file_handle_t;
+#define INVALID_FILE -1
+#endif
+
+struct file_writer_buffer {
+	uint8_t                   *data;
+	size_t                    size;
+	int64_t                   offset;
+};
+
+struct file_writer {
+	file_handle_t             file;
+	struct file_writer_params params;
+	bool                      direct;
+	bool                      direct_on;
+
+	/* buffers [io_idx, io_idx + queued) are waiting on the I/O thread,
+	 * and the buffer after them is being filled */
+	struct file_writer_buffer *buffers;
+	size_t                    io_idx;
+	size_t                    queued;
+	size_t                    fill_idx;
+	int64_t                   pos;
+
+	pthread_mutex_t           mutex;
+	pthread_cond_t            io_cond;
+	pthread_cond_t            free_cond;
+	pthread_t                 thread;
+	bool                      stop;
+	bool                      congested;
+	volatile bool             failed;
+
+	/* serializes the congestion callback; signaled_congested is the last
+	 * state handed to it */
+	pthread_mutex_t           signal_mutex;
+	bool                      signaled_congested;
+
+	uint64_t                  unsynced;
+	struct file_writer_stats  stats;
+};
+
+/* ------------------------------------------------------------------------- */
+/* platform file functions */
+
+static uint64_t get_time_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64_t)((double)count.QuadPart * 1000000000.0 /
+			(double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void *alloc_buffer(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, DIRECT_IO_ALIGN);
+#else
+	void *ptr;
+	return posix_memalign(&ptr, DIRECT_IO_ALIGN, size) == 0 ? ptr : NULL;
+#endif
+}
+
+static void free_buffer(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+static bool open_file(struct file_writer *fw, const char *path)
+{
+#ifdef _WIN32
+	wchar_t *wpath;
+	int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+
+	if (!len)
+		return false;
+
+	wpath = malloc(len * sizeof(wchar_t));
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, len);
+
+	fw->file = CreateFileW(wpath, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(wpath);
+
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+	/* not every file system supports direct I/O */
+	if (fw->params.direct_io) {
+		fw->file = open(path, flags | O_DIRECT, 0644);
+		if (fw->file != INVALID_FILE) {
+			fw->direct = true;
+			fw->direct_on = true;
+			return true;
+		}
+	}
+#endif
+
+	fw->file = open(path, flags, 0644);
+#endif
+
+	return fw->file != INVALID_FILE;
+}
+
+static void preallocate_file(struct file_writer *fw, int64_t size)
+{
+#if defined(_WIN32)
+	FILE_ALLOCATION_INFO info;
+	info.AllocationSize.QuadPart = size;
+	SetFileInformationByHandle(fw->file, FileAllocationInfo, &info,
+			sizeof(info));
+#elif defined(__linux__)
+	fallocate(fw->file, FALLOC_FL_KEEP_SIZE, 0, size);
+#else
+	(void)fw;
+	(void)size;
+#endif
+}
+
+#ifdef O_DIRECT
+static inline bool is_aligned(const struct file_writer_buffer *buf)
+{
+	return buf->offset % DIRECT_IO_ALIGN == 0 &&
+	       buf->size % DIRECT_IO_ALIGN == 0;
+}
+
+/* direct I/O is only used for aligned writes, anything else (the end of the
+ * file, or data written after a seek) goes through the page cache */
+static void set_direct_io(struct file_writer *fw, bool direct)
+{
+	int flags;
+
+	if (fw->direct_on == direct)
+		return;
+
+	flags = fcntl(fw->file, F_GETFL);
+	flags = direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+
+	if (fcntl(fw->file, F_SETFL, flags) == 0)
+		fw->direct_on = direct;
+}
+#endif
+
+static bool write_buffer(struct file_writer *fw,
+		const struct file_writer_buffer *buf)
+{
+#ifdef _WIN32
+	const uint8_t *data = buf->data;
+	size_t size = buf->size;
+	int64_t offset = buf->offset;
+
+	while (size > 0) {
+		OVERLAPPED ov = {0};
+		DWORD to_write = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD written;
+
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+
+		if (!WriteFile(fw->file, data, to_write, &written, &ov) ||
+		    !written)
+			return false;
+
+		data += written;
+		size -= written;
+		offset += written;
+	}
+
+#else
+	const uint8_t *data = buf->data;
+	size_t size = buf->size;
+	off_t offset = (off_t)buf->offset;
+
+#ifdef O_DIRECT
+	if (fw->direct)
+		set_direct_io(fw, is_aligned(buf));
+#endif
+
+	while (size > 0) {
+		ssize_t written = pwrite(fw->file, data, size, offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+
+		data += written;
+		size -= (size_t)written;
+		offset += written;
+	}
+#endif
+
+	return true;
+}
+
+static bool sync_file(struct file_writer *fw)
+{
+#if defined(_WIN32)
+	return !!FlushFileBuffers(fw->file);
+#elif defined(__linux__)
+	return fdatasync(fw->file) == 0;
+#else
+	return fsync(fw->file) == 0;
+#endif
+}
+
+static void close_file(struct file_writer *fw)
+{
+#ifdef _WIN32
+	CloseHandle(fw->file);
+#else
+	close(fw->file);
+#endif
+	fw->file = INVALID_FILE;
+}
+
+/* ------------------------------------------------------------------------- */
+/* I/O thread */
+
+/* called without fw->mutex after either thread changes fw->congested.  the
+ * current state is re-read under signal_mutex, so transitions reach the
+ * callback in order, and a change that was already undone by the other
+ * thread is not reported at all */
+static void signal_congestion(struct file_writer *fw)
+{
+	bool congested;
+
+	if (!fw->params.congestion)
+		return;
+
+	pthread_mutex_lock(&fw->signal_mutex);
+
+	pthread_mutex_lock(&fw->mutex);
+	congested = fw->congested;
+	pthread_mutex_unlock(&fw->mutex);
+
+	if (congested != fw->signaled_congested) {
+		fw->signaled_congested = congested;
+		fw->params.congestion(fw->params.congestion_param, congested);
+	}
+
+	pthread_mutex_unlock(&fw->signal_mutex);
+}
+
+static void *io_thread(void *data)
+{
+	struct file_writer *fw = data;
+
+	pthread_mutex_lock(&fw->mutex);
+
+	for (;;) {
+		struct file_writer_buffer *buf;
+		bool relieved = false;
+		bool success;
+
+		while (!fw->queued && !fw->stop)
+			pthread_cond_wait(&fw->io_cond, &fw->mutex);
+		if (!fw->queued)
+			break;
+
+		buf = &fw->buffers[fw->io_idx];
+		pthread_mutex_unlock(&fw->mutex);
+
+		/* keep consuming buffers after a failure so the writing
+		 * thread never waits forever */
+		success = !os_atomic_load_bool(&fw->failed) &&
+			write_buffer(fw, buf);
+
+		if (success && fw->params.sync == FILE_WRITER_SYNC_INTERVAL) {
+			fw->unsynced += buf->size;
+			if (fw->unsynced >= fw->params.sync_interval) {
+				success = sync_file(fw);
+				fw->unsynced = 0;
+			}
+		}
+
+		pthread_mutex_lock(&fw->mutex);
+
+		if (success)
+			fw->stats.bytes_written += buf->size;
+		else
+			os_atomic_set_bool(&fw->failed, true);
+
+		buf->size = 0;
+		fw->io_idx = (fw->io_idx + 1) % fw->params.num_buffers;
+		fw->queued--;
+
+		if (fw->congested &&
+		    fw->queued <= fw->params.num_buffers / 4) {
+			fw->congested = false;
+			relieved = true;
+		}
+
+		pthread_cond_signal(&fw->free_cond);
+
+		if (relieved) {
+			pthread_mutex_unlock(&fw->mutex);
+			signal_congestion(fw);
+			pthread_mutex_lock(&fw->mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&fw->mutex);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* hands the buffer being filled to the I/O thread and waits until there is
+ * a free buffer to fill next */
+static bool queue_buffer(struct file_writer *fw)
+{
+	size_t num_buffers = fw->params.num_buffers;
+	bool congested = false;
+
+	if (!fw->buffers[fw->fill_idx].size)
+		return !os_atomic_load_bool(&fw->failed);
+
+	pthread_mutex_lock(&fw->mutex);
+
+	fw->queued++;
+	if (fw->queued > fw->stats.max_queued)
+		fw->stats.max_queued = fw->queued;
+
+	if (!fw->congested &&
+	    fw->queued >= num_buffers - num_buffers / 4) {
+		fw->congested = true;
+		congested = true;
+	}
+
+	pthread_cond_signal(&fw->io_cond);
+
+	if (fw->queued == num_buffers) {
+		uint64_t start = get_time_ns();
+
+		while (fw->queued == num_buffers)
+			pthread_cond_wait(&fw->free_cond, &fw->mutex);
+
+		fw->stats.blocked_ns += get_time_ns() - start;
+	}
+
+	fw->fill_idx = (fw->io_idx + fw->queued) % num_buffers;
+	pthread_mutex_unlock(&fw->mutex);
+
+	if (congested)
+		signal_congestion(fw);
+
+	return !os_atomic_load_bool(&fw->failed);
+}
+
+static void free_writer(struct file_writer *fw)
+{
+	if (fw->buffers) {
+		for (size_t i = 0; i < fw->params.num_buffers; i++)
+			free_buffer(fw->buffers[i].data);
+		free(fw->buffers);
+	}
+
+	if (fw->file != INVALID_FILE)
+		close_file(fw);
+
+	pthread_mutex_destroy(&fw->mutex);
+	pthread_mutex_destroy(&fw->signal_mutex);
+	pthread_cond_destroy(&fw->io_cond);
+	pthread_cond_destroy(&fw->free_cond);
+	free(fw);
+}
+
+struct file_writer *file_writer_open(const char *path,
+		const struct file_writer_params *params)
+{
+	struct file_writer *fw = calloc(1, sizeof(*fw));
+	size_t buffer_size;
+
+	if (!fw)
+		return NULL;
+
+	fw->file = INVALID_FILE;
+	if (params)
+		fw->params = *params;
+	if (!fw->params.buffer_size)
+		fw->params.buffer_size = DEFAULT_BUFFER_SIZE;
+	if (!fw->params.num_buffers)
+		fw->params.num_buffers = DEFAULT_NUM_BUFFERS;
+	if (fw->params.num_buffers < 2)
+		fw->params.num_buffers = 2;
+
+	/* full buffers must stay aligned for direct I/O */
+	buffer_size = fw->params.buffer_size + DIRECT_IO_ALIGN - 1;
+	buffer_size -= buffer_size % DIRECT_IO_ALIGN;
+	fw->params.buffer_size = buffer_size;
+
+	if (pthread_mutex_init(&fw->mutex, NULL) != 0) {
+		free(fw);
+		return NULL;
+	}
+	if (pthread_mutex_init(&fw->signal_mutex, NULL) != 0) {
+		pthread_mutex_destroy(&fw->mutex);
+		free(fw);
+		return NULL;
+	}
+	pthread_cond_init(&fw->io_cond, NULL);
+	pthread_cond_init(&fw->free_cond, NULL);
+
+	fw->buffers = calloc(fw->params.num_buffers, sizeof(*fw->buffers));
+	if (!fw->buffers)
+		goto fail;
+
+	for (size_t i = 0; i < fw->params.num_buffers; i++) {
+		fw->buffers[i].data = alloc_buffer(buffer_size);
+		if (!fw->buffers[i].data)
+			goto fail;
+	}
+
+	if (!path || !open_file(fw, path))
+		goto fail;
+
+	if (fw->params.preallocate > 0)
+		preallocate_file(fw, fw->params.preallocate);
+
+	if (pthread_create(&fw->thread, NULL, io_thread, fw) != 0)
+		goto fail;
+
+	return fw;
+
+fail:
+	free_writer(fw);
+	return NULL;
+}
+
+bool file_writer_close(struct file_writer *fw)
+{
+	bool success;
+
+	if (!fw)
+		return false;
+
+	queue_buffer(fw);
+
+	pthread_mutex_lock(&fw->mutex);
+	fw->stop = true;
+	pthread_cond_signal(&fw->io_cond);
+	pthread_mutex_unlock(&fw->mutex);
+
+	pthread_join(fw->thread, NULL);
+
+	success = !os_atomic_load_bool(&fw->failed);
+	if (success && fw->params.sync != FILE_WRITER_SYNC_NONE)
+		success = sync_file(fw);
+
+	free_writer(fw);
+	return success;
+}
+
+bool file_writer_write(struct file_writer *fw, const void *data,
+		size_t size)
+{
+	const uint8_t *in = data;
+
+	if (!fw || os_atomic_load_bool(&fw->failed))
+		return false;
+
+	while (size > 0) {
+		struct file_writer_buffer *buf = &fw->buffers[fw->fill_idx];
+		size_t copy = fw->params.buffer_size - buf->size;
+
+		if (copy > size)
+			copy = size;
+		if (!buf->size)
+			buf->offset = fw->pos;
+
+		memcpy(buf->data + buf->size, in, copy);
+		buf->size += copy;
+		fw->pos += copy;
+		in += copy;
+		size -= copy;
+
+		if (buf->size == fw->params.buffer_size && !queue_buffer(fw))
+			return false;
+	}
+
+	return true;
+}
+
+bool file_writer_seek(struct file_writer *fw, int64_t offset)
+{
+	if (!fw || offset < 0)
+		return false;
+
+	/* the buffer being filled is written at its own offset */
+	if (!queue_buffer(fw))
+		return false;
+
+	fw->pos = offset;
+	return true;
+}
+
+int64_t file_writer_tell(struct file_writer *fw)
+{
+	return fw ? fw->pos : -1;
+}
+
+bool file_writer_flush(struct file_writer *fw)
+{
+	if (!fw)
+		return false;
+
+	queue_buffer(fw);
+
+	pthread_mutex_lock(&fw->mutex);
+	while (fw->queued)
+		pthread_cond_wait(&fw->free_cond, &fw->mutex);
+	pthread_mutex_unlock(&fw->mutex);
+
+	return !os_atomic_load_bool(&fw->failed);
+}
+
+void file_writer_get_stats(struct file_writer *fw,
+		struct file_writer_stats *stats)
+{
+	if (!fw) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	pthread_mutex_lock(&fw->mutex);
+	*stats = fw->stats;
+	pthread_mutex_unlock(&fw->mutex);
+}
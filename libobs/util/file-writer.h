@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2013 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+
+/*
+ *   Asynchronous file writer.  Data is copied into a ring of large write
+ * buffers, and full buffers are written to the file by a dedicated I/O
+ * thread, so a slow disk only stalls the writing thread once every buffer
+ * is queued.
+ *
+ *   Writing, seeking and closing must be done from a single thread.  Only
+ * pthreads and the C library are used, so this can also be built into
+ * helper programs that do not link libobs.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct file_writer;
+
+enum file_writer_sync {
+	FILE_WRITER_SYNC_NONE,     /* never sync to disk */
+	FILE_WRITER_SYNC_CLOSE,    /* sync when closing the file */
+	FILE_WRITER_SYNC_INTERVAL, /* sync every sync_interval bytes */
+};
+
+/* called when every write buffer is nearly full (congested is true), and
+ * again once the I/O thread has caught up.  Can be called from the I/O
+ * thread. */
+typedef void (*file_writer_congestion_t)(void *param, bool congested);
+
+struct file_writer_params {
+	size_t                   buffer_size;   /* 0 for the default (1 MiB) */
+	size_t                   num_buffers;   /* 0 for the default (16) */
+
+	/* bypasses the OS page cache for aligned writes where supported */
+	bool                     direct_io;
+
+	/* bytes to reserve on disk up front where supported, 0 for none.
+	 * The size of the file is not changed. */
+	int64_t                  preallocate;
+
+	enum file_writer_sync    sync;
+	uint64_t                 sync_interval;
+
+	file_writer_congestion_t congestion;
+	void                     *congestion_param;
+};
+
+struct file_writer_stats {
+	uint64_t bytes_written; /* bytes written to the file so far */
+	uint64_t blocked_ns;    /* time spent waiting on a free buffer */
+	size_t   max_queued;    /* most write buffers queued at once */
+};
+
+/* params can be NULL to use the defaults */
+EXPORT struct file_writer *file_writer_open(const char *path,
+		const struct file_writer_params *params);
+
+/* flushes, waits for the I/O thread and closes the file.  Returns false if
+ * any write failed. */
+EXPORT bool file_writer_close(struct file_writer *fw);
+
+/* copies data into the write buffers, waiting for a free buffer only when
+ * all of them are queued.  Returns false once a write has failed. */
+EXPORT bool file_writer_write(struct file_writer *fw, const void *data,
+		size_t size);
+
+/* changes the position of the next write */
+EXPORT bool file_writer_seek(struct file_writer *fw, int64_t offset);
+EXPORT int64_t file_writer_tell(struct file_writer *fw);
+
+/* waits until all written data has been handed to the OS */
+EXPORT bool file_writer_flush(struct file_writer *fw);
+
+EXPORT void file_writer_get_stats(struct file_writer *fw,
+		struct file_writer_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -18,15 +18,19 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/statvfs.h>
 #include <dirent.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <dlfcn.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <glob.h>
 #include <time.h>
 #include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "obsconfig.h"
 
@@ -42,6 +46,7 @@
 #include <libprocstat.h>
 #else
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #endif
 #include <spawn.h>
 #endif
@@ -140,6 +145,29 @@ void os_cpu_usage_info_destroy(os_cpu_usage_info_t *info)
 
 #endif
 
+#if !defined(__APPLE__)
+
+/* os_gettime_ns uses CLOCK_MONOTONIC, so sleep to the absolute time instead
+ * of computing a relative one, which avoids drift from preemption between
+ * reading the time and going to sleep */
+bool os_sleepto_ns(uint64_t time_target)
+{
+	uint64_t current = os_gettime_ns();
+	if (time_target < current)
+		return false;
+
+	struct timespec req;
+	req.tv_sec = (time_t)(time_target / 1000000000);
+	req.tv_nsec = (long)(time_target % 1000000000);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL) ==
+			EINTR);
+
+	return true;
+}
+
+#else
+
 bool os_sleepto_ns(uint64_t time_target)
 {
 	uint64_t current = os_gettime_ns();
@@ -162,6 +190,36 @@ bool os_sleepto_ns(uint64_t time_target)
 	return true;
 }
 
+#endif
+
+bool os_set_thread_priority(enum os_thread_priority priority)
+{
+	struct sched_param param;
+	int policy = SCHED_OTHER;
+
+	memset(&param, 0, sizeof(param));
+
+	if (priority == OS_THREAD_PRIORITY_REALTIME) {
+		policy = SCHED_FIFO;
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	}
+
+	if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
+		return false;
+
+	if (priority == OS_THREAD_PRIORITY_REALTIME)
+		return true;
+
+#if defined(__linux__)
+	/* on linux, the nice value of a thread id only affects that thread */
+	int nice_value = priority == OS_THREAD_PRIORITY_HIGH ? -10 : 0;
+	return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid),
+			nice_value) == 0;
+#else
+	return priority == OS_THREAD_PRIORITY_NORMAL;
+#endif
+}
+
 void os_sleep_ms(uint32_t duration)
 {
 	usleep(duration*1000);
@@ -449,6 +507,35 @@ int os_safe_replace(const char *target, const char *from, const char *backup)
 	return rename(from, target);
 }
 
+void *os_map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *data = NULL;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+				fd, 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+		else
+			*size = (size_t)st.st_size;
+	}
+
+	close(fd);
+	return data;
+}
+
+void os_unmap_file(void *data, size_t size)
+{
+	if (data)
+		munmap(data, size);
+}
+
 #if !defined(__APPLE__)
 os_performance_token_t *os_request_high_performance(const char *reason)
 {
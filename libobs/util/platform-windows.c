@@ -56,6 +56,10 @@ static inline uint32_t get_winver(void)
 	return winver;
 }
 
+/* the DLL directory is process-wide, and modules may be opened from several
+ * threads at once */
+static pthread_mutex_t dll_directory_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void *os_dlopen(const char *path)
 {
 	struct dstr dll_name;
@@ -78,6 +82,7 @@ void *os_dlopen(const char *path)
 	 * libraries that are within the library's own directory */
 	wpath_slash = wcsrchr(wpath, L'/');
 	if (wpath_slash) {
+		pthread_mutex_lock(&dll_directory_mutex);
 		*wpath_slash = 0;
 		SetDllDirectoryW(wpath);
 		*wpath_slash = L'/';
@@ -87,8 +92,10 @@ void *os_dlopen(const char *path)
 	bfree(wpath);
 	dstr_free(&dll_name);
 
-	if (wpath_slash)
+	if (wpath_slash) {
 		SetDllDirectoryW(NULL);
+		pthread_mutex_unlock(&dll_directory_mutex);
+	}
 
 	if (!h_library) {
 		DWORD error = GetLastError();
@@ -213,6 +220,18 @@ bool os_sleepto_ns(uint64_t time_target)
 	}
 }
 
+bool os_set_thread_priority(enum os_thread_priority priority)
+{
+	int value = THREAD_PRIORITY_NORMAL;
+
+	if (priority == OS_THREAD_PRIORITY_HIGH)
+		value = THREAD_PRIORITY_HIGHEST;
+	else if (priority == OS_THREAD_PRIORITY_REALTIME)
+		value = THREAD_PRIORITY_TIME_CRITICAL;
+
+	return !!SetThreadPriority(GetCurrentThread(), value);
+}
+
 void os_sleep_ms(uint32_t duration)
 {
 	/* windows 8+ appears to have decreased sleep precision */
@@ -600,6 +619,49 @@ fail:
 	return code;
 }
 
+void *os_map_file(const char *path, size_t *size)
+{
+	wchar_t *wpath = NULL;
+	LARGE_INTEGER file_size;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	void *data = NULL;
+
+	if (!os_utf8_to_wcs_ptr(path, 0, &wpath))
+		return NULL;
+
+	file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	bfree(wpath);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+		goto fail;
+
+	mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		goto fail;
+
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data)
+		*size = (size_t)file_size.QuadPart;
+
+fail:
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return data;
+}
+
+void os_unmap_file(void *data, size_t size)
+{
+	if (data)
+		UnmapViewOfFile(data);
+
+	UNUSED_PARAMETER(size);
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinst_dll, DWORD reason, LPVOID reserved)
 {
 	switch (reason) {
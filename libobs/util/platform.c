@@ -620,6 +620,22 @@ static int recursive_mkdir(char *path)
 	return ret;
 }
 
+bool os_sleepto_ns_spin(uint64_t time_target, uint64_t spin_ns)
+{
+	uint64_t t = os_gettime_ns();
+
+	if (t >= time_target)
+		return false;
+
+	if (time_target - t > spin_ns)
+		os_sleepto_ns(time_target - spin_ns);
+
+	while (os_gettime_ns() < time_target)
+		;
+
+	return true;
+}
+
 int os_mkdirs(const char *dir)
 {
 	struct dstr dir_str;
@@ -58,6 +58,10 @@ EXPORT bool os_quick_write_mbs_file(const char *path, const char *str,
 		size_t len);
 
 EXPORT int64_t os_get_file_size(const char *path);
+
+/* maps a file read-only in to memory, returns NULL on failure */
+EXPORT void *os_map_file(const char *path, size_t *size);
+EXPORT void os_unmap_file(void *data, size_t size);
 EXPORT int64_t os_get_free_space(const char *path);
 
 EXPORT size_t os_mbs_to_wcs(const char *str, size_t str_len, wchar_t *dst,
@@ -103,6 +107,25 @@ EXPORT void                   os_end_high_performance(os_performance_token_t *);
 EXPORT bool os_sleepto_ns(uint64_t time_target);
 EXPORT void os_sleep_ms(uint32_t duration);
 
+/**
+ * Sleeps to a specific time like os_sleepto_ns, but wakes up spin_ns early
+ * and spins for the remainder, trading CPU time for wakeup accuracy.
+ */
+EXPORT bool os_sleepto_ns_spin(uint64_t time_target, uint64_t spin_ns);
+
+enum os_thread_priority {
+	OS_THREAD_PRIORITY_NORMAL,
+	OS_THREAD_PRIORITY_HIGH,
+	OS_THREAD_PRIORITY_REALTIME
+};
+
+/**
+ * Sets the scheduling priority of the calling thread.  On linux/mac the
+ * realtime priority uses SCHED_FIFO.  Elevated priorities usually require
+ * privileges; returns false if the priority could not be set.
+ */
+EXPORT bool os_set_thread_priority(enum os_thread_priority priority);
+
 EXPORT uint64_t os_gettime_ns(void);
 
 EXPORT int os_get_config_path(char *dst, size_t size, const char *name);
@@ -14,7 +14,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/stat.h>
+#include <stdlib.h>
 #include "dstr.h"
+#include "darray.h"
 #include "text-lookup.h"
 #include "lexer.h"
 #include "platform.h"
@@ -23,162 +26,22 @@
 
 struct text_leaf {
 	char *lookup, *value;
+	size_t index;
 };
 
-static inline void text_leaf_destroy(struct text_leaf *leaf)
-{
-	if (leaf) {
-		bfree(leaf->lookup);
-		bfree(leaf->value);
-		bfree(leaf);
-	}
-}
-
-/* ------------------------------------------------------------------------- */
-
-struct text_node {
-	struct dstr str;
-	struct text_node *first_subnode;
-	struct text_leaf *leaf;
-
-	struct text_node *next;
-};
-
-static void text_node_destroy(struct text_node *node)
-{
-	struct text_node *subnode;
-
-	if (!node)
-		return;
-
-	subnode = node->first_subnode;
-	while (subnode) {
-		struct text_node *destroy_node = subnode;
-
-		subnode = subnode->next;
-		text_node_destroy(destroy_node);
-	}
-
-	dstr_free(&node->str);
-	if (node->leaf)
-		text_leaf_destroy(node->leaf);
-	bfree(node);
-}
-
-static struct text_node *text_node_bychar(struct text_node *node, char ch)
-{
-	struct text_node *subnode = node->first_subnode;
-
-	while (subnode) {
-		if (!dstr_is_empty(&subnode->str) &&
-		    subnode->str.array[0] == ch)
-			return subnode;
-
-		subnode = subnode->next;
-	}
-
-	return NULL;
-}
+typedef DARRAY(struct text_leaf) leaf_array_t;
 
-static struct text_node *text_node_byname(struct text_node *node,
-		const char *name)
+static void free_leaves(leaf_array_t *leaves)
 {
-	struct text_node *subnode = node->first_subnode;
-
-	while (subnode) {
-		if (astrcmpi_n(subnode->str.array, name, subnode->str.len) == 0)
-			return subnode;
-
-		subnode = subnode->next;
+	for (size_t i = 0; i < leaves->num; i++) {
+		bfree(leaves->array[i].lookup);
+		bfree(leaves->array[i].value);
 	}
-
-	return NULL;
+	darray_free(&leaves->da);
 }
 
 /* ------------------------------------------------------------------------- */
 
-struct text_lookup {
-	struct dstr language;
-	struct text_node *top;
-};
-
-static void lookup_createsubnode(const char *lookup_val,
-		struct text_leaf *leaf, struct text_node *node)
-{
-	struct text_node *new = bzalloc(sizeof(struct text_node));
-	new->leaf = leaf;
-	new->next = node->first_subnode;
-	dstr_copy(&new->str, lookup_val);
-
-	node->first_subnode = new;
-}
-
-static void lookup_splitnode(const char *lookup_val, size_t len,
-		struct text_leaf *leaf, struct text_node *node)
-{
-	struct text_node *split = bzalloc(sizeof(struct text_node));
-
-	dstr_copy(&split->str, node->str.array+len);
-	split->leaf = node->leaf;
-	split->first_subnode = node->first_subnode;
-	node->first_subnode = split;
-
-	dstr_resize(&node->str, len);
-
-	if (lookup_val[len] != 0) {
-		node->leaf = NULL;
-		lookup_createsubnode(lookup_val+len, leaf, node);
-	} else {
-		node->leaf = leaf;
-	}
-}
-
-static inline void lookup_replaceleaf(struct text_node *node,
-		struct text_leaf *leaf)
-{
-	text_leaf_destroy(node->leaf);
-	node->leaf = leaf;
-}
-
-static void lookup_addstring(const char *lookup_val, struct text_leaf *leaf,
-		struct text_node *node)
-{
-	struct text_node *child;
-
-	/* value already exists, so replace */
-	if (!lookup_val || !*lookup_val) {
-		lookup_replaceleaf(node, leaf);
-		return;
-	}
-
-	child = text_node_bychar(node, *lookup_val);
-	if (child) {
-		size_t len;
-
-		for (len = 0; len < child->str.len; len++) {
-			char val1 = child->str.array[len],
-			        val2 = lookup_val[len];
-
-			if (val1 >= 'A' && val1 <= 'Z')
-				val1 += 0x20;
-			if (val2 >= 'A' && val2 <= 'Z')
-				val2 += 0x20;
-
-			if (val1 != val2)
-				break;
-		}
-
-		if (len == child->str.len) {
-			lookup_addstring(lookup_val+len, leaf, child);
-			return;
-		} else {
-			lookup_splitnode(lookup_val, len, leaf, child);
-		}
-	} else {
-		lookup_createsubnode(lookup_val, leaf, node);
-	}
-}
-
 static void lookup_getstringtoken(struct lexer *lex, struct strref *token)
 {
 	const char *temp = lex->offset;
@@ -292,8 +155,7 @@ static char *convert_string(const char *str, size_t len)
 	return out.array;
 }
 
-static void lookup_addfiledata(struct text_lookup *lookup,
-		const char *file_data)
+static void lookup_addfiledata(leaf_array_t *leaves, const char *file_data)
 {
 	struct lexer lex;
 	struct strref name, value;
@@ -319,11 +181,11 @@ getval:
 			goto getval;
 		}
 
-		leaf = bmalloc(sizeof(struct text_leaf));
+		leaf = darray_push_back_new(sizeof(struct text_leaf),
+				&leaves->da);
 		leaf->lookup = bstrdup_n(name.array,  name.len);
 		leaf->value  = convert_string(value.array, value.len);
-
-		lookup_addstring(leaf->lookup, leaf, lookup->top);
+		leaf->index  = leaves->num - 1;
 
 		if (!lookup_goto_nextline(&lex))
 			break;
@@ -332,50 +194,482 @@ getval:
 	lexer_free(&lex);
 }
 
-static inline bool lookup_getstring(const char *lookup_val,
-		const char **out, struct text_node *node)
+/* ------------------------------------------------------------------------- */
+/* compiled tables
+ *
+ *   After a file is parsed, its strings are compiled in to a flat table that
+ * is indexed by a minimal perfect hash (hash and displace): every key hashes
+ * to a bucket, and every bucket stores the displacement value that moves its
+ * keys in to free slots of the entry array.  A lookup is one hash, two array
+ * reads and a single string compare.  Because the table contains no
+ * pointers, it can be written to disk as-is and mapped in to memory when the
+ * same file is loaded again.
+ */
+
+#define LOOKUP_MAGIC            0x4B4C5458 /* "XTLK" */
+#define LOOKUP_VERSION          1
+#define LOOKUP_MAX_SEEDS        16
+#define LOOKUP_MAX_DISPLACEMENT (1 << 16)
+
+struct lookup_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t  source_mtime;
+	int64_t  source_size;
+	uint32_t seed;
+	uint32_t num_entries;
+	uint32_t num_buckets;
+	uint32_t strings_size;
+	uint32_t source_path;
+	uint32_t total_size;
+};
+
+struct lookup_entry {
+	uint32_t key;
+	uint32_t value;
+};
+
+struct text_table {
+	uint8_t                    *data;
+	size_t                     size;
+	bool                       mapped;
+
+	const struct lookup_header *header;
+	const uint32_t             *displace;
+	const struct lookup_entry  *entries;
+	const char                 *strings;
+};
+
+struct text_lookup {
+	struct dstr language;
+	DARRAY(struct text_table) tables;
+};
+
+static char *cache_dir = NULL;
+
+static inline uint64_t lookup_hash(const char *str, uint32_t seed)
+{
+	uint64_t hash = 14695981039346656037ULL ^ seed;
+
+	for (; *str; str++) {
+		uint8_t ch = (uint8_t)*str;
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 0x20;
+
+		hash ^= ch;
+		hash *= 1099511628211ULL;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline uint32_t lookup_slot(uint64_t hash, uint32_t displace,
+		uint32_t count)
+{
+	uint32_t val = (uint32_t)hash ^ (displace * 0x9E3779B9);
+
+	val ^= val >> 16;
+	val *= 0x85EBCA6B;
+	val ^= val >> 13;
+	val *= 0xC2B2AE35;
+	val ^= val >> 16;
+	return val % count;
+}
+
+static inline uint32_t lookup_bucket(uint64_t hash, uint32_t count)
 {
-	struct text_node *child;
-	char ch;
+	return (uint32_t)(hash >> 32) % count;
+}
+
+static inline size_t table_size(uint32_t num_buckets, uint32_t num_entries,
+		uint32_t strings_size)
+{
+	return sizeof(struct lookup_header) +
+		sizeof(uint32_t) * num_buckets +
+		sizeof(struct lookup_entry) * num_entries +
+		strings_size;
+}
 
-	if (!node)
+static bool text_table_init(struct text_table *table, uint8_t *data,
+		size_t size)
+{
+	const struct lookup_header *header = (const struct lookup_header*)data;
+	const uint8_t *ptr = data + sizeof(*header);
+
+	if (size < sizeof(*header))
+		return false;
+	if (header->magic != LOOKUP_MAGIC || header->version != LOOKUP_VERSION)
+		return false;
+	if (header->total_size != size || header->num_buckets == 0 ||
+	    header->strings_size == 0)
 		return false;
+	if (table_size(header->num_buckets, header->num_entries,
+				header->strings_size) != size)
+		return false;
+
+	table->data     = data;
+	table->size     = size;
+	table->header   = header;
+	table->displace = (const uint32_t*)ptr;
+	ptr += sizeof(uint32_t) * header->num_buckets;
+	table->entries  = (const struct lookup_entry*)ptr;
+	ptr += sizeof(struct lookup_entry) * header->num_entries;
+	table->strings  = (const char*)ptr;
+
+	if (table->strings[header->strings_size - 1] != 0)
+		return false;
+	if (header->source_path >= header->strings_size)
+		return false;
+
+	for (uint32_t i = 0; i < header->num_entries; i++) {
+		const struct lookup_entry *entry = &table->entries[i];
+		if (entry->key >= header->strings_size ||
+		    entry->value >= header->strings_size)
+			return false;
+	}
+
+	return true;
+}
+
+static void text_table_free(struct text_table *table)
+{
+	if (table->mapped)
+		os_unmap_file(table->data, table->size);
+	else
+		bfree(table->data);
+}
+
+static bool text_table_getstr(const struct text_table *table,
+		const char *lookup_val, const char **out)
+{
+	const struct lookup_header *header = table->header;
+	const struct lookup_entry *entry;
+	uint64_t hash;
+	uint32_t bucket;
 
-	child = text_node_byname(node, lookup_val);
-	if (!child)
+	if (!header->num_entries)
 		return false;
 
-	lookup_val += child->str.len;
-	ch = *lookup_val;
-	if (ch)
-		return lookup_getstring(lookup_val, out, child);
+	hash   = lookup_hash(lookup_val, header->seed);
+	bucket = lookup_bucket(hash, header->num_buckets);
+	entry  = &table->entries[lookup_slot(hash, table->displace[bucket],
+			header->num_entries)];
 
-	if (!child->leaf)
+	if (astrcmpi(table->strings + entry->key, lookup_val) != 0)
 		return false;
 
-	*out = child->leaf->value;
+	*out = table->strings + entry->value;
 	return true;
 }
 
 /* ------------------------------------------------------------------------- */
+/* table compilation */
 
-lookup_t *text_lookup_create(const char *path)
+struct bucket_info {
+	uint32_t first;
+	uint32_t count;
+};
+
+static int cmp_leaf(const void *a, const void *b)
 {
-	struct text_lookup *lookup = bzalloc(sizeof(struct text_lookup));
+	const struct text_leaf *leaf1 = a;
+	const struct text_leaf *leaf2 = b;
+	int val = astrcmpi(leaf1->lookup, leaf2->lookup);
 
-	if (!text_lookup_add(lookup, path)) {
-		bfree(lookup);
-		lookup = NULL;
+	if (val != 0)
+		return val;
+	return leaf1->index > leaf2->index ? -1 : 1;
+}
+
+/* names are case insensitive, and later definitions of a name replace
+ * earlier ones */
+static void remove_duplicate_leaves(leaf_array_t *leaves)
+{
+	size_t num = 0;
+
+	if (!leaves->num)
+		return;
+
+	qsort(leaves->array, leaves->num, sizeof(struct text_leaf), cmp_leaf);
+
+	for (size_t i = 0; i < leaves->num; i++) {
+		struct text_leaf *leaf = &leaves->array[i];
+
+		if (num && astrcmpi(leaves->array[num - 1].lookup,
+					leaf->lookup) == 0) {
+			bfree(leaf->lookup);
+			bfree(leaf->value);
+			continue;
+		}
+
+		leaves->array[num++] = *leaf;
 	}
 
-	return lookup;
+	leaves->num = num;
 }
 
-bool text_lookup_add(lookup_t *lookup, const char *path)
+static int cmp_bucket_size(const void *a, const void *b)
+{
+	const struct bucket_info *bucket1 = a;
+	const struct bucket_info *bucket2 = b;
+
+	if (bucket1->count != bucket2->count)
+		return bucket1->count > bucket2->count ? -1 : 1;
+	return bucket1->first < bucket2->first ? -1 :
+		(bucket1->first > bucket2->first ? 1 : 0);
+}
+
+static bool place_bucket(const uint64_t *hashes, const uint32_t *keys,
+		const struct bucket_info *info, uint32_t num_entries,
+		uint32_t *slots, uint32_t *out_displace, uint32_t *temp)
+{
+	for (uint32_t d = 0; d < LOOKUP_MAX_DISPLACEMENT; d++) {
+		uint32_t placed = 0;
+
+		for (; placed < info->count; placed++) {
+			uint32_t key = keys[info->first + placed];
+			uint32_t slot = lookup_slot(hashes[key], d,
+					num_entries);
+
+			if (slots[slot] != UINT32_MAX)
+				break;
+
+			slots[slot] = key;
+			temp[placed] = slot;
+		}
+
+		if (placed == info->count) {
+			*out_displace = d;
+			return true;
+		}
+
+		while (placed > 0)
+			slots[temp[--placed]] = UINT32_MAX;
+	}
+
+	return false;
+}
+
+/* maps each entry slot to the index of the key stored in it */
+static bool build_perfect_hash(leaf_array_t *leaves, uint32_t seed,
+		uint32_t num_buckets, uint32_t *displace, uint32_t *slots)
+{
+	uint32_t num_entries = (uint32_t)leaves->num;
+	uint64_t *hashes = bmalloc(sizeof(uint64_t) * num_entries);
+	uint32_t *keys = bmalloc(sizeof(uint32_t) * num_entries);
+	uint32_t *temp = bmalloc(sizeof(uint32_t) * num_entries);
+	struct bucket_info *buckets =
+		bzalloc(sizeof(struct bucket_info) * num_buckets);
+	struct bucket_info *order =
+		bmalloc(sizeof(struct bucket_info) * num_buckets);
+	bool success = true;
+	uint32_t first = 0;
+
+	for (uint32_t i = 0; i < num_entries; i++) {
+		hashes[i] = lookup_hash(leaves->array[i].lookup, seed);
+		buckets[lookup_bucket(hashes[i], num_buckets)].count++;
+	}
+
+	for (uint32_t i = 0; i < num_buckets; i++) {
+		buckets[i].first = first;
+		first += buckets[i].count;
+		buckets[i].count = 0;
+	}
+
+	for (uint32_t i = 0; i < num_entries; i++) {
+		struct bucket_info *bucket =
+			&buckets[lookup_bucket(hashes[i], num_buckets)];
+		keys[bucket->first + bucket->count++] = i;
+	}
+
+	/* place the largest buckets first while most slots are still free */
+	memcpy(order, buckets, sizeof(struct bucket_info) * num_buckets);
+	qsort(order, num_buckets, sizeof(struct bucket_info), cmp_bucket_size);
+
+	memset(displace, 0, sizeof(uint32_t) * num_buckets);
+	memset(slots, 0xFF, sizeof(uint32_t) * num_entries);
+
+	for (uint32_t i = 0; i < num_buckets && order[i].count; i++) {
+		uint32_t idx = lookup_bucket(hashes[keys[order[i].first]],
+				num_buckets);
+
+		if (!place_bucket(hashes, keys, &order[i], num_entries, slots,
+					&displace[idx], temp)) {
+			success = false;
+			break;
+		}
+	}
+
+	bfree(hashes);
+	bfree(keys);
+	bfree(temp);
+	bfree(buckets);
+	bfree(order);
+	return success;
+}
+
+static inline uint32_t push_string(struct darray *strings, const char *str)
+{
+	uint32_t offset = (uint32_t)strings->num;
+	darray_push_back_array(sizeof(char), strings, str, strlen(str) + 1);
+	return offset;
+}
+
+static bool compile_table(struct text_table *table, leaf_array_t *leaves,
+		const char *path, const struct stat *st)
+{
+	DARRAY(char) strings = {0};
+	struct lookup_header header = {0};
+	struct lookup_entry *entries;
+	uint32_t *displace;
+	uint32_t *slots;
+	uint8_t *data;
+	uint32_t num_entries;
+	uint32_t num_buckets;
+	bool success = false;
+
+	remove_duplicate_leaves(leaves);
+	num_entries = (uint32_t)leaves->num;
+	num_buckets = num_entries / 2 + 1;
+
+	displace = bmalloc(sizeof(uint32_t) * num_buckets);
+	slots = bmalloc(sizeof(uint32_t) * (num_entries ? num_entries : 1));
+
+	for (uint32_t seed = 0; seed < LOOKUP_MAX_SEEDS; seed++) {
+		if (!num_entries || build_perfect_hash(leaves, seed,
+					num_buckets, displace, slots)) {
+			header.seed = seed;
+			success = true;
+			break;
+		}
+	}
+
+	if (!success)
+		goto fail;
+
+	entries = bmalloc(sizeof(struct lookup_entry) *
+			(num_entries ? num_entries : 1));
+
+	for (uint32_t i = 0; i < num_entries; i++) {
+		struct text_leaf *leaf = &leaves->array[slots[i]];
+		entries[i].key   = push_string(&strings.da, leaf->lookup);
+		entries[i].value = push_string(&strings.da, leaf->value);
+	}
+
+	header.magic        = LOOKUP_MAGIC;
+	header.version      = LOOKUP_VERSION;
+	header.source_mtime = (int64_t)st->st_mtime;
+	header.source_size  = (int64_t)st->st_size;
+	header.num_entries  = num_entries;
+	header.num_buckets  = num_buckets;
+	header.source_path  = push_string(&strings.da, path);
+	header.strings_size = (uint32_t)strings.num;
+	header.total_size   = (uint32_t)table_size(num_buckets, num_entries,
+			header.strings_size);
+
+	data = bmalloc(header.total_size);
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + sizeof(header), displace,
+			sizeof(uint32_t) * num_buckets);
+	memcpy(data + sizeof(header) + sizeof(uint32_t) * num_buckets,
+			entries, sizeof(struct lookup_entry) * num_entries);
+	memcpy(data + header.total_size - header.strings_size, strings.array,
+			header.strings_size);
+
+	bfree(entries);
+
+	table->mapped = false;
+	success = text_table_init(table, data, header.total_size);
+	if (!success)
+		bfree(data);
+
+fail:
+	bfree(displace);
+	bfree(slots);
+	da_free(strings);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* on-disk cache */
+
+static char *get_cache_file(const char *path)
+{
+	struct dstr cache_file = {0};
+
+	if (!cache_dir)
+		return NULL;
+
+	dstr_printf(&cache_file, "%s/%016llx.lookup", cache_dir,
+			(unsigned long long)lookup_hash(path, 0));
+	return cache_file.array;
+}
+
+static bool load_cached_table(struct text_table *table, const char *cache_file,
+		const char *path, const struct stat *st)
+{
+	const struct lookup_header *header;
+	size_t size;
+	uint8_t *data = os_map_file(cache_file, &size);
+
+	if (!data)
+		return false;
+
+	table->mapped = true;
+	if (!text_table_init(table, data, size))
+		goto fail;
+
+	header = table->header;
+	if (header->source_mtime != (int64_t)st->st_mtime ||
+	    header->source_size != (int64_t)st->st_size ||
+	    strcmp(table->strings + header->source_path, path) != 0)
+		goto fail;
+
+	return true;
+
+fail:
+	os_unmap_file(data, size);
+	return false;
+}
+
+static void save_cached_table(const struct text_table *table,
+		const char *cache_file)
+{
+	struct dstr temp_file = {0};
+	FILE *file;
+	size_t written;
+
+	if (os_mkdirs(cache_dir) == MKDIR_ERROR)
+		return;
+
+	dstr_printf(&temp_file, "%s.tmp", cache_file);
+
+	file = os_fopen(temp_file.array, "wb");
+	if (!file) {
+		dstr_free(&temp_file);
+		return;
+	}
+
+	written = fwrite(table->data, 1, table->size, file);
+	fclose(file);
+
+	if (written != table->size || os_rename(temp_file.array, cache_file) != 0)
+		os_unlink(temp_file.array);
+
+	dstr_free(&temp_file);
+}
+
+static bool parse_file(struct text_table *table, const char *path,
+		const struct stat *st)
 {
+	leaf_array_t leaves = {0};
 	struct dstr file_str;
 	char *temp = NULL;
 	FILE *file;
+	bool success;
 
 	file = os_fopen(path, "rb");
 	if (!file)
@@ -388,21 +682,70 @@ bool text_lookup_add(lookup_t *lookup, const char *path)
 	if (!file_str.array)
 		return false;
 
-	if (!lookup->top)
-		lookup->top = bzalloc(sizeof(struct text_node));
-
 	dstr_replace(&file_str, "\r", " ");
-	lookup_addfiledata(lookup, file_str.array);
+	lookup_addfiledata(&leaves, file_str.array);
 	dstr_free(&file_str);
 
-	return true;
+	success = compile_table(table, &leaves, path, st);
+	free_leaves(&leaves);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void text_lookup_set_cache_dir(const char *dir)
+{
+	bfree(cache_dir);
+	cache_dir = dir ? bstrdup(dir) : NULL;
+}
+
+lookup_t *text_lookup_create(const char *path)
+{
+	struct text_lookup *lookup = bzalloc(sizeof(struct text_lookup));
+
+	if (!text_lookup_add(lookup, path)) {
+		bfree(lookup);
+		lookup = NULL;
+	}
+
+	return lookup;
+}
+
+bool text_lookup_add(lookup_t *lookup, const char *path)
+{
+	struct text_table table = {0};
+	struct stat st = {0};
+	char *cache_file;
+	bool success = false;
+
+	if (!path || os_stat(path, &st) != 0)
+		return false;
+
+	cache_file = get_cache_file(path);
+	if (cache_file)
+		success = load_cached_table(&table, cache_file, path, &st);
+
+	if (!success) {
+		success = parse_file(&table, path, &st);
+		if (success && cache_file)
+			save_cached_table(&table, cache_file);
+	}
+
+	if (success)
+		da_push_back(lookup->tables, &table);
+
+	bfree(cache_file);
+	return success;
 }
 
 void text_lookup_destroy(lookup_t *lookup)
 {
 	if (lookup) {
 		dstr_free(&lookup->language);
-		text_node_destroy(lookup->top);
+
+		for (size_t i = 0; i < lookup->tables.num; i++)
+			text_table_free(&lookup->tables.array[i]);
+		da_free(lookup->tables);
 
 		bfree(lookup);
 	}
@@ -411,7 +754,15 @@ void text_lookup_destroy(lookup_t *lookup)
 bool text_lookup_getstr(lookup_t *lookup, const char *lookup_val,
 		const char **out)
 {
-	if (lookup)
-		return lookup_getstring(lookup_val, out, lookup->top);
+	if (!lookup || !lookup_val)
+		return false;
+
+	/* files added later override the strings of earlier files */
+	for (size_t i = lookup->tables.num; i > 0; i--) {
+		if (text_table_getstr(&lookup->tables.array[i - 1], lookup_val,
+					out))
+			return true;
+	}
+
 	return false;
 }
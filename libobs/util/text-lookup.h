@@ -19,9 +19,11 @@
 /*
  * Text Lookup interface
  *
- *   Used for storing and looking up localized strings.  Stores localization
- * strings in a radix/trie tree to efficiently look up associated strings via a
- * unique string identifier name.
+ *   Used for storing and looking up localized strings.  Each file is compiled
+ * in to a flat table indexed by a minimal perfect hash of the (case
+ * insensitive) string identifier names.  If a cache directory is set, compiled
+ * tables are stored there and memory-mapped the next time the same unchanged
+ * file is loaded, which skips parsing entirely.
  */
 
 #include "c99defs.h"
@@ -35,6 +37,11 @@ struct text_lookup;
 typedef struct text_lookup lookup_t;
 
 /* functions */
+
+/* sets the directory compiled tables are cached in (NULL to disable).  must
+ * be called before any lookups are created. */
+EXPORT void text_lookup_set_cache_dir(const char *dir);
+
 EXPORT lookup_t *text_lookup_create(const char *path);
 EXPORT bool text_lookup_add(lookup_t *lookup, const char *path);
 EXPORT void text_lookup_destroy(lookup_t *lookup);
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2015 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+/*
+ *   Shared memory packet transport between the muxer output and the
+ * ffmpeg-mux process.  Packets (an ffm_packet_info followed by its data) are
+ * written to a ring buffer in an anonymous shared memory file that only the
+ * ffmpeg-mux process inherits, instead of through its stdin pipe.  The writer
+ * and reader only wake each other with a futex when the other side is
+ * actually waiting, so a busy ring costs no system calls at all.
+ *
+ *   There is exactly one writer (the muxer output) and one reader (the
+ * ffmpeg-mux process).  Positions are byte counts that only ever grow; the
+ * ring offset is the position modulo the ring size.
+ */
+
+#if defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define FFM_SHM_SUPPORTED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ffmpeg-mux.h"
+
+#define FFM_SHM_MAGIC        0x4D534646 /* "FFSM" */
+#define FFM_SHM_DEFAULT_SIZE (32 * 1024 * 1024)
+#define FFM_SHM_WAIT_MS      100
+#define FFM_SHM_TIMEOUT_MS   10000
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC          0x0001U
+#endif
+
+struct ffm_shm_ring {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t closed;
+	int32_t  writer_pid;
+	int32_t  reader_pid;
+	uint8_t  pad0[44];
+
+	/* written by the writer only */
+	uint64_t write_pos;
+	uint32_t data_seq;
+	uint32_t writer_waiting;
+	uint8_t  pad1[48];
+
+	/* written by the reader only */
+	uint64_t read_pos;
+	uint32_t space_seq;
+	uint32_t reader_waiting;
+	uint32_t reader_closed;
+	uint8_t  pad2[44];
+};
+
+static inline uint8_t *ffm_shm_data(struct ffm_shm_ring *ring)
+{
+	return (uint8_t*)(ring + 1);
+}
+
+static inline size_t ffm_shm_map_size(uint32_t size)
+{
+	return sizeof(struct ffm_shm_ring) + size;
+}
+
+static inline uint64_t ffm_shm_load(const uint64_t *pos)
+{
+	return __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+static inline void ffm_shm_store(uint64_t *pos, uint64_t val)
+{
+	__atomic_store_n(pos, val, __ATOMIC_RELEASE);
+}
+
+static inline void ffm_shm_futex_wait(uint32_t *addr, uint32_t val, int ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static inline void ffm_shm_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* bumps the sequence of a futex word and wakes the other side if waiting */
+static inline void ffm_shm_signal(uint32_t *seq, uint32_t *waiting)
+{
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		ffm_shm_futex_wake(seq);
+}
+
+/* a process that has exited but not been waited on yet still exists, so its
+ * state is checked as well */
+static inline bool ffm_shm_process_alive(int32_t pid)
+{
+	char path[64];
+	char buf[256];
+	const char *state;
+	size_t size;
+	FILE *file;
+
+	if (!pid)
+		return true;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	size = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+	buf[size] = 0;
+
+	state = strrchr(buf, ')');
+	return !state || (state[1] && state[2] != 'Z' && state[2] != 'X');
+}
+
+static inline void ffm_shm_copy_in(struct ffm_shm_ring *ring, uint64_t pos,
+		const uint8_t *data, size_t size)
+{
+	size_t offset = (size_t)(pos % ring->size);
+	size_t first = ring->size - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(ffm_shm_data(ring) + offset, data, first);
+	memcpy(ffm_shm_data(ring), data + first, size - first);
+}
+
+static inline void ffm_shm_copy_out(struct ffm_shm_ring *ring, uint64_t pos,
+		uint8_t *data, size_t size)
+{
+	size_t offset = (size_t)(pos % ring->size);
+	size_t first = ring->size - offset;
+
+	if (first > size)
+		first = size;
+
+	memcpy(data, ffm_shm_data(ring) + offset, first);
+	memcpy(data + first, ffm_shm_data(ring), size - first);
+}
+
+/* ------------------------------------------------------------------------- */
+/* writer (muxer output) side */
+
+/* creates the ring in a shared memory file, returning the file descriptor in
+ * fd.  The descriptor is closed on exec, see ffm_shm_set_inherit. */
+static inline struct ffm_shm_ring *ffm_shm_create(uint32_t size, int *fd)
+{
+	struct ffm_shm_ring *ring;
+	int shm_fd;
+
+#ifdef SYS_memfd_create
+	shm_fd = (int)syscall(SYS_memfd_create, "ffmpeg-mux", MFD_CLOEXEC);
+#else
+	shm_fd = -1;
+#endif
+	if (shm_fd == -1)
+		return NULL;
+
+	if (ftruncate(shm_fd, (off_t)ffm_shm_map_size(size)) != 0) {
+		close(shm_fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, ffm_shm_map_size(size), PROT_READ | PROT_WRITE,
+			MAP_SHARED, shm_fd, 0);
+	if (ring == MAP_FAILED) {
+		close(shm_fd);
+		return NULL;
+	}
+
+	ring->magic = FFM_SHM_MAGIC;
+	ring->size = size;
+	ring->writer_pid = (int32_t)getpid();
+
+	*fd = shm_fd;
+	return ring;
+}
+
+/* lets the ring be inherited by the next process that is started, or stops it
+ * from being inherited */
+static inline bool ffm_shm_set_inherit(int fd, bool inherit)
+{
+	int flags = fcntl(fd, F_GETFD);
+
+	if (flags == -1)
+		return false;
+
+	if (inherit)
+		flags &= ~FD_CLOEXEC;
+	else
+		flags |= FD_CLOEXEC;
+
+	return fcntl(fd, F_SETFD, flags) == 0;
+}
+
+/* waits until there is space to write, returning the free space, or 0 if the
+ * reader has gone away */
+static inline size_t ffm_shm_wait_space(struct ffm_shm_ring *ring)
+{
+	uint64_t write_pos = ring->write_pos;
+	int waited = 0;
+
+	for (;;) {
+		uint32_t seq = __atomic_load_n(&ring->space_seq,
+				__ATOMIC_SEQ_CST);
+		uint64_t read_pos = ffm_shm_load(&ring->read_pos);
+		size_t free_size = ring->size - (size_t)(write_pos - read_pos);
+
+		if (free_size)
+			return free_size;
+
+		int32_t reader = __atomic_load_n(&ring->reader_pid,
+				__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->reader_closed, __ATOMIC_SEQ_CST))
+			return 0;
+		if (waited && !ffm_shm_process_alive(reader))
+			return 0;
+		if (!reader && waited >= FFM_SHM_TIMEOUT_MS)
+			return 0;
+
+		__atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+		ffm_shm_futex_wait(&ring->space_seq, seq, FFM_SHM_WAIT_MS);
+		__atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST);
+
+		waited += FFM_SHM_WAIT_MS;
+	}
+}
+
+static inline bool ffm_shm_write(struct ffm_shm_ring *ring,
+		const uint8_t *data, size_t size)
+{
+	while (size) {
+		size_t free_size = ffm_shm_wait_space(ring);
+		if (!free_size)
+			return false;
+		if (free_size > size)
+			free_size = size;
+
+		ffm_shm_copy_in(ring, ring->write_pos, data, free_size);
+		ffm_shm_store(&ring->write_pos, ring->write_pos + free_size);
+		ffm_shm_signal(&ring->data_seq, &ring->reader_waiting);
+
+		data += free_size;
+		size -= free_size;
+	}
+
+	return true;
+}
+
+static inline bool ffm_shm_write_packet(struct ffm_shm_ring *ring,
+		const struct ffm_packet_info *info, const uint8_t *data)
+{
+	size_t total = sizeof(*info) + info->size;
+	uint64_t read_pos = ffm_shm_load(&ring->read_pos);
+	size_t free_size = ring->size - (size_t)(ring->write_pos - read_pos);
+
+	/* packets that fit are published at once, so the reader is woken
+	 * at most once per packet */
+	if (total <= free_size) {
+		ffm_shm_copy_in(ring, ring->write_pos, (const uint8_t*)info,
+				sizeof(*info));
+		ffm_shm_copy_in(ring, ring->write_pos + sizeof(*info), data,
+				info->size);
+		ffm_shm_store(&ring->write_pos, ring->write_pos + total);
+		ffm_shm_signal(&ring->data_seq, &ring->reader_waiting);
+		return true;
+	}
+
+	return ffm_shm_write(ring, (const uint8_t*)info, sizeof(*info)) &&
+	       ffm_shm_write(ring, data, info->size);
+}
+
+/* tells the reader that no more packets will be written */
+static inline void ffm_shm_close(struct ffm_shm_ring *ring)
+{
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+	ffm_shm_signal(&ring->data_seq, &ring->reader_waiting);
+}
+
+static inline void ffm_shm_destroy(struct ffm_shm_ring *ring)
+{
+	if (ring)
+		munmap(ring, ffm_shm_map_size(ring->size));
+}
+
+/* ------------------------------------------------------------------------- */
+/* reader (ffmpeg-mux) side */
+
+static inline struct ffm_shm_ring *ffm_shm_open(int fd)
+{
+	struct ffm_shm_ring *ring;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 ||
+	    (size_t)st.st_size <= sizeof(struct ffm_shm_ring)) {
+		close(fd);
+		return NULL;
+	}
+
+	ring = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	if (ring->magic != FFM_SHM_MAGIC ||
+	    ffm_shm_map_size(ring->size) != (size_t)st.st_size) {
+		munmap(ring, (size_t)st.st_size);
+		return NULL;
+	}
+
+	__atomic_store_n(&ring->reader_pid, (int32_t)getpid(),
+			__ATOMIC_SEQ_CST);
+	return ring;
+}
+
+/* waits until at least size bytes (or the whole ring) can be read, returning
+ * how much can be read, which is less only once the writer is done */
+static inline size_t ffm_shm_wait_data(struct ffm_shm_ring *ring, size_t size)
+{
+	uint64_t read_pos = ring->read_pos;
+
+	if (size > ring->size)
+		size = ring->size;
+
+	for (;;) {
+		uint32_t seq = __atomic_load_n(&ring->data_seq,
+				__ATOMIC_SEQ_CST);
+		uint32_t closed = __atomic_load_n(&ring->closed,
+				__ATOMIC_SEQ_CST);
+		size_t avail = (size_t)(ffm_shm_load(&ring->write_pos) -
+				read_pos);
+
+		if (avail >= size || closed)
+			return avail;
+		if (!ffm_shm_process_alive(ring->writer_pid))
+			return avail;
+
+		__atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+		ffm_shm_futex_wait(&ring->data_seq, seq, FFM_SHM_WAIT_MS);
+		__atomic_store_n(&ring->reader_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+}
+
+static inline void ffm_shm_advance(struct ffm_shm_ring *ring, size_t size)
+{
+	ffm_shm_store(&ring->read_pos, ring->read_pos + size);
+	ffm_shm_signal(&ring->space_seq, &ring->writer_waiting);
+}
+
+/* tells the writer that no more packets will be read */
+static inline void ffm_shm_close_reader(struct ffm_shm_ring *ring)
+{
+	__atomic_store_n(&ring->reader_closed, 1, __ATOMIC_SEQ_CST);
+	ffm_shm_signal(&ring->space_seq, &ring->writer_waiting);
+}
+
+/* reads exactly size bytes, returning 0 if the writer finished first */
+static inline size_t ffm_shm_read(struct ffm_shm_ring *ring, void *vdata,
+		size_t size)
+{
+	uint8_t *data = vdata;
+	size_t total = size;
+
+	while (size > 0) {
+		size_t avail = ffm_shm_wait_data(ring, size);
+		if (!avail)
+			return 0;
+		if (avail > size)
+			avail = size;
+
+		ffm_shm_copy_out(ring, ring->read_pos, data, avail);
+		ffm_shm_advance(ring, avail);
+
+		data += avail;
+		size -= avail;
+	}
+
+	return total;
+}
+
+/* returns the next size bytes in place if they are contiguous in the ring,
+ * without consuming them (see ffm_shm_advance), or NULL if they have to be
+ * read with ffm_shm_read instead */
+static inline uint8_t *ffm_shm_peek(struct ffm_shm_ring *ring, size_t size)
+{
+	size_t offset = (size_t)(ring->read_pos % ring->size);
+
+	if (offset + size > ring->size)
+		return NULL;
+	if (ffm_shm_wait_data(ring, size) < size)
+		return NULL;
+
+	return ffm_shm_data(ring) + offset;
+}
+
+#endif
@@ -25,9 +25,12 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ffmpeg-mux.h"
+#include "ffmpeg-mux-shm.h"
 
 #include <libavformat/avformat.h>
+#include <util/file-writer.h>
 
 #if LIBAVCODEC_VERSION_MAJOR >= 58
 #define CODEC_FLAG_GLOBAL_H AV_CODEC_FLAG_GLOBAL_HEADER
@@ -105,6 +108,10 @@ struct ffmpeg_mux {
 	struct header          *audio_header;
 	int                    num_audio_streams;
 	bool                   initialized;
+#ifdef FFM_SHM_SUPPORTED
+	struct ffm_shm_ring    *shm;
+#endif
+	struct file_writer     *writer;
 	char error[4096];
 };
 
@@ -116,8 +123,18 @@ static void header_free(struct header *header)
 static void free_avformat(struct ffmpeg_mux *ffm)
 {
 	if (ffm->output) {
-		if ((ffm->output->oformat->flags & AVFMT_NOFILE) == 0)
+		if (ffm->writer) {
+			avio_flush(ffm->output->pb);
+			av_freep(&ffm->output->pb->buffer);
+			av_freep(&ffm->output->pb);
+
+			if (!file_writer_close(ffm->writer))
+				printf("Failed to write '%s'\n", ffm->params.file);
+			ffm->writer = NULL;
+
+		} else if ((ffm->output->oformat->flags & AVFMT_NOFILE) == 0) {
 			avio_close(ffm->output->pb);
+		}
 
 		avformat_free_context(ffm->output);
 		ffm->output = NULL;
@@ -138,6 +155,13 @@ static void ffmpeg_mux_free(struct ffmpeg_mux *ffm)
 		av_write_trailer(ffm->output);
 	}
 
+#ifdef FFM_SHM_SUPPORTED
+	if (ffm->shm) {
+		ffm_shm_close_reader(ffm->shm);
+		ffm_shm_destroy(ffm->shm);
+	}
+#endif
+
 	free_avformat(ffm);
 
 	header_free(&ffm->video_header);
@@ -402,11 +426,16 @@ static void ffmpeg_mux_header(struct ffmpeg_mux *ffm, uint8_t *data,
 	}
 }
 
-static size_t safe_read(void *vdata, size_t size)
+static size_t safe_read(struct ffmpeg_mux *ffm, void *vdata, size_t size)
 {
 	uint8_t *data = vdata;
 	size_t  total = size;
 
+#ifdef FFM_SHM_SUPPORTED
+	if (ffm->shm)
+		return ffm_shm_read(ffm->shm, vdata, size);
+#endif
+
 	while (size > 0) {
 		size_t in_size = fread(data, 1, size, stdin);
 		if (in_size == 0)
@@ -423,11 +452,11 @@ static bool ffmpeg_mux_get_header(struct ffmpeg_mux *ffm)
 {
 	struct ffm_packet_info info = {0};
 
-	bool success = safe_read(&info, sizeof(info)) == sizeof(info);
+	bool success = safe_read(ffm, &info, sizeof(info)) == sizeof(info);
 	if (success) {
 		uint8_t *data = malloc(info.size);
 
-		if (safe_read(data, info.size) == info.size) {
+		if (safe_read(ffm, data, info.size) == info.size) {
 			ffmpeg_mux_header(ffm, data, &info);
 		} else {
 			success = false;
@@ -460,12 +489,70 @@ static inline bool ffmpeg_mux_get_extra_data(struct ffmpeg_mux *ffm)
 #pragma warning(disable : 4996)
 #endif
 
+#define AVIO_BUFFER_SIZE 65536
+
+static int file_writer_write_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+	return file_writer_write(opaque, buf, (size_t)buf_size) ?
+		buf_size : AVERROR(EIO);
+}
+
+static int64_t file_writer_seek_packet(void *opaque, int64_t offset,
+		int whence)
+{
+	struct file_writer *writer = opaque;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offset += file_writer_tell(writer);
+		break;
+	default:
+		return -1;
+	}
+
+	return file_writer_seek(writer, offset) ? offset : -1;
+}
+
+/* writes the file from a separate I/O thread, so a slow disk does not stop
+ * packets from being read from the pipe */
+static bool open_file_writer(struct ffmpeg_mux *ffm)
+{
+	uint8_t *buf;
+
+	/* faststart rereads the file when the trailer is written, before the
+	 * writer has caught up */
+	if (ffm->params.muxer_settings &&
+	    strstr(ffm->params.muxer_settings, "faststart"))
+		return false;
+
+	ffm->writer = file_writer_open(ffm->params.file, NULL);
+	if (!ffm->writer)
+		return false;
+
+	buf = av_malloc(AVIO_BUFFER_SIZE);
+	if (buf)
+		ffm->output->pb = avio_alloc_context(buf, AVIO_BUFFER_SIZE, 1,
+				ffm->writer, NULL, file_writer_write_packet,
+				file_writer_seek_packet);
+
+	if (!ffm->output->pb) {
+		av_free(buf);
+		file_writer_close(ffm->writer);
+		ffm->writer = NULL;
+		return false;
+	}
+
+	return true;
+}
+
 static inline int open_output_file(struct ffmpeg_mux *ffm)
 {
 	AVOutputFormat *format = ffm->output->oformat;
 	int ret;
 
-	if ((format->flags & AVFMT_NOFILE) == 0) {
+	if ((format->flags & AVFMT_NOFILE) == 0 && !open_file_writer(ffm)) {
 		ret = avio_open(&ffm->output->pb, ffm->params.file,
 				AVIO_FLAG_WRITE);
 		if (ret < 0) {
@@ -551,11 +638,43 @@ static int ffmpeg_mux_init_context(struct ffmpeg_mux *ffm)
 	return FFM_SUCCESS;
 }
 
+/* packets are read from a shared memory ring instead of stdin if the muxer
+ * output passes "--shm <fd>" first */
+static bool init_transport(struct ffmpeg_mux *ffm, int *argc, char ***argv)
+{
+	int fd;
+
+	if (!*argc || strcmp((*argv)[0], "--shm") != 0)
+		return true;
+
+	(*argc)--;
+	(*argv)++;
+
+	if (!get_opt_int(argc, argv, &fd, "shared memory file"))
+		return false;
+
+#ifdef FFM_SHM_SUPPORTED
+	ffm->shm = ffm_shm_open(fd);
+	if (!ffm->shm) {
+		puts("Couldn't open shared memory ring");
+		return false;
+	}
+
+	return true;
+#else
+	(void)ffm;
+	puts("Shared memory transport is not supported");
+	return false;
+#endif
+}
+
 static int ffmpeg_mux_init_internal(struct ffmpeg_mux *ffm, int argc,
 		char *argv[])
 {
 	argc--;
 	argv++;
+	if (!init_transport(ffm, &argc, &argv))
+		return FFM_ERROR;
 	if (!init_params(&argc, &argv, &ffm->params, &ffm->audio))
 		return FFM_ERROR;
 
@@ -683,10 +802,20 @@ int main(int argc, char *argv[])
 		return ret;
 	}
 
-	while (!fail && safe_read(&info, sizeof(info)) == sizeof(info)) {
+	while (!fail && safe_read(&ffm, &info, sizeof(info)) == sizeof(info)) {
+#ifdef FFM_SHM_SUPPORTED
+		/* the muxer copies packets it doesn't own, so they can be
+		 * muxed straight from the ring */
+		uint8_t *data = ffm.shm ? ffm_shm_peek(ffm.shm, info.size) : NULL;
+		if (data) {
+			ffmpeg_mux_packet(&ffm, data, &info);
+			ffm_shm_advance(ffm.shm, info.size);
+			continue;
+		}
+#endif
 		resize_buf_resize(&rb, info.size);
 
-		if (safe_read(rb.buf, info.size) == info.size) {
+		if (safe_read(&ffm, rb.buf, info.size) == info.size) {
 			ffmpeg_mux_packet(&ffm, rb.buf, &info);
 		} else {
 			fail = true;
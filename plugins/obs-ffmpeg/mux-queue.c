@@ -0,0 +1,154 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "mux-queue.h"
+
+/* packets are signaled to the mux thread in batches while gathering */
+#define MUX_GATHER_BATCH 256
+
+struct mux_packet {
+	struct encoder_packet packet;
+	size_t                order;
+};
+
+bool mux_queue_init(struct mux_queue *queue)
+{
+	memset(queue, 0, sizeof(*queue));
+	pthread_mutex_init_value(&queue->mutex);
+
+	if (pthread_mutex_init(&queue->mutex, NULL) != 0)
+		return false;
+	if (os_event_init(&queue->event, OS_EVENT_TYPE_AUTO) != 0) {
+		pthread_mutex_destroy(&queue->mutex);
+		return false;
+	}
+
+	return true;
+}
+
+void mux_queue_free(struct mux_queue *queue)
+{
+	mux_queue_clear(queue);
+	pthread_mutex_destroy(&queue->mutex);
+	os_event_destroy(queue->event);
+}
+
+void mux_queue_start(struct mux_queue *queue, uint32_t track_mask)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->track_mask = track_mask;
+	queue->num_pushed = 0;
+	queue->gathered = false;
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static inline size_t mux_track_idx(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO ? 0 : packet->track_idx + 1;
+}
+
+void mux_queue_push(struct mux_queue *queue,
+		const struct encoder_packet *packet)
+{
+	struct mux_packet mux_pkt = {.packet = *packet};
+	bool signal;
+
+	pthread_mutex_lock(&queue->mutex);
+	mux_pkt.order = queue->num_pushed++;
+	circlebuf_push_back(&queue->tracks[mux_track_idx(packet)],
+			&mux_pkt, sizeof(mux_pkt));
+	signal = queue->num_pushed % MUX_GATHER_BATCH == 0;
+	pthread_mutex_unlock(&queue->mutex);
+
+	if (signal)
+		os_event_signal(queue->event);
+}
+
+void mux_queue_end(struct mux_queue *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->gathered = true;
+	pthread_mutex_unlock(&queue->mutex);
+
+	os_event_signal(queue->event);
+}
+
+/* mutex must be held.  Each track is already in dts order, so the next
+ * packet to mux is the front packet with the lowest dts_usec, and for
+ * equal timestamps the one gathered last.  Until gathering is done, a
+ * packet can only be chosen once every track expected to have packets
+ * has one queued, because a track that has nothing queued yet may still
+ * get a lower timestamp. */
+static bool find_next_track(struct mux_queue *queue, size_t *track)
+{
+	struct mux_packet *next = NULL;
+	bool ready = true;
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES + 1; i++) {
+		struct circlebuf *cb = &queue->tracks[i];
+		struct mux_packet *pkt;
+
+		if (!cb->size) {
+			if (!queue->gathered &&
+			    (queue->track_mask & (1 << i)) != 0)
+				ready = false;
+			continue;
+		}
+
+		pkt = circlebuf_data(cb, 0);
+		if (!next ||
+		    pkt->packet.dts_usec < next->packet.dts_usec ||
+		    (pkt->packet.dts_usec == next->packet.dts_usec &&
+		     pkt->order > next->order)) {
+			next = pkt;
+			*track = i;
+		}
+	}
+
+	return next && ready;
+}
+
+bool mux_queue_next(struct mux_queue *queue, struct encoder_packet *packet)
+{
+	struct mux_packet mux_pkt;
+	size_t track = 0;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	while (!find_next_track(queue, &track)) {
+		if (queue->gathered) {
+			pthread_mutex_unlock(&queue->mutex);
+			return false;
+		}
+
+		pthread_mutex_unlock(&queue->mutex);
+		os_event_wait(queue->event);
+		pthread_mutex_lock(&queue->mutex);
+	}
+
+	circlebuf_pop_front(&queue->tracks[track], &mux_pkt, sizeof(mux_pkt));
+	pthread_mutex_unlock(&queue->mutex);
+
+	*packet = mux_pkt.packet;
+	return true;
+}
+
+void mux_queue_clear(struct mux_queue *queue)
+{
+	for (size_t i = 0; i < MAX_AUDIO_MIXES + 1; i++)
+		circlebuf_free(&queue->tracks[i]);
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <obs-module.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+
+/*
+ *   Merges the packets of a saved replay buffer in to muxing order while they
+ * are still being gathered.  Packets are queued per track (video first, then
+ * each audio track), and each track is expected to already be in dts order.
+ *
+ *   One thread pushes the packets in the order they were buffered, and
+ * another takes them back out merged: by dts_usec, and newest first for
+ * equal timestamps, which is the order the replay buffer has always used.
+ */
+
+struct mux_queue {
+	struct circlebuf tracks[MAX_AUDIO_MIXES + 1];
+	uint32_t         track_mask;
+	size_t           num_pushed;
+	bool             gathered;
+
+	pthread_mutex_t  mutex;
+	os_event_t       *event;
+};
+
+extern bool mux_queue_init(struct mux_queue *queue);
+extern void mux_queue_free(struct mux_queue *queue);
+
+/* starts gathering.  track_mask has a bit for each track that will have
+ * packets: bit 0 for video, and bit 1 + track_idx for audio. */
+extern void mux_queue_start(struct mux_queue *queue, uint32_t track_mask);
+
+/* queues a packet.  The queue takes over the packet's reference. */
+extern void mux_queue_push(struct mux_queue *queue,
+		const struct encoder_packet *packet);
+
+/* marks the end of gathering */
+extern void mux_queue_end(struct mux_queue *queue);
+
+/* gets the next packet in muxing order, waiting on gathering when needed.
+ * Returns false once every gathered packet has been returned. */
+extern bool mux_queue_next(struct mux_queue *queue,
+		struct encoder_packet *packet);
+
+/* frees the memory of the queues once every packet has been taken out */
+extern void mux_queue_clear(struct mux_queue *queue);
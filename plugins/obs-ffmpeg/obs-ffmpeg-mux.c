@@ -25,6 +25,9 @@
 #include <util/circlebuf.h>
 #include <util/threading.h>
 #include "ffmpeg-mux/ffmpeg-mux.h"
+#include "ffmpeg-mux/ffmpeg-mux-shm.h"
+#include "replay-disk-buffer.h"
+#include "mux-queue.h"
 
 #ifdef _WIN32
 #include "util/windows/win-version.h"
@@ -39,9 +42,14 @@
 #define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 
+#define DEFAULT_DISK_CACHE_MB 4096
+
 struct ffmpeg_muxer {
 	obs_output_t      *output;
 	os_process_pipe_t *pipe;
+#ifdef FFM_SHM_SUPPORTED
+	struct ffm_shm_ring *shm;
+#endif
 	int64_t           stop_ts;
 	uint64_t          total_bytes;
 	struct dstr       path;
@@ -60,7 +68,14 @@ struct ffmpeg_muxer {
 	int               keyframes;
 	obs_hotkey_id     hotkey;
 
-	DARRAY(struct encoder_packet) mux_packets;
+	/* replay buffer kept on disk instead of in memory */
+	struct replay_disk_buffer *disk;
+	struct replay_disk_reader *disk_reader;
+
+	/* packets being saved, merged by the mux thread while they are
+	 * gathered */
+	struct mux_queue              mux_queue;
+
 	pthread_t                     mux_thread;
 	bool                          mux_thread_joinable;
 	volatile bool                 muxing;
@@ -74,6 +89,17 @@ static const char *ffmpeg_mux_getname(void *type)
 
 static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 {
+	if (stream->disk) {
+		/* the mux thread may still be reading from it */
+		if (stream->mux_thread_joinable) {
+			pthread_join(stream->mux_thread, NULL);
+			stream->mux_thread_joinable = false;
+		}
+
+		replay_disk_buffer_destroy(stream->disk);
+		stream->disk = NULL;
+	}
+
 	while (stream->packets.size > 0) {
 		struct encoder_packet pkt;
 		circlebuf_pop_front(&stream->packets, &pkt, sizeof(pkt));
@@ -89,6 +115,8 @@ static inline void replay_buffer_clear(struct ffmpeg_muxer *stream)
 	stream->keyframes = 0;
 }
 
+static int stop_pipe(struct ffmpeg_muxer *stream);
+
 static void ffmpeg_mux_destroy(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -96,9 +124,8 @@ static void ffmpeg_mux_destroy(void *data)
 	replay_buffer_clear(stream);
 	if (stream->mux_thread_joinable)
 		pthread_join(stream->mux_thread, NULL);
-	da_free(stream->mux_packets);
 
-	os_process_pipe_destroy(stream->pipe);
+	stop_pipe(stream);
 	dstr_free(&stream->path);
 	bfree(stream);
 }
@@ -225,7 +252,7 @@ static void add_muxer_params(struct dstr *cmd, struct ffmpeg_muxer *stream)
 }
 
 static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
-		const char *path)
+		const char *path, int shm_fd)
 {
 	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
 	obs_encoder_t *aencoders[MAX_AUDIO_MIXES];
@@ -243,7 +270,12 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 
 	dstr_init_move_array(cmd, obs_module_file(FFMPEG_MUX));
 	dstr_insert_ch(cmd, 0, '\"');
-	dstr_cat(cmd, "\" \"");
+	dstr_cat(cmd, "\" ");
+
+	if (shm_fd != -1)
+		dstr_catf(cmd, "--shm %d ", shm_fd);
+
+	dstr_cat(cmd, "\"");
 
 	dstr_copy(&stream->path, path);
 	dstr_replace(&stream->path, "\"", "\"\"");
@@ -265,12 +297,72 @@ static void build_command_line(struct ffmpeg_muxer *stream, struct dstr *cmd,
 	add_muxer_params(cmd, stream);
 }
 
+#ifdef FFM_SHM_SUPPORTED
+/* the ring is created close-on-exec, and is only made inheritable while its
+ * own ffmpeg-mux process is started.  outputs starting at the same time are
+ * serialized so that no ffmpeg-mux process gets another output's ring. */
+static pthread_mutex_t shm_inherit_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static inline void start_pipe(struct ffmpeg_muxer *stream, const char *path)
 {
 	struct dstr cmd;
-	build_command_line(stream, &cmd, path);
+	int shm_fd = -1;
+
+#ifdef FFM_SHM_SUPPORTED
+	stream->shm = ffm_shm_create(FFM_SHM_DEFAULT_SIZE, &shm_fd);
+	if (!stream->shm)
+		info("Failed to create shared memory ring, writing packets "
+		     "to the process pipe instead");
+
+	pthread_mutex_lock(&shm_inherit_mutex);
+	if (shm_fd != -1 && !ffm_shm_set_inherit(shm_fd, true)) {
+		warn("Failed to pass the shared memory ring to ffmpeg-mux, "
+		     "writing packets to the process pipe instead");
+		ffm_shm_destroy(stream->shm);
+		stream->shm = NULL;
+		close(shm_fd);
+		shm_fd = -1;
+	}
+#endif
+
+	build_command_line(stream, &cmd, path, shm_fd);
 	stream->pipe = os_process_pipe_create(cmd.array, "w");
+
+#ifdef FFM_SHM_SUPPORTED
+	/* the ffmpeg-mux process has inherited the ring by now */
+	if (shm_fd != -1)
+		close(shm_fd);
+	pthread_mutex_unlock(&shm_inherit_mutex);
+#endif
+
 	dstr_free(&cmd);
+
+#ifdef FFM_SHM_SUPPORTED
+	if (!stream->pipe) {
+		ffm_shm_destroy(stream->shm);
+		stream->shm = NULL;
+	}
+#endif
+}
+
+static int stop_pipe(struct ffmpeg_muxer *stream)
+{
+	int ret;
+
+#ifdef FFM_SHM_SUPPORTED
+	if (stream->shm)
+		ffm_shm_close(stream->shm);
+#endif
+
+	ret = os_process_pipe_destroy(stream->pipe);
+	stream->pipe = NULL;
+
+#ifdef FFM_SHM_SUPPORTED
+	ffm_shm_destroy(stream->shm);
+	stream->shm = NULL;
+#endif
+	return ret;
 }
 
 static bool ffmpeg_mux_start(void *data)
@@ -340,8 +432,7 @@ static int deactivate(struct ffmpeg_muxer *stream)
 	int ret = -1;
 
 	if (active(stream)) {
-		ret = os_process_pipe_destroy(stream->pipe);
-		stream->pipe = NULL;
+		ret = stop_pipe(stream);
 
 		os_atomic_set_bool(&stream->active, false);
 		os_atomic_set_bool(&stream->sent_headers, false);
@@ -396,6 +487,19 @@ static bool write_packet(struct ffmpeg_muxer *stream,
 		.keyframe = packet->keyframe
 	};
 
+#ifdef FFM_SHM_SUPPORTED
+	if (stream->shm) {
+		if (!ffm_shm_write_packet(stream->shm, &info, packet->data)) {
+			warn("Writing packet to the shared memory ring failed");
+			signal_failure(stream);
+			return false;
+		}
+
+		stream->total_bytes += packet->size;
+		return true;
+	}
+#endif
+
 	ret = os_process_pipe_write(stream->pipe, (const uint8_t*)&info,
 			sizeof(info));
 	if (ret != sizeof(info)) {
@@ -558,6 +662,9 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 	struct ffmpeg_muxer *stream = bzalloc(sizeof(*stream));
 	stream->output = output;
 
+	if (!mux_queue_init(&stream->mux_queue))
+		goto fail;
+
 	stream->hotkey = obs_hotkey_register_output(output,
 			"ReplayBuffer.Save",
 			obs_module_text("ReplayBuffer.Save"),
@@ -569,6 +676,10 @@ static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
 			get_last_replay, stream);
 
 	return stream;
+
+fail:
+	bfree(stream);
+	return NULL;
 }
 
 static void replay_buffer_destroy(void *data)
@@ -576,9 +687,51 @@ static void replay_buffer_destroy(void *data)
 	struct ffmpeg_muxer *stream = data;
 	if (stream->hotkey)
 		obs_hotkey_unregister(stream->hotkey);
+
+	if (stream->mux_thread_joinable) {
+		pthread_join(stream->mux_thread, NULL);
+		stream->mux_thread_joinable = false;
+	}
+
+	mux_queue_free(&stream->mux_queue);
 	ffmpeg_mux_destroy(data);
 }
 
+static bool replay_buffer_start_disk_cache(struct ffmpeg_muxer *stream,
+		obs_data_t *settings)
+{
+	const char *path = obs_data_get_string(settings, "disk_cache_path");
+	int64_t size = stream->max_size;
+	struct dstr default_path = {0};
+
+	if (!path || !*path) {
+		dstr_copy(&default_path,
+				obs_data_get_string(settings, "directory"));
+		dstr_replace(&default_path, "\\", "/");
+		if (dstr_end(&default_path) != '/')
+			dstr_cat_ch(&default_path, '/');
+		dstr_cat(&default_path, "replay-buffer.cache");
+		path = default_path.array;
+	}
+
+	if (!size) {
+		warn("No maximum size set for the replay buffer disk cache, "
+		     "using %d MB", DEFAULT_DISK_CACHE_MB);
+		size = DEFAULT_DISK_CACHE_MB * (1024LL * 1024LL);
+	}
+
+	stream->disk = replay_disk_buffer_create(path, (uint64_t)size);
+	if (stream->disk)
+		info("Buffering replay in '%s' (%d MB)", path,
+				(int)(size / (1024 * 1024)));
+	else
+		obs_output_set_last_error(stream->output,
+				obs_module_text("UnableToWritePath"));
+
+	dstr_free(&default_path);
+	return stream->disk != NULL;
+}
+
 static bool replay_buffer_start(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
@@ -591,6 +744,13 @@ static bool replay_buffer_start(void *data)
 	obs_data_t *s = obs_output_get_settings(stream->output);
 	stream->max_time = obs_data_get_int(s, "max_time_sec") * 1000000LL;
 	stream->max_size = obs_data_get_int(s, "max_size_mb") * (1024 * 1024);
+
+	if (obs_data_get_bool(s, "disk_cache") &&
+	    !replay_buffer_start_disk_cache(stream, s)) {
+		obs_data_release(s);
+		return false;
+	}
+
 	obs_data_release(s);
 
 	os_atomic_set_bool(&stream->active, true);
@@ -662,14 +822,12 @@ static inline void replay_buffer_purge(struct ffmpeg_muxer *stream,
 		purge(stream);
 }
 
-static void insert_packet(struct darray *array, struct encoder_packet *packet,
+static void push_mux_packet(struct ffmpeg_muxer *stream,
+		struct encoder_packet *packet,
 		int64_t video_offset, int64_t *audio_offsets,
 		int64_t video_dts_offset, int64_t *audio_dts_offsets)
 {
 	struct encoder_packet pkt;
-	DARRAY(struct encoder_packet) packets;
-	packets.da = *array;
-	size_t idx;
 
 	obs_encoder_packet_ref(&pkt, packet);
 
@@ -683,19 +841,13 @@ static void insert_packet(struct darray *array, struct encoder_packet *packet,
 		pkt.pts -= audio_dts_offsets[pkt.track_idx];
 	}
 
-	for (idx = packets.num; idx > 0; idx--) {
-		struct encoder_packet *p = packets.array + (idx - 1);
-		if (p->dts_usec < pkt.dts_usec)
-			break;
-	}
-
-	da_insert(packets, idx, &pkt);
-	*array = packets.da;
+	mux_queue_push(&stream->mux_queue, &pkt);
 }
 
 static void *replay_buffer_mux_thread(void *data)
 {
 	struct ffmpeg_muxer *stream = data;
+	struct encoder_packet pkt;
 
 	start_pipe(stream, stream->path.array);
 
@@ -710,31 +862,100 @@ static void *replay_buffer_mux_thread(void *data)
 		goto error;
 	}
 
-	for (size_t i = 0; i < stream->mux_packets.num; i++) {
-		struct encoder_packet *pkt = &stream->mux_packets.array[i];
-		write_packet(stream, pkt);
-		obs_encoder_packet_release(pkt);
+	if (stream->disk_reader) {
+		/* packets are streamed from the disk cache one at a time */
+		while (replay_disk_reader_next(stream->disk_reader, &pkt)) {
+			if (!write_packet(stream, &pkt))
+				break;
+		}
+	}
+
+	while (mux_queue_next(&stream->mux_queue, &pkt)) {
+		write_packet(stream, &pkt);
+		obs_encoder_packet_release(&pkt);
 	}
 
 	info("Wrote replay buffer to '%s'", stream->path.array);
 
 error:
-	os_process_pipe_destroy(stream->pipe);
-	stream->pipe = NULL;
-	da_free(stream->mux_packets);
+	/* drain whatever is still being gathered */
+	while (mux_queue_next(&stream->mux_queue, &pkt))
+		obs_encoder_packet_release(&pkt);
+
+	mux_queue_clear(&stream->mux_queue);
+
+	stop_pipe(stream);
+	replay_disk_reader_destroy(stream->disk_reader);
+	stream->disk_reader = NULL;
 	os_atomic_set_bool(&stream->muxing, false);
 	return NULL;
 }
 
+static inline uint32_t get_mux_track_mask(struct ffmpeg_muxer *stream)
+{
+	uint32_t mask = 0;
+
+	if (obs_output_get_video_encoder(stream->output))
+		mask |= 1;
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		if (obs_output_get_audio_encoder(stream->output, i))
+			mask |= 1 << (i + 1);
+	}
+
+	return mask;
+}
+
 static void replay_buffer_save(struct ffmpeg_muxer *stream)
 {
 	const size_t size = sizeof(struct encoder_packet);
 	size_t num_packets = stream->packets.size / size;
 
-	da_reserve(stream->mux_packets, num_packets);
+	if (stream->disk) {
+		stream->disk_reader = replay_disk_buffer_read(stream->disk);
+		if (!stream->disk_reader)
+			return;
+		num_packets = 0;
+	}
+
+	/* ---------------------------- */
+	/* generate filename */
+
+	obs_data_t *settings = obs_output_get_settings(stream->output);
+	const char *dir = obs_data_get_string(settings, "directory");
+	const char *fmt = obs_data_get_string(settings, "format");
+	const char *ext = obs_data_get_string(settings, "extension");
+	bool space = obs_data_get_bool(settings, "allow_spaces");
+
+	char *filename = os_generate_formatted_filename(ext, space, fmt);
+
+	dstr_copy(&stream->path, dir);
+	dstr_replace(&stream->path, "\\", "/");
+	if (dstr_end(&stream->path) != '/')
+		dstr_cat_ch(&stream->path, '/');
+	dstr_cat(&stream->path, filename);
+
+	bfree(filename);
+	obs_data_release(settings);
 
 	/* ---------------------------- */
-	/* reorder packets */
+	/* start muxing, packets are merged as they are gathered */
+
+	mux_queue_start(&stream->mux_queue, get_mux_track_mask(stream));
+
+	os_atomic_set_bool(&stream->muxing, true);
+	stream->mux_thread_joinable = pthread_create(&stream->mux_thread, NULL,
+			replay_buffer_mux_thread, stream) == 0;
+
+	if (!stream->mux_thread_joinable) {
+		replay_disk_reader_destroy(stream->disk_reader);
+		stream->disk_reader = NULL;
+		os_atomic_set_bool(&stream->muxing, false);
+		return;
+	}
+
+	/* ---------------------------- */
+	/* gather packets */
 
 	bool found_video = false;
 	bool found_audio[MAX_AUDIO_MIXES] = {0};
@@ -761,36 +982,12 @@ static void replay_buffer_save(struct ffmpeg_muxer *stream)
 			}
 		}
 
-		insert_packet(&stream->mux_packets.da, pkt,
+		push_mux_packet(stream, pkt,
 				video_offset, audio_offsets,
 				video_dts_offset, audio_dts_offsets);
 	}
 
-	/* ---------------------------- */
-	/* generate filename */
-
-	obs_data_t *settings = obs_output_get_settings(stream->output);
-	const char *dir = obs_data_get_string(settings, "directory");
-	const char *fmt = obs_data_get_string(settings, "format");
-	const char *ext = obs_data_get_string(settings, "extension");
-	bool space = obs_data_get_bool(settings, "allow_spaces");
-
-	char *filename = os_generate_formatted_filename(ext, space, fmt);
-
-	dstr_copy(&stream->path, dir);
-	dstr_replace(&stream->path, "\\", "/");
-	if (dstr_end(&stream->path) != '/')
-		dstr_cat_ch(&stream->path, '/');
-	dstr_cat(&stream->path, filename);
-
-	bfree(filename);
-	obs_data_release(settings);
-
-	/* ---------------------------- */
-
-	os_atomic_set_bool(&stream->muxing, true);
-	stream->mux_thread_joinable = pthread_create(&stream->mux_thread, NULL,
-			replay_buffer_mux_thread, stream) == 0;
+	mux_queue_end(&stream->mux_queue);
 }
 
 static void deactivate_replay_buffer(struct ffmpeg_muxer *stream)
@@ -819,17 +1016,23 @@ static void replay_buffer_data(void *data, struct encoder_packet *packet)
 		}
 	}
 
-	obs_encoder_packet_ref(&pkt, packet);
-	replay_buffer_purge(stream, &pkt);
+	if (stream->disk) {
+		replay_disk_buffer_push(stream->disk, packet,
+				stream->max_time);
+	} else {
+		obs_encoder_packet_ref(&pkt, packet);
+		replay_buffer_purge(stream, &pkt);
 
-	if (!stream->packets.size)
-		stream->cur_time = pkt.dts_usec;
-	stream->cur_size += pkt.size;
+		if (!stream->packets.size)
+			stream->cur_time = pkt.dts_usec;
+		stream->cur_size += pkt.size;
 
-	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
+		circlebuf_push_back(&stream->packets, packet,
+				sizeof(*packet));
 
-	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
-		stream->keyframes++;
+		if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
+			stream->keyframes++;
+	}
 
 	if (stream->save_ts && packet->sys_dts_usec >= stream->save_ts) {
 		if (os_atomic_load_bool(&stream->muxing))
@@ -852,6 +1055,7 @@ static void replay_buffer_defaults(obs_data_t *s)
 	obs_data_set_default_string(s, "format", "%CCYY-%MM-%DD %hh-%mm-%ss");
 	obs_data_set_default_string(s, "extension", "mp4");
 	obs_data_set_default_bool(s, "allow_spaces", true);
+	obs_data_set_default_bool(s, "disk_cache", false);
 }
 
 struct obs_output_info replay_buffer = {
@@ -0,0 +1,769 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/circlebuf.h>
+#include <util/bmem.h>
+#include "replay-disk-buffer.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define do_log(level, format, ...) \
+	blog(level, "[replay disk buffer: '%s'] " format, \
+			rdb->path, ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+
+/*
+ *   Records are a disk_record followed by the packet data, aligned to 8 bytes.
+ * A record never wraps around the end of the ring: if it doesn't fit, the
+ * rest of the ring is skipped (marked with a padding record if there's room
+ * for one).
+ *
+ *   Positions are byte counts that only ever grow; the offset in the file is
+ * the position modulo the ring size.
+ */
+
+#define RECORD_PADDING  0xFF
+#define NO_PIN          UINT64_MAX
+#define MAX_TRACKS      (1 + MAX_AUDIO_MIXES)
+#define MAX_PENDING     (64 * 1024 * 1024)
+
+struct disk_record {
+	int64_t  pts;
+	int64_t  dts;
+	int64_t  dts_usec;
+	int64_t  sys_dts_usec;
+	int32_t  timebase_num;
+	int32_t  timebase_den;
+	uint32_t size;
+	uint32_t track_idx;
+	uint8_t  type;
+	uint8_t  keyframe;
+	uint8_t  reserved[6];
+};
+
+struct keyframe_entry {
+	uint64_t pos;
+	int64_t  dts_usec;
+};
+
+/* a record waiting on the write thread.  data holds the disk_record followed
+ * by the packet data. */
+struct pending_write {
+	uint64_t pos;
+	uint64_t end;
+	uint64_t padding_pos;
+	bool     padding;
+	uint8_t  *data;
+	size_t   size;
+};
+
+struct replay_disk_buffer {
+	char             *path;
+	FILE             *file;
+	uint64_t         capacity;
+
+	pthread_mutex_t  mutex;
+	bool             wait_keyframe;
+	uint64_t         head;
+	int64_t          head_dts_usec;
+	struct circlebuf keyframes;
+	uint32_t         tracks;
+
+	/* records are handed to the write thread up to write_pos, and are on
+	 * disk up to tail */
+	uint64_t         write_pos;
+	uint64_t         tail;
+	struct circlebuf pending;
+	size_t           pending_size;
+	uint64_t         error_end;
+
+	pthread_t        write_thread;
+	bool             write_thread_active;
+	os_event_t       *write_event;
+	os_event_t       *written_event;
+	volatile bool    stop;
+	uint64_t         file_offset;
+
+	/* oldest position the reader still needs */
+	uint64_t         pin;
+	bool             reading;
+};
+
+struct disk_cursor {
+	FILE               *file;
+	uint64_t           file_offset;
+	uint64_t           pos;
+
+	struct disk_record rec;
+	uint64_t           rec_pos;
+	bool               has_record;
+
+	bool               found_first;
+	int64_t            dts_usec_offset;
+	int64_t            dts_offset;
+};
+
+struct replay_disk_reader {
+	struct replay_disk_buffer *rdb;
+	uint64_t                  start;
+	uint64_t                  end;
+	uint32_t                  tracks;
+	bool                      opened;
+	bool                      failed;
+
+	struct disk_cursor        cursors[MAX_TRACKS];
+	size_t                    num_cursors;
+
+	uint8_t                   *data;
+	size_t                    data_capacity;
+};
+
+static inline uint64_t record_size(uint64_t size)
+{
+	return (sizeof(struct disk_record) + size + 7) & ~(uint64_t)7;
+}
+
+static inline uint32_t record_track(const struct disk_record *rec)
+{
+	return rec->type == OBS_ENCODER_VIDEO ? 0 : 1 + rec->track_idx;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *write_thread(void *data);
+
+static bool preallocate(FILE *file, uint64_t size)
+{
+#if defined(_WIN32)
+	return _chsize_s(_fileno(file), (__int64)size) == 0;
+#elif defined(__linux__)
+	return posix_fallocate(fileno(file), 0, (off_t)size) == 0 ||
+	       ftruncate(fileno(file), (off_t)size) == 0;
+#else
+	return ftruncate(fileno(file), (off_t)size) == 0;
+#endif
+}
+
+struct replay_disk_buffer *replay_disk_buffer_create(const char *path,
+		uint64_t size)
+{
+	struct replay_disk_buffer *rdb;
+	FILE *file;
+
+	size &= ~(uint64_t)7;
+	if (size < record_size(0) * 2) {
+		blog(LOG_WARNING, "replay_disk_buffer_create: Invalid size");
+		return NULL;
+	}
+
+	file = os_fopen(path, "w+b");
+	if (!file) {
+		blog(LOG_WARNING, "replay_disk_buffer_create: Failed to open "
+		                  "'%s'", path);
+		return NULL;
+	}
+
+	/* each record is written with one call on the write thread, and has
+	 * to be visible to the reader's own handles right away */
+	setvbuf(file, NULL, _IONBF, 0);
+
+	if (!preallocate(file, size)) {
+		blog(LOG_WARNING, "replay_disk_buffer_create: Failed to "
+		                  "allocate %"PRIu64" bytes for '%s'",
+		                  size, path);
+		fclose(file);
+		os_unlink(path);
+		return NULL;
+	}
+
+	rdb = bzalloc(sizeof(*rdb));
+	rdb->path = bstrdup(path);
+	rdb->file = file;
+	rdb->capacity = size;
+	rdb->pin = NO_PIN;
+
+	pthread_mutex_init_value(&rdb->mutex);
+	if (pthread_mutex_init(&rdb->mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&rdb->write_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (os_event_init(&rdb->written_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+
+	rdb->write_thread_active = pthread_create(&rdb->write_thread, NULL,
+			write_thread, rdb) == 0;
+	if (!rdb->write_thread_active)
+		goto fail;
+
+	return rdb;
+
+fail:
+	replay_disk_buffer_destroy(rdb);
+	return NULL;
+}
+
+void replay_disk_buffer_destroy(struct replay_disk_buffer *rdb)
+{
+	if (!rdb)
+		return;
+
+	if (rdb->write_thread_active) {
+		os_atomic_set_bool(&rdb->stop, true);
+		os_event_signal(rdb->write_event);
+		pthread_join(rdb->write_thread, NULL);
+	}
+
+	while (rdb->pending.size) {
+		struct pending_write pw;
+		circlebuf_pop_front(&rdb->pending, &pw, sizeof(pw));
+		bfree(pw.data);
+	}
+
+	if (rdb->file) {
+		fclose(rdb->file);
+		os_unlink(rdb->path);
+	}
+
+	circlebuf_free(&rdb->pending);
+	circlebuf_free(&rdb->keyframes);
+	os_event_destroy(rdb->write_event);
+	os_event_destroy(rdb->written_event);
+	pthread_mutex_destroy(&rdb->mutex);
+	bfree(rdb->path);
+	bfree(rdb);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* gets the first keyframe after the head.  mutex must be locked. */
+static bool next_keyframe(struct replay_disk_buffer *rdb,
+		struct keyframe_entry *kf)
+{
+	while (rdb->keyframes.size) {
+		circlebuf_peek_front(&rdb->keyframes, kf, sizeof(*kf));
+		if (kf->pos > rdb->head)
+			return true;
+
+		circlebuf_pop_front(&rdb->keyframes, NULL, sizeof(*kf));
+	}
+
+	return false;
+}
+
+static inline size_t keyframe_count(struct replay_disk_buffer *rdb)
+{
+	return rdb->keyframes.size / sizeof(struct keyframe_entry);
+}
+
+/* purges the oldest group of pictures.  mutex must be locked. */
+static bool purge(struct replay_disk_buffer *rdb)
+{
+	struct keyframe_entry kf;
+
+	if (!next_keyframe(rdb, &kf))
+		return false;
+
+	rdb->head = kf.pos;
+	rdb->head_dts_usec = kf.dts_usec;
+	return true;
+}
+
+static void purge_time(struct replay_disk_buffer *rdb, int64_t dts_usec,
+		int64_t max_time)
+{
+	if (!max_time)
+		return;
+
+	while (keyframe_count(rdb) > 2 &&
+	       (dts_usec - rdb->head_dts_usec) > max_time) {
+		if (!purge(rdb))
+			break;
+	}
+}
+
+/* drops everything and waits for the next keyframe.  records that were
+ * already handed to the write thread are still written, so the part of the
+ * ring before write_pos stays in order for a reader.  mutex must be locked. */
+static void reset(struct replay_disk_buffer *rdb)
+{
+	rdb->head = rdb->write_pos;
+	circlebuf_pop_front(&rdb->keyframes, NULL, rdb->keyframes.size);
+	rdb->wait_keyframe = true;
+}
+
+/* purges until everything up to end fits in the ring.  fails instead of
+ * waiting if the reader still needs the part of the ring that would be
+ * overwritten.  mutex must be locked. */
+static bool make_space(struct replay_disk_buffer *rdb, uint64_t end)
+{
+	while (end - rdb->head > rdb->capacity) {
+		if (!purge(rdb))
+			return false;
+	}
+
+	return rdb->pin == NO_PIN || end - rdb->pin <= rdb->capacity;
+}
+
+/* ------------------------------------------------------------------------- */
+/* write thread */
+
+static bool write_data(struct replay_disk_buffer *rdb, uint64_t pos,
+		const void *data, size_t size)
+{
+	uint64_t offset = pos % rdb->capacity;
+
+	/* records are mostly written back to back, so the seek is skipped
+	 * unless the ring wrapped or a write failed */
+	if (rdb->file_offset != offset) {
+		if (os_fseeki64(rdb->file, (int64_t)offset, SEEK_SET) != 0) {
+			rdb->file_offset = UINT64_MAX;
+			return false;
+		}
+		rdb->file_offset = offset;
+	}
+
+	if (fwrite(data, 1, size, rdb->file) != size) {
+		rdb->file_offset = UINT64_MAX;
+		return false;
+	}
+
+	rdb->file_offset += size;
+	return true;
+}
+
+static bool write_pending(struct replay_disk_buffer *rdb,
+		const struct pending_write *pw)
+{
+	if (pw->padding) {
+		struct disk_record padding = {.type = RECORD_PADDING};
+		if (!write_data(rdb, pw->padding_pos, &padding,
+					sizeof(padding)))
+			return false;
+	}
+
+	return write_data(rdb, pw->pos, pw->data, pw->size);
+}
+
+static bool next_pending(struct replay_disk_buffer *rdb,
+		struct pending_write *pw)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&rdb->mutex);
+	if (rdb->pending.size) {
+		circlebuf_pop_front(&rdb->pending, pw, sizeof(*pw));
+		found = true;
+	}
+	pthread_mutex_unlock(&rdb->mutex);
+
+	return found;
+}
+
+static void *write_thread(void *data)
+{
+	struct replay_disk_buffer *rdb = data;
+	struct pending_write pw;
+
+	os_set_thread_name("replay disk buffer: write_thread");
+
+	while (os_event_wait(rdb->write_event) == 0) {
+		if (os_atomic_load_bool(&rdb->stop))
+			break;
+
+		while (next_pending(rdb, &pw)) {
+			bool success = write_pending(rdb, &pw);
+
+			/* the tail moves past a failed record as well, so a
+			 * reader never waits on it; error_end tells the
+			 * reader that it can't be read */
+			pthread_mutex_lock(&rdb->mutex);
+			rdb->pending_size -= pw.size;
+			rdb->tail = pw.end;
+			if (!success) {
+				warn("Failed to write packet, dropping "
+				     "buffered packets");
+				rdb->error_end = pw.end;
+				reset(rdb);
+			}
+			pthread_mutex_unlock(&rdb->mutex);
+
+			os_event_signal(rdb->written_event);
+			bfree(pw.data);
+		}
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void replay_disk_buffer_push(struct replay_disk_buffer *rdb,
+		const struct encoder_packet *packet, int64_t max_time)
+{
+	bool keyframe = packet->type == OBS_ENCODER_VIDEO && packet->keyframe;
+	uint64_t size = record_size(packet->size);
+	uint64_t remaining;
+	uint64_t pos;
+	struct pending_write pw = {0};
+
+	struct disk_record rec = {
+		.pts          = packet->pts,
+		.dts          = packet->dts,
+		.dts_usec     = packet->dts_usec,
+		.sys_dts_usec = packet->sys_dts_usec,
+		.timebase_num = packet->timebase_num,
+		.timebase_den = packet->timebase_den,
+		.size         = (uint32_t)packet->size,
+		.track_idx    = (uint32_t)packet->track_idx,
+		.type         = (uint8_t)packet->type,
+		.keyframe     = packet->keyframe
+	};
+
+	/* copied before locking, the reader and the write thread take the
+	 * mutex too */
+	pw.size = sizeof(rec) + packet->size;
+	pw.data = bmalloc(pw.size);
+	memcpy(pw.data, &rec, sizeof(rec));
+	if (packet->size)
+		memcpy(pw.data + sizeof(rec), packet->data, packet->size);
+
+	pthread_mutex_lock(&rdb->mutex);
+
+	if (rdb->wait_keyframe) {
+		if (!keyframe)
+			goto unlock;
+		rdb->wait_keyframe = false;
+	}
+
+	if (size > rdb->capacity / 2) {
+		warn("Packet of %"PRIu64" bytes is too large for the buffer, "
+		     "dropping buffered packets", (uint64_t)packet->size);
+		reset(rdb);
+		goto unlock;
+	}
+
+	/* the packet is copied until the write thread gets to it, so a disk
+	 * that can't keep up is treated like a full ring */
+	if (rdb->pending_size + size > MAX_PENDING) {
+		warn("Disk is not keeping up with the packets, dropping "
+		     "buffered packets");
+		reset(rdb);
+		goto unlock;
+	}
+
+	purge_time(rdb, packet->dts_usec, max_time);
+
+	pos = rdb->write_pos;
+	remaining = rdb->capacity - pos % rdb->capacity;
+	if (remaining < size)
+		pos += remaining;
+
+	if (!make_space(rdb, pos + size)) {
+		/* keyframes keep failing the same way until the reader is
+		 * done, but there's only something to drop the first time */
+		if (rdb->head != rdb->write_pos)
+			warn("Buffer is full while being saved or a single "
+			     "group of pictures doesn't fit in it, dropping "
+			     "buffered packets");
+		reset(rdb);
+
+		/* a keyframe can start the buffer over right away */
+		if (!keyframe || !make_space(rdb, pos + size))
+			goto unlock;
+
+		rdb->wait_keyframe = false;
+	}
+
+	if (rdb->head == rdb->write_pos) {
+		rdb->head = pos;
+		rdb->head_dts_usec = packet->dts_usec;
+	}
+	if (keyframe) {
+		struct keyframe_entry kf = {pos, packet->dts_usec};
+		circlebuf_push_back(&rdb->keyframes, &kf, sizeof(kf));
+	}
+
+	rdb->tracks |= 1 << record_track(&rec);
+
+	pw.pos         = pos;
+	pw.end         = pos + size;
+	pw.padding_pos = rdb->write_pos;
+	pw.padding     = pos != rdb->write_pos && remaining >= sizeof(rec);
+
+	circlebuf_push_back(&rdb->pending, &pw, sizeof(pw));
+	rdb->pending_size += pw.size;
+	rdb->write_pos = pw.end;
+
+	pthread_mutex_unlock(&rdb->mutex);
+
+	os_event_signal(rdb->write_event);
+	return;
+
+unlock:
+	pthread_mutex_unlock(&rdb->mutex);
+	bfree(pw.data);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool cursor_seek(struct disk_cursor *cursor, uint64_t offset)
+{
+	if (cursor->file_offset == offset)
+		return true;
+	if (os_fseeki64(cursor->file, (int64_t)offset, SEEK_SET) != 0)
+		return false;
+
+	cursor->file_offset = offset;
+	return true;
+}
+
+static bool cursor_read(struct disk_cursor *cursor, void *data, size_t size)
+{
+	if (fread(data, 1, size, cursor->file) != size)
+		return false;
+
+	cursor->file_offset += size;
+	return true;
+}
+
+/* finds the next record of the cursor's track */
+static void cursor_next(struct replay_disk_reader *reader, uint32_t track,
+		struct disk_cursor *cursor)
+{
+	uint64_t capacity = reader->rdb->capacity;
+
+	cursor->has_record = false;
+
+	while (cursor->pos < reader->end) {
+		uint64_t offset = cursor->pos % capacity;
+		uint64_t remaining = capacity - offset;
+
+		if (remaining < sizeof(struct disk_record)) {
+			cursor->pos += remaining;
+			continue;
+		}
+
+		if (!cursor_seek(cursor, offset) ||
+		    !cursor_read(cursor, &cursor->rec, sizeof(cursor->rec)))
+			return;
+
+		if (cursor->rec.type == RECORD_PADDING) {
+			cursor->pos += remaining;
+			continue;
+		}
+
+		cursor->rec_pos = cursor->pos;
+		cursor->pos += record_size(cursor->rec.size);
+
+		if (record_track(&cursor->rec) == track) {
+			cursor->has_record = true;
+			break;
+		}
+	}
+
+	if (cursor->has_record && !cursor->found_first) {
+		cursor->dts_usec_offset = cursor->rec.dts_usec;
+		cursor->dts_offset = cursor->rec.dts;
+		cursor->found_first = true;
+	}
+}
+
+static void update_pin(struct replay_disk_reader *reader)
+{
+	struct replay_disk_buffer *rdb = reader->rdb;
+	uint64_t pin = reader->end;
+
+	for (size_t i = 0; i < reader->num_cursors; i++) {
+		struct disk_cursor *cursor = &reader->cursors[i];
+		if (cursor->has_record && cursor->rec_pos < pin)
+			pin = cursor->rec_pos;
+	}
+
+	pthread_mutex_lock(&rdb->mutex);
+	rdb->pin = pin;
+	pthread_mutex_unlock(&rdb->mutex);
+}
+
+struct replay_disk_reader *replay_disk_buffer_read(
+		struct replay_disk_buffer *rdb)
+{
+	struct replay_disk_reader *reader;
+
+	pthread_mutex_lock(&rdb->mutex);
+	if (rdb->reading) {
+		pthread_mutex_unlock(&rdb->mutex);
+		return NULL;
+	}
+
+	rdb->reading = true;
+	rdb->pin = rdb->head;
+
+	reader = bzalloc(sizeof(*reader));
+	reader->rdb = rdb;
+	reader->start = rdb->head;
+	reader->end = rdb->write_pos;
+	reader->tracks = rdb->tracks;
+	pthread_mutex_unlock(&rdb->mutex);
+
+	return reader;
+}
+
+/* waits for the write thread to get the buffered range on disk, and opens a
+ * cursor for each track.  this is done on the first read instead of in
+ * replay_disk_buffer_read, which is called from the encoder thread. */
+static bool open_reader(struct replay_disk_reader *reader)
+{
+	struct replay_disk_buffer *rdb = reader->rdb;
+	bool write_failed;
+
+	pthread_mutex_lock(&rdb->mutex);
+	while (rdb->tail < reader->end) {
+		pthread_mutex_unlock(&rdb->mutex);
+		os_event_wait(rdb->written_event);
+		pthread_mutex_lock(&rdb->mutex);
+	}
+	write_failed = rdb->error_end > reader->start;
+	pthread_mutex_unlock(&rdb->mutex);
+
+	if (write_failed) {
+		warn("Failed to write packets that are being saved");
+		return false;
+	}
+
+	/* each track is read with its own cursor, and the tracks are merged
+	 * as they're read */
+	for (uint32_t track = 0; track < MAX_TRACKS; track++) {
+		struct disk_cursor *cursor;
+
+		if ((reader->tracks & (1 << track)) == 0)
+			continue;
+
+		cursor = &reader->cursors[reader->num_cursors++];
+		cursor->file = os_fopen(rdb->path, "rb");
+		cursor->pos = reader->start;
+
+		if (!cursor->file) {
+			warn("Failed to open buffer for reading");
+			return false;
+		}
+
+		cursor->file_offset = 0;
+		cursor_next(reader, track, cursor);
+	}
+
+	update_pin(reader);
+	return true;
+}
+
+bool replay_disk_reader_next(struct replay_disk_reader *reader,
+		struct encoder_packet *packet)
+{
+	struct replay_disk_buffer *rdb = reader->rdb;
+	struct disk_cursor *next = NULL;
+	int64_t next_dts_usec = 0;
+	uint32_t track;
+
+	if (!reader->opened) {
+		reader->opened = true;
+		reader->failed = !open_reader(reader);
+	}
+	if (reader->failed)
+		return false;
+
+	for (size_t i = 0; i < reader->num_cursors; i++) {
+		struct disk_cursor *cursor = &reader->cursors[i];
+		int64_t dts_usec;
+
+		if (!cursor->has_record)
+			continue;
+
+		/* packets with the same timestamp are ordered newest first,
+		 * the same way the memory buffer orders them */
+		dts_usec = cursor->rec.dts_usec - cursor->dts_usec_offset;
+		if (!next || dts_usec < next_dts_usec ||
+		    (dts_usec == next_dts_usec &&
+		     cursor->rec_pos > next->rec_pos)) {
+			next = cursor;
+			next_dts_usec = dts_usec;
+		}
+	}
+
+	if (!next)
+		return false;
+
+	if (next->rec.size > reader->data_capacity) {
+		reader->data = brealloc(reader->data, next->rec.size);
+		reader->data_capacity = next->rec.size;
+	}
+
+	if (!cursor_seek(next, (next->rec_pos + sizeof(next->rec)) %
+				rdb->capacity) ||
+	    !cursor_read(next, reader->data, next->rec.size)) {
+		warn("Failed to read packet");
+		return false;
+	}
+
+	memset(packet, 0, sizeof(*packet));
+	packet->data         = reader->data;
+	packet->size         = next->rec.size;
+	packet->pts          = next->rec.pts - next->dts_offset;
+	packet->dts          = next->rec.dts - next->dts_offset;
+	packet->dts_usec     = next_dts_usec;
+	packet->sys_dts_usec = next->rec.sys_dts_usec;
+	packet->timebase_num = next->rec.timebase_num;
+	packet->timebase_den = next->rec.timebase_den;
+	packet->track_idx    = next->rec.track_idx;
+	packet->type         = (enum obs_encoder_type)next->rec.type;
+	packet->keyframe     = next->rec.keyframe != 0;
+
+	track = record_track(&next->rec);
+	cursor_next(reader, track, next);
+	update_pin(reader);
+	return true;
+}
+
+void replay_disk_reader_destroy(struct replay_disk_reader *reader)
+{
+	struct replay_disk_buffer *rdb;
+
+	if (!reader)
+		return;
+
+	rdb = reader->rdb;
+
+	pthread_mutex_lock(&rdb->mutex);
+	rdb->pin = NO_PIN;
+	rdb->reading = false;
+	pthread_mutex_unlock(&rdb->mutex);
+
+	for (size_t i = 0; i < reader->num_cursors; i++) {
+		if (reader->cursors[i].file)
+			fclose(reader->cursors[i].file);
+	}
+
+	bfree(reader->data);
+	bfree(reader);
+}
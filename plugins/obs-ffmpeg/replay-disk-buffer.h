@@ -0,0 +1,59 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <obs-module.h>
+
+/*
+ *   Replay buffer that keeps packets in a preallocated ring file instead of
+ * memory.  Only the positions of video keyframes are kept in memory, and the
+ * oldest group of pictures is purged by advancing the head of the ring.
+ *
+ *   Packets are pushed from a single thread, which only copies them: they are
+ * written to the file on a thread of the buffer's own.  A reader streams the
+ * buffered packets back in muxing order without loading them into memory,
+ * and can be used from another thread while packets are still being pushed.
+ */
+
+struct replay_disk_buffer;
+struct replay_disk_reader;
+
+extern struct replay_disk_buffer *replay_disk_buffer_create(const char *path,
+		uint64_t size);
+extern void replay_disk_buffer_destroy(struct replay_disk_buffer *rdb);
+
+/* pushes a packet, purging the oldest packets when the ring is full or when
+ * it holds more than max_time microseconds.  Never waits on the disk or on a
+ * reader: when the packet can't be buffered, everything is dropped and the
+ * buffer starts over at the next keyframe. */
+extern void replay_disk_buffer_push(struct replay_disk_buffer *rdb,
+		const struct encoder_packet *packet, int64_t max_time);
+
+/* starts reading everything that is currently buffered.  The buffered range
+ * is kept from being overwritten while it is read, so packets pushed while
+ * the ring is full are dropped until the reader is done.  Only one reader can
+ * exist at a time. */
+extern struct replay_disk_reader *replay_disk_buffer_read(
+		struct replay_disk_buffer *rdb);
+
+/* gets the next packet in muxing order, with timestamps offset to start at
+ * zero for each track.  The packet data is valid until the next call.  The
+ * first call waits for the buffered range to be written to the file. */
+extern bool replay_disk_reader_next(struct replay_disk_reader *reader,
+		struct encoder_packet *packet);
+extern void replay_disk_reader_destroy(struct replay_disk_reader *reader);
@@ -0,0 +1,152 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <string.h>
+#include "bitrate-controller.h"
+
+/* how often the throughput is sampled */
+#define SAMPLE_INTERVAL_NS 250000000ULL
+
+/* time given to the encoder to react before lowering the bitrate again */
+#define DECREASE_HOLD_NS   1000000000ULL
+
+/* time the queue must stay drained before the bitrate is raised, and the
+ * time between each increase after that */
+#define INCREASE_HOLD_NS   5000000000ULL
+#define INCREASE_STEP_NS   2000000000ULL
+
+#define MIN_INCREASE_KBPS  50
+
+void bitrate_controller_init(struct bitrate_controller *bc,
+		uint32_t min_kbps, uint32_t max_kbps, int64_t queue_high_usec)
+{
+	memset(bc, 0, sizeof(*bc));
+
+	if (min_kbps > max_kbps)
+		min_kbps = max_kbps;
+
+	bc->min_kbps        = min_kbps;
+	bc->max_kbps        = max_kbps;
+	bc->target_kbps     = max_kbps;
+	bc->queue_high_usec = queue_high_usec;
+	bc->queue_low_usec  = queue_high_usec / 4;
+}
+
+static inline uint32_t clamp_kbps(struct bitrate_controller *bc, double kbps)
+{
+	if (kbps < (double)bc->min_kbps)
+		return bc->min_kbps;
+	if (kbps > (double)bc->max_kbps)
+		return bc->max_kbps;
+	return (uint32_t)kbps;
+}
+
+static void sample_throughput(struct bitrate_controller *bc, uint64_t ts_ns,
+		uint64_t acked_bytes)
+{
+	uint64_t elapsed = ts_ns - bc->interval_start_ns;
+	uint64_t acked = acked_bytes > bc->interval_start_acked ?
+		acked_bytes - bc->interval_start_acked : 0;
+	double kbps = (double)acked * 8000000.0 / (double)elapsed;
+
+	if (bc->throughput_kbps == 0.0)
+		bc->throughput_kbps = kbps;
+	else
+		bc->throughput_kbps = bc->throughput_kbps * 0.75 + kbps * 0.25;
+
+	bc->interval_start_ns    = ts_ns;
+	bc->interval_start_acked = acked_bytes;
+}
+
+bool bitrate_controller_sample_due(const struct bitrate_controller *bc,
+		uint64_t ts_ns)
+{
+	return !bc->interval_start_ns ||
+		ts_ns - bc->interval_start_ns >= SAMPLE_INTERVAL_NS;
+}
+
+bool bitrate_controller_update(struct bitrate_controller *bc,
+		uint64_t ts_ns, uint64_t acked_bytes, uint64_t queued_bytes,
+		int64_t queued_usec)
+{
+	uint32_t target = bc->target_kbps;
+	int64_t queue_usec;
+
+	if (!bc->interval_start_ns) {
+		bc->interval_start_ns    = ts_ns;
+		bc->interval_start_acked = acked_bytes;
+		bc->last_change_ns       = ts_ns;
+		return false;
+	}
+
+	if (ts_ns - bc->interval_start_ns < SAMPLE_INTERVAL_NS)
+		return false;
+
+	sample_throughput(bc, ts_ns, acked_bytes);
+
+	/* unacknowledged bytes are converted to the time it takes to send
+	 * them at the measured throughput */
+	queue_usec = queued_usec;
+	if (bc->throughput_kbps >= 1.0)
+		queue_usec += (int64_t)((double)queued_bytes * 8000.0 /
+				bc->throughput_kbps);
+
+	bc->queue_usec = queue_usec;
+
+	/* once lowered, the bitrate is only lowered again if the queue keeps
+	 * growing instead of draining */
+	if (queue_usec > bc->queue_high_usec &&
+	    queue_usec > bc->change_queue_usec) {
+		bc->queue_low_since_ns = 0;
+
+		/* drop below what the link actually delivered so that the
+		 * queue drains */
+		if (ts_ns - bc->last_change_ns >= DECREASE_HOLD_NS) {
+			double kbps = bc->throughput_kbps * 0.9;
+			if (kbps > (double)target * 0.85)
+				kbps = (double)target * 0.85;
+			target = clamp_kbps(bc, kbps);
+		}
+
+	} else if (queue_usec < bc->queue_low_usec) {
+		if (!bc->queue_low_since_ns)
+			bc->queue_low_since_ns = ts_ns;
+
+		bc->change_queue_usec = 0;
+
+		if (ts_ns - bc->queue_low_since_ns >= INCREASE_HOLD_NS &&
+		    ts_ns - bc->last_change_ns >= INCREASE_STEP_NS) {
+			uint32_t step = target / 12;
+			if (step < MIN_INCREASE_KBPS)
+				step = MIN_INCREASE_KBPS;
+			target = clamp_kbps(bc, (double)target + (double)step);
+		}
+
+	} else {
+		bc->queue_low_since_ns = 0;
+	}
+
+	if (target == bc->target_kbps)
+		return false;
+
+	if (target < bc->target_kbps)
+		bc->change_queue_usec = queue_usec;
+
+	bc->target_kbps    = target;
+	bc->last_change_ns = ts_ns;
+	return true;
+}
@@ -0,0 +1,66 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <util/c99defs.h>
+
+/*
+ *   Adaptive bitrate controller for stream outputs.  The available throughput
+ * is estimated from the bytes acknowledged by the peer, and the amount of
+ * data waiting to be sent is watched for congestion.  The target bitrate is
+ * lowered quickly when the send queue grows, and raised slowly while the
+ * queue stays drained.
+ */
+
+struct bitrate_controller {
+	uint32_t min_kbps;
+	uint32_t max_kbps;
+	uint32_t target_kbps;
+
+	/* queue duration at which the bitrate is lowered */
+	int64_t  queue_high_usec;
+	int64_t  queue_low_usec;
+
+	/* smoothed acknowledged throughput */
+	double   throughput_kbps;
+
+	uint64_t interval_start_ns;
+	uint64_t interval_start_acked;
+	uint64_t last_change_ns;
+	uint64_t queue_low_since_ns;
+	int64_t  change_queue_usec;
+	int64_t  queue_usec;
+};
+
+/* starts at max_kbps */
+extern void bitrate_controller_init(struct bitrate_controller *bc,
+		uint32_t min_kbps, uint32_t max_kbps, int64_t queue_high_usec);
+
+/* true once enough time has passed since the last sample for
+ * bitrate_controller_update to take a new one, so callers only gather the
+ * inputs when they are used */
+extern bool bitrate_controller_sample_due(const struct bitrate_controller *bc,
+		uint64_t ts_ns);
+
+/* acked_bytes is the total number of bytes acknowledged by the peer so far,
+ * queued_bytes the number of bytes written but not yet acknowledged, and
+ * queued_usec the duration of the packets not yet written.  Returns true if
+ * target_kbps has changed. */
+extern bool bitrate_controller_update(struct bitrate_controller *bc,
+		uint64_t ts_ns, uint64_t acked_bytes, uint64_t queued_bytes,
+		int64_t queued_usec);
@@ -34,7 +34,8 @@
 struct flv_output {
 	obs_output_t    *output;
 	struct dstr     path;
-	FILE            *file;
+	struct file_writer *file;
+	bool            write_failed;
 	volatile bool   active;
 	volatile bool   stopping;
 	uint64_t        stop_ts;
@@ -43,6 +44,10 @@ struct flv_output {
 
 	pthread_mutex_t mutex;
 
+	/* closes the file after the output stops */
+	pthread_t       close_thread;
+	bool            close_thread_active;
+
 	bool            got_first_video;
 	int32_t         start_dts_offset;
 };
@@ -65,10 +70,19 @@ static const char *flv_output_getname(void *unused)
 
 static void flv_output_stop(void *data, uint64_t ts);
 
+static void join_close_thread(struct flv_output *stream)
+{
+	if (stream->close_thread_active) {
+		pthread_join(stream->close_thread, NULL);
+		stream->close_thread_active = false;
+	}
+}
+
 static void flv_output_destroy(void *data)
 {
 	struct flv_output *stream = data;
 
+	join_close_thread(stream);
 	pthread_mutex_destroy(&stream->mutex);
 	dstr_free(&stream->path);
 	bfree(stream);
@@ -95,7 +109,13 @@ static int write_packet(struct flv_output *stream,
 
 	flv_packet_mux(packet, is_header ? 0 : stream->start_dts_offset,
 			&data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
+	if (!file_writer_write(stream->file, data, size)) {
+		if (!stream->write_failed)
+			warn("Failed to write to FLV file '%s'",
+					stream->path.array);
+		stream->write_failed = true;
+		ret = -1;
+	}
 	bfree(data);
 
 	return ret;
@@ -107,7 +127,7 @@ static void write_meta_data(struct flv_output *stream)
 	size_t  meta_data_size;
 
 	flv_meta_data(stream->output, &meta_data, &meta_data_size, true, 0);
-	fwrite(meta_data, 1, meta_data_size, stream->file);
+	file_writer_write(stream->file, meta_data, meta_data_size);
 	bfree(meta_data);
 }
 
@@ -151,9 +171,22 @@ static void write_headers(struct flv_output *stream)
 	write_audio_header(stream);
 }
 
+static void flv_output_congestion(void *data, bool congested)
+{
+	struct flv_output *stream = data;
+
+	if (congested)
+		warn("Disk is not keeping up with FLV file output");
+}
+
 static bool flv_output_start(void *data)
 {
 	struct flv_output *stream = data;
+	struct file_writer_params params = {
+		.sync             = FILE_WRITER_SYNC_CLOSE,
+		.congestion       = flv_output_congestion,
+		.congestion_param = stream
+	};
 	obs_data_t *settings;
 	const char *path;
 
@@ -162,8 +195,11 @@ static bool flv_output_start(void *data)
 	if (!obs_output_initialize_encoders(stream->output, 0))
 		return false;
 
+	join_close_thread(stream);
+
 	stream->got_first_video = false;
 	stream->sent_headers = false;
+	stream->write_failed = false;
 	os_atomic_set_bool(&stream->stopping, false);
 
 	/* get path */
@@ -172,7 +208,7 @@ static bool flv_output_start(void *data)
 	dstr_copy(&stream->path, path);
 	obs_data_release(settings);
 
-	stream->file = os_fopen(stream->path.array, "wb");
+	stream->file = file_writer_open(stream->path.array, &params);
 	if (!stream->file) {
 		warn("Unable to open FLV file '%s'", stream->path.array);
 		return false;
@@ -193,21 +229,52 @@ static void flv_output_stop(void *data, uint64_t ts)
 	os_atomic_set_bool(&stream->stopping, true);
 }
 
-static void flv_output_actual_stop(struct flv_output *stream)
+static void close_file(struct flv_output *stream)
 {
-	os_atomic_set_bool(&stream->active, false);
-
 	if (stream->file) {
+		struct file_writer_stats stats;
+
 		write_file_info(stream->file, stream->last_packet_ts,
-				os_ftelli64(stream->file));
+				file_writer_tell(stream->file));
 
-		fclose(stream->file);
+		file_writer_get_stats(stream->file, &stats);
+		if (stats.blocked_ns)
+			info("Waited %" PRIu64 " ms on the disk while writing",
+					stats.blocked_ns / 1000000);
+
+		if (!file_writer_close(stream->file))
+			warn("Failed to write FLV file '%s'",
+					stream->path.array);
+		stream->file = NULL;
 	}
 	obs_output_end_data_capture(stream->output);
 
 	info("FLV file output complete");
 }
 
+static void *close_thread(void *data)
+{
+	struct flv_output *stream = data;
+
+	os_set_thread_name("flv-output: close_thread");
+	close_file(stream);
+	return NULL;
+}
+
+/* closing the file waits for the disk to take every queued buffer, and
+ * syncs it, so it's done on its own thread instead of the encoder's.  the
+ * file isn't touched here again until the next start joins the thread. */
+static void flv_output_actual_stop(struct flv_output *stream)
+{
+	os_atomic_set_bool(&stream->active, false);
+
+	if (pthread_create(&stream->close_thread, NULL, close_thread,
+				stream) == 0)
+		stream->close_thread_active = true;
+	else
+		close_file(stream);
+}
+
 static void flv_output_data(void *data, struct encoder_packet *packet)
 {
 	struct flv_output     *stream = data;
@@ -0,0 +1,423 @@
+#ifdef __linux__
+#include "rtmp-stream.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+
+/* marks the end of each chunk of data queued by librtmp, so that the time
+ * it waited in the send ring can be measured */
+struct write_mark {
+	uint64_t end;
+	uint64_t ts;
+};
+
+/* how often the kernel queue is sampled and the statistics published */
+#define STATS_INTERVAL_NS 250000000ULL
+
+void socket_thread_linux_queue(struct rtmp_stream *stream, const char *data,
+		int len)
+{
+	struct write_mark mark;
+
+	stream->write_ring_queued += (uint64_t)len;
+	mark.end = stream->write_ring_queued;
+	mark.ts  = os_gettime_ns();
+
+	circlebuf_push_back(&stream->write_ring, data, (size_t)len);
+	circlebuf_push_back(&stream->write_marks, &mark, sizeof(mark));
+}
+
+void socket_thread_linux_wake(struct rtmp_stream *stream)
+{
+	uint64_t one = 1;
+	ssize_t ret = write(stream->socket_wake_fd, &one, sizeof(one));
+	UNUSED_PARAMETER(ret);
+}
+
+static void fatal_sock_shutdown(struct rtmp_stream *stream)
+{
+	pthread_mutex_lock(&stream->write_buf_mutex);
+	close(stream->rtmp.m_sb.sb_socket);
+	stream->rtmp.m_sb.sb_socket = -1;
+	stream->write_buf_len = 0;
+	circlebuf_pop_front(&stream->write_ring, NULL,
+			stream->write_ring.size);
+	circlebuf_pop_front(&stream->write_marks, NULL,
+			stream->write_marks.size);
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	os_event_signal(stream->buffer_space_available_event);
+}
+
+static bool discard_recv_data(struct rtmp_stream *stream)
+{
+	char discard[16384];
+
+	for (;;) {
+		ssize_t ret = recv(stream->rtmp.m_sb.sb_socket, discard,
+				sizeof(discard), 0);
+		if (ret > 0)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		blog(LOG_ERROR, "socket_thread_linux: Socket error, recv() "
+				"returned %d, errno %d", (int)ret,
+				ret < 0 ? errno : 0);
+		stream->rtmp.last_error_code = ret < 0 ? errno : 0;
+		return false;
+	}
+}
+
+static void set_writable_events(int epoll_fd, int sock, bool wait_writable)
+{
+	struct epoll_event ev = {0};
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	if (wait_writable)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = sock;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &ev);
+}
+
+/* returns how long to wait before writing, 0 to write now, or -1 when
+ * nothing is queued */
+static int batch_wait_ms(struct rtmp_stream *stream, bool flush)
+{
+	struct write_mark *first;
+	uint64_t age_ms;
+	int wait_ms = 0;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+
+	if (!stream->write_buf_len) {
+		wait_ms = -1;
+
+	} else if (!flush && stream->socket_batch_ms > 0 &&
+	           stream->write_buf_len < stream->write_buf_size / 2) {
+		first = circlebuf_data(&stream->write_marks, 0);
+		age_ms = (os_gettime_ns() - first->ts) / 1000000;
+
+		if (age_ms < (uint64_t)stream->socket_batch_ms)
+			wait_ms = stream->socket_batch_ms - (int)age_ms;
+	}
+
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+	return wait_ms;
+}
+
+/* write_buf_mutex must be locked */
+static void update_stats(struct rtmp_stream *stream,
+		struct socket_stats *stats, size_t sent)
+{
+	uint64_t ts = os_gettime_ns();
+
+	stats->sent += sent;
+	stats->writes++;
+
+	while (stream->write_marks.size) {
+		struct write_mark *mark = circlebuf_data(&stream->write_marks,
+				0);
+		uint64_t latency;
+
+		if (mark->end > stats->sent)
+			break;
+
+		latency = ts - mark->ts;
+		stats->total_latency_ns += latency;
+		if (latency > stats->max_latency_ns)
+			stats->max_latency_ns = latency;
+		stats->chunks++;
+
+		circlebuf_pop_front(&stream->write_marks, NULL, sizeof(*mark));
+	}
+}
+
+/* samples the data the kernel has not sent yet, and publishes the
+ * statistics.  called without write_buf_mutex, at most once per
+ * STATS_INTERVAL_NS unless forced. */
+static void sample_stats(struct rtmp_stream *stream,
+		struct socket_stats *stats, uint64_t *next_sample_ns,
+		bool force)
+{
+	uint64_t ts = os_gettime_ns();
+	int unsent = 0;
+
+	if (!force && ts < *next_sample_ns)
+		return;
+
+	*next_sample_ns = ts + STATS_INTERVAL_NS;
+
+	if (stream->rtmp.m_sb.sb_socket != -1 &&
+	    ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQNSD, &unsent) == 0) {
+		stats->unsent = unsent > 0 ? (size_t)unsent : 0;
+		if (stats->unsent > stats->max_unsent)
+			stats->max_unsent = stats->unsent;
+	}
+
+	pthread_mutex_lock(&stream->socket_stats_mutex);
+	stream->socket_stats = *stats;
+	pthread_mutex_unlock(&stream->socket_stats_mutex);
+}
+
+enum data_ret {
+	RET_FATAL,
+	RET_BLOCKED,
+	RET_CONTINUE
+};
+
+/* writes the queued data with a single call, both parts of the ring at
+ * once, up to max_size bytes */
+static enum data_ret write_data(struct rtmp_stream *stream,
+		struct socket_stats *stats, size_t max_size)
+{
+	struct circlebuf *ring = &stream->write_ring;
+	struct iovec iov[2];
+	struct msghdr msg = {0};
+	size_t size;
+	size_t first_size;
+	ssize_t ret;
+	int err_code;
+
+	pthread_mutex_lock(&stream->write_buf_mutex);
+
+	size = ring->size < max_size ? ring->size : max_size;
+	first_size = ring->capacity - ring->start_pos;
+	if (first_size > size)
+		first_size = size;
+
+	if (ring->size > stats->max_queued)
+		stats->max_queued = ring->size;
+
+	iov[0].iov_base = (uint8_t*)ring->data + ring->start_pos;
+	iov[0].iov_len  = first_size;
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len  = size - first_size;
+
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+	do {
+		ret = sendmsg(stream->rtmp.m_sb.sb_socket, &msg, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0) {
+		circlebuf_pop_front(ring, NULL, (size_t)ret);
+		stream->write_buf_len -= (size_t)ret;
+		update_stats(stream, stats, (size_t)ret);
+
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+		os_event_signal(stream->buffer_space_available_event);
+		return RET_CONTINUE;
+	}
+
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return RET_BLOCKED;
+
+	/* connection closed, or connection was aborted / socket closed /
+	 * etc, that's a fatal error. */
+	err_code = ret < 0 ? errno : 0;
+	blog(LOG_ERROR, "socket_thread_linux: Socket error, sendmsg() "
+			"returned %d, errno %d", (int)ret, err_code);
+
+	stream->rtmp.last_error_code = err_code;
+	fatal_sock_shutdown(stream);
+	return RET_FATAL;
+}
+
+static void set_notsent_lowat(struct rtmp_stream *stream)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	/* keeps only a fraction of the data in the kernel unsent, so the
+	 * rest stays in the send ring where it is counted as congestion */
+	int lowat = (int)(stream->write_buf_size / 4);
+	if (lowat < 16384)
+		lowat = 16384;
+
+	if (setsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP,
+				TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) != 0)
+		blog(LOG_WARNING, "socket_thread_linux: Failed to set "
+				"TCP_NOTSENT_LOWAT, errno %d", errno);
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+}
+
+#define LATENCY_FACTOR 20
+
+static inline void socket_thread_linux_internal(struct rtmp_stream *stream)
+{
+	struct socket_stats stats = {0};
+	uint64_t next_sample_ns = 0;
+	struct epoll_event ev = {0};
+	int sock = stream->rtmp.m_sb.sb_socket;
+	bool can_write = true;
+	int epoll_fd;
+
+	int delay_time;
+	size_t latency_packet_size;
+
+	if (stream->low_latency_mode) {
+		delay_time = 1000 / LATENCY_FACTOR;
+		latency_packet_size = stream->write_buf_size /
+			(LATENCY_FACTOR - 2);
+	} else {
+		latency_packet_size = stream->write_buf_size;
+		delay_time = 0;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+				"epoll_create1 failure, errno %d", errno);
+		fatal_sock_shutdown(stream);
+		return;
+	}
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = sock;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev);
+
+	ev.events = EPOLLIN;
+	ev.data.fd = stream->socket_wake_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stream->socket_wake_fd, &ev);
+
+	set_notsent_lowat(stream);
+	sample_stats(stream, &stats, &next_sample_ns, true);
+
+	if (stream->socket_batch_ms)
+		blog(LOG_INFO, "socket_thread_linux: Batching writes for up "
+				"to %d ms", stream->socket_batch_ms);
+
+	for (;;) {
+		struct epoll_event events[2];
+		bool exiting = os_event_try(stream->send_thread_signaled_exit)
+			!= EAGAIN;
+		int timeout = -1;
+		int count;
+
+		if (can_write) {
+			int wait_ms = batch_wait_ms(stream, exiting);
+
+			if (wait_ms == 0) {
+				switch (write_data(stream, &stats,
+						latency_packet_size)) {
+				case RET_FATAL:
+					goto fatal;
+				case RET_BLOCKED:
+					can_write = false;
+					set_writable_events(epoll_fd, sock,
+							true);
+					sample_stats(stream, &stats,
+							&next_sample_ns, false);
+					break;
+				case RET_CONTINUE:
+					sample_stats(stream, &stats,
+							&next_sample_ns, false);
+					if (delay_time)
+						os_sleep_ms(delay_time);
+					continue;
+				}
+
+			} else if (wait_ms < 0 && exiting) {
+				/* everything has been sent */
+				os_event_reset(stream->send_thread_signaled_exit);
+				break;
+
+			} else {
+				timeout = wait_ms;
+			}
+		}
+
+		count = epoll_wait(epoll_fd, events, 2, timeout);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			blog(LOG_ERROR, "socket_thread_linux: Aborting due to "
+					"epoll_wait failure, errno %d", errno);
+			fatal_sock_shutdown(stream);
+			goto fatal;
+		}
+
+		for (int i = 0; i < count; i++) {
+			uint32_t flags = events[i].events;
+
+			if (events[i].data.fd == stream->socket_wake_fd) {
+				uint64_t val;
+				ssize_t ret = read(stream->socket_wake_fd,
+						&val, sizeof(val));
+				UNUSED_PARAMETER(ret);
+				continue;
+			}
+
+			if (flags & EPOLLIN) {
+				if (!discard_recv_data(stream)) {
+					fatal_sock_shutdown(stream);
+					goto fatal;
+				}
+			}
+
+			if (flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+				int err_code = 0;
+				socklen_t size = sizeof(err_code);
+
+				getsockopt(sock, SOL_SOCKET, SO_ERROR,
+						&err_code, &size);
+
+				if (exiting)
+					blog(LOG_ERROR, "socket_thread_linux: "
+							"Aborting due to socket "
+							"close during shutdown, "
+							"%d bytes lost, error %d",
+							(int)stream->write_buf_len,
+							err_code);
+				else
+					blog(LOG_ERROR, "socket_thread_linux: "
+							"Aborting due to socket "
+							"close, error %d",
+							err_code);
+
+				stream->rtmp.last_error_code = err_code;
+				fatal_sock_shutdown(stream);
+				goto fatal;
+			}
+
+			if ((flags & EPOLLOUT) && !can_write) {
+				can_write = true;
+				set_writable_events(epoll_fd, sock, false);
+			}
+		}
+	}
+
+	blog(LOG_INFO, "socket_thread_linux: Normal exit");
+
+fatal:
+	close(epoll_fd);
+	sample_stats(stream, &stats, &next_sample_ns, true);
+
+	blog(LOG_INFO, "socket_thread_linux: %"PRIu64" bytes in %"PRIu64
+			" writes, send latency avg/max: %"PRIu64"/%"PRIu64
+			" ms, max queued: %zu bytes (ring), %zu bytes "
+			"(kernel, unsent)",
+			stats.sent, stats.writes,
+			stats.chunks ? stats.total_latency_ns /
+				stats.chunks / 1000000 : 0,
+			stats.max_latency_ns / 1000000,
+			stats.max_queued, stats.max_unsent);
+}
+
+void *socket_thread_linux(void *data)
+{
+	struct rtmp_stream *stream = data;
+
+	os_set_thread_name("rtmp-stream: socket_thread_linux");
+	socket_thread_linux_internal(stream);
+	return NULL;
+}
+#endif
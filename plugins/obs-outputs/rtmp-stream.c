@@ -112,17 +112,50 @@ static void rtmp_stream_destroy(void *data)
 	os_event_destroy(stream->socket_available_event);
 	os_event_destroy(stream->send_thread_signaled_exit);
 	pthread_mutex_destroy(&stream->write_buf_mutex);
+	pthread_mutex_destroy(&stream->socket_stats_mutex);
 
 	if (stream->write_buf)
 		bfree(stream->write_buf);
+#ifdef __linux__
+	if (stream->socket_wake_fd != -1)
+		close(stream->socket_wake_fd);
+	circlebuf_free(&stream->write_ring);
+	circlebuf_free(&stream->write_marks);
+#endif
 	bfree(stream);
 }
 
+static void get_socket_stats(void *data, calldata_t *cd)
+{
+	struct rtmp_stream *stream = data;
+	struct socket_stats stats;
+
+	pthread_mutex_lock(&stream->socket_stats_mutex);
+	stats = stream->socket_stats;
+	pthread_mutex_unlock(&stream->socket_stats_mutex);
+
+	calldata_set_int(cd, "bytes_sent", (long long)stats.sent);
+	calldata_set_int(cd, "writes", (long long)stats.writes);
+	calldata_set_int(cd, "avg_send_latency_ms", stats.chunks ?
+			(long long)(stats.total_latency_ns / stats.chunks /
+				1000000) : 0);
+	calldata_set_int(cd, "max_send_latency_ms",
+			(long long)(stats.max_latency_ns / 1000000));
+	calldata_set_int(cd, "max_queued_bytes", (long long)stats.max_queued);
+	calldata_set_int(cd, "unsent_bytes", (long long)stats.unsent);
+	calldata_set_int(cd, "max_unsent_bytes", (long long)stats.max_unsent);
+}
+
 static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+	pthread_mutex_init_value(&stream->socket_stats_mutex);
+#ifdef __linux__
+	stream->socket_wake_fd = -1;
+#endif
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
@@ -137,6 +170,8 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize write buffer mutex");
 		goto fail;
 	}
+	if (pthread_mutex_init(&stream->socket_stats_mutex, NULL) != 0)
+		goto fail;
 
 	if (os_event_init(&stream->buffer_space_available_event,
 		OS_EVENT_TYPE_AUTO) != 0) {
@@ -158,6 +193,20 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 		warn("Failed to initialize socket exit event");
 		goto fail;
 	}
+#ifdef __linux__
+	stream->socket_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stream->socket_wake_fd == -1) {
+		warn("Failed to initialize socket wake event");
+		goto fail;
+	}
+#endif
+
+	/* filled in by the socket thread, which only exists on linux */
+	proc_handler_add(ph, "void get_socket_stats(out int bytes_sent, "
+			"out int writes, out int avg_send_latency_ms, "
+			"out int max_send_latency_ms, out int max_queued_bytes, "
+			"out int unsent_bytes, out int max_unsent_bytes)",
+			get_socket_stats, stream);
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -293,6 +342,14 @@ static void droptest_cap_data_rate(struct rtmp_stream *stream, size_t size)
 }
 #endif
 
+static inline void signal_socket_thread(struct rtmp_stream *stream)
+{
+	os_event_signal(stream->buffer_has_data_event);
+#ifdef __linux__
+	socket_thread_linux_wake(stream);
+#endif
+}
+
 static int socket_queue_data(RTMPSockBuf *sb, const char *data, int len, void *arg)
 {
 	UNUSED_PARAMETER(sb);
@@ -317,12 +374,16 @@ retry_send:
 		goto retry_send;
 	}
 
+#ifdef __linux__
+	socket_thread_linux_queue(stream, data, len);
+#else
 	memcpy(stream->write_buf + stream->write_buf_len, data, len);
+#endif
 	stream->write_buf_len += len;
 
 	pthread_mutex_unlock(&stream->write_buf_mutex);
 
-	os_event_signal (stream->buffer_has_data_event);
+	signal_socket_thread(stream);
 
 	return len;
 }
@@ -370,6 +431,162 @@ static int send_packet(struct rtmp_stream *stream,
 
 static inline bool send_headers(struct rtmp_stream *stream);
 
+static size_t get_socket_queued_bytes(struct rtmp_stream *stream)
+{
+	int queued = 0;
+
+#if defined(__linux__)
+	if (ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQ, &queued) != 0)
+		queued = 0;
+#elif defined(__APPLE__)
+	socklen_t size = sizeof(queued);
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, SOL_SOCKET, SO_NWRITE,
+				&queued, &size) != 0)
+		queued = 0;
+#else
+	/* adaptive bitrate is never enabled here, see ABR_SUPPORTED */
+	UNUSED_PARAMETER(stream);
+#endif
+
+	return queued > 0 ? (size_t)queued : 0;
+}
+
+static int64_t get_queued_usec(struct rtmp_stream *stream)
+{
+	int64_t queued = 0;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	if (stream->packets.size) {
+		struct encoder_packet *first = circlebuf_data(&stream->packets,
+				0);
+		queued = stream->last_dts_usec - first->dts_usec;
+	}
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return queued > 0 ? queued : 0;
+}
+
+static void set_video_bitrate(struct rtmp_stream *stream, uint32_t kbps)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t *settings = obs_data_create();
+
+	obs_data_set_int(settings, "bitrate", kbps);
+	obs_encoder_update(vencoder, settings);
+	obs_data_release(settings);
+}
+
+struct shared_encoder_info {
+	obs_output_t  *output;
+	obs_encoder_t *encoder;
+	bool          shared;
+};
+
+static bool find_shared_encoder(void *param, obs_output_t *output)
+{
+	struct shared_encoder_info *info = param;
+
+	if (output != info->output && obs_output_active(output) &&
+	    obs_output_get_video_encoder(output) == info->encoder) {
+		info->shared = true;
+		return false;
+	}
+
+	return true;
+}
+
+/* changing the bitrate of the encoder would also change it for any other
+ * active output that uses the same encoder, such as a recording */
+static bool video_encoder_shared(struct rtmp_stream *stream)
+{
+	struct shared_encoder_info info = {
+		.output  = stream->output,
+		.encoder = obs_output_get_video_encoder(stream->output)
+	};
+
+	obs_enum_outputs(find_shared_encoder, &info);
+	return info.shared;
+}
+
+static void update_bitrate(struct rtmp_stream *stream)
+{
+	uint64_t ts = os_gettime_ns();
+	uint32_t last_kbps = stream->abr.target_kbps;
+	uint64_t queued_bytes;
+	uint64_t acked_bytes;
+
+	/* only sample the socket and the queues once per interval */
+	if (!bitrate_controller_sample_due(&stream->abr, ts))
+		return;
+
+	queued_bytes = get_socket_queued_bytes(stream);
+
+	if (stream->new_socket_loop) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		queued_bytes += stream->write_buf_len;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+	}
+
+	acked_bytes = stream->total_bytes_sent > queued_bytes ?
+		stream->total_bytes_sent - queued_bytes : 0;
+
+	if (!bitrate_controller_update(&stream->abr, ts,
+				acked_bytes, queued_bytes,
+				get_queued_usec(stream)))
+		return;
+
+	if (video_encoder_shared(stream)) {
+		warn("Video encoder is now used by another output, adaptive "
+		     "bitrate disabled");
+		if (last_kbps != stream->abr_orig_kbps)
+			set_video_bitrate(stream, stream->abr_orig_kbps);
+		stream->abr_enabled = false;
+		return;
+	}
+
+	info("Adaptive bitrate: changing video bitrate to %u kbps "
+	     "(throughput: %.0f kbps, queued: %" PRId64 " ms)",
+	     stream->abr.target_kbps, stream->abr.throughput_kbps,
+	     stream->abr.queue_usec / 1000);
+
+	set_video_bitrate(stream, stream->abr.target_kbps);
+}
+
+static void init_bitrate_controller(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	obs_data_t *settings;
+	int bitrate;
+
+	if (!stream->abr_enabled || !vencoder)
+		return;
+
+	if (video_encoder_shared(stream)) {
+		warn("Video encoder is shared with another output, adaptive "
+		     "bitrate disabled");
+		stream->abr_enabled = false;
+		return;
+	}
+
+	settings = obs_encoder_get_settings(vencoder);
+	bitrate = (int)obs_data_get_int(settings, "bitrate");
+	obs_data_release(settings);
+
+	if (bitrate <= 0) {
+		warn("Video encoder has no bitrate setting, adaptive "
+		     "bitrate disabled");
+		stream->abr_enabled = false;
+		return;
+	}
+
+	stream->abr_orig_kbps = (uint32_t)bitrate;
+	bitrate_controller_init(&stream->abr, stream->abr_min_kbps,
+			stream->abr_orig_kbps, stream->drop_threshold_usec / 2);
+
+	info("Adaptive bitrate enabled (%u - %u kbps)",
+			stream->abr.min_kbps, stream->abr.max_kbps);
+}
+
 static inline bool can_shutdown_stream(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
@@ -484,6 +701,9 @@ static void *send_thread(void *data)
 			os_atomic_set_bool(&stream->disconnected, true);
 			break;
 		}
+
+		if (stream->abr_enabled)
+			update_bitrate(stream);
 	}
 
 	if (disconnected(stream)) {
@@ -494,12 +714,17 @@ static void *send_thread(void *data)
 
 	if (stream->new_socket_loop) {
 		os_event_signal(stream->send_thread_signaled_exit);
-		os_event_signal(stream->buffer_has_data_event);
+		signal_socket_thread(stream);
 		pthread_join(stream->socket_thread, NULL);
 		stream->socket_thread_active = false;
 		stream->rtmp.m_bCustomSend = false;
 	}
 
+	/* the encoder settings are kept for the next stream */
+	if (stream->abr_enabled &&
+	    stream->abr.target_kbps != stream->abr_orig_kbps)
+		set_video_bitrate(stream, stream->abr_orig_kbps);
+
 	set_output_error(stream);
 	RTMP_Close(&stream->rtmp);
 
@@ -632,6 +857,17 @@ static int init_send(struct rtmp_stream *stream)
 #endif
 
 	reset_semaphore(stream);
+	init_bitrate_controller(stream);
+
+#ifdef __linux__
+	/* the linux socket thread writes to the socket directly, which
+	 * cannot be done for an encrypted connection */
+	if (stream->new_socket_loop && stream->rtmp.m_sb.sb_ssl) {
+		info("New socket loop is not supported with RTMPS on this "
+		     "platform, using the default socket loop");
+		stream->new_socket_loop = false;
+	}
+#endif
 
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
 	if (ret != 0) {
@@ -702,11 +938,25 @@ static int init_send(struct rtmp_stream *stream)
 			ideal_buffer_size = 131072;
 
 		stream->write_buf_size = ideal_buffer_size;
+
+#ifdef __linux__
+		/* the ring is never grown past write_buf_size */
+		circlebuf_free(&stream->write_ring);
+		circlebuf_free(&stream->write_marks);
+		circlebuf_reserve(&stream->write_ring, ideal_buffer_size);
+		stream->write_buf = NULL;
+		stream->write_buf_len = 0;
+		stream->write_ring_queued = 0;
+#else
 		stream->write_buf = bmalloc(ideal_buffer_size);
+#endif
 
 #ifdef _WIN32
 		ret = pthread_create(&stream->socket_thread, NULL,
 				socket_thread_windows, stream);
+#elif defined(__linux__)
+		ret = pthread_create(&stream->socket_thread, NULL,
+				socket_thread_linux, stream);
 #else
 		warn("New socket loop not supported on this platform");
 		return OBS_OUTPUT_ERROR;
@@ -915,6 +1165,15 @@ static bool init_connect(struct rtmp_stream *stream)
 			OPT_NEWSOCKETLOOP_ENABLED);
 	stream->low_latency_mode = obs_data_get_bool(settings,
 			OPT_LOWLATENCY_ENABLED);
+	stream->socket_batch_ms = (int)obs_data_get_int(settings,
+			OPT_SOCKET_BATCH_MS);
+#ifdef ABR_SUPPORTED
+	stream->abr_enabled = obs_data_get_bool(settings, OPT_ABR_ENABLED);
+#else
+	stream->abr_enabled = false;
+#endif
+	stream->abr_min_kbps = (uint32_t)obs_data_get_int(settings,
+			OPT_ABR_MIN_BITRATE);
 
 	obs_data_release(settings);
 	return true;
@@ -1138,6 +1397,9 @@ static void rtmp_stream_defaults(obs_data_t *defaults)
 	obs_data_set_default_string(defaults, OPT_BIND_IP, "default");
 	obs_data_set_default_bool(defaults, OPT_NEWSOCKETLOOP_ENABLED, false);
 	obs_data_set_default_bool(defaults, OPT_LOWLATENCY_ENABLED, false);
+	obs_data_set_default_int(defaults, OPT_SOCKET_BATCH_MS, 0);
+	obs_data_set_default_bool(defaults, OPT_ABR_ENABLED, false);
+	obs_data_set_default_int(defaults, OPT_ABR_MIN_BITRATE, 500);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -1169,6 +1431,18 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 			obs_module_text("RTMPStream.NewSocketLoop"));
 	obs_properties_add_bool(props, OPT_LOWLATENCY_ENABLED,
 			obs_module_text("RTMPStream.LowLatencyMode"));
+#ifdef __linux__
+	obs_properties_add_int(props, OPT_SOCKET_BATCH_MS,
+			obs_module_text("RTMPStream.SocketBatch"),
+			0, 100, 1);
+#endif
+#ifdef ABR_SUPPORTED
+	obs_properties_add_bool(props, OPT_ABR_ENABLED,
+			obs_module_text("RTMPStream.AdaptiveBitrate"));
+	obs_properties_add_int(props, OPT_ABR_MIN_BITRATE,
+			obs_module_text("RTMPStream.AdaptiveBitrateMin"),
+			100, 100000, 50);
+#endif
 
 	return props;
 }
@@ -9,6 +9,7 @@
 #include "librtmp/log.h"
 #include "flv-mux.h"
 #include "net-if.h"
+#include "bitrate-controller.h"
 
 #ifdef _WIN32
 #include <Iphlpapi.h>
@@ -16,6 +17,12 @@
 #include <sys/ioctl.h>
 #endif
 
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #define do_log(level, format, ...) \
 	blog(level, "[rtmp stream: '%s'] " format, \
 			obs_output_get_name(stream->output), ##__VA_ARGS__)
@@ -30,6 +37,15 @@
 #define OPT_BIND_IP "bind_ip"
 #define OPT_NEWSOCKETLOOP_ENABLED "new_socket_loop_enabled"
 #define OPT_LOWLATENCY_ENABLED "low_latency_mode_enabled"
+#define OPT_SOCKET_BATCH_MS "socket_batch_ms"
+#define OPT_ABR_ENABLED "adaptive_bitrate_enabled"
+#define OPT_ABR_MIN_BITRATE "adaptive_bitrate_min_kbps"
+
+/* adaptive bitrate needs to know how much data is still queued in the
+ * socket, which Windows only exposes to administrators */
+#if defined(__linux__) || defined(__APPLE__)
+#define ABR_SUPPORTED
+#endif
 
 //#define TEST_FRAMEDROPS
 
@@ -44,6 +60,18 @@ struct droptest_info {
 };
 #endif
 
+/* send statistics of the socket thread */
+struct socket_stats {
+	uint64_t sent;
+	uint64_t writes;
+	uint64_t chunks;
+	uint64_t total_latency_ns;
+	uint64_t max_latency_ns;
+	size_t   max_queued;
+	size_t   max_unsent;
+	size_t   unsent;
+};
+
 struct rtmp_stream {
 	obs_output_t     *output;
 
@@ -84,6 +112,13 @@ struct rtmp_stream {
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
 
+	/* adaptive bitrate, lowers the video bitrate before frames have to
+	 * be dropped */
+	bool             abr_enabled;
+	uint32_t         abr_min_kbps;
+	uint32_t         abr_orig_kbps;
+	struct bitrate_controller abr;
+
 #ifdef TEST_FRAMEDROPS
 	struct circlebuf droptest_info;
 	size_t           droptest_size;
@@ -104,8 +139,28 @@ struct rtmp_stream {
 	os_event_t       *buffer_has_data_event;
 	os_event_t       *socket_available_event;
 	os_event_t       *send_thread_signaled_exit;
+	int              socket_batch_ms;
+
+	/* copy of the socket thread's statistics, updated periodically for
+	 * the get_socket_stats procedure */
+	pthread_mutex_t  socket_stats_mutex;
+	struct socket_stats socket_stats;
+
+#ifdef __linux__
+	/* the linux socket thread sends from a ring instead of write_buf,
+	 * and is woken through an eventfd so that it can wait with epoll */
+	int              socket_wake_fd;
+	struct circlebuf write_ring;
+	struct circlebuf write_marks;
+	uint64_t         write_ring_queued;
+#endif
 };
 
 #ifdef _WIN32
 void *socket_thread_windows(void *data);
+#elif defined(__linux__)
+void *socket_thread_linux(void *data);
+void socket_thread_linux_queue(struct rtmp_stream *stream, const char *data,
+		int len);
+void socket_thread_linux_wake(struct rtmp_stream *stream);
 #endif
@@ -780,6 +780,8 @@ inline void TextSource::Tick(float seconds)
 			LoadFileText();
 			RenderText();
 			update_file = false;
+
+			obs_source_video_changed(source);
 		}
 
 		if (file_timestamp != t) {
@@ -969,7 +971,7 @@ bool obs_module_load(void)
 	obs_source_info si = {};
 	si.id = "text_gdiplus";
 	si.type = OBS_SOURCE_TYPE_INPUT;
-	si.output_flags = OBS_SOURCE_VIDEO;
+	si.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_STATIC_VIDEO;
 	si.get_properties = get_properties;
 
 	si.get_name = [] (void*)
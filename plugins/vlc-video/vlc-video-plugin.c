@@ -7,6 +7,7 @@
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE("vlc-video", "en-US")
+OBS_MODULE_ALLOW_DEFERRED_LOAD()
 MODULE_EXPORT const char *obs_module_description(void)
 {
 	return "VLC playlist source";
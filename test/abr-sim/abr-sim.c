@@ -0,0 +1,374 @@
+/*
+ *   Streams fake video over a loopback TCP connection to a sink that reads at
+ * a throttled rate, with the bitrate driven by the stream output's adaptive
+ * bitrate controller, and prints how the bitrate follows the link.
+ *
+ *   The link rate changes to each of the given rates in turn, every
+ * <seconds> seconds.  Frames that wait longer than the drop threshold are
+ * dropped, the same way the RTMP output drops them.
+ *
+ *   usage: abr-sim [-d seconds] [-m min kbps] [-M max kbps] [kbps...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
+#include <util/bmem.h>
+
+#include "bitrate-controller.h"
+
+#define FPS                30
+#define DROP_THRESHOLD_USEC 700000
+#define SINK_TICK_MS       5
+
+struct frame {
+	int64_t  dts_usec;
+	size_t   size;
+};
+
+struct sim {
+	DARRAY(uint32_t)   link_kbps;
+	uint64_t           phase_ns;
+	uint64_t           start_ns;
+
+	int                listen_sock;
+	int                send_sock;
+	int                sink_sock;
+
+	pthread_mutex_t    mutex;
+	os_sem_t           *send_sem;
+	struct circlebuf   frames;
+	int64_t            last_dts_usec;
+	uint32_t           target_kbps;
+	int                dropped;
+
+	volatile bool      stop;
+
+	struct bitrate_controller abr;
+	uint64_t           bytes_sent;
+	int64_t            max_queue_usec;
+};
+
+static uint32_t cur_link_kbps(struct sim *sim, uint64_t ts)
+{
+	size_t phase = (size_t)((ts - sim->start_ns) / sim->phase_ns);
+	if (phase >= sim->link_kbps.num)
+		phase = sim->link_kbps.num - 1;
+	return sim->link_kbps.array[phase];
+}
+
+/* reads from the socket no faster than the current link rate */
+static void *sink_thread(void *data)
+{
+	struct sim *sim = data;
+	uint8_t buf[65536];
+	double tokens = 0.0;
+	uint64_t last_ts = os_gettime_ns();
+
+	while (!os_atomic_load_bool(&sim->stop)) {
+		uint64_t ts = os_gettime_ns();
+		double kbps = (double)cur_link_kbps(sim, ts);
+		ssize_t ret;
+		size_t size;
+
+		tokens += kbps * 125.0 * (double)(ts - last_ts) / 1000000000.0;
+		if (tokens > sizeof(buf))
+			tokens = sizeof(buf);
+		last_ts = ts;
+
+		size = (size_t)tokens;
+		if (size) {
+			ret = recv(sim->sink_sock, buf, size, MSG_DONTWAIT);
+			if (ret > 0)
+				tokens -= (double)ret;
+			else if (ret == 0)
+				break;
+		}
+
+		os_sleep_ms(SINK_TICK_MS);
+	}
+
+	return NULL;
+}
+
+static size_t socket_queued_bytes(int sock)
+{
+	int queued = 0;
+#ifdef __linux__
+	if (ioctl(sock, SIOCOUTQ, &queued) != 0)
+		queued = 0;
+#elif defined(__APPLE__)
+	socklen_t size = sizeof(queued);
+	if (getsockopt(sock, SOL_SOCKET, SO_NWRITE, &queued, &size) != 0)
+		queued = 0;
+#endif
+	return queued > 0 ? (size_t)queued : 0;
+}
+
+static int64_t queued_usec(struct sim *sim)
+{
+	int64_t queued = 0;
+
+	pthread_mutex_lock(&sim->mutex);
+	if (sim->frames.size) {
+		struct frame *first = circlebuf_data(&sim->frames, 0);
+		queued = sim->last_dts_usec - first->dts_usec;
+	}
+	pthread_mutex_unlock(&sim->mutex);
+
+	return queued;
+}
+
+/* writes queued frames to the socket, like the RTMP send thread */
+static void *send_thread(void *data)
+{
+	struct sim *sim = data;
+	uint8_t *buf = bzalloc(1024 * 1024);
+
+	while (os_sem_wait(sim->send_sem) == 0) {
+		struct frame frame;
+		size_t queued;
+		uint64_t ts;
+
+		if (os_atomic_load_bool(&sim->stop))
+			break;
+
+		pthread_mutex_lock(&sim->mutex);
+		if (!sim->frames.size) {
+			pthread_mutex_unlock(&sim->mutex);
+			continue;
+		}
+		circlebuf_pop_front(&sim->frames, &frame, sizeof(frame));
+		pthread_mutex_unlock(&sim->mutex);
+
+		for (size_t sent = 0; sent < frame.size;) {
+			ssize_t ret = send(sim->send_sock, buf + sent,
+					frame.size - sent, 0);
+			if (ret <= 0)
+				goto done;
+			sent += (size_t)ret;
+		}
+
+		sim->bytes_sent += frame.size;
+
+		/* sampled once per interval, the same way the RTMP output
+		 * does it */
+		ts = os_gettime_ns();
+		if (!bitrate_controller_sample_due(&sim->abr, ts))
+			continue;
+
+		queued = socket_queued_bytes(sim->send_sock);
+
+		if (bitrate_controller_update(&sim->abr, ts,
+					sim->bytes_sent - queued, queued,
+					queued_usec(sim))) {
+			pthread_mutex_lock(&sim->mutex);
+			sim->target_kbps = sim->abr.target_kbps;
+			pthread_mutex_unlock(&sim->mutex);
+		}
+
+		if (sim->abr.queue_usec > sim->max_queue_usec)
+			sim->max_queue_usec = sim->abr.queue_usec;
+	}
+
+done:
+	bfree(buf);
+	return NULL;
+}
+
+static void drop_frames(struct sim *sim)
+{
+	while (sim->frames.size) {
+		struct frame *first = circlebuf_data(&sim->frames, 0);
+		if (sim->last_dts_usec - first->dts_usec <= DROP_THRESHOLD_USEC)
+			break;
+
+		circlebuf_pop_front(&sim->frames, NULL, sizeof(*first));
+		sim->dropped++;
+	}
+}
+
+static bool open_sockets(struct sim *sim)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	int rcvbuf = 65536;
+	int one = 1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sim->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sim->listen_sock < 0)
+		return false;
+	if (bind(sim->listen_sock, (struct sockaddr*)&addr, len) != 0)
+		return false;
+	if (listen(sim->listen_sock, 1) != 0)
+		return false;
+	if (getsockname(sim->listen_sock, (struct sockaddr*)&addr, &len) != 0)
+		return false;
+
+	sim->send_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sim->send_sock < 0)
+		return false;
+	setsockopt(sim->send_sock, IPPROTO_TCP, TCP_NODELAY, &one,
+			sizeof(one));
+	if (connect(sim->send_sock, (struct sockaddr*)&addr, len) != 0)
+		return false;
+
+	sim->sink_sock = accept(sim->listen_sock, NULL, NULL);
+	if (sim->sink_sock < 0)
+		return false;
+
+	/* keep the receive window small so that the throttled sink pushes
+	 * back on the sender quickly */
+	setsockopt(sim->sink_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+			sizeof(rcvbuf));
+	return true;
+}
+
+static void usage(void)
+{
+	puts("usage: abr-sim [-d seconds] [-m min kbps] [-M max kbps] "
+	     "[kbps...]");
+	puts("  -d  seconds for each link rate (default: 20)");
+	puts("  -m  lowest bitrate (default: 500)");
+	puts("  -M  highest bitrate (default: 6000)");
+	puts("  link rates default to 8000 3000 1200 5000");
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t default_rates[] = {8000, 3000, 1200, 5000};
+	struct sim sim = {0};
+	pthread_t send_thread_id, sink_thread_id;
+	uint32_t min_kbps = 500, max_kbps = 6000;
+	uint64_t seconds = 20;
+	uint64_t frame_ns = 1000000000ULL / FPS;
+	uint64_t next_ts, next_print, end_ts;
+	uint64_t frame_idx = 0;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		if (strcmp(argv[i], "-d") == 0)
+			seconds = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-m") == 0)
+			min_kbps = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-M") == 0)
+			max_kbps = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	for (; i < argc; i++) {
+		uint32_t kbps = (uint32_t)strtoul(argv[i], NULL, 10);
+		da_push_back(sim.link_kbps, &kbps);
+	}
+	if (!sim.link_kbps.num) {
+		for (size_t j = 0; j < sizeof(default_rates) /
+				sizeof(default_rates[0]); j++)
+			da_push_back(sim.link_kbps, &default_rates[j]);
+	}
+
+	if (!seconds || !max_kbps) {
+		usage();
+		return 1;
+	}
+
+	if (!open_sockets(&sim)) {
+		fprintf(stderr, "Failed to open loopback sockets: %s\n",
+				strerror(errno));
+		return 1;
+	}
+
+	pthread_mutex_init(&sim.mutex, NULL);
+	os_sem_init(&sim.send_sem, 0);
+
+	bitrate_controller_init(&sim.abr, min_kbps, max_kbps,
+			DROP_THRESHOLD_USEC / 2);
+	sim.target_kbps = sim.abr.target_kbps;
+	sim.phase_ns = seconds * 1000000000ULL;
+	sim.start_ns = os_gettime_ns();
+
+	pthread_create(&sink_thread_id, NULL, sink_thread, &sim);
+	pthread_create(&send_thread_id, NULL, send_thread, &sim);
+
+	puts("  time   link kbps   bitrate   throughput   queue ms   dropped");
+
+	next_ts    = sim.start_ns;
+	next_print = sim.start_ns;
+	end_ts     = sim.start_ns + sim.phase_ns * sim.link_kbps.num;
+
+	while (next_ts < end_ts) {
+		struct frame frame;
+		uint32_t kbps;
+
+		os_sleepto_ns(next_ts);
+
+		pthread_mutex_lock(&sim.mutex);
+		kbps = sim.target_kbps;
+		frame.dts_usec = (int64_t)(frame_idx * frame_ns / 1000);
+		frame.size = (size_t)kbps * 125 / FPS;
+		sim.last_dts_usec = frame.dts_usec;
+		circlebuf_push_back(&sim.frames, &frame, sizeof(frame));
+		drop_frames(&sim);
+		pthread_mutex_unlock(&sim.mutex);
+
+		os_sem_post(sim.send_sem);
+
+		if (next_ts >= next_print) {
+			printf("%6.1f   %9u   %7u   %10.0f   %8lld   %7d\n",
+					(double)(next_ts - sim.start_ns) /
+					1000000000.0,
+					cur_link_kbps(&sim, next_ts), kbps,
+					sim.abr.throughput_kbps,
+					(long long)(sim.abr.queue_usec / 1000),
+					sim.dropped);
+			next_print += 1000000000ULL;
+		}
+
+		next_ts += frame_ns;
+		frame_idx++;
+	}
+
+	os_atomic_set_bool(&sim.stop, true);
+	os_sem_post(sim.send_sem);
+	shutdown(sim.send_sock, SHUT_RDWR);
+	shutdown(sim.sink_sock, SHUT_RDWR);
+	pthread_join(send_thread_id, NULL);
+	pthread_join(sink_thread_id, NULL);
+
+	printf("frames dropped: %d, highest queue: %lld ms\n", sim.dropped,
+			(long long)(sim.max_queue_usec / 1000));
+
+	close(sim.send_sock);
+	close(sim.sink_sock);
+	close(sim.listen_sock);
+	circlebuf_free(&sim.frames);
+	da_free(sim.link_kbps);
+	os_sem_destroy(sim.send_sem);
+	pthread_mutex_destroy(&sim.mutex);
+	return 0;
+}
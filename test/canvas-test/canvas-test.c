@@ -0,0 +1,241 @@
+/*
+ *   Renders a horizontal 1920x1080 main video and a vertical 1080x1920
+ * canvas from the same libobs instance, each showing a different source,
+ * and checks that the frames of both video outputs arrive at their own
+ * frame rate, at their own size, and with the color of their own source.
+ * Also checks that a canvas whose output size aligns down to nothing is
+ * rejected.
+ *
+ *   Runs on any OpenGL driver, for example Mesa's llvmpipe under Xvfb
+ * (LIBGL_ALWAYS_SOFTWARE=1).
+ *
+ *   usage: canvas-test [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+#include <obs.h>
+
+#define MAIN_COLOR   0xFF0000FF /* red */
+#define CANVAS_COLOR 0xFFFF0000 /* blue */
+
+struct color_source {
+	uint32_t color;
+};
+
+struct frame_stats {
+	const char *name;
+	uint32_t   width;
+	uint32_t   height;
+	uint32_t   color;
+	long       frames;
+	long       wrong_color;
+	uint64_t   first_ts;
+	uint64_t   last_ts;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static const char *color_source_get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Canvas test color";
+}
+
+static void *color_source_create(obs_data_t *settings, obs_source_t *source)
+{
+	struct color_source *context = bzalloc(sizeof(*context));
+	context->color = (uint32_t)obs_data_get_int(settings, "color");
+	UNUSED_PARAMETER(source);
+	return context;
+}
+
+static void color_source_destroy(void *data)
+{
+	bfree(data);
+}
+
+static uint32_t color_source_get_size(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return 1920;
+}
+
+static void color_source_render(void *data, gs_effect_t *effect)
+{
+	struct color_source *context = data;
+	gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+	gs_eparam_t *color = gs_effect_get_param_by_name(solid, "color");
+	struct vec4 color_val;
+
+	vec4_from_rgba(&color_val, context->color);
+	gs_effect_set_vec4(color, &color_val);
+
+	while (gs_effect_loop(solid, "Solid"))
+		gs_draw_sprite(NULL, 0, 1920, 1920);
+
+	UNUSED_PARAMETER(effect);
+}
+
+static struct obs_source_info color_source_info = {
+	.id           = "canvas_test_color",
+	.type         = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW,
+	.get_name     = color_source_get_name,
+	.create       = color_source_create,
+	.destroy      = color_source_destroy,
+	.get_width    = color_source_get_size,
+	.get_height   = color_source_get_size,
+	.video_render = color_source_render,
+};
+
+static obs_source_t *create_color_source(const char *name, uint32_t color)
+{
+	obs_data_t *settings = obs_data_create();
+	obs_source_t *source;
+
+	obs_data_set_int(settings, "color", color);
+	source = obs_source_create("canvas_test_color", name, settings, NULL);
+	obs_data_release(settings);
+	return source;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void receive_frame(void *param, struct video_data *frame)
+{
+	struct frame_stats *stats = param;
+	uint32_t x = stats->width / 2;
+	uint32_t y = stats->height / 2;
+	uint8_t *pixel = frame->data[0] + y * frame->linesize[0] + x * 4;
+	uint32_t color = (uint32_t)pixel[0] | (uint32_t)pixel[1] << 8 |
+		(uint32_t)pixel[2] << 16 | (uint32_t)pixel[3] << 24;
+
+	if (!stats->frames)
+		stats->first_ts = frame->timestamp;
+	stats->last_ts = frame->timestamp;
+	stats->frames++;
+
+	if (color != stats->color)
+		stats->wrong_color++;
+}
+
+static bool check_stats(const struct frame_stats *stats, uint32_t fps,
+		int seconds)
+{
+	long expected = (long)fps * seconds;
+	double ms = stats->frames > 1 ?
+		(double)(stats->last_ts - stats->first_ts) / 1000000.0 /
+		(double)(stats->frames - 1) : 0.0;
+
+	printf("%-6s %ux%u: %ld frames, %.2f ms apart, %ld with the wrong "
+	       "color\n", stats->name, stats->width, stats->height,
+	       stats->frames, ms, stats->wrong_color);
+
+	/* allow for frames lost to startup and to slow software rendering */
+	if (stats->frames < expected / 2) {
+		printf("%s: expected about %ld frames\n", stats->name,
+				expected);
+		return false;
+	}
+	if (stats->wrong_color) {
+		printf("%s: frames show the wrong source\n", stats->name);
+		return false;
+	}
+
+	return true;
+}
+
+static void set_video_info(struct obs_video_info *ovi, uint32_t fps,
+		uint32_t cx, uint32_t cy)
+{
+	ovi->graphics_module = DL_OPENGL;
+	ovi->fps_num         = fps;
+	ovi->fps_den         = 1;
+	ovi->base_width      = cx;
+	ovi->base_height     = cy;
+	ovi->output_width    = cx;
+	ovi->output_height   = cy;
+	ovi->output_format   = VIDEO_FORMAT_RGBA;
+	ovi->colorspace      = VIDEO_CS_709;
+	ovi->range           = VIDEO_RANGE_PARTIAL;
+	ovi->scale_type      = OBS_SCALE_BILINEAR;
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	struct frame_stats main_stats = {"main", 1920, 1080, MAIN_COLOR};
+	struct frame_stats canvas_stats = {"canvas", 1080, 1920, CANVAS_COLOR};
+	struct obs_video_info ovi = {0};
+	struct obs_video_info canvas_ovi = {0};
+	obs_source_t *main_source = NULL;
+	obs_source_t *canvas_source = NULL;
+	obs_canvas_t *canvas = NULL;
+	bool success = false;
+
+	if (seconds <= 0) {
+		puts("usage: canvas-test [seconds]");
+		return 1;
+	}
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		puts("Failed to start libobs");
+		return 1;
+	}
+
+	set_video_info(&ovi, 30, 1920, 1080);
+	if (obs_reset_video(&ovi) != OBS_VIDEO_SUCCESS) {
+		puts("Failed to initialize video");
+		goto finish;
+	}
+
+	/* an output width of 3 aligns down to 0 */
+	set_video_info(&canvas_ovi, 15, 3, 1920);
+	canvas = obs_canvas_create(&canvas_ovi);
+	if (canvas) {
+		puts("A canvas was created with an output width of 0");
+		goto finish;
+	}
+
+	set_video_info(&canvas_ovi, 15, 1080, 1920);
+	canvas = obs_canvas_create(&canvas_ovi);
+	if (!canvas) {
+		puts("Failed to create a canvas");
+		goto finish;
+	}
+
+	obs_register_source(&color_source_info);
+	main_source = create_color_source("main", MAIN_COLOR);
+	canvas_source = create_color_source("canvas", CANVAS_COLOR);
+
+	obs_set_output_source(0, main_source);
+	obs_canvas_set_source(canvas, 0, canvas_source);
+
+	video_output_connect(obs_get_video(), NULL, receive_frame,
+			&main_stats);
+	video_output_connect(obs_canvas_get_video(canvas), NULL,
+			receive_frame, &canvas_stats);
+
+	os_sleep_ms((uint32_t)seconds * 1000);
+
+	video_output_disconnect(obs_get_video(), receive_frame, &main_stats);
+	video_output_disconnect(obs_canvas_get_video(canvas), receive_frame,
+			&canvas_stats);
+
+	success = check_stats(&main_stats, ovi.fps_num, seconds);
+	success = check_stats(&canvas_stats, canvas_ovi.fps_num, seconds) &&
+		success;
+
+	obs_set_output_source(0, NULL);
+	obs_canvas_set_source(canvas, 0, NULL);
+
+finish:
+	obs_source_release(main_source);
+	obs_source_release(canvas_source);
+	obs_canvas_destroy(canvas);
+	obs_shutdown();
+	return success ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+/*
+ *   Checks that the scalar, SSE2 and AVX2 conversions of a UYVX frame to
+ * I420, NV12 and I444 produce the same bytes, for odd as well as even widths
+ * and heights, without writing past the planes of video_frame_init.  Then
+ * measures each conversion at 1080p, 1440p and 4K, both on a single thread
+ * and split in to row stripes over the format conversion pool the graphics
+ * thread uses when GPU conversion is disabled, and checks that both produce
+ * the same output.
+ *
+ *   usage: convert-bench [frames] [threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/bmem.h>
+#include <media-io/format-conversion.h>
+
+#define MAX_THREADS 16
+#define GUARD_SIZE  64
+#define GUARD_BYTE  0xA5
+
+typedef void (*convert_func_t)(const uint8_t *input, uint32_t in_linesize,
+		uint32_t start_y, uint32_t end_y,
+		uint8_t *output[], const uint32_t out_linesize[]);
+
+struct format {
+	const char     *name;
+	convert_func_t convert;
+	/* chroma plane count and subsampling */
+	int            planes;
+	int            chroma_shift_x;
+	int            chroma_shift_y;
+};
+
+struct frame {
+	uint8_t        *data[3];
+	uint32_t       linesize[3];
+	uint32_t       height[3];
+};
+
+struct convert_job {
+	const struct format *format;
+	const uint8_t  *input;
+	uint32_t       in_linesize;
+	uint32_t       height;
+	struct frame   *output;
+};
+
+static const struct format formats[] = {
+	{"I420", compress_uyvx_to_i420, 3, 1, 1},
+	{"NV12", compress_uyvx_to_nv12, 2, 0, 1},
+	{"I444", convert_uyvx_to_i444,  3, 0, 0},
+};
+
+static const struct {
+	const char                 *name;
+	enum format_conversion_isa isa;
+} isas[] = {
+	{"scalar", FORMAT_CONVERSION_ISA_SCALAR},
+	{"SSE2",   FORMAT_CONVERSION_ISA_SSE2},
+	{"AVX2",   FORMAT_CONVERSION_ISA_AVX2},
+};
+
+static const struct {
+	uint32_t width;
+	uint32_t height;
+} check_sizes[] = {
+	{1, 1}, {2, 2}, {3, 5}, {5, 3}, {7, 7}, {9, 2}, {15, 9}, {17, 16},
+	{31, 33}, {64, 64}, {641, 359}, {1921, 1081},
+};
+
+static const struct {
+	const char *name;
+	uint32_t   width;
+	uint32_t   height;
+} resolutions[] = {
+	{"1080p", 1920, 1080},
+	{"1440p", 2560, 1440},
+	{"4K",    3840, 2160},
+};
+
+/* planes sized like video_frame_init's, followed by guard bytes */
+static void frame_init(struct frame *frame, const struct format *format,
+		uint32_t width, uint32_t height)
+{
+	memset(frame, 0, sizeof(*frame));
+
+	for (int i = 0; i < format->planes; i++) {
+		uint32_t w = i ? width  >> format->chroma_shift_x : width;
+		uint32_t h = i ? height >> format->chroma_shift_y : height;
+		size_t size;
+
+		/* NV12 interleaves both chroma planes in one */
+		if (i && format->planes == 2)
+			w = width;
+
+		frame->linesize[i] = w;
+		frame->height[i] = h;
+
+		size = (size_t)w * h;
+		frame->data[i] = bzalloc(size + GUARD_SIZE);
+		memset(frame->data[i] + size, GUARD_BYTE, GUARD_SIZE);
+	}
+}
+
+static void frame_free(struct frame *frame)
+{
+	for (int i = 0; i < 3; i++)
+		bfree(frame->data[i]);
+}
+
+static bool frame_equal(const struct frame *a, const struct frame *b)
+{
+	for (int i = 0; i < 3; i++) {
+		size_t size = (size_t)a->linesize[i] * a->height[i];
+		if (size && memcmp(a->data[i], b->data[i], size) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static bool guards_intact(const struct frame *frame)
+{
+	for (int i = 0; i < 3; i++) {
+		const uint8_t *guard;
+
+		if (!frame->data[i])
+			continue;
+
+		guard = frame->data[i] +
+			(size_t)frame->linesize[i] * frame->height[i];
+		for (size_t j = 0; j < GUARD_SIZE; j++) {
+			if (guard[j] != GUARD_BYTE)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static uint8_t *create_input(uint32_t width, uint32_t height)
+{
+	size_t size = (size_t)width * 4 * height;
+	uint8_t *input = bmalloc(size);
+
+	for (size_t i = 0; i < size; i++)
+		input[i] = (uint8_t)(i * 7 + i / (width * 4) + (i >> 9));
+
+	return input;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void convert_rows(void *param, uint32_t start_y, uint32_t end_y)
+{
+	struct convert_job *job = param;
+
+	job->format->convert(job->input, job->in_linesize, start_y, end_y,
+			job->output->data, job->output->linesize);
+}
+
+static void convert(struct convert_job *job,
+		struct format_conversion_pool *pool)
+{
+	if (pool)
+		format_conversion_pool_run(pool, job->height, convert_rows,
+				job);
+	else
+		convert_rows(job, 0, job->height);
+}
+
+/* converts with each instruction set the CPU supports, and on the pool, and
+ * compares the results with the scalar conversion */
+static bool check_size(uint32_t width, uint32_t height,
+		struct format_conversion_pool *pool)
+{
+	uint8_t *input = create_input(width, height);
+	bool success = true;
+
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		const struct format *format = &formats[f];
+		struct convert_job job = {format, input, width * 4, height};
+		struct frame scalar;
+
+		frame_init(&scalar, format, width, height);
+		format_conversion_set_isa(FORMAT_CONVERSION_ISA_SCALAR);
+		job.output = &scalar;
+		convert(&job, NULL);
+
+		for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+			struct frame frame;
+
+			if (!format_conversion_set_isa(isas[i].isa))
+				continue;
+
+			for (int use_pool = 0; use_pool < 2; use_pool++) {
+				const char *how = use_pool ? "pool" : "single";
+
+				if (use_pool && !pool)
+					continue;
+
+				frame_init(&frame, format, width, height);
+				job.output = &frame;
+				convert(&job, use_pool ? pool : NULL);
+
+				if (!guards_intact(&frame)) {
+					printf("%s %s %s %ux%u: wrote past "
+					       "the end of a plane\n",
+					       format->name, isas[i].name,
+					       how, width, height);
+					success = false;
+				} else if (!frame_equal(&scalar, &frame)) {
+					printf("%s %s %s %ux%u: output "
+					       "differs from scalar output\n",
+					       format->name, isas[i].name,
+					       how, width, height);
+					success = false;
+				}
+
+				frame_free(&frame);
+			}
+		}
+
+		frame_free(&scalar);
+	}
+
+	format_conversion_set_isa(FORMAT_CONVERSION_ISA_AUTO);
+	bfree(input);
+	return success;
+}
+
+static double convert_ms(struct convert_job *job,
+		struct format_conversion_pool *pool, int frames)
+{
+	uint64_t start = os_gettime_ns();
+
+	for (int i = 0; i < frames; i++)
+		convert(job, pool);
+
+	return (double)(os_gettime_ns() - start) / 1000000.0 / frames;
+}
+
+static bool bench_resolution(size_t r, struct format_conversion_pool *pool,
+		int frames)
+{
+	uint32_t width = resolutions[r].width;
+	uint32_t height = resolutions[r].height;
+	uint8_t *input = create_input(width, height);
+	bool success = true;
+
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		struct convert_job job = {&formats[f], input, width * 4,
+			height};
+		struct frame single, striped;
+		double single_ms, pool_ms;
+
+		frame_init(&single, &formats[f], width, height);
+		frame_init(&striped, &formats[f], width, height);
+
+		job.output = &single;
+		single_ms = convert_ms(&job, NULL, frames);
+		job.output = &striped;
+		pool_ms = convert_ms(&job, pool, frames);
+
+		printf("%6s   %10s   %13.2f   %9.2f   %6.2fx\n",
+				formats[f].name, resolutions[r].name,
+				single_ms, pool_ms, single_ms / pool_ms);
+
+		if (!frame_equal(&single, &striped)) {
+			printf("%s %s: striped output differs from "
+			       "single-threaded output\n",
+			       formats[f].name, resolutions[r].name);
+			success = false;
+		}
+
+		frame_free(&single);
+		frame_free(&striped);
+	}
+
+	bfree(input);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 100;
+	int cores = os_get_physical_cores();
+	int threads = argc > 2 ? atoi(argv[2]) : (cores > 1 ? cores - 1 : 0);
+	struct format_conversion_pool *pool = NULL;
+	bool success = true;
+
+	if (frames <= 0 || threads < 0) {
+		puts("usage: convert-bench [frames] [threads]");
+		return 1;
+	}
+
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	if (threads) {
+		pool = format_conversion_pool_create((size_t)threads);
+		if (!pool) {
+			puts("Failed to create conversion threads");
+			return 1;
+		}
+	}
+
+	printf("comparing scalar, SSE2%s conversions\n",
+			format_conversion_set_isa(FORMAT_CONVERSION_ISA_AVX2) ?
+			" and AVX2" : " (no AVX2)");
+	format_conversion_set_isa(FORMAT_CONVERSION_ISA_AUTO);
+
+	for (size_t i = 0; i < sizeof(check_sizes) / sizeof(check_sizes[0]);
+			i++)
+		success = check_size(check_sizes[i].width,
+				check_sizes[i].height, pool) && success;
+
+	printf("%d frames, %d threads plus the calling thread\n", frames,
+			threads);
+	puts("format   resolution   1 thread (ms)   pool (ms)   speedup");
+
+	for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]);
+			r++)
+		success = bench_resolution(r, pool, frames) && success;
+
+	format_conversion_pool_destroy(pool);
+	return success ? 0 : 1;
+}
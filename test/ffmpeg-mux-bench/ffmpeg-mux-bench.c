@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2015 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ *   Pushes synthetic packets (one video packet followed by one packet per
+ * audio track, like a recording) from a parent to a child process through
+ * both the pipe and the shared memory transports used with ffmpeg-mux, and
+ * prints the throughput of each.  The child reads packets the same way
+ * ffmpeg-mux does, but discards them instead of muxing them.
+ *
+ *   usage: ffmpeg-mux-bench [video packet size] [video packets] [tracks]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ffmpeg-mux.h"
+#include "ffmpeg-mux-shm.h"
+
+#define AUDIO_PACKET_SIZE 1024
+
+struct bench_params {
+	size_t video_size;
+	int    video_packets;
+	int    tracks;
+};
+
+static inline double get_time_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static inline int total_packets(const struct bench_params *params)
+{
+	return params->video_packets * (1 + params->tracks);
+}
+
+static inline size_t total_bytes(const struct bench_params *params)
+{
+	return (size_t)params->video_packets *
+		(params->video_size + params->tracks * AUDIO_PACKET_SIZE);
+}
+
+static void print_result(const char *name, const struct bench_params *params,
+		double seconds)
+{
+	printf("%-6s %8.1f MB/s %10.0f packets/s (%.3f s)\n", name,
+			(double)total_bytes(params) / seconds / 1000000.0,
+			(double)total_packets(params) / seconds, seconds);
+}
+
+/* writes all packets, returning false if the reader went away */
+typedef bool (*write_packet_t)(void *param, const struct ffm_packet_info *info,
+		const uint8_t *data);
+
+static bool write_packets(const struct bench_params *params,
+		write_packet_t write_packet, void *param)
+{
+	uint8_t *video = malloc(params->video_size);
+	uint8_t audio[AUDIO_PACKET_SIZE];
+	bool success = true;
+
+	memset(video, 0x55, params->video_size);
+	memset(audio, 0xAA, sizeof(audio));
+
+	for (int i = 0; success && i < params->video_packets; i++) {
+		struct ffm_packet_info info = {
+			.pts = i,
+			.dts = i,
+			.size = (uint32_t)params->video_size,
+			.type = FFM_PACKET_VIDEO,
+			.keyframe = i % 60 == 0
+		};
+
+		success = write_packet(param, &info, video);
+
+		for (int j = 0; success && j < params->tracks; j++) {
+			info.size = AUDIO_PACKET_SIZE;
+			info.index = (uint32_t)j;
+			info.type = FFM_PACKET_AUDIO;
+			info.keyframe = true;
+
+			success = write_packet(param, &info, audio);
+		}
+	}
+
+	free(video);
+	return success;
+}
+
+/* the child exits with 0 only if it received every packet intact */
+static bool wait_reader(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid)
+		return false;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static inline bool check_packet(const struct ffm_packet_info *info,
+		const uint8_t *data)
+{
+	uint8_t expected = info->type == FFM_PACKET_VIDEO ? 0x55 : 0xAA;
+	return !info->size || (data[0] == expected &&
+	                       data[info->size - 1] == expected);
+}
+
+/* ------------------------------------------------------------------------- */
+/* pipe transport */
+
+static size_t pipe_read(FILE *file, void *vdata, size_t size)
+{
+	uint8_t *data = vdata;
+	size_t  total = size;
+
+	while (size > 0) {
+		size_t in_size = fread(data, 1, size, file);
+		if (in_size == 0)
+			return 0;
+
+		size -= in_size;
+		data += in_size;
+	}
+
+	return total;
+}
+
+static int pipe_reader(int fd, const struct bench_params *params)
+{
+	struct ffm_packet_info info;
+	FILE *file = fdopen(fd, "rb");
+	uint8_t *buf = NULL;
+	size_t capacity = 0;
+	int packets = 0;
+
+	while (pipe_read(file, &info, sizeof(info)) == sizeof(info)) {
+		if (info.size > capacity) {
+			capacity = info.size;
+			buf = realloc(buf, capacity);
+		}
+
+		if (pipe_read(file, buf, info.size) != info.size)
+			break;
+		if (!check_packet(&info, buf))
+			break;
+
+		packets++;
+	}
+
+	free(buf);
+	fclose(file);
+	return packets == total_packets(params) ? 0 : 1;
+}
+
+static bool pipe_write_packet(void *param, const struct ffm_packet_info *info,
+		const uint8_t *data)
+{
+	FILE *file = param;
+
+	return fwrite(info, 1, sizeof(*info), file) == sizeof(*info) &&
+	       fwrite(data, 1, info->size, file) == info->size;
+}
+
+static bool bench_pipe(const struct bench_params *params)
+{
+	double start;
+	bool success;
+	FILE *file;
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) != 0)
+		return false;
+
+	pid = fork();
+	if (pid == -1)
+		return false;
+	if (pid == 0) {
+		close(fds[1]);
+		_exit(pipe_reader(fds[0], params));
+	}
+
+	close(fds[0]);
+	file = fdopen(fds[1], "wb");
+
+	start = get_time_sec();
+	success = write_packets(params, pipe_write_packet, file);
+	fclose(file);
+	success = wait_reader(pid) && success;
+
+	if (success)
+		print_result("pipe", params, get_time_sec() - start);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+/* shared memory transport */
+
+#ifdef FFM_SHM_SUPPORTED
+static int shm_reader(int fd, const struct bench_params *params)
+{
+	struct ffm_shm_ring *ring = ffm_shm_open(fd);
+	struct ffm_packet_info info;
+	uint8_t *buf = NULL;
+	size_t capacity = 0;
+	int packets = 0;
+
+	if (!ring)
+		return 1;
+
+	while (ffm_shm_read(ring, &info, sizeof(info)) == sizeof(info)) {
+		uint8_t *data = ffm_shm_peek(ring, info.size);
+
+		if (data) {
+			if (!check_packet(&info, data))
+				break;
+
+			ffm_shm_advance(ring, info.size);
+			packets++;
+			continue;
+		}
+
+		if (info.size > capacity) {
+			capacity = info.size;
+			buf = realloc(buf, capacity);
+		}
+
+		if (ffm_shm_read(ring, buf, info.size) != info.size)
+			break;
+		if (!check_packet(&info, buf))
+			break;
+
+		packets++;
+	}
+
+	ffm_shm_close_reader(ring);
+	ffm_shm_destroy(ring);
+	free(buf);
+	return packets == total_packets(params) ? 0 : 1;
+}
+
+static bool shm_write_packet(void *param, const struct ffm_packet_info *info,
+		const uint8_t *data)
+{
+	return ffm_shm_write_packet(param, info, data);
+}
+
+static bool bench_shm(const struct bench_params *params)
+{
+	struct ffm_shm_ring *ring;
+	double start;
+	bool success;
+	pid_t pid;
+	int flags;
+	int fd;
+
+	ring = ffm_shm_create(FFM_SHM_DEFAULT_SIZE, &fd);
+	if (!ring)
+		return false;
+
+	/* only the ffmpeg-mux process started for the ring may inherit it */
+	flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || !(flags & FD_CLOEXEC)) {
+		puts("shared memory ring is not closed on exec");
+		close(fd);
+		ffm_shm_destroy(ring);
+		return false;
+	}
+
+	pid = fork();
+	if (pid == -1)
+		return false;
+	if (pid == 0)
+		_exit(shm_reader(fd, params));
+
+	close(fd);
+
+	start = get_time_sec();
+	success = write_packets(params, shm_write_packet, ring);
+	ffm_shm_close(ring);
+	success = wait_reader(pid) && success;
+
+	ffm_shm_destroy(ring);
+
+	if (success)
+		print_result("shm", params, get_time_sec() - start);
+	return success;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	struct bench_params params = {
+		.video_size = 256 * 1024,
+		.video_packets = 10000,
+		.tracks = 6
+	};
+	bool success = true;
+
+	if (argc > 1)
+		params.video_size = (size_t)strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		params.video_packets = atoi(argv[2]);
+	if (argc > 3)
+		params.tracks = atoi(argv[3]);
+
+	if (!params.video_size || params.video_packets <= 0 ||
+	    params.tracks < 0) {
+		puts("usage: ffmpeg-mux-bench [video packet size] "
+		     "[video packets] [tracks]");
+		return 1;
+	}
+
+	printf("%d video packets of %zu bytes, %d audio tracks, %.1f MB\n",
+			params.video_packets, params.video_size,
+			params.tracks,
+			(double)total_bytes(&params) / 1000000.0);
+
+	if (!bench_pipe(&params)) {
+		puts("pipe transport failed");
+		success = false;
+	}
+
+#ifdef FFM_SHM_SUPPORTED
+	if (!bench_shm(&params)) {
+		puts("shared memory transport failed");
+		success = false;
+	}
+#else
+	puts("shared memory transport not supported on this platform");
+#endif
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/*
+ *   Writes a file through the asynchronous file writer the way the FLV output
+ * and ffmpeg-mux do: many small writes, and a seek back to rewrite the header
+ * every so often.  Reads the file back and checks that it holds exactly what
+ * was written, with a few different writer settings, and compares the time
+ * spent in the writing thread with plain fwrite calls.
+ *
+ *   usage: file-writer-test [directory] [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/file-writer.h>
+#include <util/dstr.h>
+#include <util/bmem.h>
+
+#define MAX_CHUNK     (192 * 1024)
+#define HEADER_SIZE   13
+#define HEADER_EVERY  (8 * 1024 * 1024)
+
+struct writer_test {
+	const char                *name;
+	struct file_writer_params params;
+};
+
+struct congestion {
+	volatile long congested;
+	volatile long relieved;
+	volatile long out_of_order;
+	volatile bool state;
+};
+
+static const struct writer_test tests[] = {
+	{"defaults",        {0}},
+	{"small buffers",   {.buffer_size = 4096, .num_buffers = 2}},
+	{"direct I/O",      {.direct_io = true,
+	                     .preallocate = 64 * 1024 * 1024,
+	                     .sync = FILE_WRITER_SYNC_CLOSE}},
+	{"sync interval",   {.sync = FILE_WRITER_SYNC_INTERVAL,
+	                     .sync_interval = 4 * 1024 * 1024}},
+};
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint32_t next_random(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static void on_congestion(void *param, bool congested)
+{
+	struct congestion *c = param;
+
+	/* each change must be the opposite of the one before it */
+	if (os_atomic_set_bool(&c->state, congested) == congested)
+		os_atomic_inc_long(&c->out_of_order);
+
+	if (congested)
+		os_atomic_inc_long(&c->congested);
+	else
+		os_atomic_inc_long(&c->relieved);
+}
+
+typedef bool (*write_func_t)(void *file, const void *data, size_t size);
+typedef bool (*seek_func_t)(void *file, int64_t offset);
+
+static bool fw_write(void *file, const void *data, size_t size)
+{
+	return file_writer_write(file, data, size);
+}
+
+static bool fw_seek(void *file, int64_t offset)
+{
+	return file_writer_seek(file, offset);
+}
+
+static bool stdio_write(void *file, const void *data, size_t size)
+{
+	return fwrite(data, 1, size, file) == size;
+}
+
+static bool stdio_seek(void *file, int64_t offset)
+{
+	return os_fseeki64(file, offset, SEEK_SET) == 0;
+}
+
+/* writes the contents of expected in chunks of random size, and rewrites the
+ * header after every HEADER_EVERY bytes, the way the FLV output updates its
+ * duration.  Returns the milliseconds spent, or a negative value on error. */
+static double write_file(void *file, write_func_t write_data,
+		seek_func_t seek_to, uint8_t *expected, size_t size)
+{
+	uint32_t seed = 1;
+	size_t pos = 0;
+	size_t next_header = HEADER_EVERY;
+	uint64_t start = os_gettime_ns();
+
+	while (pos < size) {
+		size_t chunk = next_random(&seed) % MAX_CHUNK + 1;
+
+		if (chunk > size - pos)
+			chunk = size - pos;
+		if (!write_data(file, expected + pos, chunk))
+			return -1.0;
+
+		pos += chunk;
+
+		if (pos >= next_header) {
+			for (size_t i = 0; i < HEADER_SIZE; i++)
+				expected[i] = (uint8_t)(pos >> (i % 8) * 8);
+
+			if (!seek_to(file, 0) ||
+			    !write_data(file, expected, HEADER_SIZE) ||
+			    !seek_to(file, (int64_t)pos))
+				return -1.0;
+
+			next_header += HEADER_EVERY;
+		}
+	}
+
+	return (double)(os_gettime_ns() - start) / 1000000.0;
+}
+
+static bool check_file(const char *path, const uint8_t *expected,
+		size_t size)
+{
+	uint8_t *data = bmalloc(size + 1);
+	FILE *file = os_fopen(path, "rb");
+	size_t read = 0;
+	bool success;
+
+	if (file) {
+		read = fread(data, 1, size + 1, file);
+		fclose(file);
+	}
+
+	success = read == size && memcmp(data, expected, size) == 0;
+	bfree(data);
+	return success;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool run_test(const struct writer_test *test, const char *path,
+		uint8_t *expected, size_t size)
+{
+	struct file_writer_params params = test->params;
+	struct file_writer_stats stats;
+	struct congestion congestion = {0};
+	struct file_writer *fw;
+	double ms;
+	bool success;
+
+	params.congestion = on_congestion;
+	params.congestion_param = &congestion;
+
+	fw = file_writer_open(path, &params);
+	if (!fw) {
+		printf("%s: failed to open '%s'\n", test->name, path);
+		return false;
+	}
+
+	ms = write_file(fw, fw_write, fw_seek, expected, size);
+	file_writer_get_stats(fw, &stats);
+	success = file_writer_close(fw) && ms >= 0.0;
+
+	if (!success) {
+		printf("%s: failed to write the file\n", test->name);
+		return false;
+	}
+
+	printf("%-14s %8.1f ms, blocked %8.1f ms, %2d buffers queued at most, "
+	       "congested %ld times\n", test->name, ms,
+	       (double)stats.blocked_ns / 1000000.0, (int)stats.max_queued,
+	       os_atomic_load_long(&congestion.congested));
+
+	if (!check_file(path, expected, size)) {
+		printf("%s: the file does not hold what was written\n",
+				test->name);
+		success = false;
+	}
+
+	/* the I/O thread always catches up before the file is closed */
+	if (os_atomic_load_long(&congestion.congested) !=
+	    os_atomic_load_long(&congestion.relieved)) {
+		printf("%s: congestion was signaled %ld times, but relieved "
+		       "%ld times\n", test->name,
+		       os_atomic_load_long(&congestion.congested),
+		       os_atomic_load_long(&congestion.relieved));
+		success = false;
+	}
+
+	if (os_atomic_load_long(&congestion.out_of_order)) {
+		printf("%s: congestion changes arrived out of order %ld "
+		       "times\n", test->name,
+		       os_atomic_load_long(&congestion.out_of_order));
+		success = false;
+	}
+
+	return success;
+}
+
+static bool run_stdio(const char *path, uint8_t *expected, size_t size)
+{
+	FILE *file = os_fopen(path, "wb");
+	double ms;
+
+	if (!file) {
+		printf("fwrite: failed to open '%s'\n", path);
+		return false;
+	}
+
+	ms = write_file(file, stdio_write, stdio_seek, expected, size);
+	fclose(file);
+
+	if (ms < 0.0) {
+		puts("fwrite: failed to write the file");
+		return false;
+	}
+
+	printf("%-14s %8.1f ms\n", "fwrite", ms);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	int megabytes = argc > 2 ? atoi(argv[2]) : 64;
+	struct dstr path = {0};
+	uint8_t *expected;
+	size_t size;
+	bool success = true;
+
+	if (megabytes <= 0) {
+		puts("usage: file-writer-test [directory] [megabytes]");
+		return 1;
+	}
+
+	size = (size_t)megabytes * 1024 * 1024;
+	expected = bmalloc(size);
+	for (size_t i = 0; i < size; i++)
+		expected[i] = (uint8_t)(i * 31 + i / 4099);
+
+	dstr_printf(&path, "%s/file-writer-test.bin", dir);
+
+	success = run_stdio(path.array, expected, size);
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		success = run_test(&tests[i], path.array, expected, size) &&
+			success;
+
+	os_unlink(path.array);
+	dstr_free(&path);
+	bfree(expected);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,345 @@
+/*
+ *   Gathers a generated replay buffer in to the mux queue of the FFmpeg muxer
+ * while another thread takes the packets back out, and checks that they come
+ * out in the same order the replay buffer's old insert_packet sorted them in
+ * before muxing.  Also prints how long each takes.
+ *
+ *   Streams are checked with every track present, with an audio track that
+ * starts late, and with an audio track that is expected but never gets any
+ * packets.
+ *
+ *   usage: mux-queue-test [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include <util/bmem.h>
+
+#include "mux-queue.h"
+
+#define VIDEO_USEC       33333
+#define AUDIO_USEC       21333
+#define AUDIO_DELAY_USEC 5000
+
+struct stream_test {
+	const char *name;
+	int        audio_tracks;
+	/* the last audio track starts this late */
+	int64_t    late_usec;
+	/* an audio track that is expected but gets no packets */
+	bool       empty_track;
+};
+
+struct take_thread {
+	struct mux_queue *queue;
+	struct darray    packets;
+};
+
+static const struct stream_test tests[] = {
+	{"video and two audio tracks", 2, 0,       false},
+	{"audio track starting late",  2, 3000000, false},
+	{"expected track never used",  1, 0,       true},
+};
+
+/* ------------------------------------------------------------------------- */
+
+static int compare_arrival(const void *a_ptr, const void *b_ptr)
+{
+	const struct encoder_packet *a = a_ptr;
+	const struct encoder_packet *b = b_ptr;
+	int64_t a_ts = a->dts_usec +
+		(a->type == OBS_ENCODER_AUDIO ? AUDIO_DELAY_USEC : 0);
+	int64_t b_ts = b->dts_usec +
+		(b->type == OBS_ENCODER_AUDIO ? AUDIO_DELAY_USEC : 0);
+
+	if (a_ts != b_ts)
+		return a_ts < b_ts ? -1 : 1;
+	if (a->type != b->type)
+		return a->type == OBS_ENCODER_VIDEO ? -1 : 1;
+	if (a->track_idx != b->track_idx)
+		return a->track_idx < b->track_idx ? -1 : 1;
+	return 0;
+}
+
+/* generates a replay buffer in the order encoders would output packets:
+ * audio shortly after video, and every audio track with the same
+ * timestamps.  sys_dts_usec isn't used by the queue, so it carries the
+ * position of each packet in the buffer. */
+static void generate_packets(struct darray *array,
+		const struct stream_test *test, int seconds)
+{
+	DARRAY(struct encoder_packet) packets;
+	int64_t end = (int64_t)seconds * 1000000;
+
+	da_init(packets);
+
+	/* the buffer starts at a keyframe some time in to the stream */
+	for (int64_t i = 300; i * VIDEO_USEC < end; i++) {
+		struct encoder_packet *pkt = da_push_back_new(packets);
+
+		pkt->type         = OBS_ENCODER_VIDEO;
+		pkt->keyframe     = i % 30 == 0;
+		pkt->dts          = i;
+		pkt->pts          = i + 1;
+		pkt->dts_usec     = i * VIDEO_USEC;
+		pkt->timebase_num = 1;
+		pkt->timebase_den = 30;
+	}
+
+	for (int track = 0; track < test->audio_tracks; track++) {
+		int64_t start = 450;
+
+		if (track == test->audio_tracks - 1)
+			start += test->late_usec / AUDIO_USEC;
+
+		for (int64_t i = start; i * AUDIO_USEC < end; i++) {
+			struct encoder_packet *pkt = da_push_back_new(packets);
+
+			pkt->type         = OBS_ENCODER_AUDIO;
+			pkt->track_idx    = (size_t)track;
+			pkt->dts          = i * 1024;
+			pkt->pts          = i * 1024;
+			pkt->dts_usec     = i * AUDIO_USEC;
+			pkt->timebase_num = 1;
+			pkt->timebase_den = 48000;
+		}
+	}
+
+	qsort(packets.array, packets.num, sizeof(struct encoder_packet),
+			compare_arrival);
+
+	for (size_t i = 0; i < packets.num; i++)
+		packets.array[i].sys_dts_usec = (int64_t)i;
+
+	*array = packets.da;
+}
+
+static void find_offsets(const struct encoder_packet *pkt, bool *found_video,
+		bool *found_audio, int64_t *video_offset,
+		int64_t *video_dts_offset, int64_t *audio_offsets,
+		int64_t *audio_dts_offsets)
+{
+	if (pkt->type == OBS_ENCODER_VIDEO) {
+		if (!*found_video) {
+			*video_offset = pkt->dts_usec;
+			*video_dts_offset = pkt->dts;
+			*found_video = true;
+		}
+	} else {
+		if (!found_audio[pkt->track_idx]) {
+			found_audio[pkt->track_idx] = true;
+			audio_offsets[pkt->track_idx] = pkt->dts_usec;
+			audio_dts_offsets[pkt->track_idx] = pkt->dts;
+		}
+	}
+}
+
+static void apply_offsets(struct encoder_packet *pkt, int64_t video_offset,
+		int64_t *audio_offsets, int64_t video_dts_offset,
+		int64_t *audio_dts_offsets)
+{
+	if (pkt->type == OBS_ENCODER_VIDEO) {
+		pkt->dts_usec -= video_offset;
+		pkt->dts -= video_dts_offset;
+		pkt->pts -= video_dts_offset;
+	} else {
+		pkt->dts_usec -= audio_offsets[pkt->track_idx];
+		pkt->dts -= audio_dts_offsets[pkt->track_idx];
+		pkt->pts -= audio_dts_offsets[pkt->track_idx];
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* how the replay buffer used to sort packets before muxing them */
+static void insert_packet(struct darray *array,
+		const struct encoder_packet *packet, int64_t video_offset,
+		int64_t *audio_offsets, int64_t video_dts_offset,
+		int64_t *audio_dts_offsets)
+{
+	struct encoder_packet pkt = *packet;
+	DARRAY(struct encoder_packet) packets;
+	packets.da = *array;
+	size_t idx;
+
+	apply_offsets(&pkt, video_offset, audio_offsets, video_dts_offset,
+			audio_dts_offsets);
+
+	for (idx = packets.num; idx > 0; idx--) {
+		struct encoder_packet *p = packets.array + (idx - 1);
+		if (p->dts_usec < pkt.dts_usec)
+			break;
+	}
+
+	da_insert(packets, idx, &pkt);
+	*array = packets.da;
+}
+
+static double insert_order(struct darray *array,
+		const struct encoder_packet *packets, size_t num)
+{
+	bool found_video = false;
+	bool found_audio[MAX_AUDIO_MIXES] = {0};
+	int64_t video_offset = 0;
+	int64_t video_dts_offset = 0;
+	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	uint64_t start = os_gettime_ns();
+
+	for (size_t i = 0; i < num; i++) {
+		find_offsets(&packets[i], &found_video, found_audio,
+				&video_offset, &video_dts_offset,
+				audio_offsets, audio_dts_offsets);
+		insert_packet(array, &packets[i], video_offset, audio_offsets,
+				video_dts_offset, audio_dts_offsets);
+	}
+
+	return (double)(os_gettime_ns() - start) / 1000000.0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *take_thread(void *data)
+{
+	struct take_thread *tt = data;
+	DARRAY(struct encoder_packet) packets;
+	struct encoder_packet pkt;
+
+	packets.da = tt->packets;
+	while (mux_queue_next(tt->queue, &pkt))
+		da_push_back(packets, &pkt);
+	tt->packets = packets.da;
+
+	return NULL;
+}
+
+/* gathers the packets the same way the replay buffer does when it's saved,
+ * while the packets are taken out on another thread */
+static double queue_order(struct darray *array, struct mux_queue *queue,
+		uint32_t track_mask, const struct encoder_packet *packets,
+		size_t num)
+{
+	bool found_video = false;
+	bool found_audio[MAX_AUDIO_MIXES] = {0};
+	int64_t video_offset = 0;
+	int64_t video_dts_offset = 0;
+	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+	struct take_thread tt = {queue};
+	pthread_t thread;
+	uint64_t start = os_gettime_ns();
+
+	mux_queue_start(queue, track_mask);
+
+	if (pthread_create(&thread, NULL, take_thread, &tt) != 0)
+		return -1.0;
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet pkt = packets[i];
+
+		find_offsets(&pkt, &found_video, found_audio,
+				&video_offset, &video_dts_offset,
+				audio_offsets, audio_dts_offsets);
+		apply_offsets(&pkt, video_offset, audio_offsets,
+				video_dts_offset, audio_dts_offsets);
+		mux_queue_push(queue, &pkt);
+	}
+
+	mux_queue_end(queue);
+	pthread_join(thread, NULL);
+	mux_queue_clear(queue);
+
+	*array = tt.packets;
+	return (double)(os_gettime_ns() - start) / 1000000.0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool run_test(const struct stream_test *test, int seconds)
+{
+	DARRAY(struct encoder_packet) packets;
+	DARRAY(struct encoder_packet) expected;
+	DARRAY(struct encoder_packet) merged;
+	struct mux_queue queue;
+	uint32_t track_mask = 1;
+	double insert_ms, queue_ms;
+	bool success = true;
+
+	for (int i = 0; i < test->audio_tracks; i++)
+		track_mask |= 1 << (i + 1);
+	if (test->empty_track)
+		track_mask |= 1 << (test->audio_tracks + 1);
+
+	if (!mux_queue_init(&queue)) {
+		printf("%s: failed to create the queue\n", test->name);
+		return false;
+	}
+
+	da_init(expected);
+	da_init(merged);
+	generate_packets(&packets.da, test, seconds);
+
+	insert_ms = insert_order(&expected.da, packets.array, packets.num);
+	queue_ms = queue_order(&merged.da, &queue, track_mask, packets.array,
+			packets.num);
+	if (queue_ms < 0.0) {
+		printf("%s: failed to create a thread\n", test->name);
+		success = false;
+		goto finish;
+	}
+
+	if (merged.num != expected.num) {
+		printf("%s: merged %zu packets of %zu\n", test->name,
+				merged.num, expected.num);
+		success = false;
+		goto finish;
+	}
+
+	for (size_t i = 0; i < merged.num; i++) {
+		const struct encoder_packet *a = &merged.array[i];
+		const struct encoder_packet *b = &expected.array[i];
+
+		if (a->sys_dts_usec != b->sys_dts_usec ||
+		    a->dts_usec != b->dts_usec || a->dts != b->dts ||
+		    a->pts != b->pts) {
+			printf("%s: packet %zu is packet %"PRId64", "
+			       "insert_packet put packet %"PRId64" there\n",
+			       test->name, i, a->sys_dts_usec,
+			       b->sys_dts_usec);
+			success = false;
+			goto finish;
+		}
+	}
+
+	printf("%-28s %7zu packets: insert_packet %8.2f ms, mux queue "
+	       "%8.2f ms\n", test->name, merged.num, insert_ms, queue_ms);
+
+finish:
+	da_free(packets);
+	da_free(expected);
+	da_free(merged);
+	mux_queue_free(&queue);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 300;
+	bool success = true;
+
+	if (seconds <= 30) {
+		puts("usage: mux-queue-test [seconds, more than 30]");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		success = run_test(&tests[i], seconds) && success;
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/*
+ *   Remuxes a set of files with the libobs batch remuxer and prints the
+ * combined throughput, for benchmarking remuxing without the UI.  Each
+ * output file is written next to its input with the given extension.
+ *
+ *   usage: remux-bench [-j jobs] [-r MB/s] [-e extension] files...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <media-io/media-remux.h>
+
+static bool print_progress(void *data, float percent)
+{
+	UNUSED_PARAMETER(data);
+
+	printf("\r%5.1f%%", percent);
+	fflush(stdout);
+	return true;
+}
+
+static void usage(void)
+{
+	puts("usage: remux-bench [-j jobs] [-r MB/s] [-e extension] files...");
+	puts("  -j  files remuxed at the same time (default: logical cores)");
+	puts("  -r  combined read and write limit in MB/s (default: none)");
+	puts("  -e  output file extension (default: mp4)");
+}
+
+int main(int argc, char *argv[])
+{
+	struct media_remux_batch_stats stats;
+	media_remux_batch_t batch;
+	const char *ext = "mp4";
+	size_t jobs = 0;
+	uint64_t rate = 0;
+	double seconds;
+	bool success;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		if (strcmp(argv[i], "-j") == 0)
+			jobs = (size_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0)
+			rate = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+		else if (strcmp(argv[i], "-e") == 0)
+			ext = argv[++i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (i == argc) {
+		usage();
+		return 1;
+	}
+
+	batch = media_remux_batch_create(jobs, rate);
+	if (!batch)
+		return 1;
+
+	for (; i < argc; i++) {
+		struct dstr out = {0};
+		const char *dot = strrchr(argv[i], '.');
+
+		if (dot)
+			dstr_ncopy(&out, argv[i], dot - argv[i]);
+		else
+			dstr_copy(&out, argv[i]);
+		dstr_catf(&out, ".%s", ext);
+
+		if (media_remux_batch_add(batch, argv[i], out.array) ==
+				(size_t)-1)
+			printf("skipping '%s'\n", argv[i]);
+
+		dstr_free(&out);
+	}
+
+	success = media_remux_batch_process(batch, print_progress, NULL);
+	media_remux_batch_get_stats(batch, &stats);
+
+	seconds = (double)stats.elapsed_ns / 1000000000.0;
+	printf("\n%zu/%zu files remuxed, %zu failed\n",
+			stats.jobs_done - stats.jobs_failed,
+			stats.jobs_total, stats.jobs_failed);
+	printf("read %.1f MB, wrote %.1f MB in %.3f s: %.1f MB/s\n",
+			(double)stats.bytes_read / 1000000.0,
+			(double)stats.bytes_written / 1000000.0, seconds,
+			(double)(stats.bytes_read + stats.bytes_written) /
+			1000000.0 / seconds);
+
+	media_remux_batch_destroy(batch);
+	return success ? 0 : 1;
+}
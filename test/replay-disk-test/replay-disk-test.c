@@ -0,0 +1,488 @@
+/*
+ *   Pushes a generated stream of video and audio packets to the replay buffer
+ * disk cache and checks that the packets read back from it are the ones the
+ * memory replay buffer would have saved, in the order its insert_packet puts
+ * them in: by timestamp relative to the first packet of each track, and
+ * newest first when timestamps are equal.
+ *
+ *   This is done for a ring that only holds a couple of groups of pictures,
+ * one that has to wrap around, and one that holds the whole stream.  Each
+ * ring is read once while the next quarter of the stream is being pushed from
+ * another thread, which may drop packets instead of waiting on the reader,
+ * and once more after the rest has been pushed.  Each ring is also pushed to
+ * while a reader holds it without reading, which must not slow pushing down,
+ * and must leave a buffer that starts over at a keyframe once the reader is
+ * gone.
+ *
+ *   usage: replay-disk-test [directory]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/bmem.h>
+
+#include "replay-disk-buffer.h"
+
+#define SECONDS          20
+#define VIDEO_USEC       33333
+#define AUDIO_USEC       21333
+#define AUDIO_DELAY_USEC 5000
+#define AUDIO_TRACKS     2
+#define KEYFRAME_FRAMES  30
+#define HELD_PUSH_MAX_MS 1000
+
+struct test_packet {
+	uint64_t               serial;
+	enum obs_encoder_type  type;
+	size_t                 track_idx;
+	bool                   keyframe;
+	int64_t                pts;
+	int64_t                dts;
+	int64_t                dts_usec;
+	int32_t                timebase_num;
+	int32_t                timebase_den;
+	size_t                 size;
+};
+
+struct ring_test {
+	const char             *name;
+	uint64_t               size;
+};
+
+struct push_thread {
+	struct replay_disk_buffer *rdb;
+	const struct test_packet  *packets;
+	size_t                    start;
+	size_t                    end;
+	uint8_t                   *data;
+};
+
+static const struct ring_test rings[] = {
+	{"two GOPs",     512 * 1024},
+	{"wrapping",     2 * 1024 * 1024},
+	{"whole stream", 32 * 1024 * 1024},
+};
+
+/* ------------------------------------------------------------------------- */
+
+static int compare_arrival(const void *a_ptr, const void *b_ptr)
+{
+	const struct test_packet *a = a_ptr;
+	const struct test_packet *b = b_ptr;
+	int64_t a_ts = a->dts_usec +
+		(a->type == OBS_ENCODER_AUDIO ? AUDIO_DELAY_USEC : 0);
+	int64_t b_ts = b->dts_usec +
+		(b->type == OBS_ENCODER_AUDIO ? AUDIO_DELAY_USEC : 0);
+
+	if (a_ts != b_ts)
+		return a_ts < b_ts ? -1 : 1;
+	if (a->type != b->type)
+		return a->type == OBS_ENCODER_VIDEO ? -1 : 1;
+	if (a->track_idx != b->track_idx)
+		return a->track_idx < b->track_idx ? -1 : 1;
+	return 0;
+}
+
+/* generates packets in the order encoders would output them: audio shortly
+ * after video, and both audio tracks with the same timestamps */
+static void generate_packets(struct darray *array)
+{
+	DARRAY(struct test_packet) packets;
+	int64_t end = (int64_t)SECONDS * 1000000;
+
+	da_init(packets);
+
+	for (int64_t i = 0; i * VIDEO_USEC < end; i++) {
+		struct test_packet *pkt = da_push_back_new(packets);
+
+		pkt->type         = OBS_ENCODER_VIDEO;
+		pkt->keyframe     = i % KEYFRAME_FRAMES == 0;
+		pkt->dts          = i;
+		pkt->pts          = i + 1;
+		pkt->dts_usec     = i * VIDEO_USEC;
+		pkt->timebase_num = 1;
+		pkt->timebase_den = 30;
+		pkt->size         = pkt->keyframe ? 40000 :
+			4000 + (size_t)(i * 37 % 3000);
+	}
+
+	for (size_t track = 0; track < AUDIO_TRACKS; track++) {
+		for (int64_t i = 0; i * AUDIO_USEC < end; i++) {
+			struct test_packet *pkt = da_push_back_new(packets);
+
+			pkt->type         = OBS_ENCODER_AUDIO;
+			pkt->track_idx    = track;
+			pkt->dts          = i * 1024;
+			pkt->pts          = i * 1024;
+			pkt->dts_usec     = i * AUDIO_USEC;
+			pkt->timebase_num = 1;
+			pkt->timebase_den = 48000;
+			pkt->size         = 300 + (size_t)(i % 50);
+		}
+	}
+
+	qsort(packets.array, packets.num, sizeof(struct test_packet),
+			compare_arrival);
+
+	for (size_t i = 0; i < packets.num; i++)
+		packets.array[i].serial = i;
+
+	*array = packets.da;
+}
+
+static inline uint8_t data_byte(uint64_t serial, size_t i)
+{
+	return (uint8_t)(serial * 13 + i);
+}
+
+static void push_packet(struct replay_disk_buffer *rdb,
+		const struct test_packet *test, uint8_t *data)
+{
+	struct encoder_packet packet = {0};
+
+	for (size_t i = 0; i < test->size; i++)
+		data[i] = data_byte(test->serial, i);
+	memcpy(data, &test->serial, sizeof(test->serial));
+
+	packet.data         = data;
+	packet.size         = test->size;
+	packet.type         = test->type;
+	packet.track_idx    = test->track_idx;
+	packet.keyframe     = test->keyframe;
+	packet.pts          = test->pts;
+	packet.dts          = test->dts;
+	packet.dts_usec     = test->dts_usec;
+	packet.sys_dts_usec = test->dts_usec;
+	packet.timebase_num = test->timebase_num;
+	packet.timebase_den = test->timebase_den;
+
+	replay_disk_buffer_push(rdb, &packet, 0);
+}
+
+static void *push_thread(void *data)
+{
+	struct push_thread *pt = data;
+
+	for (size_t i = pt->start; i < pt->end; i++)
+		push_packet(pt->rdb, &pt->packets[i], pt->data);
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* the reordering the memory replay buffer does when it is saved */
+static void insert_packet(struct darray *array,
+		const struct test_packet *packet, int64_t video_offset,
+		int64_t *audio_offsets, int64_t video_dts_offset,
+		int64_t *audio_dts_offsets)
+{
+	struct test_packet pkt = *packet;
+	DARRAY(struct test_packet) packets;
+	packets.da = *array;
+	size_t idx;
+
+	if (pkt.type == OBS_ENCODER_VIDEO) {
+		pkt.dts_usec -= video_offset;
+		pkt.dts -= video_dts_offset;
+		pkt.pts -= video_dts_offset;
+	} else {
+		pkt.dts_usec -= audio_offsets[pkt.track_idx];
+		pkt.dts -= audio_dts_offsets[pkt.track_idx];
+		pkt.pts -= audio_dts_offsets[pkt.track_idx];
+	}
+
+	for (idx = packets.num; idx > 0; idx--) {
+		struct test_packet *p = packets.array + (idx - 1);
+		if (p->dts_usec < pkt.dts_usec)
+			break;
+	}
+
+	da_insert(packets, idx, &pkt);
+	*array = packets.da;
+}
+
+static void memory_order(struct darray *array,
+		const struct test_packet *packets, size_t start, size_t end)
+{
+	bool found_video = false;
+	bool found_audio[MAX_AUDIO_MIXES] = {0};
+	int64_t video_offset = 0;
+	int64_t video_dts_offset = 0;
+	int64_t audio_offsets[MAX_AUDIO_MIXES] = {0};
+	int64_t audio_dts_offsets[MAX_AUDIO_MIXES] = {0};
+
+	for (size_t i = start; i < end; i++) {
+		const struct test_packet *pkt = &packets[i];
+
+		if (pkt->type == OBS_ENCODER_VIDEO) {
+			if (!found_video) {
+				video_offset = pkt->dts_usec;
+				video_dts_offset = pkt->dts;
+				found_video = true;
+			}
+		} else {
+			if (!found_audio[pkt->track_idx]) {
+				found_audio[pkt->track_idx] = true;
+				audio_offsets[pkt->track_idx] = pkt->dts_usec;
+				audio_dts_offsets[pkt->track_idx] = pkt->dts;
+			}
+		}
+
+		insert_packet(array, pkt, video_offset, audio_offsets,
+				video_dts_offset, audio_dts_offsets);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool check_data(const struct encoder_packet *packet, uint64_t serial)
+{
+	for (size_t i = sizeof(serial); i < packet->size; i++) {
+		if (packet->data[i] != data_byte(serial, i))
+			return false;
+	}
+
+	return true;
+}
+
+/* reads everything from the reader and compares it with what the memory
+ * buffer would have saved of the first <end> packets */
+static bool read_and_check(struct replay_disk_reader *reader,
+		const struct test_packet *packets, size_t end,
+		const char *name)
+{
+	DARRAY(struct test_packet) read;
+	DARRAY(struct test_packet) expected;
+	struct encoder_packet packet;
+	uint64_t start = UINT64_MAX;
+	bool success = true;
+
+	da_init(read);
+	da_init(expected);
+
+	while (replay_disk_reader_next(reader, &packet)) {
+		struct test_packet *pkt = da_push_back_new(read);
+
+		memcpy(&pkt->serial, packet.data, sizeof(pkt->serial));
+		pkt->type      = packet.type;
+		pkt->track_idx = packet.track_idx;
+		pkt->keyframe  = packet.keyframe;
+		pkt->pts       = packet.pts;
+		pkt->dts       = packet.dts;
+		pkt->dts_usec  = packet.dts_usec;
+		pkt->size      = packet.size;
+
+		if (pkt->serial >= end ||
+		    packet.size != packets[pkt->serial].size ||
+		    !check_data(&packet, pkt->serial)) {
+			printf("%s: packet %zu is corrupt\n", name,
+					read.num - 1);
+			success = false;
+			goto finish;
+		}
+
+		if (pkt->serial < start)
+			start = pkt->serial;
+	}
+
+	if (!read.num) {
+		printf("%s: nothing was buffered\n", name);
+		success = false;
+		goto finish;
+	}
+
+	/* the buffer only ever drops whole groups of pictures from the
+	 * front, so what is left must start with a keyframe */
+	if (packets[start].type != OBS_ENCODER_VIDEO ||
+	    !packets[start].keyframe) {
+		printf("%s: buffer does not start with a keyframe\n", name);
+		success = false;
+		goto finish;
+	}
+
+	memory_order(&expected.da, packets, (size_t)start, end);
+
+	if (read.num != expected.num) {
+		printf("%s: read %zu packets, the memory buffer has %zu\n",
+				name, read.num, expected.num);
+		success = false;
+		goto finish;
+	}
+
+	for (size_t i = 0; i < read.num; i++) {
+		const struct test_packet *a = &read.array[i];
+		const struct test_packet *b = &expected.array[i];
+
+		if (a->serial != b->serial || a->dts_usec != b->dts_usec ||
+		    a->dts != b->dts || a->pts != b->pts) {
+			printf("%s: packet %zu is packet %"PRIu64" (dts %"PRId64
+			       " us), the memory buffer has packet %"PRIu64
+			       " (dts %"PRId64" us)\n", name, i, a->serial,
+			       a->dts_usec, b->serial, b->dts_usec);
+			success = false;
+			goto finish;
+		}
+	}
+
+	printf("%-28s %6zu packets, %5.1f s, in order\n", name, read.num,
+			(double)(packets[end - 1].dts_usec -
+			         packets[start].dts_usec) / 1000000.0);
+
+finish:
+	da_free(read);
+	da_free(expected);
+	return success;
+}
+
+static bool test_ring(const struct ring_test *ring, const char *dir,
+		const struct test_packet *packets, size_t num)
+{
+	struct replay_disk_buffer *rdb;
+	struct replay_disk_reader *reader;
+	struct push_thread pt = {0};
+	struct dstr path = {0};
+	struct dstr name = {0};
+	pthread_t thread;
+	size_t half = num / 2;
+	size_t quarter = num / 4;
+	bool success = false;
+
+	dstr_printf(&path, "%s/replay-disk-test.buf", dir);
+
+	rdb = replay_disk_buffer_create(path.array, ring->size);
+	if (!rdb) {
+		printf("%s: failed to create the buffer\n", ring->name);
+		goto finish;
+	}
+
+	pt.rdb     = rdb;
+	pt.packets = packets;
+	pt.data    = bmalloc(64 * 1024);
+
+	for (size_t i = 0; i < half; i++)
+		push_packet(rdb, &packets[i], pt.data);
+
+	/* read the first half while the second half is pushed */
+	reader = replay_disk_buffer_read(rdb);
+	if (!reader) {
+		printf("%s: failed to read the buffer\n", ring->name);
+		goto finish;
+	}
+
+	pt.start = half;
+	pt.end   = half + quarter;
+	if (pthread_create(&thread, NULL, push_thread, &pt) != 0) {
+		replay_disk_reader_destroy(reader);
+		goto finish;
+	}
+
+	dstr_printf(&name, "%s, pushing", ring->name);
+	success = read_and_check(reader, packets, half, name.array);
+	replay_disk_reader_destroy(reader);
+
+	pthread_join(thread, NULL);
+
+	for (size_t i = half + quarter; i < num; i++)
+		push_packet(rdb, &packets[i], pt.data);
+
+	reader = replay_disk_buffer_read(rdb);
+	dstr_printf(&name, "%s, after", ring->name);
+	success = reader && read_and_check(reader, packets, num, name.array) &&
+		success;
+	replay_disk_reader_destroy(reader);
+
+finish:
+	replay_disk_buffer_destroy(rdb);
+	bfree(pt.data);
+	dstr_free(&path);
+	dstr_free(&name);
+	return success;
+}
+
+/* pushes the middle third of the stream while a reader that never reads
+ * holds the buffer */
+static bool test_held_reader(const struct ring_test *ring, const char *dir,
+		const struct test_packet *packets, size_t num)
+{
+	struct replay_disk_buffer *rdb;
+	struct replay_disk_reader *reader;
+	struct dstr path = {0};
+	struct dstr name = {0};
+	uint8_t *data = bmalloc(64 * 1024);
+	size_t third = num / 3;
+	uint64_t start_ns;
+	uint64_t held_ms;
+	bool success = false;
+
+	dstr_printf(&path, "%s/replay-disk-test.buf", dir);
+	dstr_printf(&name, "%s, held", ring->name);
+
+	rdb = replay_disk_buffer_create(path.array, ring->size);
+	if (!rdb) {
+		printf("%s: failed to create the buffer\n", name.array);
+		goto finish;
+	}
+
+	for (size_t i = 0; i < third; i++)
+		push_packet(rdb, &packets[i], data);
+
+	reader = replay_disk_buffer_read(rdb);
+	if (!reader) {
+		printf("%s: failed to read the buffer\n", name.array);
+		goto finish;
+	}
+
+	start_ns = os_gettime_ns();
+	for (size_t i = third; i < third * 2; i++)
+		push_packet(rdb, &packets[i], data);
+	held_ms = (os_gettime_ns() - start_ns) / 1000000;
+
+	replay_disk_reader_destroy(reader);
+
+	if (held_ms > HELD_PUSH_MAX_MS) {
+		printf("%s: pushing took %"PRIu64" ms while the buffer was "
+		       "held\n", name.array, held_ms);
+		goto finish;
+	}
+
+	for (size_t i = third * 2; i < num; i++)
+		push_packet(rdb, &packets[i], data);
+
+	reader = replay_disk_buffer_read(rdb);
+	success = reader && read_and_check(reader, packets, num, name.array);
+	replay_disk_reader_destroy(reader);
+
+finish:
+	replay_disk_buffer_destroy(rdb);
+	bfree(data);
+	dstr_free(&path);
+	dstr_free(&name);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : ".";
+	DARRAY(struct test_packet) packets;
+	bool success = true;
+
+	generate_packets(&packets.da);
+
+	for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+		success = test_ring(&rings[i], dir, packets.array,
+				packets.num) && success;
+	for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+		success = test_held_reader(&rings[i], dir, packets.array,
+				packets.num) && success;
+
+	da_free(packets);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+/*
+ *   Streams data through the linux socket thread of the RTMP output to a
+ * loopback connection that reads it slowly, the way a congested ingest
+ * would, and checks that every byte arrives in order.  Runs with batching
+ * off, with batching on, and in low latency mode, and checks that the send
+ * ring never grows past the size it was reserved with, and that the
+ * statistics published for the get_socket_stats procedure add up.
+ *
+ *   usage: rtmp-socket-test [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rtmp-stream.h"
+
+#define RING_SIZE 131072
+#define MAX_CHUNK 5000
+
+struct socket_test {
+	const char *name;
+	int        batch_ms;
+	bool       low_latency;
+	/* low latency mode only sends a few hundred kilobytes per second */
+	int        size_divisor;
+};
+
+struct sink {
+	int      sock;
+	uint64_t size;
+	uint64_t received;
+	bool     intact;
+};
+
+static const struct socket_test tests[] = {
+	{"no batching", 0,  false, 1},
+	{"batching",    20, false, 1},
+	{"low latency", 0,  true,  32},
+};
+
+/* ------------------------------------------------------------------------- */
+
+static inline uint8_t pattern(uint64_t pos)
+{
+	return (uint8_t)(pos * 7 % 251);
+}
+
+static void *sink_thread(void *data)
+{
+	struct sink *sink = data;
+	uint8_t buf[4096];
+
+	while (sink->received < sink->size) {
+		ssize_t ret = recv(sink->sock, buf, sizeof(buf), 0);
+		if (ret <= 0) {
+			sink->intact = false;
+			break;
+		}
+
+		for (ssize_t i = 0; i < ret; i++) {
+			if (buf[i] != pattern(sink->received + i))
+				sink->intact = false;
+		}
+
+		sink->received += (uint64_t)ret;
+
+		/* read slowly, so the socket thread has to wait for space */
+		if (sink->received / sizeof(buf) % 64 == 0)
+			os_sleep_ms(2);
+	}
+
+	return NULL;
+}
+
+static bool connect_loopback(int *client, int *server)
+{
+	struct sockaddr_in addr = {0};
+	socklen_t len = sizeof(addr);
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int nonblocking = 1;
+
+	*client = -1;
+	*server = -1;
+
+	if (listener < 0)
+		return false;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(listener, (struct sockaddr*)&addr, len) != 0 ||
+	    listen(listener, 1) != 0 ||
+	    getsockname(listener, (struct sockaddr*)&addr, &len) != 0)
+		goto fail;
+
+	*client = socket(AF_INET, SOCK_STREAM, 0);
+	if (*client < 0 ||
+	    connect(*client, (struct sockaddr*)&addr, len) != 0)
+		goto fail;
+
+	*server = accept(listener, NULL, NULL);
+	if (*server < 0)
+		goto fail;
+
+	close(listener);
+	return ioctl(*client, FIONBIO, &nonblocking) == 0;
+
+fail:
+	close(listener);
+	if (*client >= 0)
+		close(*client);
+	*client = -1;
+	return false;
+}
+
+/* queues data the way librtmp's send callback does, waiting for space when
+ * the ring is full */
+static void queue_data(struct rtmp_stream *stream, const char *data, int len)
+{
+	for (;;) {
+		pthread_mutex_lock(&stream->write_buf_mutex);
+		if (stream->write_buf_len + len <= stream->write_buf_size)
+			break;
+		pthread_mutex_unlock(&stream->write_buf_mutex);
+
+		os_event_wait(stream->buffer_space_available_event);
+	}
+
+	socket_thread_linux_queue(stream, data, len);
+	stream->write_buf_len += len;
+	pthread_mutex_unlock(&stream->write_buf_mutex);
+
+	os_event_signal(stream->buffer_has_data_event);
+	socket_thread_linux_wake(stream);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool stream_init(struct rtmp_stream *stream,
+		const struct socket_test *test, int sock)
+{
+	stream->rtmp.m_sb.sb_socket = sock;
+	stream->socket_batch_ms = test->batch_ms;
+	stream->low_latency_mode = test->low_latency;
+	stream->write_buf_size = RING_SIZE;
+	stream->socket_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	circlebuf_reserve(&stream->write_ring, RING_SIZE);
+
+	return stream->socket_wake_fd != -1 &&
+		pthread_mutex_init(&stream->write_buf_mutex, NULL) == 0 &&
+		pthread_mutex_init(&stream->socket_stats_mutex, NULL) == 0 &&
+		os_event_init(&stream->buffer_space_available_event,
+				OS_EVENT_TYPE_AUTO) == 0 &&
+		os_event_init(&stream->buffer_has_data_event,
+				OS_EVENT_TYPE_AUTO) == 0 &&
+		os_event_init(&stream->send_thread_signaled_exit,
+				OS_EVENT_TYPE_MANUAL) == 0;
+}
+
+static void stream_free(struct rtmp_stream *stream)
+{
+	if (stream->rtmp.m_sb.sb_socket != -1)
+		close(stream->rtmp.m_sb.sb_socket);
+	if (stream->socket_wake_fd != -1)
+		close(stream->socket_wake_fd);
+
+	pthread_mutex_destroy(&stream->write_buf_mutex);
+	pthread_mutex_destroy(&stream->socket_stats_mutex);
+	os_event_destroy(stream->buffer_space_available_event);
+	os_event_destroy(stream->buffer_has_data_event);
+	os_event_destroy(stream->send_thread_signaled_exit);
+	circlebuf_free(&stream->write_ring);
+	circlebuf_free(&stream->write_marks);
+}
+
+static bool run_test(const struct socket_test *test, uint64_t size)
+{
+	struct rtmp_stream stream = {0};
+	struct sink sink = {0};
+	pthread_t socket_thread, reader;
+	char chunk[MAX_CHUNK];
+	uint32_t seed = 1;
+	uint64_t pos = 0;
+	uint64_t start;
+	double ms;
+	int client;
+	bool success = true;
+
+	if (!connect_loopback(&client, &sink.sock)) {
+		printf("%s: failed to connect over loopback\n", test->name);
+		return false;
+	}
+
+	sink.size = size;
+	sink.intact = true;
+
+	if (!stream_init(&stream, test, client)) {
+		printf("%s: failed to initialize the stream\n", test->name);
+		success = false;
+		goto finish;
+	}
+
+	start = os_gettime_ns();
+
+	pthread_create(&reader, NULL, sink_thread, &sink);
+	pthread_create(&socket_thread, NULL, socket_thread_linux, &stream);
+
+	while (pos < size) {
+		int len;
+
+		seed = seed * 1103515245 + 12345;
+		len = (int)((seed >> 8) % MAX_CHUNK) + 1;
+		if ((uint64_t)len > size - pos)
+			len = (int)(size - pos);
+
+		for (int i = 0; i < len; i++)
+			chunk[i] = (char)pattern(pos + i);
+
+		queue_data(&stream, chunk, len);
+		pos += (uint64_t)len;
+	}
+
+	os_event_signal(stream.send_thread_signaled_exit);
+	socket_thread_linux_wake(&stream);
+	pthread_join(socket_thread, NULL);
+	pthread_join(reader, NULL);
+
+	ms = (double)(os_gettime_ns() - start) / 1000000.0;
+
+	printf("%-12s %8.1f ms, %"PRIu64" of %"PRIu64" bytes received, "
+	       "ring capacity %zu\n", test->name, ms, sink.received, size,
+	       stream.write_ring.capacity);
+
+	if (sink.received != size || !sink.intact) {
+		printf("%s: the data did not arrive intact\n", test->name);
+		success = false;
+	}
+	if (stream.socket_stats.sent != size) {
+		printf("%s: the published statistics count %"PRIu64" bytes "
+		       "sent\n", test->name, stream.socket_stats.sent);
+		success = false;
+	}
+	if (stream.write_ring.capacity != RING_SIZE ||
+	    stream.write_ring.size) {
+		printf("%s: the send ring grew, or was not emptied\n",
+				test->name);
+		success = false;
+	}
+
+finish:
+	stream_free(&stream);
+	close(sink.sock);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int megabytes = argc > 1 ? atoi(argv[1]) : 8;
+	bool success = true;
+
+	if (megabytes <= 0) {
+		puts("usage: rtmp-socket-test [megabytes]");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		success = run_test(&tests[i], (uint64_t)megabytes * 1024 *
+				1024 / tests[i].size_divisor) && success;
+
+	return success ? 0 : 1;
+}
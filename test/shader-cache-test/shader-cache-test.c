@@ -0,0 +1,282 @@
+/*
+ *   Draws every technique of every effect in a directory in to a texture on
+ * a new OpenGL device with an empty shader cache, and then again on a second
+ * device that uses the cache the first one filled, and prints how long each
+ * took.  Programs are only linked (and cached) when they are first drawn
+ * with, so every technique is drawn.
+ *
+ *   Fails if nothing was cached, if the second device linked any program
+ * instead of loading it from the cache, or if an effect that loaded without
+ * the cache does not load with it.
+ *
+ *   Needs a driver that supports program binaries, for example Mesa's
+ * llvmpipe under Xvfb (LIBGL_ALWAYS_SOFTWARE=1).
+ *
+ *   usage: shader-cache-test <effect directory> [cache directory]
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/dstr.h>
+#include <util/bmem.h>
+#include <graphics/graphics.h>
+#include <graphics/effect.h>
+
+#define TARGET_SIZE 64
+
+struct pass_stats {
+	int    effects;
+	int    techniques;
+	double ms;
+};
+
+/* counts of messages of the cache that show a program was not loaded from
+ * it, or that a shader it deferred failed to compile */
+static long discarded;
+static long deferred_failed;
+
+/* ------------------------------------------------------------------------- */
+
+static void log_handler(int lvl, const char *format, va_list args, void *param)
+{
+	char msg[4096];
+
+	vsnprintf(msg, sizeof(msg), format, args);
+
+	if (strstr(msg, "Discarding cached program"))
+		discarded++;
+	if (strstr(msg, "Failed to compile deferred shader"))
+		deferred_failed++;
+
+	if (lvl <= LOG_WARNING)
+		printf("%s\n", msg);
+
+	UNUSED_PARAMETER(param);
+}
+
+/* lists the cached programs, sorted by name */
+static size_t list_programs(const char *dir, struct dstr *list)
+{
+	struct dstr pattern = {0};
+	os_glob_t *glob;
+	size_t count = 0;
+
+	dstr_free(list);
+	dstr_printf(&pattern, "%s/*.program", dir);
+
+	if (os_glob(pattern.array, 0, &glob) == 0) {
+		count = glob->gl_pathc;
+		for (size_t i = 0; i < count; i++) {
+			dstr_cat(list, glob->gl_pathv[i].path);
+			dstr_cat(list, "\n");
+		}
+		os_globfree(glob);
+	}
+
+	dstr_free(&pattern);
+	return count;
+}
+
+static void clear_cache(const char *dir)
+{
+	static const char *exts[] = {"shader", "program"};
+
+	for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+		struct dstr pattern = {0};
+		os_glob_t *glob;
+
+		dstr_printf(&pattern, "%s/*.%s", dir, exts[i]);
+		if (os_glob(pattern.array, 0, &glob) == 0) {
+			for (size_t j = 0; j < glob->gl_pathc; j++)
+				os_unlink(glob->gl_pathv[j].path);
+			os_globfree(glob);
+		}
+
+		dstr_free(&pattern);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* draws with every pass of every technique, which is when the programs of
+ * the effect are linked or loaded from the cache.  returns the number of
+ * techniques drawn. */
+static int draw_techniques(gs_effect_t *effect)
+{
+	int count = 0;
+
+	for (size_t i = 0; i < effect->techniques.num; i++) {
+		gs_technique_t *tech = effect->techniques.array + i;
+		size_t passes = gs_technique_begin(tech);
+
+		for (size_t j = 0; j < passes; j++) {
+			if (gs_technique_begin_pass(tech, j)) {
+				gs_draw_sprite(NULL, 0, TARGET_SIZE,
+						TARGET_SIZE);
+				gs_technique_end_pass(tech);
+			}
+		}
+
+		gs_technique_end(tech);
+		count++;
+	}
+
+	return count;
+}
+
+static bool run_pass(os_glob_t *effects, const char *cache_dir,
+		bool *loaded, struct pass_stats *stats)
+{
+	graphics_t *graphics = NULL;
+	gs_texrender_t *texrender;
+	uint64_t start;
+
+	memset(stats, 0, sizeof(*stats));
+	gs_set_shader_cache_dir(cache_dir);
+
+	start = os_gettime_ns();
+
+	if (gs_create(&graphics, DL_OPENGL, 0) != GS_SUCCESS) {
+		puts("Failed to create an OpenGL device");
+		return false;
+	}
+
+	gs_enter_context(graphics);
+	texrender = gs_texrender_create(GS_RGBA, GS_ZS_NONE);
+
+	for (size_t i = 0; i < effects->gl_pathc; i++) {
+		const char *path = effects->gl_pathv[i].path;
+		char *errors = NULL;
+		gs_effect_t *effect;
+
+		effect = gs_effect_create_from_file(path, &errors);
+		loaded[i] = !!effect;
+
+		if (effect) {
+			stats->effects++;
+
+			gs_texrender_reset(texrender);
+			if (gs_texrender_begin(texrender, TARGET_SIZE,
+						TARGET_SIZE)) {
+				gs_ortho(0.0f, (float)TARGET_SIZE, 0.0f,
+						(float)TARGET_SIZE,
+						-100.0f, 100.0f);
+				stats->techniques += draw_techniques(effect);
+				gs_texrender_end(texrender);
+			}
+
+		} else if (errors) {
+			printf("%s: %s\n", path, errors);
+		}
+
+		gs_effect_destroy(effect);
+		bfree(errors);
+	}
+
+	gs_texrender_destroy(texrender);
+	gs_leave_context();
+	gs_destroy(graphics);
+
+	stats->ms = (double)(os_gettime_ns() - start) / 1000000.0;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *cache_dir = argc > 2 ? argv[2] : "shader-cache-test";
+	struct dstr pattern = {0};
+	struct dstr cold_programs = {0};
+	struct dstr warm_programs = {0};
+	struct pass_stats cold, warm;
+	os_glob_t *effects;
+	bool *cold_loaded, *warm_loaded;
+	size_t num_cached;
+	bool success = false;
+
+	if (argc < 2) {
+		puts("usage: shader-cache-test <effect directory> "
+		     "[cache directory]");
+		return 1;
+	}
+
+	dstr_printf(&pattern, "%s/*.effect", argv[1]);
+	if (os_glob(pattern.array, 0, &effects) != 0 || !effects->gl_pathc) {
+		printf("No effects found in '%s'\n", argv[1]);
+		dstr_free(&pattern);
+		return 1;
+	}
+	dstr_free(&pattern);
+
+	base_set_log_handler(log_handler, NULL);
+
+	os_mkdirs(cache_dir);
+	clear_cache(cache_dir);
+
+	cold_loaded = bzalloc(effects->gl_pathc * sizeof(bool));
+	warm_loaded = bzalloc(effects->gl_pathc * sizeof(bool));
+
+	if (!run_pass(effects, cache_dir, cold_loaded, &cold))
+		goto finish;
+
+	num_cached = list_programs(cache_dir, &cold_programs);
+
+	printf("cache empty:  %d of %d effects, %d techniques in %.1f ms, "
+	       "%d programs cached\n", cold.effects,
+	       (int)effects->gl_pathc, cold.techniques, cold.ms,
+	       (int)num_cached);
+
+	if (!num_cached) {
+		puts("Nothing was cached, the driver may not support program "
+		     "binaries");
+		goto finish;
+	}
+
+	discarded = 0;
+
+	if (!run_pass(effects, cache_dir, warm_loaded, &warm))
+		goto finish;
+
+	list_programs(cache_dir, &warm_programs);
+
+	printf("cache filled: %d of %d effects, %d techniques in %.1f ms\n",
+			warm.effects, (int)effects->gl_pathc,
+			warm.techniques, warm.ms);
+
+	success = true;
+
+	for (size_t i = 0; i < effects->gl_pathc; i++) {
+		if (cold_loaded[i] && !warm_loaded[i]) {
+			printf("%s failed to load from the cache\n",
+					effects->gl_pathv[i].path);
+			success = false;
+		}
+	}
+
+	/* a program that wasn't loaded from the cache is linked and saved,
+	 * which either adds a file or follows a discarded one */
+	if (discarded || dstr_is_empty(&warm_programs) ||
+	    dstr_cmp(&cold_programs, warm_programs.array) != 0) {
+		printf("%ld cached programs were discarded, and %d programs "
+		       "are cached now instead of %d\n", discarded,
+		       (int)list_programs(cache_dir, &warm_programs),
+		       (int)num_cached);
+		success = false;
+	}
+
+	if (deferred_failed) {
+		printf("%ld deferred shaders failed to compile\n",
+				deferred_failed);
+		success = false;
+	}
+
+finish:
+	dstr_free(&cold_programs);
+	dstr_free(&warm_programs);
+	bfree(cold_loaded);
+	bfree(warm_loaded);
+	os_globfree(effects);
+	return success ? 0 : 1;
+}
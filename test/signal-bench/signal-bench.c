@@ -0,0 +1,120 @@
+/*
+ *   Measures the cost of emitting a signal with 0, 1 and 10 connected
+ * callbacks, both by name and by a resolved signal id, and checks that
+ * global callbacks are called.
+ *
+ *   usage: signal-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+#include <callback/signal.h>
+
+#define MAX_SUBSCRIBERS 10
+
+static const char *signal_decl = "void volume(ptr source, in out float volume)";
+
+static void volume_callback(void *data, calldata_t *params)
+{
+	long *count = data;
+	(*count)++;
+	UNUSED_PARAMETER(params);
+}
+
+static void global_callback(void *data, const char *name, calldata_t *params)
+{
+	long *count = data;
+	(*count)++;
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(params);
+}
+
+static double emit_ns(signal_handler_t *handler, signal_id_t id,
+		long iterations)
+{
+	uint8_t stack[128];
+	calldata_t params;
+	uint64_t start;
+
+	calldata_init_fixed(&params, stack, sizeof(stack));
+	calldata_set_ptr(&params, "source", NULL);
+	calldata_set_float(&params, "volume", 1.0);
+
+	start = os_gettime_ns();
+	for (long i = 0; i < iterations; i++) {
+		if (id)
+			signal_handler_signal_id(handler, id, &params);
+		else
+			signal_handler_signal(handler, "volume", &params);
+	}
+
+	return (double)(os_gettime_ns() - start) / (double)iterations;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int subscriber_counts[] = {0, 1, 10};
+	long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+	long counts[MAX_SUBSCRIBERS] = {0};
+	long global_count = 0;
+	signal_handler_t *handler;
+	signal_id_t id;
+	int connected = 0;
+	bool success = true;
+
+	if (iterations <= 0) {
+		puts("usage: signal-bench [iterations]");
+		return 1;
+	}
+
+	handler = signal_handler_create();
+	signal_handler_add(handler, signal_decl);
+	id = signal_handler_get_id(handler, "volume");
+
+	puts("subscribers   by name (ns)   by id (ns)");
+
+	for (size_t i = 0; i < sizeof(subscriber_counts) /
+			sizeof(subscriber_counts[0]); i++) {
+		int target = subscriber_counts[i];
+		double name_ns, id_ns;
+
+		for (; connected < target; connected++)
+			signal_handler_connect(handler, "volume",
+					volume_callback, &counts[connected]);
+
+		name_ns = emit_ns(handler, NULL, iterations);
+		id_ns = emit_ns(handler, id, iterations);
+
+		printf("%11d   %12.1f   %10.1f\n", target, name_ns, id_ns);
+	}
+
+	/* every connected callback must have been called for each emission
+	 * made while it was connected */
+	for (int i = 0; i < connected; i++) {
+		long expected = (i == 0 ? 4 : 2) * iterations;
+		if (counts[i] != expected) {
+			printf("callback %d called %ld times, expected %ld\n",
+					i, counts[i], expected);
+			success = false;
+		}
+	}
+
+	signal_handler_connect_global(handler, global_callback,
+			&global_count);
+	printf("with a global callback: %.1f ns\n",
+			emit_ns(handler, id, iterations));
+	signal_handler_disconnect_global(handler, global_callback,
+			&global_count);
+	emit_ns(handler, id, 1);
+
+	if (global_count != iterations) {
+		printf("global callback called %ld times, expected %ld\n",
+				global_count, iterations);
+		success = false;
+	}
+
+	signal_handler_destroy(handler);
+	return success ? 0 : 1;
+}
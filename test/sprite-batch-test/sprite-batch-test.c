@@ -0,0 +1,237 @@
+/*
+ *   Renders a scene with two items of a static checkerboard source, both
+ * magnified 32 times: a bilinear item that is batched, followed by a point
+ * filtered item that is drawn on its own.  Checks that the bilinear item is
+ * smoothed and that the point filtered item keeps hard edges, which fails
+ * if the sampler of one of them leaks in to the other when the pending
+ * batch is drawn.
+ *
+ *   Runs on any OpenGL driver, for example Mesa's llvmpipe under Xvfb
+ * (LIBGL_ALWAYS_SOFTWARE=1).
+ *
+ *   usage: sprite-batch-test [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <obs.h>
+
+#define CHECKER_SIZE 4
+#define SCALE        32
+#define ITEM_SIZE    (CHECKER_SIZE * SCALE)
+#define WAIT_TIMEOUT 10000
+
+/* the first frames render the item textures, which flushes the batch on its
+ * own, so only the frames after them are checked */
+#define SKIP_FRAMES  5
+
+struct frame_stats {
+	volatile long frames;
+	long          checked;
+	long          bilinear_wrong;
+	long          point_wrong;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static const char *checker_get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return "Sprite batch test checkerboard";
+}
+
+static void *checker_create(obs_data_t *settings, obs_source_t *source)
+{
+	UNUSED_PARAMETER(settings);
+	return source;
+}
+
+static void checker_destroy(void *data)
+{
+	UNUSED_PARAMETER(data);
+}
+
+static uint32_t checker_get_size(void *data)
+{
+	UNUSED_PARAMETER(data);
+	return CHECKER_SIZE;
+}
+
+static void checker_render(void *data, gs_effect_t *effect)
+{
+	gs_effect_t *solid = obs_get_base_effect(OBS_EFFECT_SOLID);
+	gs_eparam_t *color = gs_effect_get_param_by_name(solid, "color");
+	struct vec4 white;
+
+	vec4_from_rgba(&white, 0xFFFFFFFF);
+	gs_effect_set_vec4(color, &white);
+
+	/* the texture is cleared to black, only the white cells are drawn */
+	while (gs_effect_loop(solid, "Solid")) {
+		for (int y = 0; y < CHECKER_SIZE; y++) {
+			for (int x = (y & 1); x < CHECKER_SIZE; x += 2) {
+				gs_matrix_push();
+				gs_matrix_translate3f((float)x, (float)y, 0.0f);
+				gs_draw_sprite(NULL, 0, 1, 1);
+				gs_matrix_pop();
+			}
+		}
+	}
+
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(effect);
+}
+
+static struct obs_source_info checker_info = {
+	.id           = "sprite_batch_test_checker",
+	.type         = OBS_SOURCE_TYPE_INPUT,
+	.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW |
+	                OBS_SOURCE_STATIC_VIDEO,
+	.get_name     = checker_get_name,
+	.create       = checker_create,
+	.destroy      = checker_destroy,
+	.get_width    = checker_get_size,
+	.get_height   = checker_get_size,
+	.video_render = checker_render,
+};
+
+/* ------------------------------------------------------------------------- */
+
+/* counts the pixels of a row that are neither black nor white */
+static int count_blended(const uint8_t *row, int start, int end)
+{
+	int blended = 0;
+
+	for (int x = start; x < end; x++) {
+		uint8_t red = row[x * 4];
+		if (red != 0 && red != 255)
+			blended++;
+	}
+
+	return blended;
+}
+
+static void receive_frame(void *param, struct video_data *frame)
+{
+	struct frame_stats *stats = param;
+	long frame_num = os_atomic_inc_long(&stats->frames);
+
+	if (frame_num <= SKIP_FRAMES)
+		return;
+
+	stats->checked++;
+
+	/* every row crosses cell edges of both items */
+	for (int y = 0; y < ITEM_SIZE; y += 8) {
+		const uint8_t *row = frame->data[0] + y * frame->linesize[0];
+
+		if (count_blended(row, 0, ITEM_SIZE) == 0) {
+			stats->bilinear_wrong++;
+			break;
+		}
+		if (count_blended(row, ITEM_SIZE, ITEM_SIZE * 2) != 0) {
+			stats->point_wrong++;
+			break;
+		}
+	}
+}
+
+static obs_sceneitem_t *add_item(obs_scene_t *scene, obs_source_t *source,
+		float x, enum obs_scale_type filter)
+{
+	obs_sceneitem_t *item = obs_scene_add(scene, source);
+	struct vec2 pos;
+	struct vec2 scale;
+
+	vec2_set(&pos, x, 0.0f);
+	vec2_set(&scale, (float)SCALE, (float)SCALE);
+	obs_sceneitem_set_pos(item, &pos);
+	obs_sceneitem_set_scale(item, &scale);
+	obs_sceneitem_set_scale_filter(item, filter);
+	return item;
+}
+
+static bool wait_for_frames(struct frame_stats *stats, long frames)
+{
+	uint64_t timeout = os_gettime_ns() + WAIT_TIMEOUT * 1000000ULL;
+
+	while (os_atomic_load_long(&stats->frames) < frames) {
+		if (os_gettime_ns() > timeout)
+			return false;
+		os_sleep_ms(10);
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 30;
+	struct frame_stats stats = {0};
+	struct obs_video_info ovi = {0};
+	obs_source_t *source = NULL;
+	obs_scene_t *scene = NULL;
+	bool success = false;
+
+	if (frames <= 0) {
+		puts("usage: sprite-batch-test [frames]");
+		return 1;
+	}
+
+	if (!obs_startup("en-US", NULL, NULL)) {
+		puts("Failed to start libobs");
+		return 1;
+	}
+
+	ovi.graphics_module = DL_OPENGL;
+	ovi.fps_num         = 30;
+	ovi.fps_den         = 1;
+	ovi.base_width      = ITEM_SIZE * 2;
+	ovi.base_height     = ITEM_SIZE;
+	ovi.output_width    = ITEM_SIZE * 2;
+	ovi.output_height   = ITEM_SIZE;
+	ovi.output_format   = VIDEO_FORMAT_RGBA;
+	ovi.colorspace      = VIDEO_CS_709;
+	ovi.range           = VIDEO_RANGE_FULL;
+	ovi.scale_type      = OBS_SCALE_BILINEAR;
+
+	if (obs_reset_video(&ovi) != OBS_VIDEO_SUCCESS) {
+		puts("Failed to initialize video");
+		goto finish;
+	}
+
+	obs_register_source(&checker_info);
+	source = obs_source_create("sprite_batch_test_checker", "checker",
+			NULL, NULL);
+	scene = obs_scene_create("scene");
+
+	/* the bilinear item is batched, and still pending when the point
+	 * filtered item sets its sampler */
+	add_item(scene, source, 0.0f, OBS_SCALE_BILINEAR);
+	add_item(scene, source, (float)ITEM_SIZE, OBS_SCALE_POINT);
+
+	obs_set_output_source(0, obs_scene_get_source(scene));
+	video_output_connect(obs_get_video(), NULL, receive_frame, &stats);
+
+	if (!wait_for_frames(&stats, SKIP_FRAMES + frames))
+		puts("Timed out waiting for frames");
+
+	video_output_disconnect(obs_get_video(), receive_frame, &stats);
+	obs_set_output_source(0, NULL);
+
+	printf("%ld frames checked, %ld with a sharp bilinear item, %ld with "
+	       "a smoothed point filtered item\n", stats.checked,
+	       stats.bilinear_wrong, stats.point_wrong);
+
+	success = stats.checked >= frames && !stats.bilinear_wrong &&
+		!stats.point_wrong;
+
+finish:
+	obs_scene_release(scene);
+	obs_source_release(source);
+	obs_shutdown();
+	return success ? 0 : 1;
+}
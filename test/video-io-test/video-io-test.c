@@ -0,0 +1,378 @@
+/*
+ *   Connects several inputs to a 1920x1080 I420 video output, some of them
+ * with the same conversion, and checks that every input receives exactly the
+ * frame a separate, unsliced scaler produces for it, and that inputs with the
+ * same conversion share one converted frame.  The 1280x1080 conversion keeps
+ * the height of the output, so it is converted in slices on machines with
+ * enough cores.
+ *
+ *   Also prints how long it takes to deliver a frame to one input and to
+ * several inputs with the same conversion, which should be about the same
+ * now that the conversion is only done once.
+ *
+ *   usage: video-io-test [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/bmem.h>
+#include <media-io/video-io.h>
+#include <media-io/video-frame.h>
+#include <media-io/video-scaler.h>
+
+#define WIDTH        1920
+#define HEIGHT       1080
+#define WAIT_TIMEOUT 2000
+
+struct input {
+	const char              *name;
+	struct video_scale_info conversion;
+	video_scaler_t          *scaler;
+	struct video_frame      expected;
+	volatile long           frames;
+	long                    mismatches;
+	const uint8_t           *last_data;
+	int                     group;
+};
+
+/* ------------------------------------------------------------------------- */
+
+static void get_plane_size(enum video_format format, uint32_t width,
+		uint32_t height, int plane, uint32_t *row_bytes, uint32_t *rows)
+{
+	*row_bytes = 0;
+	*rows = 0;
+
+	switch (format) {
+	case VIDEO_FORMAT_I420:
+		if (plane < 3) {
+			*row_bytes = plane ? (width + 1) / 2 : width;
+			*rows = plane ? (height + 1) / 2 : height;
+		}
+		break;
+	case VIDEO_FORMAT_NV12:
+		if (plane < 2) {
+			*row_bytes = plane ? (width + 1) / 2 * 2 : width;
+			*rows = plane ? (height + 1) / 2 : height;
+		}
+		break;
+	case VIDEO_FORMAT_RGBA:
+	case VIDEO_FORMAT_BGRA:
+	case VIDEO_FORMAT_BGRX:
+		if (plane == 0) {
+			*row_bytes = width * 4;
+			*rows = height;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* fills a frame of the output with a pattern that only depends on the frame
+ * number, so that inputs can recreate the source of any frame they get */
+static void fill_frame(uint8_t *const data[], const uint32_t linesize[],
+		uint64_t frame_num)
+{
+	for (int plane = 0; plane < 3; plane++) {
+		uint32_t row_bytes, rows;
+
+		get_plane_size(VIDEO_FORMAT_I420, WIDTH, HEIGHT, plane,
+				&row_bytes, &rows);
+
+		for (uint32_t y = 0; y < rows; y++) {
+			uint8_t *row = data[plane] + y * linesize[plane];
+
+			for (uint32_t x = 0; x < row_bytes; x++)
+				row[x] = (uint8_t)(x * 3 + y * 5 +
+						frame_num * 11 + plane * 64);
+		}
+	}
+}
+
+static bool frames_equal(const struct video_scale_info *info,
+		const struct video_frame *expected,
+		const struct video_data *frame)
+{
+	for (int plane = 0; plane < MAX_AV_PLANES; plane++) {
+		uint32_t row_bytes, rows;
+
+		get_plane_size(info->format, info->width, info->height, plane,
+				&row_bytes, &rows);
+
+		for (uint32_t y = 0; y < rows; y++) {
+			if (memcmp(expected->data[plane] +
+			           y * expected->linesize[plane],
+			           frame->data[plane] + y * frame->linesize[plane],
+			           row_bytes) != 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* turned off while timing, so only the conversions of video-io are timed */
+static volatile bool verify = true;
+
+static void receive_frame(void *param, struct video_data *frame)
+{
+	struct input *input = param;
+	const struct video_scale_info *info = &input->conversion;
+	struct video_frame src;
+
+	if (!os_atomic_load_bool(&verify)) {
+		os_atomic_inc_long(&input->frames);
+		return;
+	}
+
+	/* frame timestamps are the frame numbers */
+	video_frame_init(&src, VIDEO_FORMAT_I420, WIDTH, HEIGHT);
+	fill_frame(src.data, src.linesize, frame->timestamp);
+
+	video_scaler_scale(input->scaler, input->expected.data,
+			input->expected.linesize,
+			(const uint8_t *const *)src.data, src.linesize);
+	video_frame_free(&src);
+
+	if (!frames_equal(info, &input->expected, frame))
+		input->mismatches++;
+
+	input->last_data = frame->data[0];
+	os_atomic_inc_long(&input->frames);
+}
+
+static bool input_init(struct input *input)
+{
+	struct video_scale_info from = {
+		.format     = VIDEO_FORMAT_I420,
+		.width      = WIDTH,
+		.height     = HEIGHT,
+		.range      = VIDEO_RANGE_PARTIAL,
+		.colorspace = VIDEO_CS_709
+	};
+
+	input->conversion.range = VIDEO_RANGE_PARTIAL;
+	input->conversion.colorspace = VIDEO_CS_709;
+
+	if (video_scaler_create(&input->scaler, &input->conversion, &from,
+				VIDEO_SCALE_FAST_BILINEAR) !=
+			VIDEO_SCALER_SUCCESS) {
+		printf("%s: failed to create the reference scaler\n",
+				input->name);
+		return false;
+	}
+
+	video_frame_init(&input->expected, input->conversion.format,
+			input->conversion.width, input->conversion.height);
+	return true;
+}
+
+static void input_free(struct input *input)
+{
+	video_scaler_destroy(input->scaler);
+	video_frame_free(&input->expected);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool wait_for_frames(struct input *inputs, size_t num, long frames)
+{
+	uint64_t timeout = os_gettime_ns() + WAIT_TIMEOUT * 1000000ULL;
+
+	for (size_t i = 0; i < num; i++) {
+		while (os_atomic_load_long(&inputs[i].frames) < frames) {
+			if (os_gettime_ns() > timeout)
+				return false;
+			os_sleep_ms(0);
+		}
+	}
+
+	return true;
+}
+
+/* outputs the frames one at a time, and returns the average time in
+ * milliseconds it took for every input to receive a frame, or a negative
+ * value if an input stopped receiving them */
+static double output_frames(video_t *video, struct input *inputs, size_t num,
+		int frames)
+{
+	uint64_t total = 0;
+
+	for (int i = 0; i < frames; i++) {
+		struct video_frame frame;
+		uint64_t start;
+
+		if (!video_output_lock_frame(video, &frame, 1, (uint64_t)i)) {
+			puts("Failed to lock an output frame");
+			return -1.0;
+		}
+
+		fill_frame(frame.data, frame.linesize, (uint64_t)i);
+
+		start = os_gettime_ns();
+		video_output_unlock_frame(video);
+
+		if (!wait_for_frames(inputs, num, i + 1)) {
+			puts("Timed out waiting for frames");
+			return -1.0;
+		}
+
+		total += os_gettime_ns() - start;
+	}
+
+	return (double)total / 1000000.0 / frames;
+}
+
+static bool connect_inputs(video_t *video, struct input *inputs, size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		os_atomic_set_long(&inputs[i].frames, 0);
+
+		if (!video_output_connect(video, &inputs[i].conversion,
+					receive_frame, &inputs[i])) {
+			printf("%s: failed to connect\n", inputs[i].name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void disconnect_inputs(video_t *video, struct input *inputs,
+		size_t num)
+{
+	for (size_t i = 0; i < num; i++)
+		video_output_disconnect(video, receive_frame, &inputs[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static double time_shared(video_t *video, struct input *inputs, size_t num,
+		int frames)
+{
+	double ms = -1.0;
+
+	if (connect_inputs(video, inputs, num))
+		ms = output_frames(video, inputs, num, frames);
+
+	disconnect_inputs(video, inputs, num);
+	return ms;
+}
+
+static bool check_inputs(struct input *inputs, size_t num, int frames)
+{
+	bool success = true;
+
+	for (size_t i = 0; i < num; i++) {
+		struct input *input = &inputs[i];
+
+		printf("%-10s %4ux%-4u %s: %ld frames, %ld wrong\n",
+				input->name, input->conversion.width,
+				input->conversion.height,
+				get_video_format_name(input->conversion.format),
+				input->frames, input->mismatches);
+
+		if (input->frames != frames || input->mismatches)
+			success = false;
+	}
+
+	/* the last frame of inputs with the same conversion must come from
+	 * the same converted frame, and from different ones otherwise */
+	for (size_t i = 0; i < num; i++) {
+		for (size_t j = i + 1; j < num; j++) {
+			bool shared = inputs[i].last_data == inputs[j].last_data;
+			bool same = inputs[i].group == inputs[j].group;
+
+			if (shared != same) {
+				printf("%s and %s %s a converted frame\n",
+						inputs[i].name, inputs[j].name,
+						shared ? "share" : "do not share");
+				success = false;
+			}
+		}
+	}
+
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 60;
+	struct video_output_info ovi = {
+		.name       = "video-io-test",
+		.format     = VIDEO_FORMAT_I420,
+		.fps_num    = 30,
+		.fps_den    = 1,
+		.width      = WIDTH,
+		.height     = HEIGHT,
+		.cache_size = 6,
+		.colorspace = VIDEO_CS_709,
+		.range      = VIDEO_RANGE_PARTIAL
+	};
+	struct input inputs[] = {
+		{"720p-1",  {VIDEO_FORMAT_NV12, 1280, 720}, .group = 0},
+		{"720p-2",  {VIDEO_FORMAT_NV12, 1280, 720}, .group = 0},
+		{"720p-3",  {VIDEO_FORMAT_NV12, 1280, 720}, .group = 0},
+		{"sliced-1", {VIDEO_FORMAT_I420, 1280, 1080}, .group = 1},
+		{"sliced-2", {VIDEO_FORMAT_I420, 1280, 1080}, .group = 1},
+		{"360p",    {VIDEO_FORMAT_BGRA, 640,  360}, .group = 2},
+	};
+	size_t num_inputs = sizeof(inputs) / sizeof(inputs[0]);
+	size_t num_ready = 0;
+	video_t *video = NULL;
+	bool success = false;
+	double one_ms, shared_ms;
+
+	if (frames <= 0) {
+		puts("usage: video-io-test [frames]");
+		return 1;
+	}
+
+	for (; num_ready < num_inputs; num_ready++) {
+		if (!input_init(&inputs[num_ready]))
+			goto finish;
+	}
+
+	if (video_output_open(&video, &ovi) != VIDEO_OUTPUT_SUCCESS) {
+		puts("Failed to open the video output");
+		goto finish;
+	}
+
+	/* every input gets its frames from the shared converters */
+	if (!connect_inputs(video, inputs, num_inputs))
+		goto finish;
+	if (output_frames(video, inputs, num_inputs, frames) < 0.0)
+		goto finish;
+	disconnect_inputs(video, inputs, num_inputs);
+
+	success = check_inputs(inputs, num_inputs, frames);
+
+	/* delivering to inputs that share a conversion should cost about the
+	 * same as delivering to one of them */
+	os_atomic_set_bool(&verify, false);
+	one_ms = time_shared(video, inputs, 1, frames);
+	shared_ms = time_shared(video, inputs, 3, frames);
+	if (one_ms < 0.0 || shared_ms < 0.0) {
+		success = false;
+		goto finish;
+	}
+
+	printf("720p NV12: %.2f ms per frame for 1 input, %.2f ms for 3 "
+	       "inputs\n", one_ms, shared_ms);
+
+finish:
+	if (video) {
+		disconnect_inputs(video, inputs, num_inputs);
+		video_output_close(video);
+	}
+	for (size_t i = 0; i < num_ready; i++)
+		input_free(&inputs[i]);
+	return success ? 0 : 1;
+}